@@ -9,32 +9,25 @@
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <stdlib.h>
-#include <stdarg.h>
-#include <termios.h>
-#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 #include <sys/types.h>
 
+#include "fou_term.h"
+
 /*** defines ***/
 
-#define CTRL_KEY(k) ((k) & 0x1f)
 #define FOU_VERSION "0.0.1"
 #define FOU_TAB_STOP 8
 #define FOU_QUIT_TIMES 3
-enum editorKey {
-	BACKSPACE = 127,
-	ARROW_LEFT = 1000,
-	ARROW_RIGHT,
-	ARROW_UP,
-	ARROW_DOWN,
-	DEL_KEY,
-	HOME_KEY,
-	END_KEY,
-	PAGE_UP,
-	PAGE_DOWN
-};
+#define FOU_ROW_GAP_MIN 4096
+#define FOU_ROW_GAP 4096
 
 /*** data ***/
 
@@ -43,160 +36,258 @@ typedef struct erow {
 	int rsize;
 	char *chars;
 	char *render;
+	int gap;
+	int gaplen;
+	int save_gen;
+	int disk;
+	unsigned char cls;
+	unsigned char rcls;
 } erow;
 
-struct editorConfig {
+struct editorSaveJob;
+
+#define FOU_ARENA_CHUNK (1024 * 1024)
+#define FOU_ARENA_CLASSES 32
+#define FOU_ARENA_HUGE 254
+#define FOU_ARENA_ALIAS 255
+
+struct arenaChunk {
+	struct arenaChunk *next;
+	size_t used;
+	size_t cap;
+	char data[];
+};
+
+/* Row text lives in headerless slots carved from large chunks; the row keeps
+ * the slot's size class. Classes step by 16 bytes up to 256 and then by
+ * halves of a power of two up to 64K, so a row has some room to grow before
+ * it moves, and a slot given up goes on the free list for its class. Longer
+ * lines get a chunk of their own. */
+struct editorArena {
+	struct arenaChunk *chunks;
+	struct arenaChunk *huge;
+	void *free[FOU_ARENA_CLASSES];
+};
+
+struct arenaSlot {
+	char *p;
+	unsigned char cls;
+};
+
+struct editorFileWatch {
+	int wd;
+	char *name;
+	struct stat st;
+	int pending;
+};
+
+/* An open file: the rows are the document and its line index at once, and
+ * every view of the file shares them, renders included. The row array is a
+ * gap buffer of rowcap slots with the gap after row gap-1; go through
+ * editorRow() rather than indexing it. A row the user has not touched since
+ * the file was last read or written keeps its line number there in disk, and
+ * disk_hash holds a hash of each of those ndisk lines (ndisk is -1 when the
+ * buffer was never in sync with a file). */
+struct editorBuffer {
+	int numrows;
+	erow *row;
+	int rowcap;
+	int gap;
+	int dirty;
+	unsigned long long *disk_hash;
+	int ndisk;
+	char *filename;
+	struct editorSaveJob *save;
+	int save_gen;
+	struct arenaSlot *save_orphans;
+	int nsave_orphans;
+	struct editorFileWatch watch;
+	struct editorArena arena;
+};
+
+/* A window onto a buffer; views are stacked top to bottom, each followed by
+ * its own status bar. */
+struct editorView {
+	struct editorBuffer *buf;
 	int cx, cy;
 	int rx;
 	int rowoff;
 	int coloff;
+	int actual_x;
+	int top;
+	int rows;
+};
+
+#define FOU_MAX_VIEWS 8
+
+struct editorConfig {
+	struct editorView views[FOU_MAX_VIEWS];
+	int nviews;
+	int current;
+	struct editorBuffer **buffers;
+	int nbuffers;
 	int screenrows;
 	int screencols;
-	int actual_x;
-	int numrows;
-	erow *row;
-	int dirty;
 	int state;
-	char * filename;
-	char statusmsg[80];
-	time_t statusmsg_time;
-	struct termios orig_termios;
+	int watch_fd;
 };
 
 struct editorConfig E;
 
 /*** prototypes ***/
 
-void editorSetStatusMessage(const char *fmt, ...);
-void editorRefreshScreen();
 char *editorPrompt(char *prompt);
+void editorWatchFile(struct editorBuffer *buf, const char *filename);
+void editorLayout();
+void editorReloadPending();
+void editorSaveWait(struct editorBuffer *buf);
 
 /*** terminal ***/
 
-void die(const char *s) {
-	write(STDOUT_FILENO, "\x1b[2J", 4);
-	write(STDOUT_FILENO, "\x1b[H", 3);
-	perror(s);
-	exit(1);
+/* The terminal is gone: wait for saves in flight and leave without touching
+ * the terminal again. */
+void editorHangup() {
+	for (int i = 0; i < E.nbuffers; i++) {
+		editorSaveWait(E.buffers[i]);
+	}
+	_exit(0);
 }
 
-void disableRawMode() {
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
-		die("tcsetattr");
-	}
+void editorResize(int rows, int cols) {
+	E.screenrows = rows - 1;
+	E.screencols = cols;
+	editorLayout();
 }
 
-void enableRawMode() {
-	if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcsetattr");
-	atexit(disableRawMode);
+/*** arena ***/
 
-	struct termios raw = E.orig_termios;
-	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-	raw.c_oflag &= ~(OPOST);
-	raw.c_cflag |= (CS8);
-	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
-	raw.c_cc[VMIN] = 0;
- 	raw.c_cc[VTIME] = 1;
+size_t arenaClassSize(int c) {
+	if (c < 16) return (size_t)(c + 1) * 16;
+	c -= 16;
+	return (size_t)(c % 2 ? 512 : 384) << (c / 2);
+}
 
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+struct arenaChunk *arenaChunkOf(char *p) {
+	return (struct arenaChunk *)(p - offsetof(struct arenaChunk, data));
 }
 
-int editorReadKey() {
-	int nread;
-	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-		if (nread == -1 && errno != EAGAIN) die("read");
-	}
+size_t arenaCapacity(char *p, unsigned char cls) {
+	return cls == FOU_ARENA_HUGE ? arenaChunkOf(p)->cap : arenaClassSize(cls);
+}
 
-	if (c == '\x1b') {
-		char seq[3];
+struct arenaChunk *arenaNewChunk(size_t cap) {
+	struct arenaChunk *chunk = malloc(sizeof(struct arenaChunk) + cap);
+	if (chunk == NULL) die("malloc");
+	chunk->used = 0;
+	chunk->cap = cap;
+	return chunk;
+}
 
-		if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-		if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+char *arenaAlloc(struct editorArena *a, size_t n, unsigned char *cls) {
+	int c = n <= 256 ? (n > 0 ? (int)(n - 1) / 16 : 0) : 16;
+	while (c < FOU_ARENA_CLASSES && arenaClassSize(c) < n) c++;
 
-		if (seq[0] == '[') {
-			if (seq[1] >= '0' && seq[1] <= '9') {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-				if (seq[2] == '~'){
-					switch (seq[1]) {
-						case '1': return HOME_KEY;
-						case '3': return DEL_KEY;
-						case '4': return END_KEY;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME_KEY;
-						case '8': return END_KEY;
-					}
-				}
-			} else {
-				switch (seq[1]) {
-					case 'A': return ARROW_UP;
-					case 'B': return ARROW_DOWN;
-					case 'C': return ARROW_RIGHT;
-					case 'D': return ARROW_LEFT;
-					case 'H': return HOME_KEY;
-					case 'F': return END_KEY;
-				}
-			}
-		} else if (seq[0] == 'O') {
-			switch (seq[1]) {
-				case 'H': return HOME_KEY;
-				case 'F': return END_KEY;
-			}
-		}
+	if (c == FOU_ARENA_CLASSES) {
+		struct arenaChunk *chunk = arenaNewChunk(n);
+		chunk->next = a->huge;
+		a->huge = chunk;
+		*cls = FOU_ARENA_HUGE;
+		return chunk->data;
+	}
 
-		return '\x1b';
+	char *p = a->free[c];
+	if (p != NULL) {
+		memcpy(&a->free[c], p, sizeof(void *));
 	} else {
-		if (E.state == 0){
-			switch (c) {
-				case 'w': return ARROW_UP;
-				case 'a': return ARROW_LEFT;
-				case 's': return ARROW_DOWN;
-				case 'd': return ARROW_RIGHT;
-			}
+		size_t size = arenaClassSize(c);
+		if (a->chunks == NULL || a->chunks->cap - a->chunks->used < size) {
+			struct arenaChunk *chunk = arenaNewChunk(FOU_ARENA_CHUNK);
+			chunk->next = a->chunks;
+			a->chunks = chunk;
 		}
-		return c;
+		p = a->chunks->data + a->chunks->used;
+		a->chunks->used += size;
 	}
+	*cls = c;
+	return p;
 }
 
-int getCursorPosition(int *rows, int *cols){
-	char buff[32];
-	unsigned int i = 0;
-	if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
-
-	while (i < sizeof(buff) - 1) {
-		if (read(STDIN_FILENO, &buff[i], 1) != 1) break;
-		if (buff[i] == 'R') break;
-		i++;
+void arenaFree(struct editorArena *a, char *p, unsigned char cls) {
+	if (p == NULL || cls == FOU_ARENA_ALIAS) return;
+	if (cls == FOU_ARENA_HUGE) {
+		struct arenaChunk **pp = &a->huge;
+		while (*pp != arenaChunkOf(p)) pp = &(*pp)->next;
+		*pp = (*pp)->next;
+		free(arenaChunkOf(p));
+		return;
 	}
-	buff[i] = '\0';
+	memcpy(p, &a->free[cls], sizeof(void *));
+	a->free[cls] = p;
+}
 
-	if (buff[0] != '\xb' || buff[1] != '[') return -1;
-	if (sscanf(&buff[2], "%d;%d", rows, cols) != 2) return -1;
+/* Returns p if it already has room for n bytes, otherwise a slot with half
+ * as much again, holding the first keep bytes of p. */
+char *arenaGrow(struct editorArena *a, char *p, unsigned char *cls, size_t n, size_t keep) {
+	if (p != NULL && *cls != FOU_ARENA_ALIAS && arenaCapacity(p, *cls) >= n) return p;
+	unsigned char c;
+	char *q = arenaAlloc(a, n + n / 2, &c);
+	if (p != NULL) {
+		memcpy(q, p, keep);
+		arenaFree(a, p, *cls);
+	}
+	*cls = c;
+	return q;
+}
 
-	return 0;
+void arenaRelease(struct editorArena *a) {
+	struct arenaChunk *lists[2] = {a->chunks, a->huge};
+	for (int i = 0; i < 2; i++) {
+		while (lists[i]) {
+			struct arenaChunk *next = lists[i]->next;
+			free(lists[i]);
+			lists[i] = next;
+		}
+	}
+	memset(a, 0, sizeof(struct editorArena));
 }
 
-int getWindowSize(int *rows, int *cols) {
-	struct winsize ws;
+/*** row operations ***/
 
-	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-		if (write(STDOUT_FILENO, "\x1b[10000000C\x1b[1000000B", 12) != 12) return -1;
-		return getCursorPosition(rows, cols);
-	} else {
-		*cols = ws.ws_col;
-		*rows = ws.ws_row;
-		return 0;
+/* A row of FOU_ROW_GAP_MIN bytes or more is edited through a gap of gaplen
+ * bytes at gap, so typing in one place of a long line only moves the bytes
+ * between there and the previous edit; the text is chars[0..gap) followed by
+ * chars[gap+gaplen..size+gaplen), and chars[size+gaplen] is the '\0'. Shorter
+ * rows keep gaplen 0. A tab-free row's render aliases chars, gap and all. */
+char editorRowByte(erow *row, int j) {
+	return row->chars[j < row->gap ? j : j + row->gaplen];
+}
+
+void editorRowMoveGap(erow *row, int at) {
+	if (row->gaplen == 0) {
+		row->gap = at;
+	} else if (at < row->gap) {
+		memmove(&row->chars[at + row->gaplen], &row->chars[at], row->gap - at);
+	} else if (at > row->gap) {
+		memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], at - row->gap);
 	}
+	row->gap = at;
 }
 
-/*** row operations ***/
+/* Closes the gap up for callers that need the text in one piece; the room it
+ * had stays at the end of the row. */
+char *editorRowText(erow *row) {
+	if (row->gaplen > 0) {
+		editorRowMoveGap(row, row->size);
+		row->chars[row->size] = '\0';
+	}
+	return row->chars;
+}
 
 int editorRowCxToRx(erow *row, int cx) {
 	int rx = 0;
 	int j;
 	for (j = 0; j < cx; j++){
-		if (row->chars[j] == '\t') {
+		if (editorRowByte(row, j) == '\t') {
 			rx += (FOU_TAB_STOP - 1) - (rx % FOU_TAB_STOP);
 		}
 		rx += 1;
@@ -204,168 +295,398 @@ int editorRowCxToRx(erow *row, int cx) {
 	return rx;
 }
 
-void editorUpdateRow(erow *row) {
+void editorUpdateRow(struct editorBuffer *buf, erow *row) {
 	int tabs = 0;
 	int j;
 	for (j = 0; j < row->size; j++) {
-		if (row->chars[j] == '\t')	{
+		if (editorRowByte(row, j) == '\t')	{
 			tabs++;
 		}
 	}
 
-	free(row->render);
-	row->render = malloc(row->size + tabs*(FOU_TAB_STOP - 1) + 1);
+	/* without tabs the render is the text itself */
+	if (tabs == 0) {
+		if (row->render != row->chars) arenaFree(&buf->arena, row->render, row->rcls);
+		row->render = row->chars;
+		row->rcls = FOU_ARENA_ALIAS;
+		row->rsize = row->size;
+		return;
+	}
+	if (row->rcls == FOU_ARENA_ALIAS) row->render = NULL;
+	row->render = arenaGrow(&buf->arena, row->render, &row->rcls, row->size + tabs*(FOU_TAB_STOP - 1) + 1, 0);
 
 	int idx = 0;
 	for (j = 0; j < row->size; j++) {
-		if (row->chars[j] == '\t'){
+		char c = editorRowByte(row, j);
+		if (c == '\t'){
 			row->render[idx++] = ' ';
 			while (idx % FOU_TAB_STOP != 0) {
 				row->render[idx++] = ' ';
 			}
 		} else {
-			row->render[idx++] = row->chars[j];
+			row->render[idx++] = c;
 		}
 	}
 	row->render[idx] = '\0';
 	row->rsize = idx;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-	if (at < 0 || at > E.numrows) {
-		editorInsertRow(E.numrows, "", 0);
+/* Rows captured by an in-flight save share their chars with the snapshot, so
+ * the first edit gives the row its own copy and leaves the old one to the save. */
+int editorRowShared(struct editorBuffer *buf, erow *row) {
+	return buf->save != NULL && row->save_gen == buf->save_gen;
+}
+
+void editorSaveOrphan(struct editorBuffer *buf, erow *row) {
+	buf->save_orphans = realloc(buf->save_orphans, sizeof(struct arenaSlot) * (buf->nsave_orphans + 1));
+	if (buf->save_orphans == NULL) die("realloc");
+	buf->save_orphans[buf->nsave_orphans].p = row->chars;
+	buf->save_orphans[buf->nsave_orphans++].cls = row->cls;
+}
+
+void editorRowDetach(struct editorBuffer *buf, erow *row) {
+	row->disk = -1;
+	if (!editorRowShared(buf, row)) return;
+
+	unsigned char cls;
+	char *chars = arenaAlloc(&buf->arena, row->size + 1, &cls);
+	memcpy(chars, row->chars, row->size + 1);
+	editorSaveOrphan(buf, row);
+	if (row->render == row->chars) row->render = chars;
+	row->chars = chars;
+	row->cls = cls;
+	row->gap = row->size;
+	row->gaplen = 0;
+	row->save_gen = 0;
+}
+
+/* Keeps the other views of a buffer on the same text when rows come or go
+ * above their cursor. */
+void editorShiftViews(struct editorBuffer *buf, int at, int delta) {
+	for (int i = 0; i < E.nviews; i++) {
+		struct editorView *v = &E.views[i];
+		if (v->buf == buf && v->cy > at) v->cy += delta;
 	}
+}
 
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+/* Rows before the gap keep their index; the rest sit at the back of the
+ * array. A row comes or goes by moving the gap to it first, so typing in one
+ * place only shifts the rows between there and the previous edit. */
+erow *editorRow(struct editorBuffer *buf, int at) {
+	return &buf->row[at < buf->gap ? at : at + buf->rowcap - buf->numrows];
+}
 
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, s, len);
-	E.row[at].chars[len] = '\0';
+void editorMoveGap(struct editorBuffer *buf, int at) {
+	int gaplen = buf->rowcap - buf->numrows;
+	if (at < buf->gap) {
+		memmove(&buf->row[at + gaplen], &buf->row[at], sizeof(erow) * (buf->gap - at));
+	} else if (at > buf->gap) {
+		memmove(&buf->row[buf->gap], &buf->row[buf->gap + gaplen], sizeof(erow) * (at - buf->gap));
+	}
+	buf->gap = at;
+}
 
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	editorUpdateRow(&E.row[at]);
+void editorGrowRows(struct editorBuffer *buf) {
+	int cap = buf->rowcap ? buf->rowcap * 2 : 64;
+	int tail = buf->numrows - buf->gap;
+	buf->row = realloc(buf->row, sizeof(erow) * cap);
+	if (buf->row == NULL) die("realloc");
+	memmove(&buf->row[cap - tail], &buf->row[buf->rowcap - tail], sizeof(erow) * tail);
+	buf->rowcap = cap;
+}
 
-	E.numrows++;
-	E.dirty++;
+/* Copies the rows out in order, leaving the gap behind. */
+void editorCopyRows(struct editorBuffer *buf, erow *dst) {
+	if (buf->numrows == 0) return;
+	memcpy(dst, buf->row, sizeof(erow) * buf->gap);
+	memcpy(&dst[buf->gap], &buf->row[buf->rowcap - buf->numrows + buf->gap], sizeof(erow) * (buf->numrows - buf->gap));
 }
 
-void editorFreeRow(erow *row) {
-	free(row->render);
-	free(row->chars);
+void editorInsertRow(struct editorBuffer *buf, int at, char *s, size_t len) {
+	if (at < 0 || at > buf->numrows) {
+		editorInsertRow(buf, buf->numrows, "", 0);
+	}
+
+	if (buf->numrows == buf->rowcap) editorGrowRows(buf);
+	editorMoveGap(buf, at);
+	erow *row = &buf->row[buf->gap++];
+
+	row->size = len;
+	row->chars = arenaAlloc(&buf->arena, len + 1, &row->cls);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->gap = len;
+	row->gaplen = 0;
+
+	row->rsize = 0;
+	row->render = NULL;
+	row->rcls = FOU_ARENA_ALIAS;
+	row->save_gen = 0;
+	row->disk = -1;
+	editorUpdateRow(buf, row);
+
+	buf->numrows++;
+	buf->dirty++;
+	editorShiftViews(buf, at, 1);
 }
 
-void editorDelRow(int at) {
-	if (at < 0 || at >= E.numrows) {
+void editorFreeRow(struct editorBuffer *buf, erow *row) {
+	arenaFree(&buf->arena, row->render, row->rcls);
+	if (editorRowShared(buf, row)) {
+		editorSaveOrphan(buf, row);
+	} else {
+		arenaFree(&buf->arena, row->chars, row->cls);
+	}
+}
+
+void editorDelRow(struct editorBuffer *buf, int at) {
+	if (at < 0 || at >= buf->numrows) {
 		return;
 	}
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-	E.numrows--;
-	E.dirty++;
+	editorMoveGap(buf, at);
+	editorFreeRow(buf, &buf->row[at + buf->rowcap - buf->numrows]);
+	buf->numrows--;
+	buf->dirty++;
+	editorShiftViews(buf, at, -1);
+}
+
+/* A row without tabs renders as itself, so an edit that brings in none only
+ * re-points the render instead of scanning the whole line again. */
+void editorRowEdited(struct editorBuffer *buf, erow *row, int tabs) {
+	if (row->rcls == FOU_ARENA_ALIAS && !tabs) {
+		row->render = row->chars;
+		row->rsize = row->size;
+	} else {
+		editorUpdateRow(buf, row);
+	}
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
+void editorRowInsertChar(struct editorBuffer *buf, erow *row, int at, int c) {
 	if (at < 0 || at > row->size) {
 		at = row->size;
 	}
-	row->chars = realloc(row->chars, row->size + 2);
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+	editorRowDetach(buf, row);
+	if (row->gaplen > 0 || row->size >= FOU_ROW_GAP_MIN) {
+		if (row->gaplen == 0) {
+			row->chars = arenaGrow(&buf->arena, row->chars, &row->cls, row->size + FOU_ROW_GAP + 1, row->size);
+			row->gap = row->size;
+			row->gaplen = FOU_ROW_GAP;
+			row->chars[row->size + row->gaplen] = '\0';
+		}
+		editorRowMoveGap(row, at);
+		row->chars[row->gap++] = c;
+		row->gaplen--;
+	} else {
+		row->chars = arenaGrow(&buf->arena, row->chars, &row->cls, row->size + 2, row->size + 1);
+		memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+		row->chars[at] = c;
+	}
 	row->size++;
-	row->chars[at] = c;
-	editorUpdateRow(row);
-	E.dirty++;
+	editorRowEdited(buf, row, c == '\t');
+	buf->dirty++;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-	row->chars = realloc(row->chars, row->size + len + 1);
+void editorRowAppendString(struct editorBuffer *buf, erow *row, char *s, size_t len) {
+	editorRowDetach(buf, row);
+	editorRowText(row);
+	row->chars = arenaGrow(&buf->arena, row->chars, &row->cls, row->size + len + 1, row->size);
 	memcpy(&row->chars[row->size], s, len);
 	row->size += len;
 	row->chars[row->size] = '\0';
-	editorUpdateRow(row);
-	E.dirty++;
+	row->gap = row->size;
+	row->gaplen = 0;
+	editorRowEdited(buf, row, memchr(s, '\t', len) != NULL);
+	buf->dirty++;
 }
 
-void editorRowDelChar(erow *row, int at) {
+void editorRowDelChar(struct editorBuffer *buf, erow *row, int at) {
 	if (at < 0 || at >= row->size) {
 		return;
 	}
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+	editorRowDetach(buf, row);
+	if (row->gaplen > 0 || row->size >= FOU_ROW_GAP_MIN) {
+		editorRowMoveGap(row, at);
+		row->gaplen++;
+	} else {
+		memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+	}
 	row->size--;
-	editorUpdateRow(row);
-	E.dirty++;
+	editorRowEdited(buf, row, 0);
+	buf->dirty++;
+}
+
+/*** views ***/
+
+struct editorView *editorCurrentView() {
+	return &E.views[E.current];
+}
+
+void editorClampView(struct editorView *v) {
+	struct editorBuffer *buf = v->buf;
+	if (v->cy > buf->numrows) v->cy = buf->numrows;
+	if (v->cy < 0) v->cy = 0;
+	if (v->cy == buf->numrows) {
+		v->cx = 0;
+	} else if (v->cx > editorRow(buf, v->cy)->size) {
+		v->cx = editorRow(buf, v->cy)->size;
+	}
+}
+
+void editorClampViews(struct editorBuffer *buf) {
+	for (int i = 0; i < E.nviews; i++) {
+		if (E.views[i].buf == buf) editorClampView(&E.views[i]);
+	}
+}
+
+/* Shares the screen out evenly; the last view takes the leftover rows. */
+void editorLayout() {
+	int each = E.screenrows / E.nviews;
+	for (int i = 0; i < E.nviews; i++) {
+		E.views[i].top = i * each;
+		E.views[i].rows = (i == E.nviews - 1 ? E.screenrows - i * each : each) - 1;
+		if (E.views[i].rows < 0) E.views[i].rows = 0;
+	}
+}
+
+void editorShowBuffer(struct editorView *v, struct editorBuffer *buf) {
+	v->buf = buf;
+	v->cx = 0;
+	v->cy = 0;
+	v->rx = 0;
+	v->rowoff = 0;
+	v->coloff = 0;
+	v->actual_x = 0;
+}
+
+void editorSplitView() {
+	if (E.nviews == FOU_MAX_VIEWS || E.screenrows / (E.nviews + 1) < 2) {
+		editorSetStatusMessage("No room for another view");
+		return;
+	}
+	struct editorView *v = editorCurrentView();
+	memmove(&E.views[E.current + 1], v, sizeof(struct editorView) * (E.nviews - E.current));
+	E.nviews++;
+	E.current++;
+	editorLayout();
+}
+
+void editorCloseView() {
+	if (E.nviews == 1) return;
+	memmove(&E.views[E.current], &E.views[E.current + 1], sizeof(struct editorView) * (E.nviews - E.current - 1));
+	E.nviews--;
+	if (E.current == E.nviews) E.current--;
+	editorLayout();
 }
 
 /*** editor operations ***/
 
 void editorInsertChar(int c) {
-	if (E.cy == E.numrows) {
-		editorInsertRow(E.numrows, "", 0);
+	struct editorView *v = editorCurrentView();
+	struct editorBuffer *buf = v->buf;
+	if (v->cy == buf->numrows) {
+		editorInsertRow(buf, buf->numrows, "", 0);
 	}
-	editorRowInsertChar(&E.row[E.cy], E.cx, c);
+	editorRowInsertChar(buf, editorRow(buf, v->cy), v->cx, c);
 }
 
 void editorInsertNewline() {
-	if (E.cx == 0) {
-		editorInsertRow(E.cy, "", 0);
+	struct editorView *v = editorCurrentView();
+	struct editorBuffer *buf = v->buf;
+	if (v->cx == 0) {
+		editorInsertRow(buf, v->cy, "", 0);
 	} else {
-		erow *row = &E.row[E.cy];
-		editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-		row = &E.row[E.cy];
-		row->size = E.cx;
+		erow *row = editorRow(buf, v->cy);
+		editorInsertRow(buf, v->cy + 1, &editorRowText(row)[v->cx], row->size - v->cx);
+		row = editorRow(buf, v->cy);
+		editorRowDetach(buf, row);
+		row->size = v->cx;
 		row->chars[row->size] = '\0';
-		editorUpdateRow(row);
+		row->gap = row->size;
+		row->gaplen = 0;
+		editorUpdateRow(buf, row);
 	}
-	E.cy++;
-	E.cx = 0;
+	v->cy++;
+	v->cx = 0;
 }
 
 void editorDelChar() {
-	if (E.cy == E.numrows) return;
-	if (E.cx == 0 && E.cy == 0) return;
-
-	erow *row = &E.row[E.cy];
-	if (E.cx > 0){
-		editorRowDelChar(row, E.cx - 1);
-		E.cx--;
+	struct editorView *v = editorCurrentView();
+	struct editorBuffer *buf = v->buf;
+	if (v->cy == buf->numrows) return;
+	if (v->cx == 0 && v->cy == 0) return;
+
+	erow *row = editorRow(buf, v->cy);
+	if (v->cx > 0){
+		editorRowDelChar(buf, row, v->cx - 1);
+		v->cx--;
 	} else {
-		E.cx = E.row[E.cy - 1].size;
-		editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-		editorDelRow(E.cy);
-		E.cy--;
+		v->cx = editorRow(buf, v->cy - 1)->size;
+		editorRowAppendString(buf, editorRow(buf, v->cy - 1), editorRowText(row), row->size);
+		editorDelRow(buf, v->cy);
+		v->cy--;
 	}
 }
 
 /*** file i/o ***/
 
-char *editorRowsToString(int *buflen) {
-	int totlen = 0;
-	int j;
-	for (j = 0; j < E.numrows; j++) {
-		totlen += E.row[j].size + 1;
-	}
-	*buflen = totlen;
+struct editorBuffer *editorNewBuffer() {
+	struct editorBuffer *buf = calloc(1, sizeof(struct editorBuffer));
+	if (buf == NULL) die("calloc");
+	buf->watch.wd = -1;
+	buf->ndisk = -1;
+	E.buffers = realloc(E.buffers, sizeof(struct editorBuffer *) * (E.nbuffers + 1));
+	if (E.buffers == NULL) die("realloc");
+	E.buffers[E.nbuffers++] = buf;
+	return buf;
+}
+
+/* Rows need no freeing one by one: their text all lives in the arena. */
+void editorFreeBuffer(struct editorBuffer *buf) {
+	editorSaveWait(buf);
+	arenaRelease(&buf->arena);
+	free(buf->row);
+	free(buf->disk_hash);
+	free(buf->filename);
+	free(buf->watch.name);
+	free(buf);
+}
 
-	char *buf = malloc(totlen);
-	char *p = buf;
-	for (j = 0; j < E.numrows; j++) {
-		memcpy(p, E.row[j].chars, E.row[j].size);
-		p += E.row[j].size;
-		*p = '\n';
-		p++;
+struct editorBuffer *editorFindBuffer(const char *filename) {
+	for (int i = 0; i < E.nbuffers; i++) {
+		if (E.buffers[i]->filename && strcmp(E.buffers[i]->filename, filename) == 0) return E.buffers[i];
 	}
+	return NULL;
+}
 
-	return buf;
+unsigned long long editorHashLine(const char *s, size_t len) {
+	unsigned long long h = 14695981039346656037ULL;
+	for (size_t j = 0; j < len; j++) h = (h ^ (unsigned char)s[j]) * 1099511628211ULL;
+	return h;
 }
 
-void editorOpen(char *filename) {
-	free(E.filename);
-	E.filename = strdup(filename);
+/* The rows now match the file line for line; without hashes of its lines
+ * they are taken from the rows. */
+void editorSyncRows(struct editorBuffer *buf, unsigned long long *hash) {
+	if (hash == NULL) {
+		hash = malloc(sizeof(unsigned long long) * (buf->numrows + 1));
+		if (hash == NULL) die("malloc");
+		for (int j = 0; j < buf->numrows; j++) {
+			erow *row = editorRow(buf, j);
+			hash[j] = editorHashLine(editorRowText(row), row->size);
+		}
+	}
+	for (int j = 0; j < buf->numrows; j++) editorRow(buf, j)->disk = j;
+	free(buf->disk_hash);
+	buf->disk_hash = hash;
+	buf->ndisk = buf->numrows;
+}
+
+int editorOpen(struct editorBuffer *buf, char *filename) {
+	free(buf->filename);
+	buf->filename = strdup(filename);
 
     FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+    if (!fp) return -1;
 
     char *line = NULL;
     size_t linecap = 0;
@@ -373,91 +694,486 @@ void editorOpen(char *filename) {
     while ((linelen = getline(&line, &linecap, fp)) != -1) {
         while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
             linelen--;
-        editorInsertRow(E.numrows, line, linelen);
+        editorInsertRow(buf, buf->numrows, line, linelen);
     }
     free(line);
     fclose(fp);
-    E.dirty = 0;
+    buf->dirty = 0;
+    editorSyncRows(buf, NULL);
+    editorWatchFile(buf, filename);
+    return 0;
 }
 
-void editorSave() {
-	if (E.filename == NULL) {
-		E.filename = editorPrompt("Save as: (ESC to cancel)%s");
-		if (E.filename == NULL) {
-			editorSetStatusMessage("Save Aborted!");
+/* A file that is already open is shown again rather than read twice; a name
+ * that does not exist yet opens an empty buffer that saving will create. */
+void editorOpenPrompt() {
+	char *filename = editorPrompt("Open: %s (ESC to cancel)");
+	if (filename == NULL) return;
+
+	struct editorBuffer *buf = editorFindBuffer(filename);
+	if (buf == NULL) {
+		buf = editorNewBuffer();
+		if (editorOpen(buf, filename) == -1) {
+			if (errno != ENOENT) {
+				editorSetStatusMessage("Can't open %.40s: %s", filename, strerror(errno));
+				E.nbuffers--;
+				editorFreeBuffer(buf);
+				free(filename);
+				return;
+			}
+			editorSetStatusMessage("New file %.40s", filename);
 		}
 	}
+	editorShowBuffer(editorCurrentView(), buf);
+	free(filename);
+}
 
-	int len;
-	char *buf = editorRowsToString(&len);
+void editorNextBuffer() {
+	struct editorView *v = editorCurrentView();
+	int i = 0;
+	while (E.buffers[i] != v->buf) i++;
+	editorShowBuffer(v, E.buffers[(i + 1) % E.nbuffers]);
+}
 
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-	if (fd != -1) {
-		if (ftruncate(fd, len) != -1) {
-			if (write(fd, buf, len) == len) {
-				close(fd);
-				free(buf);
-				E.dirty = 0;
-				editorSetStatusMessage("%7d bytes written to disk", len);
-				return;
-			}
+#define FOU_SAVE_BUFSIZE (1024 * 1024)
+#define FOU_SAVE_PROGRESS (64 * 1024 * 1024)
+
+struct editorSaveJob {
+	struct editorBuffer *buf;
+	char *filename;
+	erow *rows;
+	int numrows;
+	long long total;
+	int dirty;
+	unsigned long long *hash;
+	int pipe[2];
+	pthread_t thread;
+};
+
+struct editorSaveProgress {
+	long long written;
+	int done;
+	int err;
+};
+
+int editorWriteAll(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void editorSaveReport(struct editorSaveJob *job, long long written, int done, int err) {
+	struct editorSaveProgress p = {written, done, err};
+	if (write(job->pipe[1], &p, sizeof(p)) == -1) {
+		/* the editor drains the pipe, so this only fails if it is gone */
+	}
+}
+
+void *editorSaveWorker(void *arg) {
+	struct editorSaveJob *job = arg;
+	char *buf = malloc(FOU_SAVE_BUFSIZE);
+	long long written = 0;
+	long long reported = 0;
+	int len = 0;
+	int err = 0;
+
+	int fd = open(job->filename, O_RDWR | O_CREAT, 0644);
+	if (buf == NULL || job->hash == NULL || fd == -1 || ftruncate(fd, job->total) == -1) {
+		err = buf == NULL || job->hash == NULL ? ENOMEM : errno;
+	}
+	for (int j = 0; j < job->numrows && !err; j++) {
+		erow *row = &job->rows[j];
+		job->hash[j] = editorHashLine(row->chars, row->size);
+		if (len + row->size + 1 > FOU_SAVE_BUFSIZE) {
+			if (editorWriteAll(fd, buf, len) == -1) err = errno;
+			written += len;
+			len = 0;
+		}
+		if (row->size + 1 > FOU_SAVE_BUFSIZE) {
+			if (editorWriteAll(fd, row->chars, row->size) == -1 || editorWriteAll(fd, "\n", 1) == -1) err = errno;
+			written += row->size + 1;
+		} else {
+			memcpy(&buf[len], row->chars, row->size);
+			len += row->size;
+			buf[len++] = '\n';
+		}
+		if (written - reported >= FOU_SAVE_PROGRESS) {
+			editorSaveReport(job, written, 0, 0);
+			reported = written;
 		}
-		close(fd);
 	}
+	if (!err && editorWriteAll(fd, buf, len) == -1) err = errno;
+	written += len;
+	if (!err && fsync(fd) == -1) err = errno;
+	if (fd != -1) close(fd);
 	free(buf);
-	editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+
+	editorSaveReport(job, written, 1, err);
+	return NULL;
 }
 
-/*** append buffer ***/
+void editorSaveFinish(struct editorSaveJob *job, int err) {
+	struct editorBuffer *buf = job->buf;
+	pthread_join(job->thread, NULL);
+	editorRemoveWatch(job->pipe[0]);
+	close(job->pipe[0]);
+	close(job->pipe[1]);
 
-struct abuf {
-	char *b;
-	int len;
-};
+	for (int i = 0; i < buf->nsave_orphans; i++) {
+		arenaFree(&buf->arena, buf->save_orphans[i].p, buf->save_orphans[i].cls);
+	}
+	free(buf->save_orphans);
+	buf->save_orphans = NULL;
+	buf->nsave_orphans = 0;
+	buf->save = NULL;
+
+	/* the rows were numbered for the file when the save started */
+	free(buf->disk_hash);
+	buf->disk_hash = err ? NULL : job->hash;
+	buf->ndisk = err ? -1 : job->numrows;
+	if (err) {
+		free(job->hash);
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(err));
+	} else {
+		if (buf->dirty == job->dirty) buf->dirty = 0;
+		editorWatchFile(buf, job->filename);
+		editorSetStatusMessage("%lld bytes written to disk", job->total);
+	}
+	free(job->rows);
+	free(job->filename);
+	free(job);
+}
+
+void editorSaveEvent(int fd) {
+	struct editorSaveJob *job = NULL;
+	for (int i = 0; i < E.nbuffers && job == NULL; i++) {
+		if (E.buffers[i]->save && E.buffers[i]->save->pipe[0] == fd) job = E.buffers[i]->save;
+	}
+	if (job == NULL) return;
+
+	struct editorSaveProgress p;
+	while (read(fd, &p, sizeof(p)) == sizeof(p)) {
+		if (p.done) {
+			editorSaveFinish(job, p.err);
+			return;
+		}
+		editorSetStatusMessage("Saving... %lld%%", job->total ? p.written * 100 / job->total : 100);
+	}
+}
+
+void editorSaveWait(struct editorBuffer *buf) {
+	if (buf->save == NULL) return;
+	struct pollfd pfd = {buf->save->pipe[0], POLLIN, 0};
+	while (buf->save != NULL) {
+		poll(&pfd, 1, -1);
+		editorSaveEvent(pfd.fd);
+	}
+}
+
+/* Snapshots the row array and hands serialization, write and fsync to a
+ * worker; edits made meanwhile detach their rows from the snapshot. */
+void editorSave(struct editorBuffer *buf) {
+	if (buf->save != NULL) {
+		editorSetStatusMessage("Save already in progress");
+		return;
+	}
+	if (buf->filename == NULL) {
+		buf->filename = editorPrompt("Save as: (ESC to cancel)%s");
+		if (buf->filename == NULL) {
+			editorSetStatusMessage("Save Aborted!");
+			return;
+		}
+	}
+
+	struct editorSaveJob *job = malloc(sizeof(struct editorSaveJob));
+	if (job == NULL) die("malloc");
+	job->buf = buf;
+	job->filename = strdup(buf->filename);
+	job->numrows = buf->numrows;
+	job->rows = malloc(sizeof(erow) * (buf->numrows + 1));
+	if (job->filename == NULL || job->rows == NULL) die("malloc");
+	job->dirty = buf->dirty;
+	job->hash = malloc(sizeof(unsigned long long) * (buf->numrows + 1));
+	job->total = 0;
+
+	buf->save_gen++;
+	for (int j = 0; j < buf->numrows; j++) {
+		erow *row = editorRow(buf, j);
+		editorRowText(row);
+		row->save_gen = buf->save_gen;
+		row->disk = j;
+		job->total += row->size + 1;
+	}
+	editorCopyRows(buf, job->rows);
+
+	if (pipe(job->pipe) == -1) die("pipe");
+	fcntl(job->pipe[0], F_SETFL, O_NONBLOCK);
+	if (editorAddWatch(job->pipe[0], editorSaveEvent) == -1 ||
+			pthread_create(&job->thread, NULL, editorSaveWorker, job) != 0) {
+		editorRemoveWatch(job->pipe[0]);
+		close(job->pipe[0]);
+		close(job->pipe[1]);
+		free(job->hash);
+		free(job->rows);
+		free(job->filename);
+		free(job);
+		free(buf->disk_hash);
+		buf->disk_hash = NULL;
+		buf->ndisk = -1;
+		editorSetStatusMessage("Can't save! Could not start the writer");
+		return;
+	}
+	buf->save = job;
+	editorSetStatusMessage("Saving %.20s...", buf->filename);
+}
+
+#define FOU_RELOAD_DELAY 100
+
+int editorRowEquals(erow *row, const char *s, size_t len) {
+	return (size_t)row->size == len && memcmp(editorRowText(row), s, len) == 0;
+}
 
-#define ABUF_INIT {NULL, 0}
+/* The file's lines that changed since we were last in sync with it are found
+ * against the hashes kept for it, and they come into a dirty buffer as long
+ * as the rows standing for them are all still as the file had them; any
+ * overlap with the user's edits is a conflict and nothing is taken in.
+ * Returns the number of lines brought in, or -1 on a conflict. */
+int editorReloadMerge(struct editorBuffer *buf, struct arenaSlot *lines, size_t *lens, unsigned long long *hash, int nlines) {
+	int nold = buf->ndisk;
+	if (nold < 0) return -1;
+	int head = 0;
+	while (head < nold && head < nlines && buf->disk_hash[head] == hash[head])
+		head++;
+	int tail = 0;
+	while (tail < nold - head && tail < nlines - head && buf->disk_hash[nold - 1 - tail] == hash[nlines - 1 - tail])
+		tail++;
+
+	int count = nold - head - tail;
+	int at = 0;
+	while (at < buf->numrows && editorRow(buf, at)->disk < head)
+		at++;
+	if (at + count > buf->numrows) return -1;
+	for (int k = 0; k < count; k++) {
+		if (editorRow(buf, at + k)->disk != head + k) return -1;
+	}
+
+	int changed = nlines - head - tail;
+	for (int j = 0; j < buf->numrows; j++) {
+		erow *row = editorRow(buf, j);
+		if (row->disk >= head + count) row->disk += changed - count;
+	}
+	for (int k = 0; k < count; k++) editorDelRow(buf, at);
+	for (int k = 0; k < changed; k++) {
+		editorInsertRow(buf, at + k, lines[head + k].p, lens[head + k]);
+		editorRow(buf, at + k)->disk = head + k;
+	}
+	free(buf->disk_hash);
+	buf->disk_hash = hash;
+	buf->ndisk = nlines;
+	return changed;
+}
 
-void abAppend(struct abuf *ab, const char *s, int len){
-	char *new = realloc(ab->b, ab->len + len);
+/* Re-reads the file and keeps every row of the unchanged head and tail, so
+ * only the lines that differ are rebuilt and re-rendered. Unsaved edits win:
+ * a dirty buffer only takes in changes away from the rows the user edited. */
+void editorReloadCheck(struct editorBuffer *buf) {
+	struct stat st;
+	struct stat *old = &buf->watch.st;
+	if (buf->filename == NULL || stat(buf->filename, &st) == -1) return;
+	if (st.st_ino == old->st_ino && st.st_size == old->st_size &&
+			st.st_mtim.tv_sec == old->st_mtim.tv_sec && st.st_mtim.tv_nsec == old->st_mtim.tv_nsec) {
+		return;
+	}
+	if (buf->save != NULL) {
+		buf->watch.pending = 1;
+		editorAddTimer(FOU_RELOAD_DELAY, editorReloadPending);
+		return;
+	}
+	*old = st;
+
+	FILE *fp = fopen(buf->filename, "r");
+	if (!fp) return;
+	struct arenaSlot *lines = NULL;
+	size_t *lens = NULL;
+	unsigned long long *hash = NULL;
+	int nlines = 0;
+	int cap = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	while ((linelen = getline(&line, &linecap, fp)) != -1) {
+		while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+			linelen--;
+		if (nlines == cap) {
+			cap = cap ? cap * 2 : 64;
+			lines = realloc(lines, sizeof(struct arenaSlot) * cap);
+			lens = realloc(lens, sizeof(size_t) * cap);
+			hash = realloc(hash, sizeof(unsigned long long) * cap);
+			if (lines == NULL || lens == NULL || hash == NULL) die("realloc");
+		}
+		char *p = arenaAlloc(&buf->arena, linelen + 1, &lines[nlines].cls);
+		memcpy(p, line, linelen);
+		p[linelen] = '\0';
+		lines[nlines].p = p;
+		hash[nlines] = editorHashLine(p, linelen);
+		lens[nlines++] = linelen;
+	}
+	free(line);
+	fclose(fp);
+
+	if (buf->dirty) {
+		int merged = editorReloadMerge(buf, lines, lens, hash, nlines);
+		for (int j = 0; j < nlines; j++) arenaFree(&buf->arena, lines[j].p, lines[j].cls);
+		free(lines);
+		free(lens);
+		if (merged == -1) {
+			free(hash);
+			editorSetStatusMessage("%.20s changed on disk where you edited; Ctrl-S overwrites it", buf->filename);
+		} else {
+			editorClampViews(buf);
+			editorSetStatusMessage("%.20s changed on disk; merged %d lines", buf->filename, merged);
+		}
+		return;
+	}
 
-	if (new == NULL) return;
-	memcpy(&new[ab->len], s, len);
-	ab->b = new;
-	ab->len += len;
+	int head = 0;
+	while (head < buf->numrows && head < nlines && editorRowEquals(editorRow(buf, head), lines[head].p, lens[head]))
+		head++;
+	int tail = 0;
+	while (tail < buf->numrows - head && tail < nlines - head &&
+			editorRowEquals(editorRow(buf, buf->numrows - 1 - tail), lines[nlines - 1 - tail].p, lens[nlines - 1 - tail]))
+		tail++;
+
+	int changed = nlines - head - tail;
+	for (int j = head; j < buf->numrows - tail; j++) {
+		editorFreeRow(buf, editorRow(buf, j));
+	}
+	erow *row = malloc(sizeof(erow) * (nlines + 1));
+	if (row == NULL) die("malloc");
+	for (int j = 0; j < head; j++) row[j] = *editorRow(buf, j);
+	for (int j = 0; j < tail; j++) row[nlines - tail + j] = *editorRow(buf, buf->numrows - tail + j);
+	for (int j = 0; j < nlines; j++) {
+		if (j >= head && j < nlines - tail) {
+			row[j].size = lens[j];
+			row[j].chars = lines[j].p;
+			row[j].cls = lines[j].cls;
+			row[j].gap = lens[j];
+			row[j].gaplen = 0;
+			row[j].rsize = 0;
+			row[j].render = NULL;
+			row[j].rcls = FOU_ARENA_ALIAS;
+			row[j].save_gen = 0;
+			editorUpdateRow(buf, &row[j]);
+		} else {
+			arenaFree(&buf->arena, lines[j].p, lines[j].cls);
+		}
+	}
+	free(lines);
+	free(lens);
+	free(buf->row);
+	buf->row = row;
+	buf->rowcap = nlines + 1;
+	buf->gap = nlines;
+	buf->numrows = nlines;
+	buf->dirty = 0;
+	editorSyncRows(buf, hash);
+
+	editorClampViews(buf);
+	editorSetStatusMessage("%.20s changed on disk; reloaded %d lines", buf->filename, changed > 0 ? changed : 0);
+}
+
+void editorReloadPending() {
+	for (int i = 0; i < E.nbuffers; i++) {
+		if (!E.buffers[i]->watch.pending) continue;
+		E.buffers[i]->watch.pending = 0;
+		editorReloadCheck(E.buffers[i]);
+	}
 }
 
-void abFree(struct abuf *ab){
-	free(ab->b);
+void editorWatchEvent(int fd) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int hit = 0;
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			for (int i = 0; ev->len && i < E.nbuffers; i++) {
+				struct editorFileWatch *w = &E.buffers[i]->watch;
+				if (w->wd == ev->wd && strcmp(ev->name, w->name) == 0) {
+					w->pending = 1;
+					hit = 1;
+				}
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (hit) editorAddTimer(FOU_RELOAD_DELAY, editorReloadPending);
+}
+
+/* Watches the file's directory, so saves that replace the file by rename are
+ * seen too, and remembers what the file looked like when we last had it in
+ * sync; our own saves refresh that so they are not taken for outside edits.
+ * All buffers share one inotify descriptor. */
+void editorWatchFile(struct editorBuffer *buf, const char *filename) {
+	stat(filename, &buf->watch.st);
+	if (buf->watch.wd != -1) return;
+
+	if (E.watch_fd == -1) {
+		E.watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (E.watch_fd == -1) return;
+		if (editorAddWatch(E.watch_fd, editorWatchEvent) == -1) {
+			close(E.watch_fd);
+			E.watch_fd = -1;
+			return;
+		}
+	}
+
+	const char *base = strrchr(filename, '/');
+	char *dir = base ? strndup(filename, base - filename + 1) : strdup(".");
+	free(buf->watch.name);
+	buf->watch.name = strdup(base ? base + 1 : filename);
+	if (dir == NULL || buf->watch.name == NULL) die("strdup");
+	buf->watch.wd = inotify_add_watch(E.watch_fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+	free(dir);
 }
 
 /*** ouput ***/
 
-void editorScroll() {
-	E.rx = 0;
-	if (E.cy < E.numrows) {
-		E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+void editorScroll(struct editorView *v) {
+	struct editorBuffer *buf = v->buf;
+	v->rx = 0;
+	if (v->cy < buf->numrows) {
+		v->rx = editorRowCxToRx(editorRow(buf, v->cy), v->cx);
 	}
 
-	if (E.cy < E.rowoff) {
-		E.rowoff = E.cy;
+	if (v->cy < v->rowoff) {
+		v->rowoff = v->cy;
 	}
-	if (E.cy >= E.rowoff + E.screenrows) {
-		E.rowoff = E.cy - E.screenrows + 1;
+	if (v->cy >= v->rowoff + v->rows) {
+		v->rowoff = v->cy - v->rows + 1;
 	}
-	if (E.rx < E.coloff) {
-		E.coloff = E.rx;
+	if (v->rx < v->coloff) {
+		v->coloff = v->rx;
 	}
-	if  (E.rx >= E.coloff + E.screencols) {
-		E.coloff = E.rx - E.screencols + 1;
+	if  (v->rx >= v->coloff + E.screencols) {
+		v->coloff = v->rx - E.screencols + 1;
 	}
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(struct abuf *ab, struct editorView *v) {
+	struct editorBuffer *buf = v->buf;
 	int y;
-	for (y = 0; y < E.screenrows; y++) {
-		int filerow = y + E.rowoff;
-		if (filerow >= E.numrows){
-			if (E.numrows == 0 && y == E.screenrows/3){
+	for (y = 0; y < v->rows; y++) {
+		int filerow = y + v->rowoff;
+		if (filerow >= buf->numrows){
+			if (buf->numrows == 0 && E.nviews == 1 && y == v->rows/3){
 				char welcome[80];
 				int welcomelen = snprintf(welcome, sizeof(welcome), "Fou Editor -- version %s", FOU_VERSION);
 				if (welcomelen > E.screencols) welcomelen = E.screencols;
@@ -472,10 +1188,17 @@ void editorDrawRows(struct abuf *ab) {
 				abAppend(ab, "~", 1);
 			}
 		} else {
-			int len = E.row[filerow].rsize - E.coloff;
+			erow *row = editorRow(buf, filerow);
+			int len = row->rsize - v->coloff;
 			if (len < 0) len = 0;
 			if (len > E.screencols) len = E.screencols;
-			abAppend(ab, &E.row[filerow].render[E.coloff], len);
+			if (row->render == row->chars && row->gaplen > 0 && v->coloff + len > row->gap) {
+				int head = row->gap > v->coloff ? row->gap - v->coloff : 0;
+				abAppend(ab, &row->chars[v->coloff], head);
+				abAppend(ab, &row->chars[v->coloff + head + row->gaplen], len - head);
+			} else {
+				abAppend(ab, &row->render[v->coloff], len);
+			}
 		}
 
 		abAppend(ab, "\x1b[K", 3);
@@ -483,11 +1206,13 @@ void editorDrawRows(struct abuf *ab) {
 	}
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
+void editorDrawStatusBar(struct abuf *ab, struct editorView *v) {
+	struct editorBuffer *buf = v->buf;
+	const char *mode = v != editorCurrentView() ? "" : E.state == 0 ? "COMMAND MODE" : "UPDATE MODE";
 	abAppend(ab, "\x1b[7m", 4);
 	char status[80], rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s   %.15s - %7d lines %.20s", E.filename ? E.filename : "[No Name]", E.state == 0 ? "COMMAND MODE" : "UPDATE MODE", E.numrows, E.dirty ? "(modified)": "");
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%d, %d/%d", E.cx + 1, E.cy + 1, E.numrows);
+	int len = snprintf(status, sizeof(status), "%.20s   %.15s - %7d lines %.20s", buf->filename ? buf->filename : "[No Name]", mode, buf->numrows, buf->dirty ? "(modified)": "");
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%d, %d/%d", v->cx + 1, v->cy + 1, buf->numrows);
 	if (len > E.screencols) {
 		len = E.screencols;
 	}
@@ -505,45 +1230,20 @@ void editorDrawStatusBar(struct abuf *ab) {
 	abAppend(ab, "\r\n", 2);
 }
 
-void editorSetStatusMessage(const char *fmt, ...) {
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-	va_end(ap);
-	E.statusmsg_time = time(NULL);
-}
-
-void editorDrawMessageBar(struct abuf *ab) {
-	abAppend(ab, "\x1b[K", 3);
-	int msglen = strlen(E.statusmsg);
-	if (msglen > E.screencols) {
-		msglen = E.screencols;
-	}
-	if (msglen && time(NULL) - E.statusmsg_time < 5) {
-		abAppend(ab, E.statusmsg, msglen);
-	}
-}
-
 void editorRefreshScreen() {
-	editorScroll();
-
 	struct abuf ab = ABUF_INIT;
 
-	abAppend(&ab, "\x1b[?25l", 6);
-	abAppend(&ab, "\x1b[H", 3);
-
-	editorDrawRows(&ab);
-	editorDrawStatusBar(&ab);
-	editorDrawMessageBar(&ab);
+	editorScreenStart(&ab);
 
-	char buff[32];
-	snprintf(buff, sizeof(buff), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-	abAppend(&ab, buff, strlen(buff));
-
-	abAppend(&ab, "\x1b[?25h", 6);
+	for (int i = 0; i < E.nviews; i++) {
+		editorScroll(&E.views[i]);
+		editorDrawRows(&ab, &E.views[i]);
+		editorDrawStatusBar(&ab, &E.views[i]);
+	}
+	editorDrawMessageBar(&ab, E.screencols);
 
-	write(STDOUT_FILENO, ab.b, ab.len);
-	abFree(&ab);
+	struct editorView *v = editorCurrentView();
+	editorScreenFlush(&ab, v->top + (v->cy - v->rowoff), v->rx - v->coloff);
 }
 
 /*** input ***/
@@ -553,12 +1253,13 @@ char *editorPrompt(char *prompt) {
 	char *buf = malloc(bufsize);
 
 	size_t buflen = 0;
+	buf[0] = '\0';
 
 	while(1) {
 		editorSetStatusMessage(prompt, buf);
 		editorRefreshScreen();
 
-		int c = editorReadKey();
+		int c = editorReadKey(E.state == 0);
 		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
 			if (buflen != 0) buf[--buflen] = '\0';
 		} else if (c == '\x1b'){
@@ -582,52 +1283,63 @@ char *editorPrompt(char *prompt) {
 }
 
 void editorMoveCursor(int key) {
-	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	struct editorView *v = editorCurrentView();
+	struct editorBuffer *buf = v->buf;
+	erow *row = (v->cy >= buf->numrows) ? NULL : editorRow(buf, v->cy);
 
 	switch (key) {
 		case ARROW_LEFT:
-			if(E.cx != 0) E.cx--;
-			else if((E.cy > 0) & (E.cx == 0)){
-				E.cy--;
-				E.cx = E.row[E.cy].size;
+			if(v->cx != 0) v->cx--;
+			else if((v->cy > 0) & (v->cx == 0)){
+				v->cy--;
+				v->cx = editorRow(buf, v->cy)->size;
 			}
-			E.actual_x = E.cx;
+			v->actual_x = v->cx;
 			break;
 		case ARROW_RIGHT:
-			if(row && E.cx < E.row[E.cy].size) E.cx++;
-			else if(E.cy < (E.numrows - 1)){
-				E.cx = 0;
-				E.cy++;
+			if(row && v->cx < editorRow(buf, v->cy)->size) v->cx++;
+			else if(v->cy < (buf->numrows - 1)){
+				v->cx = 0;
+				v->cy++;
 			}
-			E.actual_x = E.cx;
+			v->actual_x = v->cx;
 			break;
 		case ARROW_UP:
-			if(E.cy > 0) {
-				E.cy--;
-				if(E.actual_x > E.row[E.cy].size){
-					E.cx = E.row[E.cy].size;
+			if(v->cy > 0) {
+				v->cy--;
+				if(v->actual_x > editorRow(buf, v->cy)->size){
+					v->cx = editorRow(buf, v->cy)->size;
 				} else {
-					E.cx = E.actual_x;
+					v->cx = v->actual_x;
 				}
 			}
 			break;
 		case ARROW_DOWN:
-			if(E.cy < E.numrows - 1) {
-				E.cy++;
-				if(E.actual_x > E.row[E.cy].size){
-					E.cx = E.row[E.cy].size;
+			if(v->cy < buf->numrows - 1) {
+				v->cy++;
+				if(v->actual_x > editorRow(buf, v->cy)->size){
+					v->cx = editorRow(buf, v->cy)->size;
 				} else {
-					E.cx = E.actual_x;
+					v->cx = v->actual_x;
 				}
 			}
 			break;
 	}
 }
 
+int editorAnyDirty() {
+	for (int i = 0; i < E.nbuffers; i++) {
+		if (E.buffers[i]->dirty) return 1;
+	}
+	return 0;
+}
+
 void editorProcessKeypress() {
 	static int quit_times = FOU_QUIT_TIMES;
 
-	int c = editorReadKey();
+	int c = editorReadKey(E.state == 0);
+	struct editorView *v = editorCurrentView();
+	struct editorBuffer *buf = v->buf;
 
 	switch (c) {
 
@@ -636,11 +1348,14 @@ void editorProcessKeypress() {
 			break;
 
 		case CTRL_KEY('c'):
-			if (E.dirty && quit_times > 0) {
+			if (editorAnyDirty() && quit_times > 0) {
 				editorSetStatusMessage("WARNING!!! File has unsaved Changes. Press Ctrl-C %d more times to quit.", quit_times);
 				quit_times -= 1;
 				return;
 			}
+			for (int i = 0; i < E.nbuffers; i++) {
+				editorFreeBuffer(E.buffers[i]);
+			}
 			write(STDOUT_FILENO, "\x1b[2J", 4);
      		write(STDOUT_FILENO, "\x1b[H", 3);
      		disableRawMode();
@@ -649,32 +1364,52 @@ void editorProcessKeypress() {
 			break;
 
 		case CTRL_KEY('s'):
-			editorSave();
+			editorSave(buf);
+			break;
+
+		case CTRL_KEY('o'):
+			editorOpenPrompt();
+			break;
+
+		case CTRL_KEY('b'):
+			editorNextBuffer();
+			break;
+
+		case CTRL_KEY('t'):
+			editorSplitView();
+			break;
+
+		case CTRL_KEY('w'):
+			editorCloseView();
+			break;
+
+		case CTRL_KEY('n'):
+			E.current = (E.current + 1) % E.nviews;
 			break;
 
 		case PAGE_UP:
 		case PAGE_DOWN:
 			{
 				if (c == PAGE_UP) {
-					E.cy = E.rowoff;
+					v->cy = v->rowoff;
 				} else if (c == PAGE_DOWN) {
-					E.cy = E.rowoff + E.screenrows - 1;
-					if (E.cy > E.numrows) {
-						E.cy = E.numrows;
+					v->cy = v->rowoff + v->rows - 1;
+					if (v->cy > buf->numrows) {
+						v->cy = buf->numrows;
 					}
 				}
-				int times = E.screenrows;
+				int times = v->rows;
 				while (times--)
 					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
 			}
 			break;
 
 		case HOME_KEY:
-			E.cx = 0;
+			v->cx = 0;
 			break;
 		case END_KEY:
-			if (E.cy < E.numrows) {
-				E.cx = E.row[E.cy].size;
+			if (v->cy < buf->numrows) {
+				v->cx = editorRow(buf, v->cy)->size;
 			}
 			break;
 
@@ -702,38 +1437,36 @@ void editorProcessKeypress() {
 			break;
 	}
 
+	editorClampViews(buf);
 	quit_times = FOU_QUIT_TIMES;
 }
 
 /*** init ***/
 
 void initEditor() {
-	E.cx = 0;
-	E.cy = 0;
-	E.rx = 0;
-	E.numrows = 0;
-	E.actual_x = 0;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.row = NULL;
-	E.dirty = 0;
+	E.nviews = 1;
+	E.current = 0;
+	E.buffers = NULL;
+	E.nbuffers = 0;
 	E.state = 0;
-	E.filename = NULL;
-	E.statusmsg[0] = '\0';
-	E.statusmsg_time = 0;
+	E.watch_fd = -1;
+	editorShowBuffer(&E.views[0], editorNewBuffer());
 
 	if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-	E.screenrows -= 2;
+	E.screenrows -= 1;
+	editorLayout();
 }
 
 int main(int argc, char *argv[]) {
 	enableRawMode();
+	editorInitEvents();
 	initEditor();
-	if (argc >= 2) {
-		editorOpen(argv[1]);
+	for (int i = 1; i < argc; i++) {
+		struct editorBuffer *buf = i == 1 ? E.views[0].buf : editorNewBuffer();
+		if (editorOpen(buf, argv[i]) == -1) die("fopen");
 	}
 
-	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-C to quit");
+	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-O = open | Ctrl-T = split | Ctrl-C to quit");
 	
 	while (1) {
 		editorRefreshScreen();
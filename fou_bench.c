@@ -0,0 +1,222 @@
+/*** includes ***/
+
+/* The row benchmarks drive fou's own row code, so fou is built in here with
+ * its main renamed. */
+#define main fou_main
+#include "fou.c"
+#undef main
+
+/*
+ * Compares fou's gap-buffered row array with the flat one it replaced, on
+ * the edits that hurt the flat layout most: pressing Enter and Backspace
+ * near the top of a file with many lines, and typing in the middle of one
+ * very long line, where fou edits through a gap inside the row. Also
+ * compares trial's piece layouts, a buffer pointer per piece against a
+ * one-bit tag, by walking the table to look up offsets.
+ *
+ *   fou_bench [-r rows] [-l line length] [-k keys] [-p pieces]
+ */
+
+/*** data ***/
+
+struct rows {
+	erow *row;
+	int numrows;
+};
+
+struct widePiece {
+	int start;
+	int length;
+	char **target;
+};
+
+struct packedPiece {
+	unsigned int start : 31;
+	unsigned int add : 1;
+	int length;
+};
+
+struct benchConfig {
+	int rows;
+	int linelen;
+	int keys;
+	int pieces;
+} B = {1000000, 1000000, 200, 1000000};
+
+char *content;
+char *add;
+long sink;
+
+/*** util ***/
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*** flat layouts ***/
+
+/* The old row array: it grows by one per row and every insert or delete
+ * shifts everything after it. */
+void flatInsert(struct rows *r, int at) {
+	r->row = realloc(r->row, sizeof(erow) * (r->numrows + 1));
+	if (r->row == NULL) die("realloc");
+	memmove(&r->row[at + 1], &r->row[at], sizeof(erow) * (r->numrows - at));
+	memset(&r->row[at], 0, sizeof(erow));
+	r->numrows++;
+}
+
+void flatDelete(struct rows *r, int at) {
+	memmove(&r->row[at], &r->row[at + 1], sizeof(erow) * (r->numrows - at - 1));
+	r->numrows--;
+}
+
+/* The old row text: every key shifts the tail of the line. */
+void lineInsert(char *s, int *len, int at, int c) {
+	memmove(&s[at + 1], &s[at], *len - at + 1);
+	s[at] = c;
+	(*len)++;
+}
+
+void lineDelete(char *s, int *len, int at) {
+	memmove(&s[at], &s[at + 1], *len - at);
+	(*len)--;
+}
+
+/*** benchmarks ***/
+
+double benchRows(int gap) {
+	struct rows r = {NULL, 0};
+	struct editorBuffer *buf = editorNewBuffer();
+	for (int i = 0; i < B.rows; i++) {
+		if (gap) editorInsertRow(buf, i, "", 0);
+		else flatInsert(&r, i);
+	}
+	int at = B.rows / 100;
+	double t0 = now();
+	for (int i = 0; i < B.keys; i++) {
+		if (gap) editorInsertRow(buf, at + i, "", 0);
+		else flatInsert(&r, at + i);
+	}
+	for (int i = B.keys; i > 0; i--) {
+		if (gap) editorDelRow(buf, at + i);
+		else flatDelete(&r, at + i);
+	}
+	double secs = now() - t0;
+	free(r.row);
+	E.nbuffers--;
+	editorFreeBuffer(buf);
+	return secs / (2.0 * B.keys) * 1e9;
+}
+
+double benchLine(int gap) {
+	char *s = malloc(B.linelen + B.keys + 1);
+	if (s == NULL) die("malloc");
+	memset(s, 'a', B.linelen);
+	s[B.linelen] = '\0';
+	struct editorBuffer *buf = editorNewBuffer();
+	editorInsertRow(buf, 0, s, B.linelen);
+	erow *row = editorRow(buf, 0);
+	int len = B.linelen;
+	int at = B.linelen / 2;
+	double t0 = now();
+	for (int i = 0; i < B.keys; i++) {
+		if (gap) editorRowInsertChar(buf, row, at + i, 'x');
+		else lineInsert(s, &len, at + i, 'x');
+	}
+	for (int i = B.keys; i > 0; i--) {
+		if (gap) editorRowDelChar(buf, row, at + i - 1);
+		else lineDelete(s, &len, at + i - 1);
+	}
+	double secs = now() - t0;
+	if (row->size != B.linelen || memcmp(editorRowText(row), s, len) != 0) sink++;
+	free(s);
+	E.nbuffers--;
+	editorFreeBuffer(buf);
+	return secs / (2.0 * B.keys) * 1e9;
+}
+
+/* Each lookup walks the table from the front, as pieceByteAt does. */
+double benchPieces(int packed) {
+	struct widePiece *w = NULL;
+	struct packedPiece *p = NULL;
+	if (packed) p = malloc(sizeof(struct packedPiece) * B.pieces);
+	else w = malloc(sizeof(struct widePiece) * B.pieces);
+	content = malloc(B.pieces);
+	add = malloc(B.pieces);
+	if ((w == NULL && p == NULL) || content == NULL || add == NULL) die("malloc");
+	memset(content, 'c', B.pieces);
+	memset(add, 'a', B.pieces);
+	for (int i = 0; i < B.pieces; i++) {
+		if (packed) {
+			p[i].start = i;
+			p[i].add = i & 1;
+			p[i].length = 1;
+		} else {
+			w[i].start = i;
+			w[i].length = 1;
+			w[i].target = (i & 1) ? &add : &content;
+		}
+	}
+	long sum = 0;
+	double t0 = now();
+	for (int i = 0; i < B.keys; i++) {
+		int x = B.pieces - 1 - i % (B.pieces / 100);
+		for (int k = 0; k < B.pieces; k++) {
+			if (packed) {
+				if (x < p[k].length) {
+					sum += (p[k].add ? add : content)[p[k].start + x];
+					break;
+				}
+				x -= p[k].length;
+			} else {
+				if (x < w[k].length) {
+					sum += (*w[k].target)[w[k].start + x];
+					break;
+				}
+				x -= w[k].length;
+			}
+		}
+	}
+	double secs = now() - t0;
+	if (sum == 0) sink++;
+	free(w);
+	free(p);
+	free(content);
+	free(add);
+	return secs / B.keys * 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "r:l:k:p:")) != -1) {
+		switch (opt) {
+			case 'r': B.rows = atoi(optarg); break;
+			case 'l': B.linelen = atoi(optarg); break;
+			case 'k': B.keys = atoi(optarg); break;
+			case 'p': B.pieces = atoi(optarg); break;
+			default: goto usage;
+		}
+	}
+	if (optind != argc || B.rows < 100 || B.linelen < 2 || B.keys < 1 || B.pieces < 100) goto usage;
+
+	double flat = benchRows(0);
+	double gap = benchRows(1);
+	printf("rows: %d keys near the top of %d lines\n", B.keys, B.rows);
+	printf("  flat %10.1f ns/key\n  gap  %10.1f ns/key  (%.0fx)\n", flat, gap, gap > 0 ? flat / gap : 0.0);
+	double tail = benchLine(0);
+	double inrow = benchLine(1);
+	printf("line: %d keys inside a %d byte line\n", B.keys, B.linelen);
+	printf("  tail %10.1f ns/key\n  gap  %10.1f ns/key  (%.0fx)\n", tail, inrow, inrow > 0 ? tail / inrow : 0.0);
+	double wide = benchPieces(0);
+	double packed = benchPieces(1);
+	printf("pieces: %d lookups near the end of %d pieces\n", B.keys, B.pieces);
+	printf("  wide   %8.1f ns/lookup (%zu bytes)\n  packed %8.1f ns/lookup (%zu bytes)  (%.1fx)\n",
+			wide, sizeof(struct widePiece), packed, sizeof(struct packedPiece), packed > 0 ? wide / packed : 0.0);
+	return sink != 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-r rows] [-l line length] [-k keys] [-p pieces]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,497 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "fou_term.h"
+#include "fou_text.h"
+
+/*** defines ***/
+
+#define FOU_VERSION "0.0.1"
+#define FOU_TAB_STOP 8
+#define FOU_QUIT_TIMES 3
+
+/*
+ * A front end over fou_text.h, so one workload can be typed against each
+ * backend. It shares fou's terminal, event loop and key handling through
+ * fou_term.h; what it keeps apart is the text, which fou holds as rows of
+ * its own.
+ *
+ *   fou_edit [-b backend] [file]
+ *
+ * Nothing is kept per row. Lines are found through the backend each time
+ * they are drawn or the cursor moves, so what the editor costs is what the
+ * backend's line lookup and reads cost.
+ */
+
+/*** data ***/
+
+struct editorConfig {
+	fouText *text;
+	int cx, cy;
+	int rx;
+	int rowoff;
+	int coloff;
+	int actual_x;
+	/* newlines plus one: the line after the last newline is a row too */
+	int numrows;
+	int screenrows;
+	int screencols;
+	int state;
+	int dirty;
+	char *filename;
+};
+
+struct editorConfig E;
+
+/*** prototypes ***/
+
+char *editorPrompt(char *prompt);
+
+/*** terminal ***/
+
+/* The terminal is gone; there is nothing in flight to wait for. */
+void editorHangup() {
+	_exit(0);
+}
+
+void editorResize(int rows, int cols) {
+	E.screenrows = rows - 2;
+	E.screencols = cols;
+}
+
+/*** lines ***/
+
+size_t editorLineStart(int y) {
+	return fouTextLineStart(E.text, y);
+}
+
+/* Length of line y without its newline. */
+int editorLineLen(int y) {
+	if (y >= E.numrows) return 0;
+	size_t start = editorLineStart(y);
+	size_t end = y + 1 < E.numrows ? editorLineStart(y + 1) - 1 : fouTextLength(E.text);
+	return end - start;
+}
+
+/* Reads the first len bytes of line y; the caller frees the result. */
+char *editorLineText(int y, int len) {
+	char *s = malloc(len + 1);
+	if (s == NULL) die("malloc");
+	len = fouTextRead(E.text, editorLineStart(y), s, len);
+	s[len] = '\0';
+	return s;
+}
+
+int editorCxToRx(const char *s, int cx) {
+	int rx = 0;
+	for (int j = 0; j < cx; j++) {
+		if (s[j] == '\t') rx += (FOU_TAB_STOP - 1) - (rx % FOU_TAB_STOP);
+		rx++;
+	}
+	return rx;
+}
+
+/*** editor operations ***/
+
+void editorInsertChar(int c) {
+	char ch = c;
+	size_t at = editorLineStart(E.cy) + E.cx;
+	if (fouTextInsert(E.text, at, &ch, 1) == -1) {
+		editorSetStatusMessage("Insert failed: %s", strerror(errno));
+		return;
+	}
+	if (c == '\n') {
+		E.numrows++;
+		E.cy++;
+		E.cx = 0;
+	} else {
+		E.cx++;
+	}
+	E.actual_x = E.cx;
+	E.dirty++;
+}
+
+void editorInsertNewline() {
+	editorInsertChar('\n');
+}
+
+void editorDelChar() {
+	if (E.cx == 0 && E.cy == 0) return;
+	size_t at = editorLineStart(E.cy) + E.cx;
+	int joined = E.cx == 0 ? editorLineLen(E.cy - 1) : -1;
+	if (fouTextDelete(E.text, at - 1, 1) == -1) {
+		editorSetStatusMessage("Delete failed: %s", strerror(errno));
+		return;
+	}
+	if (joined >= 0) {
+		E.numrows--;
+		E.cy--;
+		E.cx = joined;
+	} else {
+		E.cx--;
+	}
+	E.actual_x = E.cx;
+	E.dirty++;
+}
+
+/*** file i/o ***/
+
+void editorOpen(const char *backend, char *filename) {
+	free(E.filename);
+	E.filename = filename ? strdup(filename) : NULL;
+	fouText *t = filename ? fouTextOpen(backend, filename) : NULL;
+	if (t == NULL && (filename == NULL || errno == ENOENT)) t = fouTextOpenMemory(backend, "", 0);
+	if (t == NULL) die(filename);
+	size_t lines, tabs;
+	if (fouTextCount(t, 0, fouTextLength(t), &lines, &tabs) == -1) die("fouTextCount");
+	if (E.text) fouTextClose(E.text);
+	E.text = t;
+	E.numrows = lines + 1;
+	E.cx = E.cy = 0;
+	E.dirty = 0;
+}
+
+void editorSave() {
+	if (E.filename == NULL) {
+		E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+		if (E.filename == NULL) {
+			editorSetStatusMessage("Save aborted");
+			return;
+		}
+	}
+	if (fouTextSave(E.text, E.filename) == -1) {
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+		return;
+	}
+	E.dirty = 0;
+	editorSetStatusMessage("%zu bytes written to disk", fouTextLength(E.text));
+}
+
+/*** ouput ***/
+
+void editorScroll() {
+	char *line = editorLineText(E.cy, E.cx);
+	E.rx = editorCxToRx(line, E.cx);
+	free(line);
+
+	if (E.cy < E.rowoff) {
+		E.rowoff = E.cy;
+	}
+	if (E.cy >= E.rowoff + E.screenrows) {
+		E.rowoff = E.cy - E.screenrows + 1;
+	}
+	if (E.rx < E.coloff) {
+		E.coloff = E.rx;
+	}
+	if  (E.rx >= E.coloff + E.screencols) {
+		E.coloff = E.rx - E.screencols + 1;
+	}
+}
+
+/* Only the first visible line is looked up; each line after it starts past
+ * the newline that ends the one before. */
+void editorDrawRows(struct abuf *ab) {
+	size_t length = fouTextLength(E.text);
+	size_t off = editorLineStart(E.rowoff);
+	char *chars = NULL;
+	char *render = NULL;
+	size_t cap = 0;
+	for (int y = 0; y < E.screenrows; y++) {
+		int filerow = y + E.rowoff;
+		if (filerow >= E.numrows) {
+			if (length == 0 && y == E.screenrows / 3) {
+				char welcome[80];
+				int welcomelen = snprintf(welcome, sizeof(welcome), "Fou Editor -- version %s -- %s", FOU_VERSION, fouTextBackend(E.text));
+				if (welcomelen > E.screencols) welcomelen = E.screencols;
+				int padding = (E.screencols - welcomelen) / 2;
+				if (padding) {
+					abAppend(ab, "~", 1);
+					padding--;
+				}
+				while (padding--) abAppend(ab, " ", 1);
+				abAppend(ab, welcome, welcomelen);
+			} else {
+				abAppend(ab, "~", 1);
+			}
+		} else {
+			size_t end;
+			if (fouTextSearch(E.text, off, "\n", 1, &end) != 1) end = length;
+			size_t size = end - off;
+			if (cap < size + 1) {
+				cap = size + 1;
+				chars = realloc(chars, cap);
+				render = realloc(render, cap * FOU_TAB_STOP);
+				if (chars == NULL || render == NULL) die("realloc");
+			}
+			fouTextRead(E.text, off, chars, size);
+			int rsize = 0;
+			for (size_t j = 0; j < size; j++) {
+				if (chars[j] == '\t') {
+					render[rsize++] = ' ';
+					while (rsize % FOU_TAB_STOP != 0) render[rsize++] = ' ';
+				} else {
+					render[rsize++] = chars[j];
+				}
+			}
+			int len = rsize - E.coloff;
+			if (len < 0) len = 0;
+			if (len > E.screencols) len = E.screencols;
+			if (len > 0) abAppend(ab, &render[E.coloff], len);
+			off = end + 1;
+		}
+
+		abAppend(ab, "\x1b[K", 3);
+		abAppend(ab, "\r\n", 2);
+	}
+	free(chars);
+	free(render);
+}
+
+void editorDrawStatusBar(struct abuf *ab) {
+	const char *mode = E.state == 0 ? "COMMAND MODE" : "UPDATE MODE";
+	abAppend(ab, "\x1b[7m", 4);
+	char status[80], rstatus[80];
+	int len = snprintf(status, sizeof(status), "%.20s   %.15s - %7d lines %.20s", E.filename ? E.filename : "[No Name]", mode, E.numrows, E.dirty ? "(modified)": "");
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%s  %d, %d/%d", fouTextBackend(E.text), E.cx + 1, E.cy + 1, E.numrows);
+	if (len > E.screencols) {
+		len = E.screencols;
+	}
+	abAppend(ab, status, len);
+	while (len < E.screencols) {
+		if (E.screencols - len == rlen) {
+			abAppend(ab, rstatus, rlen);
+			break;
+		} else {
+			abAppend(ab, " ", 1);
+			len++;
+		}
+	}
+	abAppend(ab, "\x1b[m", 3);
+	abAppend(ab, "\r\n", 2);
+}
+
+void editorRefreshScreen() {
+	editorScroll();
+
+	struct abuf ab = ABUF_INIT;
+
+	editorScreenStart(&ab);
+	editorDrawRows(&ab);
+	editorDrawStatusBar(&ab);
+	editorDrawMessageBar(&ab, E.screencols);
+	editorScreenFlush(&ab, E.cy - E.rowoff, E.rx - E.coloff);
+}
+
+/*** input ***/
+
+char *editorPrompt(char *prompt) {
+	size_t bufsize = 128;
+	char *buf = malloc(bufsize);
+
+	size_t buflen = 0;
+	buf[0] = '\0';
+
+	while(1) {
+		editorSetStatusMessage(prompt, buf);
+		editorRefreshScreen();
+
+		int c = editorReadKey(E.state == 0);
+		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+			if (buflen != 0) buf[--buflen] = '\0';
+		} else if (c == '\x1b'){
+			editorSetStatusMessage("");
+			free(buf);
+			return NULL;
+		} else if (c == '\r') {
+			if (buflen != 0) {
+				editorSetStatusMessage("");
+				return buf;
+			}
+		} else if (!iscntrl(c) && c < 128) {
+			if (buflen == bufsize - 1) {
+				bufsize *= 2;
+				buf = realloc(buf, bufsize);
+			}
+			buf[buflen++] = c;
+			buf[buflen] = '\0';
+		}
+	}
+}
+
+void editorMoveCursor(int key) {
+	switch (key) {
+		case ARROW_LEFT:
+			if(E.cx != 0) E.cx--;
+			else if(E.cy > 0){
+				E.cy--;
+				E.cx = editorLineLen(E.cy);
+			}
+			E.actual_x = E.cx;
+			break;
+		case ARROW_RIGHT:
+			if(E.cx < editorLineLen(E.cy)) E.cx++;
+			else if(E.cy < E.numrows - 1){
+				E.cx = 0;
+				E.cy++;
+			}
+			E.actual_x = E.cx;
+			break;
+		case ARROW_UP:
+		case ARROW_DOWN:
+			if (key == ARROW_UP && E.cy > 0) E.cy--;
+			else if (key == ARROW_DOWN && E.cy < E.numrows - 1) E.cy++;
+			else break;
+			int len = editorLineLen(E.cy);
+			E.cx = E.actual_x > len ? len : E.actual_x;
+			break;
+	}
+}
+
+void editorProcessKeypress() {
+	static int quit_times = FOU_QUIT_TIMES;
+
+	int c = editorReadKey(E.state == 0);
+
+	switch (c) {
+
+		case '\r':
+			editorInsertNewline();
+			break;
+
+		case CTRL_KEY('c'):
+			if (E.dirty && quit_times > 0) {
+				editorSetStatusMessage("WARNING!!! File has unsaved Changes. Press Ctrl-C %d more times to quit.", quit_times);
+				quit_times -= 1;
+				return;
+			}
+			fouTextClose(E.text);
+			write(STDOUT_FILENO, "\x1b[2J", 4);
+			write(STDOUT_FILENO, "\x1b[H", 3);
+			exit(0);
+			break;
+
+		case CTRL_KEY('s'):
+			editorSave();
+			break;
+
+		case PAGE_UP:
+		case PAGE_DOWN:
+			{
+				if (c == PAGE_UP) {
+					E.cy = E.rowoff;
+				} else {
+					E.cy = E.rowoff + E.screenrows - 1;
+					if (E.cy >= E.numrows) E.cy = E.numrows - 1;
+				}
+				int len = editorLineLen(E.cy);
+				if (E.cx > len) E.cx = len;
+				int times = E.screenrows;
+				while (times--)
+					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+			}
+			break;
+
+		case HOME_KEY:
+			E.cx = 0;
+			E.actual_x = E.cx;
+			break;
+		case END_KEY:
+			E.cx = editorLineLen(E.cy);
+			E.actual_x = E.cx;
+			break;
+
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL_KEY:
+			if (c == DEL_KEY) {
+				if (E.cx == editorLineLen(E.cy) && E.cy == E.numrows - 1) break;
+				editorMoveCursor(ARROW_RIGHT);
+			}
+			editorDelChar();
+			break;
+
+		case ARROW_UP:
+		case ARROW_DOWN:
+		case ARROW_LEFT:
+		case ARROW_RIGHT:
+			editorMoveCursor(c);
+			break;
+
+		case CTRL_KEY('l'):
+		case '\x1b':
+			E.state ^= 1;
+			break;
+
+		default:
+			if (c == '\t' || !iscntrl(c)) editorInsertChar(c);
+			break;
+	}
+
+	quit_times = FOU_QUIT_TIMES;
+}
+
+/*** init ***/
+
+void initEditor() {
+	E.text = NULL;
+	E.cx = 0;
+	E.cy = 0;
+	E.rx = 0;
+	E.rowoff = 0;
+	E.coloff = 0;
+	E.actual_x = 0;
+	E.state = 0;
+	E.filename = NULL;
+
+	if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+	E.screenrows -= 2;
+}
+
+int main(int argc, char *argv[]) {
+	const char *backend = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		if (opt == 'b') {
+			backend = optarg;
+			continue;
+		}
+		goto usage;
+	}
+	if (argc - optind > 1) goto usage;
+	if (backend != NULL) {
+		fouText *probe = fouTextOpenMemory(backend, "", 0);
+		if (probe == NULL) goto usage;
+		fouTextClose(probe);
+	}
+
+	enableRawMode();
+	editorInitEvents();
+	initEditor();
+	editorOpen(backend, optind < argc ? argv[optind] : NULL);
+
+	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-C = quit | Esc = command/update mode");
+
+	while (1) {
+		editorRefreshScreen();
+		editorProcessKeypress();
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-b backend] [file]\nbackends:", argv[0]);
+	for (int i = 0; fouTextBackendName(i) != NULL; i++) fprintf(stderr, " %s", fouTextBackendName(i));
+	fprintf(stderr, "\n");
+	return 1;
+}
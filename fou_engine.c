@@ -0,0 +1,898 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "fou_engine.h"
+
+/*** defines ***/
+
+#define FOU_ADD_BLOCK (64 * 1024)
+#define FOU_FANOUT 32
+#define FOU_DEPTH 32
+
+/*** data ***/
+
+/* buf 0 is the original text, buf k is add block k - 1. */
+struct fouPiece {
+	size_t start;
+	size_t length;
+	int buf;
+};
+
+/* The pieces live in the leaves of a B-tree, in text order, and every node
+ * knows the length and piece count under it. Nodes are shared between a
+ * document and its snapshots and copied before they change while shared,
+ * so a snapshot costs one reference and an edit copies one path. */
+struct fouNode {
+	int refs;
+	int leaf;
+	size_t n;
+	size_t length;
+	size_t count;
+	union {
+		struct fouPiece p[FOU_FANOUT];
+		struct fouNode *kid[FOU_FANOUT];
+	} u;
+};
+
+struct fouBlock {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/* Text shared by a document and its snapshots. Blocks are append-only and
+ * never move, so bytes a piece refers to stay put for as long as anyone
+ * holds a reference; only the document that owns the store appends. */
+struct fouStore {
+	int refs;
+	char *original;
+	size_t original_len;
+	struct fouBlock *blocks;
+	size_t nblocks;
+	size_t cap;
+};
+
+struct fouDocument {
+	struct fouStore *store;
+	struct fouNode *root;
+	/* base pointer of every buffer this document can see */
+	char **data;
+	size_t ndata;
+	int readonly;
+};
+
+/*** tree ***/
+
+static struct fouNode *fouNodeNew(int leaf) {
+	struct fouNode *nd = malloc(sizeof(struct fouNode));
+	if (nd == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	nd->refs = 1;
+	nd->leaf = leaf;
+	nd->n = 0;
+	nd->length = 0;
+	nd->count = 0;
+	return nd;
+}
+
+static void fouNodeRelease(struct fouNode *nd) {
+	if (__atomic_sub_fetch(&nd->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+	if (!nd->leaf) {
+		for (size_t i = 0; i < nd->n; i++) {
+			fouNodeRelease(nd->u.kid[i]);
+		}
+	}
+	free(nd);
+}
+
+static void fouNodeSum(struct fouNode *nd) {
+	nd->length = 0;
+	nd->count = 0;
+	for (size_t i = 0; i < nd->n; i++) {
+		if (nd->leaf) {
+			nd->length += nd->u.p[i].length;
+			nd->count++;
+		} else {
+			nd->length += nd->u.kid[i]->length;
+			nd->count += nd->u.kid[i]->count;
+		}
+	}
+}
+
+/* Makes the node *np points to safe to change, copying it first if a
+ * snapshot shares it; the copy shares the children instead. */
+static struct fouNode *fouOwn(struct fouNode **np) {
+	struct fouNode *nd = *np;
+	if (__atomic_load_n(&nd->refs, __ATOMIC_ACQUIRE) == 1) return nd;
+	struct fouNode *copy = malloc(sizeof(struct fouNode));
+	if (copy == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(copy, nd, sizeof(struct fouNode));
+	copy->refs = 1;
+	if (!copy->leaf) {
+		for (size_t i = 0; i < copy->n; i++) {
+			__atomic_add_fetch(&copy->u.kid[i]->refs, 1, __ATOMIC_ACQ_REL);
+		}
+	}
+	fouNodeRelease(nd);
+	*np = copy;
+	return copy;
+}
+
+/* Moves the back half of child i of nd, which is full, into a new sibling;
+ * nd must have room for it. */
+static int fouNodeSplit(struct fouNode *nd, size_t i) {
+	struct fouNode *kid = fouOwn(&nd->u.kid[i]);
+	if (kid == NULL) return -1;
+	struct fouNode *sib = fouNodeNew(kid->leaf);
+	if (sib == NULL) return -1;
+	size_t half = kid->n / 2;
+	sib->n = kid->n - half;
+	if (kid->leaf) memcpy(sib->u.p, &kid->u.p[half], sizeof(struct fouPiece) * sib->n);
+	else memcpy(sib->u.kid, &kid->u.kid[half], sizeof(struct fouNode *) * sib->n);
+	kid->n = half;
+	fouNodeSum(kid);
+	fouNodeSum(sib);
+	memmove(&nd->u.kid[i + 2], &nd->u.kid[i + 1], sizeof(struct fouNode *) * (nd->n - i - 1));
+	nd->u.kid[i + 1] = sib;
+	nd->n++;
+	return 0;
+}
+
+/* Builds a tree over n pieces with every node half full, leaving room for
+ * edits everywhere. */
+static struct fouNode *fouBuild(const struct fouPiece *p, size_t n) {
+	size_t fill = FOU_FANOUT / 2;
+	size_t count = n > 0 ? (n + fill - 1) / fill : 1;
+	struct fouNode **level = malloc(sizeof(struct fouNode *) * count);
+	if (level == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (size_t j = 0; j < count; j++) {
+		if ((level[j] = fouNodeNew(1)) == NULL) {
+			while (j > 0) fouNodeRelease(level[--j]);
+			free(level);
+			return NULL;
+		}
+		level[j]->n = n - j * fill < fill ? n - j * fill : fill;
+		memcpy(level[j]->u.p, &p[j * fill], sizeof(struct fouPiece) * level[j]->n);
+		fouNodeSum(level[j]);
+	}
+	while (count > 1) {
+		size_t up = (count + fill - 1) / fill;
+		for (size_t j = 0; j < up; j++) {
+			struct fouNode *nd = fouNodeNew(0);
+			if (nd == NULL) {
+				for (size_t k = 0; k < j; k++) fouNodeRelease(level[k]);
+				for (size_t k = j * fill; k < count; k++) fouNodeRelease(level[k]);
+				free(level);
+				return NULL;
+			}
+			nd->n = count - j * fill < fill ? count - j * fill : fill;
+			memcpy(nd->u.kid, &level[j * fill], sizeof(struct fouNode *) * nd->n);
+			fouNodeSum(nd);
+			level[j] = nd;
+		}
+		count = up;
+	}
+	struct fouNode *root = level[0];
+	free(level);
+	return root;
+}
+
+/* A position in the tree: the path down to a piece and the offset where
+ * the piece starts. p is NULL past the last piece. */
+struct fouCursor {
+	const struct fouNode *nd[FOU_DEPTH];
+	size_t i[FOU_DEPTH];
+	int depth;
+	size_t base;
+	const struct fouPiece *p;
+};
+
+/* Puts the cursor on the piece holding offset at. */
+static void fouSeek(const struct fouNode *root, size_t at, struct fouCursor *cu) {
+	const struct fouNode *nd = root;
+	cu->base = 0;
+	for (int d = 0;; d++) {
+		size_t i = 0;
+		cu->nd[d] = nd;
+		if (nd->leaf) {
+			while (i < nd->n && at >= cu->base + nd->u.p[i].length) {
+				cu->base += nd->u.p[i].length;
+				i++;
+			}
+			cu->i[d] = i;
+			cu->depth = d;
+			cu->p = i < nd->n ? &nd->u.p[i] : NULL;
+			return;
+		}
+		while (i + 1 < nd->n && at >= cu->base + nd->u.kid[i]->length) {
+			cu->base += nd->u.kid[i]->length;
+			i++;
+		}
+		cu->i[d] = i;
+		nd = nd->u.kid[i];
+	}
+}
+
+static const struct fouPiece *fouNext(struct fouCursor *cu) {
+	if (cu->p == NULL) return NULL;
+	cu->base += cu->p->length;
+	int d = cu->depth;
+	if (++cu->i[d] < cu->nd[d]->n) return cu->p = &cu->nd[d]->u.p[cu->i[d]];
+	do {
+		if (--d < 0) return cu->p = NULL;
+	} while (++cu->i[d] == cu->nd[d]->n);
+	for (; d < cu->depth; d++) {
+		cu->nd[d + 1] = cu->nd[d]->u.kid[cu->i[d]];
+		cu->i[d + 1] = 0;
+	}
+	return cu->p = &cu->nd[d]->u.p[0];
+}
+
+static int fouHeight(const struct fouNode *nd) {
+	int h = 1;
+	for (; !nd->leaf; nd = nd->u.kid[0]) h++;
+	return h;
+}
+
+/* Gives the root room for one more child, adding a level when it is full.
+ * Deletes never merge nodes, so a tree that has grown as deep as a cursor
+ * can follow is rebuilt instead. */
+static int fouRootRoom(fouDocument *doc) {
+	if (doc->root->n < FOU_FANOUT) return 0;
+	if (fouHeight(doc->root) + 1 >= FOU_DEPTH) {
+		struct fouPiece *p = malloc(sizeof(struct fouPiece) * doc->root->count);
+		if (p == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		size_t n = 0;
+		struct fouCursor cu;
+		for (fouSeek(doc->root, 0, &cu); cu.p; fouNext(&cu)) p[n++] = *cu.p;
+		struct fouNode *root = fouBuild(p, n);
+		free(p);
+		if (root == NULL) return -1;
+		fouNodeRelease(doc->root);
+		doc->root = root;
+		return 0;
+	}
+	struct fouNode *root = fouNodeNew(0);
+	if (root == NULL) return -1;
+	root->n = 1;
+	root->u.kid[0] = doc->root;
+	fouNodeSum(root);
+	doc->root = root;
+	return fouNodeSplit(root, 0);
+}
+
+/* Walks down to offset at, copying shared nodes and splitting full ones on
+ * the way so the leaf has room for one more piece; an offset between two
+ * children goes to the end of the first. Fills path with the nodes passed,
+ * leaf last, leaves at relative to the leaf and returns the depth. */
+static int fouDescend(fouDocument *doc, size_t *at, struct fouNode **path) {
+	if (fouRootRoom(doc) == -1) return -1;
+	struct fouNode **np = &doc->root;
+	int d = 0;
+	for (;;) {
+		struct fouNode *nd = fouOwn(np);
+		if (nd == NULL) return -1;
+		path[d++] = nd;
+		if (nd->leaf) return d;
+		size_t i = 0;
+		while (i + 1 < nd->n && *at > nd->u.kid[i]->length) {
+			*at -= nd->u.kid[i]->length;
+			i++;
+		}
+		if (nd->u.kid[i]->n == FOU_FANOUT) {
+			if (fouNodeSplit(nd, i) == -1) return -1;
+			if (*at > nd->u.kid[i]->length) {
+				*at -= nd->u.kid[i]->length;
+				i++;
+			}
+		}
+		np = &nd->u.kid[i];
+	}
+}
+
+static void fouAscend(struct fouNode **path, int d) {
+	while (d > 0) fouNodeSum(path[--d]);
+}
+
+/* Makes a piece boundary at offset at. */
+static int fouSplit(fouDocument *doc, size_t at) {
+	struct fouCursor cu;
+	fouSeek(doc->root, at, &cu);
+	if (cu.p == NULL || cu.base == at) return 0;
+	struct fouNode *path[FOU_DEPTH];
+	int d = fouDescend(doc, &at, path);
+	if (d == -1) return -1;
+	struct fouNode *leaf = path[d - 1];
+	size_t i = 0;
+	while (at >= leaf->u.p[i].length) at -= leaf->u.p[i++].length;
+	memmove(&leaf->u.p[i + 1], &leaf->u.p[i], sizeof(struct fouPiece) * (leaf->n - i));
+	leaf->u.p[i + 1].start += at;
+	leaf->u.p[i + 1].length -= at;
+	leaf->u.p[i].length = at;
+	leaf->n++;
+	fouAscend(path, d);
+	return 0;
+}
+
+/* Removes the text between a and b, both piece boundaries, from the tree
+ * under *np. Children it empties are dropped, never merged. */
+static int fouCutRange(struct fouNode **np, size_t a, size_t b) {
+	struct fouNode *nd = fouOwn(np);
+	if (nd == NULL) return -1;
+	int ret = 0;
+	size_t base = 0;
+	size_t keep = 0;
+	for (size_t i = 0; i < nd->n; i++) {
+		size_t len = nd->leaf ? nd->u.p[i].length : nd->u.kid[i]->length;
+		if (base >= a && base + len <= b) {
+			if (!nd->leaf) fouNodeRelease(nd->u.kid[i]);
+			base += len;
+			continue;
+		}
+		if (nd->leaf) {
+			nd->u.p[keep++] = nd->u.p[i];
+		} else {
+			if (base < b && base + len > a) {
+				size_t lo = a > base ? a - base : 0;
+				size_t hi = b - base < len ? b - base : len;
+				if (fouCutRange(&nd->u.kid[i], lo, hi) == -1) ret = -1;
+			}
+			nd->u.kid[keep++] = nd->u.kid[i];
+		}
+		base += len;
+	}
+	nd->n = keep;
+	fouNodeSum(nd);
+	return ret;
+}
+
+/*** store ***/
+
+static void fouStoreRelease(struct fouStore *st) {
+	if (__atomic_sub_fetch(&st->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+	free(st->original);
+	for (size_t i = 0; i < st->nblocks; i++) {
+		free(st->blocks[i].data);
+	}
+	free(st->blocks);
+	free(st);
+}
+
+static fouDocument *fouDocumentNew(struct fouStore *st) {
+	fouDocument *doc = calloc(1, sizeof(fouDocument));
+	if (doc == NULL) return NULL;
+	doc->store = st;
+	doc->ndata = st->nblocks + 1;
+	doc->data = malloc(sizeof(char *) * doc->ndata);
+	if (doc->data == NULL) {
+		free(doc);
+		return NULL;
+	}
+	doc->data[0] = st->original;
+	for (size_t i = 0; i < st->nblocks; i++) {
+		doc->data[i + 1] = st->blocks[i].data;
+	}
+	return doc;
+}
+
+static fouDocument *fouOpenStore(struct fouStore *st) {
+	st->refs = 1;
+	fouDocument *doc = fouDocumentNew(st);
+	if (doc == NULL) {
+		fouStoreRelease(st);
+		errno = ENOMEM;
+		return NULL;
+	}
+	struct fouPiece whole = {0, st->original_len, 0};
+	doc->root = fouBuild(&whole, st->original_len > 0);
+	if (doc->root == NULL) {
+		fouClose(doc);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return doc;
+}
+
+/*** open and close ***/
+
+/* The whole file is read into the store. A mapping would change under the
+ * document, or fault, when another program rewrote the file in place. */
+fouDocument *fouOpen(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	struct fouStore *store = calloc(1, sizeof(struct fouStore));
+	if (store == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* one spare byte, so a regular file that has not grown ends in one read */
+	size_t cap = S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size + 1 : 0;
+	if (cap > 0 && (store->original = malloc(cap)) == NULL) {
+		close(fd);
+		free(store);
+		errno = ENOMEM;
+		return NULL;
+	}
+	ssize_t n;
+	for (;;) {
+		if (store->original_len == cap) {
+			cap = cap ? cap * 2 : FOU_ADD_BLOCK;
+			char *grown = realloc(store->original, cap);
+			if (grown == NULL) {
+				n = -1;
+				errno = ENOMEM;
+				break;
+			}
+			store->original = grown;
+		}
+		n = read(fd, store->original + store->original_len, cap - store->original_len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		store->original_len += n;
+	}
+	if (n == -1) {
+		int err = errno;
+		close(fd);
+		free(store->original);
+		free(store);
+		errno = err;
+		return NULL;
+	}
+	close(fd);
+	return fouOpenStore(store);
+}
+
+fouDocument *fouOpenMemory(const char *data, size_t len) {
+	struct fouStore *store = calloc(1, sizeof(struct fouStore));
+	if (store == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	store->original = malloc(len > 0 ? len : 1);
+	if (store->original == NULL) {
+		free(store);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(store->original, data, len);
+	store->original_len = len;
+	return fouOpenStore(store);
+}
+
+void fouClose(fouDocument *doc) {
+	if (doc == NULL) return;
+	fouStoreRelease(doc->store);
+	if (doc->root != NULL) fouNodeRelease(doc->root);
+	free(doc->data);
+	free(doc);
+}
+
+/*** pieces ***/
+
+size_t fouLength(const fouDocument *doc) {
+	return doc->root->length;
+}
+
+/* Copies text into the add blocks; a block is only started when the current
+ * one is full, and text larger than a block gets a block of its own. */
+static int fouAppend(fouDocument *doc, const char *s, size_t len, int *buf, size_t *start) {
+	struct fouStore *st = doc->store;
+	struct fouBlock *last = st->nblocks ? &st->blocks[st->nblocks - 1] : NULL;
+	if (last == NULL || last->cap - last->len < len) {
+		if (st->nblocks == st->cap) {
+			size_t cap = st->cap ? st->cap * 2 : 16;
+			struct fouBlock *blocks = realloc(st->blocks, sizeof(struct fouBlock) * cap);
+			if (blocks == NULL) goto nomem;
+			st->blocks = blocks;
+			st->cap = cap;
+		}
+		char **data = realloc(doc->data, sizeof(char *) * (doc->ndata + 1));
+		if (data == NULL) goto nomem;
+		doc->data = data;
+		last = &st->blocks[st->nblocks];
+		last->cap = len > FOU_ADD_BLOCK ? len : FOU_ADD_BLOCK;
+		last->len = 0;
+		last->data = malloc(last->cap);
+		if (last->data == NULL) goto nomem;
+		doc->data[doc->ndata++] = last->data;
+		st->nblocks++;
+	}
+	memcpy(last->data + last->len, s, len);
+	*buf = st->nblocks;
+	*start = last->len;
+	last->len += len;
+	return 0;
+
+nomem:
+	errno = ENOMEM;
+	return -1;
+}
+
+int fouInsert(fouDocument *doc, size_t at, const char *s, size_t len) {
+	if (doc->readonly) {
+		errno = EROFS;
+		return -1;
+	}
+	if (at > fouLength(doc)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len == 0) return 0;
+
+	int buf;
+	size_t start;
+	if (fouAppend(doc, s, len, &buf, &start) == -1) return -1;
+	if (fouSplit(doc, at) == -1) return -1;
+	struct fouCursor cu;
+	if (at > 0) fouSeek(doc->root, at - 1, &cu);
+	int extend = at > 0 && cu.p->buf == buf && cu.p->start + cu.p->length == start;
+	struct fouNode *path[FOU_DEPTH];
+	int d = fouDescend(doc, &at, path);
+	if (d == -1) return -1;
+	struct fouNode *leaf = path[d - 1];
+	size_t i = 0;
+	while (i < leaf->n && at >= leaf->u.p[i].length) at -= leaf->u.p[i++].length;
+	if (extend) {
+		leaf->u.p[i - 1].length += len;
+	} else {
+		memmove(&leaf->u.p[i + 1], &leaf->u.p[i], sizeof(struct fouPiece) * (leaf->n - i));
+		leaf->u.p[i].start = start;
+		leaf->u.p[i].length = len;
+		leaf->u.p[i].buf = buf;
+		leaf->n++;
+	}
+	fouAscend(path, d);
+	return 0;
+}
+
+int fouDelete(fouDocument *doc, size_t at, size_t len) {
+	if (doc->readonly) {
+		errno = EROFS;
+		return -1;
+	}
+	size_t length = fouLength(doc);
+	if (at > length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > length - at) len = length - at;
+	if (len == 0) return 0;
+
+	if (fouSplit(doc, at) == -1 || fouSplit(doc, at + len) == -1) return -1;
+	int ret = fouCutRange(&doc->root, at, at + len);
+	/* drop levels left with a single child */
+	struct fouNode *root = doc->root;
+	while (!root->leaf && root->n == 1 && __atomic_load_n(&root->refs, __ATOMIC_ACQUIRE) == 1) {
+		doc->root = root->u.kid[0];
+		root->n = 0;
+		fouNodeRelease(root);
+		root = doc->root;
+	}
+	if (!root->leaf && root->n == 0) root->leaf = 1;
+	return ret;
+}
+
+/*** search ***/
+
+static int fouMatchAt(const fouDocument *doc, const struct fouCursor *at, size_t off, const char *needle, size_t nlen) {
+	const struct fouPiece *p = at->p;
+	struct fouCursor cu;
+	int moved = 0;
+	for (size_t j = 0; j < nlen; j++) {
+		while (off == p->length) {
+			if (!moved) {
+				cu = *at;
+				moved = 1;
+			}
+			if ((p = fouNext(&cu)) == NULL) return 0;
+			off = 0;
+		}
+		if (doc->data[p->buf][p->start + off] != needle[j]) return 0;
+		off++;
+	}
+	return 1;
+}
+
+/* Calls emit for every match starting at or after from, in order, until it
+ * returns 0; matches may run across piece boundaries. */
+static void fouSearchEach(const fouDocument *doc, size_t from, const char *needle, size_t nlen,
+		int (*emit)(void *arg, size_t pos), void *arg) {
+	struct fouCursor cu;
+	for (fouSeek(doc->root, from, &cu); cu.p; fouNext(&cu)) {
+		const char *b = doc->data[cu.p->buf] + cu.p->start;
+		size_t len = cu.p->length;
+		size_t off = from > cu.base ? from - cu.base : 0;
+		while (off < len) {
+			const char *hit = memchr(b + off, needle[0], len - off);
+			if (hit == NULL) break;
+			off = hit - b;
+			if (fouMatchAt(doc, &cu, off, needle, nlen) && !emit(arg, cu.base + off)) return;
+			off++;
+		}
+	}
+}
+
+static int fouEmitFirst(void *arg, size_t pos) {
+	*(size_t *)arg = pos;
+	return 0;
+}
+
+int fouSearch(const fouDocument *doc, size_t from, const char *needle, size_t nlen, size_t *pos) {
+	if (nlen == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	size_t found = (size_t)-1;
+	fouSearchEach(doc, from, needle, nlen, fouEmitFirst, &found);
+	if (found == (size_t)-1) return 0;
+	*pos = found;
+	return 1;
+}
+
+struct fouMatches {
+	size_t *pos;
+	size_t count;
+	size_t cap;
+	size_t nlen;
+	size_t next;
+	int failed;
+};
+
+static int fouEmitNonOverlapping(void *arg, size_t pos) {
+	struct fouMatches *m = arg;
+	if (pos < m->next) return 1;
+	if (m->count == m->cap) {
+		m->cap = m->cap ? m->cap * 2 : 64;
+		size_t *grown = realloc(m->pos, sizeof(size_t) * m->cap);
+		if (grown == NULL) {
+			m->failed = 1;
+			return 0;
+		}
+		m->pos = grown;
+	}
+	m->pos[m->count++] = pos;
+	m->next = pos + m->nlen;
+	return 1;
+}
+
+static int fouPush(struct fouPiece **p, size_t *n, size_t *cap, size_t start, size_t length, int buf) {
+	if (length == 0) return 0;
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 16;
+		struct fouPiece *grown = realloc(*p, sizeof(struct fouPiece) * *cap);
+		if (grown == NULL) return -1;
+		*p = grown;
+	}
+	(*p)[*n].start = start;
+	(*p)[*n].length = length;
+	(*p)[*n].buf = buf;
+	*n += 1;
+	return 0;
+}
+
+/* Finds every non-overlapping match in one pass, stores the replacement once
+ * and rebuilds the piece list in a single linear sweep. */
+long fouReplaceAll(fouDocument *doc, const char *needle, size_t nlen, const char *with, size_t wlen) {
+	if (doc->readonly) {
+		errno = EROFS;
+		return -1;
+	}
+	if (nlen == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct fouMatches m = {NULL, 0, 0, nlen, 0, 0};
+	fouSearchEach(doc, 0, needle, nlen, fouEmitNonOverlapping, &m);
+	if (m.failed) goto nomem;
+	if (m.count == 0) return 0;
+
+	int wbuf = 0;
+	size_t wstart = 0;
+	if (wlen > 0 && fouAppend(doc, with, wlen, &wbuf, &wstart) == -1) goto nomem;
+
+	struct fouPiece *p = NULL;
+	size_t n = 0;
+	size_t cap = 0;
+	size_t keep = 0;
+	struct fouCursor cu;
+	fouSeek(doc->root, 0, &cu);
+	for (size_t i = 0; i <= m.count; i++) {
+		size_t until = i < m.count ? m.pos[i] : fouLength(doc);
+		while (cu.p && keep < until) {
+			size_t plen = cu.p->length;
+			if (cu.base + plen <= keep) {
+				fouNext(&cu);
+				continue;
+			}
+			size_t lo = keep - cu.base;
+			size_t hi = until - cu.base < plen ? until - cu.base : plen;
+			if (fouPush(&p, &n, &cap, cu.p->start + lo, hi - lo, cu.p->buf) == -1) goto nomem_pieces;
+			keep = cu.base + hi;
+		}
+		if (i < m.count) {
+			if (fouPush(&p, &n, &cap, wstart, wlen, wbuf) == -1) goto nomem_pieces;
+			keep = m.pos[i] + nlen;
+		}
+	}
+
+	struct fouNode *root = fouBuild(p, n);
+	if (root == NULL) goto nomem_pieces;
+	fouNodeRelease(doc->root);
+	doc->root = root;
+	free(p);
+	free(m.pos);
+	return m.count;
+
+nomem_pieces:
+	free(p);
+nomem:
+	free(m.pos);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*** snapshots ***/
+
+fouDocument *fouSnapshot(const fouDocument *doc) {
+	__atomic_add_fetch(&doc->store->refs, 1, __ATOMIC_ACQ_REL);
+	fouDocument *snap = calloc(1, sizeof(fouDocument));
+	if (snap == NULL) goto nomem;
+	snap->store = doc->store;
+	snap->readonly = 1;
+	snap->ndata = doc->ndata;
+	snap->data = malloc(sizeof(char *) * doc->ndata);
+	if (snap->data == NULL) {
+		free(snap);
+		goto nomem;
+	}
+	memcpy(snap->data, doc->data, sizeof(char *) * doc->ndata);
+	__atomic_add_fetch(&doc->root->refs, 1, __ATOMIC_ACQ_REL);
+	snap->root = doc->root;
+	return snap;
+
+nomem:
+	fouStoreRelease(doc->store);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/* Puts doc back to the text of a snapshot taken from it; since the add
+ * blocks only grow, this is all an undo needs. */
+int fouRestore(fouDocument *doc, const fouDocument *snap) {
+	if (doc->readonly) {
+		errno = EROFS;
+		return -1;
+	}
+	if (snap->store != doc->store) {
+		errno = EINVAL;
+		return -1;
+	}
+	__atomic_add_fetch(&snap->root->refs, 1, __ATOMIC_ACQ_REL);
+	fouNodeRelease(doc->root);
+	doc->root = snap->root;
+	return 0;
+}
+
+/*** reading ***/
+
+int fouIterate(const fouDocument *doc, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	size_t length = fouLength(doc);
+	if (at > length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > length - at) len = length - at;
+	size_t end = at + len;
+	struct fouCursor cu;
+	for (fouSeek(doc->root, at, &cu); cu.p && cu.base < end; fouNext(&cu)) {
+		size_t plen = cu.p->length;
+		size_t lo = at > cu.base ? at - cu.base : 0;
+		size_t hi = end - cu.base < plen ? end - cu.base : plen;
+		if (fn(arg, doc->data[cu.p->buf] + cu.p->start + lo, hi - lo)) return 1;
+	}
+	return 0;
+}
+
+struct fouReadBuf {
+	char *buf;
+	size_t len;
+};
+
+static int fouReadSpan(void *arg, const char *data, size_t len) {
+	struct fouReadBuf *rb = arg;
+	memcpy(rb->buf + rb->len, data, len);
+	rb->len += len;
+	return 0;
+}
+
+size_t fouRead(const fouDocument *doc, size_t at, char *buf, size_t len) {
+	struct fouReadBuf rb = {buf, 0};
+	if (fouIterate(doc, at, len, fouReadSpan, &rb) == -1) return 0;
+	return rb.len;
+}
+
+static int fouWriteSpan(void *arg, const char *data, size_t len) {
+	return fwrite(data, 1, len, arg) != len;
+}
+
+/* Streams the pieces out; the text is never assembled in memory. */
+int fouWrite(const fouDocument *doc, FILE *fp) {
+	if (fouIterate(doc, 0, fouLength(doc), fouWriteSpan, fp) != 0) {
+		if (errno == 0) errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+int fouSave(const fouDocument *doc, const char *path) {
+	char *tmp = malloc(strlen(path) + 5);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	FILE *fp = fopen(tmp, "w");
+	int ok = fp != NULL && fouWrite(doc, fp) == 0 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	int err = errno;
+	if (fp != NULL && fclose(fp) != 0 && ok) {
+		ok = 0;
+		err = errno;
+	}
+	if (ok && rename(tmp, path) == -1) {
+		ok = 0;
+		err = errno;
+	}
+	if (!ok) unlink(tmp);
+	free(tmp);
+	errno = err;
+	return ok ? 0 : -1;
+}
+
+size_t fouPieceCount(const fouDocument *doc) {
+	return doc->root->count;
+}
+
+int fouPieceInfo(const fouDocument *doc, size_t i, size_t *start, size_t *length, enum fouBuffer *buffer) {
+	if (i >= doc->root->count) {
+		errno = EINVAL;
+		return -1;
+	}
+	const struct fouNode *nd = doc->root;
+	while (!nd->leaf) {
+		size_t k = 0;
+		while (i >= nd->u.kid[k]->count) i -= nd->u.kid[k++]->count;
+		nd = nd->u.kid[k];
+	}
+	*start = nd->u.p[i].start;
+	*length = nd->u.p[i].length;
+	*buffer = nd->u.p[i].buf == 0 ? FOU_ORIGINAL : FOU_ADD;
+	return 0;
+}
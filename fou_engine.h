@@ -0,0 +1,56 @@
+#ifndef FOU_ENGINE_H
+#define FOU_ENGINE_H
+
+/*
+ * The piece-table editing engine as a library.
+ *
+ * A fouDocument owns its pieces and buffers outright, so any number of them
+ * can be used at once, from different threads, as long as each one is only
+ * touched by one thread at a time. A snapshot is a read-only document that
+ * shares its text and its piece tree with the one it was taken from: it
+ * costs one reference, the original copies only the nodes it edits after,
+ * and it stays readable from another thread while the original keeps being
+ * edited.
+ *
+ * fouOpen reads the whole file, so a document never sees later changes to
+ * it, in place or otherwise. Offsets and lengths are in bytes. Calls that can
+ * fail return -1 (or NULL) and set errno.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define FOU_ENGINE_VERSION 1
+
+typedef struct fouDocument fouDocument;
+
+enum fouBuffer {
+	FOU_ORIGINAL = 0,
+	FOU_ADD = 1
+};
+
+/* Receives consecutive spans of text; returning non-zero stops the walk. */
+typedef int (*fouSpanFn)(void *arg, const char *data, size_t len);
+
+fouDocument *fouOpen(const char *path);
+fouDocument *fouOpenMemory(const char *data, size_t len);
+void fouClose(fouDocument *doc);
+
+size_t fouLength(const fouDocument *doc);
+int fouInsert(fouDocument *doc, size_t at, const char *s, size_t len);
+int fouDelete(fouDocument *doc, size_t at, size_t len);
+long fouReplaceAll(fouDocument *doc, const char *needle, size_t nlen, const char *with, size_t wlen);
+
+fouDocument *fouSnapshot(const fouDocument *doc);
+int fouRestore(fouDocument *doc, const fouDocument *snap);
+
+int fouIterate(const fouDocument *doc, size_t at, size_t len, fouSpanFn fn, void *arg);
+size_t fouRead(const fouDocument *doc, size_t at, char *buf, size_t len);
+int fouSearch(const fouDocument *doc, size_t from, const char *needle, size_t nlen, size_t *pos);
+int fouWrite(const fouDocument *doc, FILE *fp);
+int fouSave(const fouDocument *doc, const char *path);
+
+size_t fouPieceCount(const fouDocument *doc);
+int fouPieceInfo(const fouDocument *doc, size_t i, size_t *start, size_t *length, enum fouBuffer *buffer);
+
+#endif
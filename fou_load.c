@@ -0,0 +1,257 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*** defines ***/
+
+#define LOAD_READ_LEN 256
+#define LOAD_INSERT "loadtest"
+
+/*
+ * Load generator for fou_server: every client opens the same document and
+ * keeps up to DEPTH requests in flight on its own connection, mixing reads
+ * of LOAD_READ_LEN bytes, short searches and inserts.
+ *
+ *   fou_load [-c clients] [-n requests] [-d depth] [-w write%] socket file
+ */
+
+/*** data ***/
+
+enum loadKind {
+	LOAD_READ,
+	LOAD_SEARCH,
+	LOAD_WRITE
+};
+
+struct loadClient {
+	pthread_t thread;
+	unsigned int seed;
+	long errors;
+	double *lat;
+	long nlat;
+};
+
+struct loadConfig {
+	const char *socket;
+	const char *file;
+	int clients;
+	long requests;
+	int depth;
+	int writes;
+} L = {NULL, NULL, 8, 10000, 16, 10};
+
+/*** util ***/
+
+void die(const char *s) {
+	perror(s);
+	exit(1);
+}
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int connectTo(const char *path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) die("socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) die("connect");
+	return fd;
+}
+
+void writeAll(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			die("write");
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/*** replies ***/
+
+struct inbuf {
+	int fd;
+	char *b;
+	size_t len;
+	size_t cap;
+};
+
+void inFill(struct inbuf *in) {
+	if (in->cap - in->len < 65536) {
+		in->cap = in->cap ? in->cap * 2 : 131072;
+		in->b = realloc(in->b, in->cap);
+		if (in->b == NULL) die("realloc");
+	}
+	ssize_t n = read(in->fd, in->b + in->len, in->cap - in->len);
+	if (n == -1 && errno == EINTR) return;
+	if (n <= 0) {
+		fprintf(stderr, "server closed the connection\n");
+		exit(1);
+	}
+	in->len += n;
+}
+
+/* Consumes one reply if it is complete: the status line, plus the payload
+ * that follows a successful read. Returns 1 for ok, 0 for err, -1 if more
+ * input is needed. */
+int inReply(struct inbuf *in, int kind) {
+	if (in->len == 0) return -1;
+	char *nl = memchr(in->b, '\n', in->len);
+	if (nl == NULL) return -1;
+	size_t used = nl - in->b + 1;
+	int ok = in->len >= 3 && memcmp(in->b, "ok", 2) == 0;
+	long v = ok ? strtol(in->b + 3, NULL, 10) : 0;
+	if (ok && kind == LOAD_READ) {
+		if (in->len - used < (size_t)v) return -1;
+		used += v;
+	}
+	memmove(in->b, in->b + used, in->len - used);
+	in->len -= used;
+	return ok;
+}
+
+/*** clients ***/
+
+void *clientThread(void *arg) {
+	struct loadClient *lc = arg;
+	int fd = connectTo(L.socket);
+	struct inbuf in = {fd, NULL, 0, 0};
+
+	char line[4096];
+	int n = snprintf(line, sizeof(line), "open %s\n", L.file);
+	writeAll(fd, line, n);
+	while (in.len == 0 || memchr(in.b, '\n', in.len) == NULL) inFill(&in);
+	long id;
+	size_t length;
+	if (sscanf(in.b, "ok %ld %zu", &id, &length) != 2) {
+		fprintf(stderr, "open failed: %.*s", (int)in.len, in.b);
+		exit(1);
+	}
+	inReply(&in, LOAD_WRITE);
+
+	int *kinds = malloc(sizeof(int) * L.depth);
+	double *sent_at = malloc(sizeof(double) * L.depth);
+	lc->lat = malloc(sizeof(double) * L.requests);
+	if (kinds == NULL || sent_at == NULL || lc->lat == NULL) die("malloc");
+	char *out = malloc((size_t)L.depth * 128);
+	if (out == NULL) die("malloc");
+
+	long sent = 0;
+	long done = 0;
+	while (done < L.requests) {
+		size_t outlen = 0;
+		while (sent < L.requests && sent - done < L.depth) {
+			int roll = rand_r(&lc->seed) % 100;
+			size_t off = length ? rand_r(&lc->seed) % length : 0;
+			int kind = roll < L.writes ? LOAD_WRITE : roll < L.writes + 5 ? LOAD_SEARCH : LOAD_READ;
+			if (kind == LOAD_WRITE) {
+				outlen += sprintf(out + outlen, "insert %ld %zu %zu\n%s", id, off, strlen(LOAD_INSERT), LOAD_INSERT);
+			} else if (kind == LOAD_SEARCH) {
+				outlen += sprintf(out + outlen, "search %ld %zu 4\nfou\n", id, off);
+			} else {
+				outlen += sprintf(out + outlen, "read %ld %zu %d\n", id, off, LOAD_READ_LEN);
+			}
+			kinds[sent % L.depth] = kind;
+			sent_at[sent % L.depth] = now();
+			sent++;
+		}
+		writeAll(fd, out, outlen);
+
+		long before = done;
+		while (1) {
+			int r;
+			while (done < sent && (r = inReply(&in, kinds[done % L.depth])) != -1) {
+				if (r == 0) lc->errors++;
+				lc->lat[lc->nlat++] = now() - sent_at[done % L.depth];
+				done++;
+			}
+			if (done > before) break;
+			inFill(&in);
+		}
+	}
+
+	close(fd);
+	free(in.b);
+	free(out);
+	free(kinds);
+	free(sent_at);
+	return NULL;
+}
+
+int cmpDouble(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:d:w:")) != -1) {
+		switch (opt) {
+			case 'c': L.clients = atoi(optarg); break;
+			case 'n': L.requests = atol(optarg); break;
+			case 'd': L.depth = atoi(optarg); break;
+			case 'w': L.writes = atoi(optarg); break;
+			default: goto usage;
+		}
+	}
+	if (optind != argc - 2 || L.clients < 1 || L.requests < 1 || L.depth < 1) goto usage;
+	L.socket = argv[optind];
+	L.file = argv[optind + 1];
+
+	struct loadClient *lc = calloc(L.clients, sizeof(struct loadClient));
+	if (lc == NULL) die("calloc");
+	double t0 = now();
+	for (int i = 0; i < L.clients; i++) {
+		lc[i].seed = i + 1;
+		if (pthread_create(&lc[i].thread, NULL, clientThread, &lc[i]) != 0) die("pthread_create");
+	}
+	long errors = 0;
+	long total = 0;
+	for (int i = 0; i < L.clients; i++) {
+		pthread_join(lc[i].thread, NULL);
+		errors += lc[i].errors;
+		total += lc[i].nlat;
+	}
+	double secs = now() - t0;
+
+	double *lat = malloc(sizeof(double) * total);
+	if (lat == NULL) die("malloc");
+	long k = 0;
+	for (int i = 0; i < L.clients; i++) {
+		memcpy(lat + k, lc[i].lat, sizeof(double) * lc[i].nlat);
+		k += lc[i].nlat;
+		free(lc[i].lat);
+	}
+	qsort(lat, total, sizeof(double), cmpDouble);
+	printf("%d clients x %ld requests, depth %d, %d%% writes\n", L.clients, L.requests, L.depth, L.writes);
+	printf("%.0f req/s, p50 %.0fus, p99 %.0fus, max %.0fus, %ld errors\n",
+			total / secs, lat[total / 2] * 1e6, lat[total * 99 / 100] * 1e6, lat[total - 1] * 1e6, errors);
+	free(lat);
+	free(lc);
+	return errors != 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-c clients] [-n requests] [-d depth] [-w write%%] socket file\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,693 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fou_engine.h"
+
+/*** defines ***/
+
+#define SERVER_MAX_CLIENTS 1024
+#define SERVER_MAX_DOCS 256
+#define SERVER_MAX_READERS 64
+#define SERVER_MAX_PAYLOAD (64 * 1024 * 1024)
+#define SERVER_MAX_INFLIGHT 4096
+#define SERVER_OUT_HIGH (4 * 1024 * 1024)
+#define SERVER_READ_CHUNK (64 * 1024)
+
+/*
+ * Protocol: one request per line, answered in order on the same connection.
+ * Clients may send any number of requests without waiting for replies.
+ *
+ *   open PATH             ok ID LENGTH
+ *   length ID             ok LENGTH
+ *   read ID OFF LEN       ok N, then N bytes
+ *   search ID FROM N      N bytes of needle follow the line; ok POS or ok -1
+ *   insert ID OFF N       N bytes of text follow the line; ok LENGTH
+ *   delete ID OFF LEN     ok LENGTH
+ *   save ID [PATH]        ok
+ *
+ * Failures answer "err MESSAGE". Edits run one at a time on the writer
+ * thread; reads run on a pool of readers against the snapshot that was
+ * current when they were dispatched, and never wait for the writer.
+ */
+enum requestKind {
+	REQ_ERROR,
+	REQ_OPEN,
+	REQ_LENGTH,
+	REQ_READ,
+	REQ_SEARCH,
+	REQ_INSERT,
+	REQ_DELETE,
+	REQ_SAVE
+};
+
+/*** data ***/
+
+struct serverSnap {
+	fouDocument *doc;
+	int refs;
+};
+
+struct serverDoc {
+	char *path;
+	fouDocument *doc;
+	struct serverSnap *snap;
+};
+
+struct client;
+
+struct request {
+	struct client *c;
+	int kind;
+	int doc;
+	size_t a;
+	size_t b;
+	char *data;
+	size_t len;
+	struct serverSnap *snap;
+	char *reply;
+	size_t reply_len;
+	int dispatched;
+	int done;
+	struct request *next;
+	struct request *qnext;
+};
+
+struct client {
+	int fd;
+	char *in;
+	size_t inlen;
+	size_t incap;
+	char *out;
+	size_t outlen;
+	size_t outcap;
+	struct request *head;
+	struct request *tail;
+	int inflight;
+	int closed;
+};
+
+struct queue {
+	struct request *head;
+	struct request *tail;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct serverState {
+	struct serverDoc docs[SERVER_MAX_DOCS];
+	int ndocs;
+	pthread_mutex_t lock;
+	struct queue writes;
+	struct queue reads;
+	struct queue done;
+	int wake[2];
+	struct client *clients[SERVER_MAX_CLIENTS];
+	int nclients;
+	int listen_fd;
+	int nreaders;
+	volatile sig_atomic_t quit;
+} S;
+
+/*** util ***/
+
+void die(const char *s) {
+	perror(s);
+	exit(1);
+}
+
+void *xmalloc(size_t n) {
+	void *p = malloc(n);
+	if (p == NULL) die("malloc");
+	return p;
+}
+
+void bufAppend(char **b, size_t *len, size_t *cap, const char *s, size_t n) {
+	if (*len + n > *cap) {
+		size_t c = *cap ? *cap : 4096;
+		while (c < *len + n) c *= 2;
+		*b = realloc(*b, c);
+		if (*b == NULL) die("realloc");
+		*cap = c;
+	}
+	memcpy(*b + *len, s, n);
+	*len += n;
+}
+
+void replyf(struct request *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void replyf(struct request *r, const char *fmt, ...) {
+	char line[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+	free(r->reply);
+	r->reply = xmalloc(n);
+	memcpy(r->reply, line, n);
+	r->reply_len = n;
+}
+
+void replyErrno(struct request *r) {
+	replyf(r, "err %s\n", strerror(errno));
+}
+
+/*** queues ***/
+
+void queueInit(struct queue *q) {
+	q->head = q->tail = NULL;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+void queuePush(struct queue *q, struct request *r) {
+	r->qnext = NULL;
+	pthread_mutex_lock(&q->lock);
+	if (q->tail) q->tail->qnext = r;
+	else q->head = r;
+	q->tail = r;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* Takes everything queued, waiting for at least one request if asked to. */
+struct request *queueTake(struct queue *q, int wait) {
+	pthread_mutex_lock(&q->lock);
+	while (wait && q->head == NULL) pthread_cond_wait(&q->cond, &q->lock);
+	struct request *r = q->head;
+	q->head = q->tail = NULL;
+	pthread_mutex_unlock(&q->lock);
+	return r;
+}
+
+struct request *queuePop(struct queue *q) {
+	pthread_mutex_lock(&q->lock);
+	while (q->head == NULL) pthread_cond_wait(&q->cond, &q->lock);
+	struct request *r = q->head;
+	q->head = r->qnext;
+	if (q->head == NULL) q->tail = NULL;
+	pthread_mutex_unlock(&q->lock);
+	return r;
+}
+
+void requestDone(struct request *r) {
+	queuePush(&S.done, r);
+	if (write(S.wake[1], "d", 1) == -1) {
+		/* the pipe is full, so a wakeup is already pending */
+	}
+}
+
+/*** snapshots ***/
+
+void snapRelease(struct serverSnap *snap) {
+	pthread_mutex_lock(&S.lock);
+	int last = --snap->refs == 0;
+	pthread_mutex_unlock(&S.lock);
+	if (last) {
+		fouClose(snap->doc);
+		free(snap);
+	}
+}
+
+struct serverSnap *snapAcquire(int id) {
+	struct serverSnap *snap = NULL;
+	pthread_mutex_lock(&S.lock);
+	if (id >= 0 && id < S.ndocs) {
+		snap = S.docs[id].snap;
+		snap->refs++;
+	}
+	pthread_mutex_unlock(&S.lock);
+	return snap;
+}
+
+void snapPublish(int id) {
+	struct serverSnap *snap = xmalloc(sizeof(struct serverSnap));
+	snap->doc = fouSnapshot(S.docs[id].doc);
+	if (snap->doc == NULL) die("fouSnapshot");
+	snap->refs = 1;
+	pthread_mutex_lock(&S.lock);
+	struct serverSnap *old = S.docs[id].snap;
+	S.docs[id].snap = snap;
+	if (id == S.ndocs) S.ndocs++;
+	pthread_mutex_unlock(&S.lock);
+	if (old) snapRelease(old);
+}
+
+/*** writer ***/
+
+int writerOpen(struct request *r) {
+	for (int i = 0; i < S.ndocs; i++) {
+		if (strcmp(S.docs[i].path, r->data) == 0) {
+			replyf(r, "ok %d %zu\n", i, fouLength(S.docs[i].doc));
+			return -1;
+		}
+	}
+	if (S.ndocs == SERVER_MAX_DOCS) {
+		replyf(r, "err too many documents\n");
+		return -1;
+	}
+	fouDocument *doc = fouOpen(r->data);
+	if (doc == NULL && errno == ENOENT) doc = fouOpenMemory("", 0);
+	if (doc == NULL) {
+		replyErrno(r);
+		return -1;
+	}
+	int id = S.ndocs;
+	S.docs[id].path = strdup(r->data);
+	S.docs[id].doc = doc;
+	S.docs[id].snap = NULL;
+	if (S.docs[id].path == NULL) die("strdup");
+	snapPublish(id);
+	replyf(r, "ok %d %zu\n", id, fouLength(doc));
+	return -1;
+}
+
+/* Returns the id of the document the request changed, or -1. */
+int writerApply(struct request *r) {
+	if (r->kind == REQ_OPEN) return writerOpen(r);
+	if (r->doc < 0 || r->doc >= S.ndocs) {
+		replyf(r, "err no such document\n");
+		return -1;
+	}
+	struct serverDoc *d = &S.docs[r->doc];
+	switch (r->kind) {
+		case REQ_INSERT:
+			if (fouInsert(d->doc, r->a, r->data, r->len) == -1) break;
+			replyf(r, "ok %zu\n", fouLength(d->doc));
+			return r->doc;
+		case REQ_DELETE:
+			if (fouDelete(d->doc, r->a, r->b) == -1) break;
+			replyf(r, "ok %zu\n", fouLength(d->doc));
+			return r->doc;
+		case REQ_SAVE:
+			if (fouSave(d->doc, r->data ? r->data : d->path) == -1) break;
+			replyf(r, "ok\n");
+			return -1;
+	}
+	replyErrno(r);
+	return -1;
+}
+
+/* Applies whatever has queued up since the last round, then publishes one
+ * snapshot per document touched instead of one per edit. */
+void *writerThread(void *arg) {
+	(void)arg;
+	char touched[SERVER_MAX_DOCS];
+	while (1) {
+		struct request *batch = queueTake(&S.writes, 1);
+		memset(touched, 0, sizeof(touched));
+		for (struct request *r = batch; r; r = r->qnext) {
+			int id = writerApply(r);
+			if (id >= 0) touched[id] = 1;
+		}
+		for (int i = 0; i < SERVER_MAX_DOCS; i++) {
+			if (touched[i]) snapPublish(i);
+		}
+		while (batch) {
+			struct request *next = batch->qnext;
+			requestDone(batch);
+			batch = next;
+		}
+	}
+	return NULL;
+}
+
+/*** readers ***/
+
+struct readReply {
+	char *b;
+	size_t len;
+	size_t cap;
+};
+
+int readSpan(void *arg, const char *data, size_t len) {
+	struct readReply *rr = arg;
+	bufAppend(&rr->b, &rr->len, &rr->cap, data, len);
+	return 0;
+}
+
+void readerApply(struct request *r) {
+	fouDocument *doc = r->snap->doc;
+	switch (r->kind) {
+		case REQ_LENGTH:
+			replyf(r, "ok %zu\n", fouLength(doc));
+			break;
+		case REQ_READ: {
+			size_t total = fouLength(doc);
+			if (r->a > total) {
+				replyf(r, "err offset past the end\n");
+				break;
+			}
+			size_t n = r->b < total - r->a ? r->b : total - r->a;
+			char head[32];
+			int hlen = snprintf(head, sizeof(head), "ok %zu\n", n);
+			struct readReply rr = {NULL, 0, 0};
+			bufAppend(&rr.b, &rr.len, &rr.cap, head, hlen);
+			fouIterate(doc, r->a, n, readSpan, &rr);
+			r->reply = rr.b;
+			r->reply_len = rr.len;
+			break;
+		}
+		case REQ_SEARCH: {
+			size_t pos;
+			int found = fouSearch(doc, r->a, r->data, r->len, &pos);
+			if (found == -1) replyErrno(r);
+			else if (found) replyf(r, "ok %zu\n", pos);
+			else replyf(r, "ok -1\n");
+			break;
+		}
+	}
+}
+
+void *readerThread(void *arg) {
+	(void)arg;
+	while (1) {
+		struct request *r = queuePop(&S.reads);
+		readerApply(r);
+		snapRelease(r->snap);
+		r->snap = NULL;
+		requestDone(r);
+	}
+	return NULL;
+}
+
+/*** clients ***/
+
+int isWrite(int kind) {
+	return kind == REQ_OPEN || kind == REQ_INSERT || kind == REQ_DELETE || kind == REQ_SAVE;
+}
+
+/* Edits go out in order as soon as they arrive. A read waits until every
+ * earlier edit on its connection is applied, then pins the current
+ * snapshot, so each client sees its own requests take effect in order. */
+void clientDispatch(struct client *c) {
+	int pending_write = 0;
+	for (struct request *r = c->head; r; r = r->next) {
+		if (r->done) continue;
+		if (isWrite(r->kind)) {
+			pending_write = 1;
+			if (!r->dispatched) {
+				r->dispatched = 1;
+				queuePush(&S.writes, r);
+			}
+			continue;
+		}
+		if (r->dispatched) continue;
+		if (pending_write) return;
+		r->dispatched = 1;
+		r->snap = snapAcquire(r->doc);
+		if (r->snap == NULL) {
+			replyf(r, "err no such document\n");
+			r->done = 1;
+			continue;
+		}
+		queuePush(&S.reads, r);
+	}
+}
+
+/* A connection that goes away keeps its struct until the requests it
+ * already sent have come back from the writer and the readers. */
+void clientClose(struct client *c) {
+	close(c->fd);
+	c->fd = -1;
+	c->closed = 1;
+	c->outlen = 0;
+}
+
+void clientFlush(struct client *c) {
+	while (c->head && c->head->done) {
+		struct request *r = c->head;
+		if (!c->closed) bufAppend(&c->out, &c->outlen, &c->outcap, r->reply, r->reply_len);
+		c->head = r->next;
+		if (c->head == NULL) c->tail = NULL;
+		c->inflight--;
+		free(r->reply);
+		free(r->data);
+		free(r);
+	}
+	while (c->outlen > 0 && !c->closed) {
+		ssize_t n = write(c->fd, c->out, c->outlen);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN) clientClose(c);
+			break;
+		}
+		memmove(c->out, c->out + n, c->outlen - n);
+		c->outlen -= n;
+	}
+}
+
+void clientQueue(struct client *c, struct request *r) {
+	r->c = c;
+	r->next = NULL;
+	if (c->tail) c->tail->next = r;
+	else c->head = r;
+	c->tail = r;
+	c->inflight++;
+}
+
+/* Parses every complete request in the input buffer; returns -1 when the
+ * stream is beyond repair and the connection should be dropped. */
+int clientParse(struct client *c) {
+	size_t pos = 0;
+	while (pos < c->inlen) {
+		char *line = c->in + pos;
+		char *nl = memchr(line, '\n', c->inlen - pos);
+		if (nl == NULL) {
+			if (c->inlen - pos > 4096) return -1;
+			break;
+		}
+		*nl = '\0';
+		size_t linelen = nl - line + 1;
+
+		struct request *r = calloc(1, sizeof(struct request));
+		if (r == NULL) die("calloc");
+		r->kind = REQ_ERROR;
+		char cmd[16];
+		int id = -1;
+		size_t a = 0, b = 0;
+		int off = 0;
+		int nf = sscanf(line, "%15s %n", cmd, &off);
+		char *rest = line + off;
+		if (nf != 1) {
+			replyf(r, "err empty request\n");
+		} else if (strcmp(cmd, "open") == 0 && *rest) {
+			r->kind = REQ_OPEN;
+			r->data = strdup(rest);
+			if (r->data == NULL) die("strdup");
+		} else if (strcmp(cmd, "length") == 0 && sscanf(rest, "%d", &id) == 1) {
+			r->kind = REQ_LENGTH;
+		} else if (strcmp(cmd, "read") == 0 && sscanf(rest, "%d %zu %zu", &id, &a, &b) == 3) {
+			r->kind = REQ_READ;
+		} else if (strcmp(cmd, "delete") == 0 && sscanf(rest, "%d %zu %zu", &id, &a, &b) == 3) {
+			r->kind = REQ_DELETE;
+		} else if ((strcmp(cmd, "insert") == 0 || strcmp(cmd, "search") == 0) &&
+				sscanf(rest, "%d %zu %zu", &id, &a, &b) == 3) {
+			if (b > SERVER_MAX_PAYLOAD) {
+				free(r);
+				return -1;
+			}
+			if (c->inlen - pos - linelen < b) {
+				*nl = '\n';
+				free(r);
+				break;
+			}
+			r->kind = cmd[0] == 'i' ? REQ_INSERT : REQ_SEARCH;
+			r->data = xmalloc(b > 0 ? b : 1);
+			memcpy(r->data, nl + 1, b);
+			r->len = b;
+			linelen += b;
+			if (r->kind == REQ_SEARCH && b == 0) {
+				r->kind = REQ_ERROR;
+				replyf(r, "err empty needle\n");
+			}
+		} else if (strcmp(cmd, "save") == 0 && sscanf(rest, "%d %n", &id, &off) >= 1) {
+			r->kind = REQ_SAVE;
+			if (rest[off] && (r->data = strdup(rest + off)) == NULL) die("strdup");
+		} else {
+			replyf(r, "err bad request\n");
+		}
+		r->doc = id;
+		r->a = a;
+		r->b = b;
+		if (r->kind == REQ_ERROR) r->done = 1;
+		clientQueue(c, r);
+		pos += linelen;
+	}
+	memmove(c->in, c->in + pos, c->inlen - pos);
+	c->inlen -= pos;
+	return 0;
+}
+
+void clientRead(struct client *c) {
+	while (c->inflight < SERVER_MAX_INFLIGHT) {
+		if (c->incap - c->inlen < SERVER_READ_CHUNK) {
+			c->incap = c->incap ? c->incap * 2 : SERVER_READ_CHUNK * 2;
+			c->in = realloc(c->in, c->incap);
+			if (c->in == NULL) die("realloc");
+		}
+		ssize_t n = read(c->fd, c->in + c->inlen, c->incap - c->inlen);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && errno == EAGAIN) break;
+		if (n <= 0) {
+			clientClose(c);
+			break;
+		}
+		c->inlen += n;
+		if (clientParse(c) == -1) {
+			clientClose(c);
+			break;
+		}
+	}
+}
+
+void clientFree(int i) {
+	struct client *c = S.clients[i];
+	free(c->in);
+	free(c->out);
+	free(c);
+	S.clients[i] = S.clients[--S.nclients];
+}
+
+void serverAccept() {
+	while (1) {
+		int fd = accept4(S.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) return;
+		if (S.nclients == SERVER_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		struct client *c = calloc(1, sizeof(struct client));
+		if (c == NULL) die("calloc");
+		c->fd = fd;
+		S.clients[S.nclients++] = c;
+	}
+}
+
+/*** server ***/
+
+void serverHandleSignal(int sig) {
+	(void)sig;
+	S.quit = 1;
+}
+
+void serverInit(const char *path, int nreaders) {
+	pthread_mutex_init(&S.lock, NULL);
+	queueInit(&S.writes);
+	queueInit(&S.reads);
+	queueInit(&S.done);
+	if (pipe2(S.wake, O_NONBLOCK | O_CLOEXEC) == -1) die("pipe");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		exit(1);
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	S.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (S.listen_fd == -1) die("socket");
+	if (bind(S.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) die("bind");
+	if (listen(S.listen_fd, 128) == -1) die("listen");
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serverHandleSignal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_t t;
+	if (pthread_create(&t, NULL, writerThread, NULL) != 0) die("pthread_create");
+	S.nreaders = nreaders;
+	for (int i = 0; i < nreaders; i++) {
+		if (pthread_create(&t, NULL, readerThread, NULL) != 0) die("pthread_create");
+	}
+}
+
+/* The I/O thread owns every connection: it parses requests, hands them to
+ * the writer or the readers, and sends replies back in request order. */
+void serverLoop() {
+	static struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+	while (!S.quit) {
+		int nfds = 0;
+		fds[nfds].fd = S.listen_fd;
+		fds[nfds++].events = POLLIN;
+		fds[nfds].fd = S.wake[0];
+		fds[nfds++].events = POLLIN;
+		for (int i = 0; i < S.nclients; i++) {
+			struct client *c = S.clients[i];
+			fds[nfds].fd = c->fd;
+			fds[nfds].events = 0;
+			fds[nfds].revents = 0;
+			if (c->inflight < SERVER_MAX_INFLIGHT && c->outlen < SERVER_OUT_HIGH) fds[nfds].events |= POLLIN;
+			if (c->outlen > 0) fds[nfds].events |= POLLOUT;
+			nfds++;
+		}
+
+		if (poll(fds, nfds, -1) == -1) {
+			if (errno == EINTR) continue;
+			die("poll");
+		}
+
+		if (fds[1].revents & POLLIN) {
+			char buf[256];
+			while (read(S.wake[0], buf, sizeof(buf)) > 0);
+			for (struct request *r = queueTake(&S.done, 0); r; r = r->qnext) {
+				r->done = 1;
+			}
+		}
+		for (int i = 2; i < nfds; i++) {
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (!S.clients[i - 2]->closed) clientRead(S.clients[i - 2]);
+			}
+		}
+		if (fds[0].revents & POLLIN) serverAccept();
+
+		for (int i = S.nclients - 1; i >= 0; i--) {
+			struct client *c = S.clients[i];
+			clientFlush(c);
+			clientDispatch(c);
+			clientFlush(c);
+			if (c->closed && c->head == NULL) clientFree(i);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int nreaders = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		if (opt == 'j') nreaders = atoi(optarg);
+		else break;
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-j readers] socket\n", argv[0]);
+		exit(1);
+	}
+	if (nreaders < 1) nreaders = 1;
+	if (nreaders > SERVER_MAX_READERS) nreaders = SERVER_MAX_READERS;
+
+	serverInit(argv[optind], nreaders);
+	serverLoop();
+	unlink(argv[optind]);
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "fou_term.h"
+
+/*** defines ***/
+
+#define FOU_MAX_WATCHES 8
+#define FOU_MAX_TIMERS 8
+#define FOU_ESC_TIMEOUT 100
+
+/*** data ***/
+
+struct editorWatch {
+	int fd;
+	void (*handler)(int fd);
+};
+
+struct editorTimer {
+	long long deadline;
+	void (*handler)(void);
+};
+
+struct editorEvents {
+	int winch[2];
+	struct editorWatch watches[FOU_MAX_WATCHES];
+	int nwatches;
+	struct editorTimer timers[FOU_MAX_TIMERS];
+	int ntimers;
+} EV;
+
+struct editorTerminal {
+	char statusmsg[80];
+	time_t statusmsg_time;
+	struct termios orig_termios;
+} T;
+
+/*** terminal ***/
+
+void die(const char *s) {
+	write(STDOUT_FILENO, "\x1b[2J", 4);
+	write(STDOUT_FILENO, "\x1b[H", 3);
+	perror(s);
+	exit(1);
+}
+
+void disableRawMode() {
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &T.orig_termios) == -1){
+		die("tcsetattr");
+	}
+}
+
+void enableRawMode() {
+	if (tcgetattr(STDIN_FILENO, &T.orig_termios) == -1) die("tcsetattr");
+	atexit(disableRawMode);
+
+	struct termios raw = T.orig_termios;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_oflag &= ~(OPOST);
+	raw.c_cflag |= (CS8);
+	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+}
+
+int getCursorPosition(int *rows, int *cols){
+	char buff[32];
+	unsigned int i = 0;
+	if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
+
+	while (i < sizeof(buff) - 1) {
+		if (!editorPollByte(&buff[i], FOU_ESC_TIMEOUT)) break;
+		if (buff[i] == 'R') break;
+		i++;
+	}
+	buff[i] = '\0';
+
+	if (buff[0] != '\x1b' || buff[1] != '[') return -1;
+	if (sscanf(&buff[2], "%d;%d", rows, cols) != 2) return -1;
+
+	return 0;
+}
+
+int getWindowSize(int *rows, int *cols) {
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+		if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12) return -1;
+		return getCursorPosition(rows, cols);
+	} else {
+		*cols = ws.ws_col;
+		*rows = ws.ws_row;
+		return 0;
+	}
+}
+
+/*** events ***/
+
+long long editorNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void editorHandleWinch(int sig) {
+	(void)sig;
+	int saved_errno = errno;
+	if (write(EV.winch[1], "w", 1) == -1) {
+		/* pipe already holds a pending resize */
+	}
+	errno = saved_errno;
+}
+
+void editorInitEvents() {
+	if (pipe(EV.winch) == -1) die("pipe");
+	for (int i = 0; i < 2; i++) {
+		fcntl(EV.winch[i], F_SETFL, O_NONBLOCK);
+		fcntl(EV.winch[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorHandleWinch;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+
+	/* a hung up terminal shows up as end of input instead */
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGHUP, &sa, NULL) == -1) die("sigaction");
+}
+
+int editorAddWatch(int fd, void (*handler)(int fd)) {
+	if (EV.nwatches == FOU_MAX_WATCHES) return -1;
+	EV.watches[EV.nwatches].fd = fd;
+	EV.watches[EV.nwatches].handler = handler;
+	EV.nwatches++;
+	return 0;
+}
+
+void editorRemoveWatch(int fd) {
+	for (int i = 0; i < EV.nwatches; i++) {
+		if (EV.watches[i].fd == fd) {
+			EV.watches[i] = EV.watches[--EV.nwatches];
+			return;
+		}
+	}
+}
+
+/* One-shot timer; scheduling a handler that is already pending moves its
+ * deadline. A NULL handler only wakes the loop up for a redraw. */
+void editorAddTimer(int ms, void (*handler)(void)) {
+	int i;
+	for (i = 0; i < EV.ntimers; i++) {
+		if (EV.timers[i].handler == handler) break;
+	}
+	if (i == FOU_MAX_TIMERS) return;
+	if (i == EV.ntimers) EV.ntimers++;
+	EV.timers[i].deadline = editorNow() + ms;
+	EV.timers[i].handler = handler;
+}
+
+int editorTimerTimeout() {
+	if (EV.ntimers == 0) return -1;
+	long long next = EV.timers[0].deadline;
+	for (int i = 1; i < EV.ntimers; i++) {
+		if (EV.timers[i].deadline < next) next = EV.timers[i].deadline;
+	}
+	long long wait = next - editorNow();
+	return wait > 0 ? (int)wait : 0;
+}
+
+int editorRunTimers() {
+	long long now = editorNow();
+	int ran = 0;
+	int i = 0;
+	while (i < EV.ntimers) {
+		if (EV.timers[i].deadline <= now) {
+			void (*handler)(void) = EV.timers[i].handler;
+			EV.timers[i] = EV.timers[--EV.ntimers];
+			if (handler) handler();
+			ran = 1;
+		} else {
+			i++;
+		}
+	}
+	return ran;
+}
+
+/* Sleeps in poll until stdin is readable, servicing resizes, watched fds and
+ * timers in the meantime, so an idle editor never wakes up. */
+void editorWaitKey() {
+	while (1) {
+		struct pollfd fds[2 + FOU_MAX_WATCHES];
+		int nfds = 0;
+		fds[nfds].fd = STDIN_FILENO;
+		fds[nfds++].events = POLLIN;
+		fds[nfds].fd = EV.winch[0];
+		fds[nfds++].events = POLLIN;
+		for (int i = 0; i < EV.nwatches; i++) {
+			fds[nfds].fd = EV.watches[i].fd;
+			fds[nfds++].events = POLLIN;
+		}
+
+		if (poll(fds, nfds, editorTimerTimeout()) == -1) {
+			if (errno == EINTR) continue;
+			die("poll");
+		}
+
+		int redraw = 0;
+		if (fds[1].revents & POLLIN) {
+			char buf[32];
+			int rows, cols;
+			while (read(EV.winch[0], buf, sizeof(buf)) > 0);
+			if (getWindowSize(&rows, &cols) == -1) editorHangup();
+			editorResize(rows, cols);
+			redraw = 1;
+		}
+		for (int i = 2; i < nfds; i++) {
+			if (!fds[i].revents) continue;
+			for (int j = 0; j < EV.nwatches; j++) {
+				if (EV.watches[j].fd == fds[i].fd) {
+					EV.watches[j].handler(fds[i].fd);
+					break;
+				}
+			}
+			redraw = 1;
+		}
+		if (editorRunTimers()) redraw = 1;
+
+		if (fds[0].revents) return;
+		if (redraw) editorRefreshScreen();
+	}
+}
+
+int editorPollByte(char *c, int timeout_ms) {
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	int n = poll(&pfd, 1, timeout_ms);
+	if (n == -1 && errno != EINTR) die("poll");
+	if (n <= 0) return 0;
+	if (pfd.revents & POLLNVAL) editorHangup();
+	int nread = read(STDIN_FILENO, c, 1);
+	if (nread == 0 || (nread == -1 && errno != EAGAIN && errno != EINTR)) editorHangup();
+	return nread == 1;
+}
+
+/* In command mode w, a, s and d move the cursor like the arrow keys. */
+int editorReadKey(int command) {
+	char c;
+	do {
+		editorWaitKey();
+	} while (!editorPollByte(&c, 0));
+
+	if (c == '\x1b') {
+		char seq[3];
+
+		if (!editorPollByte(&seq[0], FOU_ESC_TIMEOUT)) return '\x1b';
+		if (!editorPollByte(&seq[1], FOU_ESC_TIMEOUT)) return '\x1b';
+
+		if (seq[0] == '[') {
+			if (seq[1] >= '0' && seq[1] <= '9') {
+				if (!editorPollByte(&seq[2], FOU_ESC_TIMEOUT)) return '\x1b';
+				if (seq[2] == '~'){
+					switch (seq[1]) {
+						case '1': return HOME_KEY;
+						case '3': return DEL_KEY;
+						case '4': return END_KEY;
+						case '5': return PAGE_UP;
+						case '6': return PAGE_DOWN;
+						case '7': return HOME_KEY;
+						case '8': return END_KEY;
+					}
+				}
+			} else {
+				switch (seq[1]) {
+					case 'A': return ARROW_UP;
+					case 'B': return ARROW_DOWN;
+					case 'C': return ARROW_RIGHT;
+					case 'D': return ARROW_LEFT;
+					case 'H': return HOME_KEY;
+					case 'F': return END_KEY;
+				}
+			}
+		} else if (seq[0] == 'O') {
+			switch (seq[1]) {
+				case 'H': return HOME_KEY;
+				case 'F': return END_KEY;
+			}
+		}
+
+		return '\x1b';
+	} else {
+		if (command){
+			switch (c) {
+				case 'w': return ARROW_UP;
+				case 'a': return ARROW_LEFT;
+				case 's': return ARROW_DOWN;
+				case 'd': return ARROW_RIGHT;
+			}
+		}
+		return c;
+	}
+}
+
+/*** append buffer ***/
+
+void abAppend(struct abuf *ab, const char *s, int len){
+	char *new = realloc(ab->b, ab->len + len);
+
+	if (new == NULL) return;
+	memcpy(&new[ab->len], s, len);
+	ab->b = new;
+	ab->len += len;
+}
+
+void abFree(struct abuf *ab){
+	free(ab->b);
+}
+
+/*** ouput ***/
+
+/* A frame is drawn with the cursor hidden, from the top left corner. */
+void editorScreenStart(struct abuf *ab) {
+	abAppend(ab, "\x1b[?25l", 6);
+	abAppend(ab, "\x1b[H", 3);
+}
+
+/* Puts the cursor at row, col (from 0), shows it and writes the frame out. */
+void editorScreenFlush(struct abuf *ab, int row, int col) {
+	char buff[32];
+	snprintf(buff, sizeof(buff), "\x1b[%d;%dH", row + 1, col + 1);
+	abAppend(ab, buff, strlen(buff));
+
+	abAppend(ab, "\x1b[?25h", 6);
+
+	write(STDOUT_FILENO, ab->b, ab->len);
+	abFree(ab);
+}
+
+void editorSetStatusMessage(const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(T.statusmsg, sizeof(T.statusmsg), fmt, ap);
+	va_end(ap);
+	T.statusmsg_time = time(NULL);
+	editorAddTimer(6000, NULL);
+}
+
+void editorDrawMessageBar(struct abuf *ab, int cols) {
+	abAppend(ab, "\x1b[K", 3);
+	int msglen = strlen(T.statusmsg);
+	if (msglen > cols) {
+		msglen = cols;
+	}
+	if (msglen && time(NULL) - T.statusmsg_time < 5) {
+		abAppend(ab, T.statusmsg, msglen);
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef FOU_TERM_H
+#define FOU_TERM_H
+
+/*
+ * The terminal side shared by fou and fou_edit: raw mode, the event loop
+ * that sleeps in poll until a key arrives, key decoding, the append buffer
+ * a screen is drawn into and the message bar at its foot.
+ *
+ * A program using it defines editorRefreshScreen, editorResize and
+ * editorHangup; the event loop calls them on a redraw, on a new window size
+ * and when the terminal goes away.
+ */
+
+#define CTRL_KEY(k) ((k) & 0x1f)
+
+enum editorKey {
+	BACKSPACE = 127,
+	ARROW_LEFT = 1000,
+	ARROW_RIGHT,
+	ARROW_UP,
+	ARROW_DOWN,
+	DEL_KEY,
+	HOME_KEY,
+	END_KEY,
+	PAGE_UP,
+	PAGE_DOWN
+};
+
+struct abuf {
+	char *b;
+	int len;
+};
+
+#define ABUF_INIT {NULL, 0}
+
+void editorRefreshScreen();
+void editorResize(int rows, int cols);
+void editorHangup();
+
+void die(const char *s);
+void disableRawMode();
+void enableRawMode();
+int getWindowSize(int *rows, int *cols);
+
+void editorInitEvents();
+int editorAddWatch(int fd, void (*handler)(int fd));
+void editorRemoveWatch(int fd);
+void editorAddTimer(int ms, void (*handler)(void));
+int editorPollByte(char *c, int timeout_ms);
+int editorReadKey(int command);
+
+void abAppend(struct abuf *ab, const char *s, int len);
+void abFree(struct abuf *ab);
+void editorScreenStart(struct abuf *ab);
+void editorScreenFlush(struct abuf *ab, int row, int col);
+
+void editorSetStatusMessage(const char *fmt, ...);
+void editorDrawMessageBar(struct abuf *ab, int cols);
+
+#endif
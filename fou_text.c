@@ -0,0 +1,1216 @@
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "fou_text.h"
+
+/*** defines ***/
+
+#define FOU_TEXT_GAP 4096
+#define ROPE_CHUNK 4096
+#define ROPE_FANOUT 16
+
+/*** data ***/
+
+/* What a backend provides. open, lineStart, count, search and replaceAll may
+ * be NULL: the file is then read into memory for openMemory, and the others
+ * fall back to generic versions built on iterate, insert and delete. */
+struct fouTextOps {
+	const char *name;
+	void *(*open)(const char *path);
+	void *(*openMemory)(const char *data, size_t len);
+	void (*close)(void *impl);
+	size_t (*length)(const void *impl);
+	int (*insert)(void *impl, size_t at, const char *s, size_t len);
+	int (*del)(void *impl, size_t at, size_t len);
+	int (*iterate)(const void *impl, size_t at, size_t len, fouSpanFn fn, void *arg);
+	size_t (*lineStart)(const void *impl, size_t line);
+	int (*count)(const void *impl, size_t at, size_t len, size_t *lines, size_t *tabs);
+	int (*search)(const void *impl, size_t from, const char *needle, size_t nlen, size_t *pos);
+	long (*replaceAll)(void *impl, const char *needle, size_t nlen, const char *with, size_t wlen);
+};
+
+struct fouText {
+	const struct fouTextOps *ops;
+	void *impl;
+};
+
+/*** pieces ***/
+
+static void *piecesOpen(const char *path) {
+	return fouOpen(path);
+}
+
+static void *piecesOpenMemory(const char *data, size_t len) {
+	return fouOpenMemory(data, len);
+}
+
+static void piecesClose(void *impl) {
+	fouClose(impl);
+}
+
+static size_t piecesLength(const void *impl) {
+	return fouLength(impl);
+}
+
+static int piecesInsert(void *impl, size_t at, const char *s, size_t len) {
+	return fouInsert(impl, at, s, len);
+}
+
+static int piecesDelete(void *impl, size_t at, size_t len) {
+	return fouDelete(impl, at, len);
+}
+
+static int piecesIterate(const void *impl, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	return fouIterate(impl, at, len, fn, arg);
+}
+
+static int piecesSearch(const void *impl, size_t from, const char *needle, size_t nlen, size_t *pos) {
+	return fouSearch(impl, from, needle, nlen, pos);
+}
+
+static long piecesReplaceAll(void *impl, const char *needle, size_t nlen, const char *with, size_t wlen) {
+	return fouReplaceAll(impl, needle, nlen, with, wlen);
+}
+
+/*** gap buffer ***/
+
+/* The text is b[0, gap) followed by b[gapend, cap). */
+struct gapText {
+	char *b;
+	size_t gap;
+	size_t gapend;
+	size_t cap;
+};
+
+static size_t gapLength(const void *impl) {
+	const struct gapText *g = impl;
+	return g->cap - (g->gapend - g->gap);
+}
+
+static void *gapOpenMemory(const char *data, size_t len) {
+	struct gapText *g = calloc(1, sizeof(struct gapText));
+	if (g == NULL) return NULL;
+	g->cap = len + FOU_TEXT_GAP;
+	g->b = malloc(g->cap);
+	if (g->b == NULL) {
+		free(g);
+		return NULL;
+	}
+	memcpy(g->b, data, len);
+	g->gap = len;
+	g->gapend = g->cap;
+	return g;
+}
+
+static void gapClose(void *impl) {
+	struct gapText *g = impl;
+	free(g->b);
+	free(g);
+}
+
+static int gapReserve(struct gapText *g, size_t n) {
+	if (g->gapend - g->gap >= n) return 0;
+	size_t need = gapLength(g) + n + FOU_TEXT_GAP;
+	size_t cap = g->cap * 2 > need ? g->cap * 2 : need;
+	char *b = realloc(g->b, cap);
+	if (b == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	size_t tail = g->cap - g->gapend;
+	memmove(b + cap - tail, b + g->gapend, tail);
+	g->b = b;
+	g->gapend = cap - tail;
+	g->cap = cap;
+	return 0;
+}
+
+static void gapMove(struct gapText *g, size_t at) {
+	if (at < g->gap) {
+		size_t n = g->gap - at;
+		memmove(g->b + g->gapend - n, g->b + at, n);
+		g->gap -= n;
+		g->gapend -= n;
+	} else if (at > g->gap) {
+		size_t n = at - g->gap;
+		memmove(g->b + g->gap, g->b + g->gapend, n);
+		g->gap += n;
+		g->gapend += n;
+	}
+}
+
+static int gapInsert(void *impl, size_t at, const char *s, size_t len) {
+	struct gapText *g = impl;
+	if (at > gapLength(g)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (gapReserve(g, len) == -1) return -1;
+	gapMove(g, at);
+	memcpy(g->b + g->gap, s, len);
+	g->gap += len;
+	return 0;
+}
+
+static int gapDelete(void *impl, size_t at, size_t len) {
+	struct gapText *g = impl;
+	size_t length = gapLength(g);
+	if (at > length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > length - at) len = length - at;
+	gapMove(g, at);
+	g->gapend += len;
+	return 0;
+}
+
+static int gapIterate(const void *impl, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	const struct gapText *g = impl;
+	size_t length = gapLength(g);
+	if (at > length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > length - at) len = length - at;
+	size_t end = at + len;
+	if (at < g->gap) {
+		size_t hi = end < g->gap ? end : g->gap;
+		if (hi > at && fn(arg, g->b + at, hi - at)) return 1;
+	}
+	if (end > g->gap) {
+		size_t lo = at > g->gap ? at : g->gap;
+		if (fn(arg, g->b + g->gapend + (lo - g->gap), end - lo)) return 1;
+	}
+	return 0;
+}
+
+/*** rows ***/
+
+/* One line per row, without its newline; there is always at least one row,
+ * and every row but the last ends in a newline. */
+struct rowLine {
+	char *s;
+	size_t len;
+};
+
+struct rowText {
+	struct rowLine *row;
+	size_t numrows;
+	size_t cap;
+	size_t length;
+};
+
+static int rowsMake(struct rowLine *line, const char *a, size_t alen, const char *b, size_t blen) {
+	line->s = malloc(alen + blen + 1);
+	if (line->s == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(line->s, a, alen);
+	memcpy(line->s + alen, b, blen);
+	line->len = alen + blen;
+	return 0;
+}
+
+static int rowsReserve(struct rowText *r, size_t n) {
+	if (n <= r->cap) return 0;
+	size_t cap = r->cap * 2 > n ? r->cap * 2 : n;
+	struct rowLine *row = realloc(r->row, sizeof(struct rowLine) * cap);
+	if (row == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	r->row = row;
+	r->cap = cap;
+	return 0;
+}
+
+static void rowsClose(void *impl) {
+	struct rowText *r = impl;
+	for (size_t i = 0; i < r->numrows; i++) {
+		free(r->row[i].s);
+	}
+	free(r->row);
+	free(r);
+}
+
+static void *rowsOpenMemory(const char *data, size_t len) {
+	struct rowText *r = calloc(1, sizeof(struct rowText));
+	if (r == NULL) return NULL;
+	const char *p = data;
+	const char *end = data + len;
+	for (;;) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *stop = nl ? nl : end;
+		if (rowsReserve(r, r->numrows + 1) == -1 || rowsMake(&r->row[r->numrows], p, stop - p, "", 0) == -1) {
+			rowsClose(r);
+			return NULL;
+		}
+		r->numrows++;
+		if (nl == NULL) break;
+		p = nl + 1;
+	}
+	r->length = len;
+	return r;
+}
+
+static size_t rowsLength(const void *impl) {
+	return ((const struct rowText *)impl)->length;
+}
+
+/* Row holding offset at, and the column within it. */
+static size_t rowsFind(const struct rowText *r, size_t at, size_t *col) {
+	size_t i = 0;
+	while (at > r->row[i].len && i + 1 < r->numrows) {
+		at -= r->row[i].len + 1;
+		i++;
+	}
+	*col = at;
+	return i;
+}
+
+static int rowsInsert(void *impl, size_t at, const char *s, size_t len) {
+	struct rowText *r = impl;
+	if (at > r->length) {
+		errno = EINVAL;
+		return -1;
+	}
+	size_t c;
+	size_t i = rowsFind(r, at, &c);
+	struct rowLine *line = &r->row[i];
+
+	size_t k = 0;
+	for (const char *p = s; (p = memchr(p, '\n', len - (p - s))) != NULL; p++) k++;
+	if (k == 0) {
+		char *grown = realloc(line->s, line->len + len + 1);
+		if (grown == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memmove(grown + c + len, grown + c, line->len - c);
+		memcpy(grown + c, s, len);
+		line->s = grown;
+		line->len += len;
+		r->length += len;
+		return 0;
+	}
+
+	/* the first segment of s joins the head of the row, the last one its
+	 * tail, and every segment in between becomes a row of its own */
+	struct rowLine *fresh = malloc(sizeof(struct rowLine) * (k + 1));
+	if (fresh == NULL || rowsReserve(r, r->numrows + k) == -1) {
+		free(fresh);
+		errno = ENOMEM;
+		return -1;
+	}
+	line = &r->row[i];
+	size_t made = 0;
+	const char *seg = s;
+	for (size_t j = 0; j <= k; j++) {
+		const char *nl = j < k ? memchr(seg, '\n', len - (seg - s)) : s + len;
+		int failed = j == 0 ? rowsMake(&fresh[j], line->s, c, seg, nl - seg) :
+				j == k ? rowsMake(&fresh[j], seg, nl - seg, line->s + c, line->len - c) :
+				rowsMake(&fresh[j], seg, nl - seg, "", 0);
+		if (failed == -1) {
+			while (made > 0) free(fresh[--made].s);
+			free(fresh);
+			return -1;
+		}
+		made++;
+		seg = nl + 1;
+	}
+	free(line->s);
+	memmove(&r->row[i + 1 + k], &r->row[i + 1], sizeof(struct rowLine) * (r->numrows - i - 1));
+	memcpy(&r->row[i], fresh, sizeof(struct rowLine) * (k + 1));
+	free(fresh);
+	r->numrows += k;
+	r->length += len;
+	return 0;
+}
+
+static int rowsDelete(void *impl, size_t at, size_t len) {
+	struct rowText *r = impl;
+	if (at > r->length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > r->length - at) len = r->length - at;
+	if (len == 0) return 0;
+	size_t c, c2;
+	size_t i = rowsFind(r, at, &c);
+	size_t j = rowsFind(r, at + len, &c2);
+	struct rowLine joined;
+	if (rowsMake(&joined, r->row[i].s, c, r->row[j].s + c2, r->row[j].len - c2) == -1) return -1;
+	for (size_t k = i; k <= j; k++) {
+		free(r->row[k].s);
+	}
+	r->row[i] = joined;
+	memmove(&r->row[i + 1], &r->row[j + 1], sizeof(struct rowLine) * (r->numrows - j - 1));
+	r->numrows -= j - i;
+	r->length -= len;
+	return 0;
+}
+
+static int rowsIterate(const void *impl, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	const struct rowText *r = impl;
+	if (at > r->length) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > r->length - at) len = r->length - at;
+	size_t end = at + len;
+	size_t base = 0;
+	for (size_t i = 0; i < r->numrows && base < end; i++) {
+		size_t rl = r->row[i].len;
+		if (base + rl > at) {
+			size_t lo = at > base ? at - base : 0;
+			size_t hi = end - base < rl ? end - base : rl;
+			if (fn(arg, r->row[i].s + lo, hi - lo)) return 1;
+		}
+		base += rl;
+		if (i + 1 < r->numrows) {
+			if (base >= at && base < end && fn(arg, "\n", 1)) return 1;
+			base++;
+		}
+	}
+	return 0;
+}
+
+static size_t rowsLineStart(const void *impl, size_t line) {
+	const struct rowText *r = impl;
+	if (line >= r->numrows) return r->length;
+	size_t off = 0;
+	for (size_t i = 0; i < line; i++) {
+		off += r->row[i].len + 1;
+	}
+	return off;
+}
+
+/*** rope ***/
+
+/* A B-tree over chunks of text. Every node caches the bytes, newlines and
+ * tabs below it, so an offset, a line or a count over a range only walks the
+ * paths down to the ends of the range, and all leaves are at the same depth.
+ * Nodes a split may need are set aside before an insert touches the tree, so
+ * running out of memory leaves the text as it was. */
+struct ropeNode {
+	size_t bytes;
+	size_t lines;
+	size_t tabs;
+	int leaf;
+	int n;
+	union {
+		char *text;
+		struct ropeNode *child[ROPE_FANOUT];
+	} u;
+};
+
+struct ropeText {
+	struct ropeNode *root;
+	struct ropeNode *spare[2];
+	struct ropeNode **scratch[2];
+	size_t scratchcap;
+};
+
+static void ropeCount(const char *s, size_t len, size_t *lines, size_t *tabs) {
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] == '\n') (*lines)++;
+		else if (s[i] == '\t') (*tabs)++;
+	}
+}
+
+static void ropeRecount(struct ropeNode *node) {
+	node->lines = 0;
+	node->tabs = 0;
+	if (node->leaf) {
+		ropeCount(node->u.text, node->bytes, &node->lines, &node->tabs);
+		return;
+	}
+	node->bytes = 0;
+	for (int i = 0; i < node->n; i++) {
+		node->bytes += node->u.child[i]->bytes;
+		node->lines += node->u.child[i]->lines;
+		node->tabs += node->u.child[i]->tabs;
+	}
+}
+
+static void ropeFree(struct ropeNode *node) {
+	if (!node->leaf) {
+		for (int i = 0; i < node->n; i++) ropeFree(node->u.child[i]);
+	}
+	free(node);
+}
+
+/* Leaves carry their chunk in the same allocation. */
+static int ropeReserve(struct ropeText *r, int leaf, size_t count) {
+	size_t have = 0;
+	for (struct ropeNode *p = r->spare[leaf]; p != NULL && have < count; p = p->u.child[0]) have++;
+	for (; have < count; have++) {
+		struct ropeNode *node = malloc(sizeof(struct ropeNode) + (leaf ? ROPE_CHUNK : 0));
+		if (node == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		node->u.child[0] = r->spare[leaf];
+		r->spare[leaf] = node;
+	}
+	return 0;
+}
+
+static struct ropeNode *ropeTake(struct ropeText *r, int leaf) {
+	struct ropeNode *node = r->spare[leaf];
+	r->spare[leaf] = node->u.child[0];
+	node->bytes = 0;
+	node->lines = 0;
+	node->tabs = 0;
+	node->leaf = leaf;
+	node->n = 0;
+	if (leaf) node->u.text = (char *)(node + 1);
+	return node;
+}
+
+static int ropeScratch(struct ropeText *r, size_t n) {
+	if (n <= r->scratchcap) return 0;
+	if (n < r->scratchcap * 2) n = r->scratchcap * 2;
+	for (int i = 0; i < 2; i++) {
+		struct ropeNode **grown = realloc(r->scratch[i], sizeof(struct ropeNode *) * n);
+		if (grown == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		r->scratch[i] = grown;
+	}
+	r->scratchcap = n;
+	return 0;
+}
+
+static int ropeHeight(const struct ropeNode *node) {
+	int h = 0;
+	for (; !node->leaf; node = node->u.child[0]) h++;
+	return h;
+}
+
+/* Inner nodes that adding this many leaves to a tree of this height can
+ * take: a level that gains c nodes needs at most c / ROPE_FANOUT + 2 new
+ * parents, up to a new root. */
+static size_t ropeInnersFor(size_t leaves, int height) {
+	size_t inners = 0;
+	size_t c = leaves;
+	for (int level = 0; level <= height || c > 1; level++) {
+		c = c / ROPE_FANOUT + 2;
+		inners += c;
+		if (level > height && c <= 2) {
+			inners += 2;
+			break;
+		}
+	}
+	return inners;
+}
+
+static int ropeReserveFor(struct ropeText *r, size_t leaves, int height) {
+	if (ropeReserve(r, 1, leaves) == -1 || ropeReserve(r, 0, ropeInnersFor(leaves, height)) == -1) return -1;
+	return ropeScratch(r, ROPE_FANOUT + leaves);
+}
+
+/* Puts list[0, n) under as few parents as will hold them, spread evenly, and
+ * leaves the parents at the front of list. */
+static size_t ropeGroup(struct ropeText *r, struct ropeNode **list, size_t n) {
+	size_t g = (n + ROPE_FANOUT - 1) / ROPE_FANOUT;
+	for (size_t j = 0; j < g; j++) {
+		struct ropeNode *parent = ropeTake(r, 0);
+		size_t lo = n * j / g;
+		size_t hi = n * (j + 1) / g;
+		for (size_t i = lo; i < hi; i++) parent->u.child[parent->n++] = list[i];
+		ropeRecount(parent);
+		list[j] = parent;
+	}
+	return g;
+}
+
+struct ropeSpan {
+	const char *p;
+	size_t len;
+};
+
+/* Cuts the concatenation of the spans into leaves of at most ROPE_CHUNK. */
+static size_t ropeLeaves(struct ropeText *r, const struct ropeSpan *sp, size_t total, struct ropeNode **out) {
+	size_t k = total ? (total + ROPE_CHUNK - 1) / ROPE_CHUNK : 1;
+	int s = 0;
+	size_t off = 0;
+	for (size_t j = 0; j < k; j++) {
+		struct ropeNode *leaf = ropeTake(r, 1);
+		size_t want = total * (j + 1) / k - total * j / k;
+		while (leaf->bytes < want) {
+			while (off == sp[s].len) {
+				s++;
+				off = 0;
+			}
+			size_t n = sp[s].len - off < want - leaf->bytes ? sp[s].len - off : want - leaf->bytes;
+			memcpy(leaf->u.text + leaf->bytes, sp[s].p + off, n);
+			leaf->bytes += n;
+			off += n;
+		}
+		ropeRecount(leaf);
+		out[j] = leaf;
+	}
+	return k;
+}
+
+/* Returns the nodes that take the place of node on its level: node itself,
+ * or the pieces it was split into. out and tmp swap roles on the way down. */
+static size_t ropeInsertNode(struct ropeText *r, struct ropeNode *node, size_t at, const char *s, size_t len,
+		struct ropeNode **out, struct ropeNode **tmp) {
+	if (node->leaf) {
+		if (node->bytes + len <= ROPE_CHUNK) {
+			memmove(node->u.text + at + len, node->u.text + at, node->bytes - at);
+			memcpy(node->u.text + at, s, len);
+			node->bytes += len;
+			ropeCount(s, len, &node->lines, &node->tabs);
+			out[0] = node;
+			return 1;
+		}
+		struct ropeSpan sp[3] = {{node->u.text, at}, {s, len}, {node->u.text + at, node->bytes - at}};
+		size_t k = ropeLeaves(r, sp, node->bytes + len, out);
+		free(node);
+		return k;
+	}
+
+	int i = 0;
+	size_t base = 0;
+	while (i < node->n - 1 && at > base + node->u.child[i]->bytes) {
+		base += node->u.child[i]->bytes;
+		i++;
+	}
+	size_t k = ropeInsertNode(r, node->u.child[i], at - base, s, len, tmp, out);
+	size_t total = node->n - 1 + k;
+	if (total <= ROPE_FANOUT) {
+		memmove(&node->u.child[i + k], &node->u.child[i + 1], sizeof(struct ropeNode *) * (node->n - i - 1));
+		memcpy(&node->u.child[i], tmp, sizeof(struct ropeNode *) * k);
+		node->n = total;
+		ropeRecount(node);
+		out[0] = node;
+		return 1;
+	}
+	memcpy(out, node->u.child, sizeof(struct ropeNode *) * i);
+	memcpy(out + i, tmp, sizeof(struct ropeNode *) * k);
+	memcpy(out + i + k, &node->u.child[i + 1], sizeof(struct ropeNode *) * (node->n - i - 1));
+	free(node);
+	return ropeGroup(r, out, total);
+}
+
+static int ropeInsert(void *impl, size_t at, const char *s, size_t len) {
+	struct ropeText *r = impl;
+	if (at > r->root->bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ropeReserveFor(r, len / ROPE_CHUNK + 2, ropeHeight(r->root)) == -1) return -1;
+	struct ropeNode **list = r->scratch[0];
+	size_t k = ropeInsertNode(r, r->root, at, s, len, list, r->scratch[1]);
+	while (k > 1) k = ropeGroup(r, list, k);
+	r->root = list[0];
+	return 0;
+}
+
+/* Evens out two neighbours, or folds the right one into the left when both
+ * fit in one node; returns 1 if it did the latter. */
+static int ropeMerge(struct ropeNode *a, struct ropeNode *b) {
+	if (a->leaf) {
+		size_t total = a->bytes + b->bytes;
+		if (total <= ROPE_CHUNK) {
+			memcpy(a->u.text + a->bytes, b->u.text, b->bytes);
+			a->bytes = total;
+			a->lines += b->lines;
+			a->tabs += b->tabs;
+			free(b);
+			return 1;
+		}
+		size_t half = total / 2;
+		if (a->bytes < half) {
+			size_t m = half - a->bytes;
+			memcpy(a->u.text + a->bytes, b->u.text, m);
+			memmove(b->u.text, b->u.text + m, b->bytes - m);
+			a->bytes += m;
+			b->bytes -= m;
+		} else {
+			size_t m = a->bytes - half;
+			memmove(b->u.text + m, b->u.text, b->bytes);
+			memcpy(b->u.text, a->u.text + half, m);
+			a->bytes -= m;
+			b->bytes += m;
+		}
+	} else {
+		int total = a->n + b->n;
+		if (total <= ROPE_FANOUT) {
+			memcpy(&a->u.child[a->n], b->u.child, sizeof(struct ropeNode *) * b->n);
+			a->n = total;
+			ropeRecount(a);
+			free(b);
+			return 1;
+		}
+		int half = total / 2;
+		if (a->n < half) {
+			int m = half - a->n;
+			memcpy(&a->u.child[a->n], b->u.child, sizeof(struct ropeNode *) * m);
+			memmove(b->u.child, &b->u.child[m], sizeof(struct ropeNode *) * (b->n - m));
+			a->n += m;
+			b->n -= m;
+		} else {
+			int m = a->n - half;
+			memmove(&b->u.child[m], b->u.child, sizeof(struct ropeNode *) * b->n);
+			memcpy(b->u.child, &a->u.child[half], sizeof(struct ropeNode *) * m);
+			a->n -= m;
+			b->n += m;
+		}
+	}
+	ropeRecount(a);
+	ropeRecount(b);
+	return 0;
+}
+
+static int ropeUnderfull(const struct ropeNode *node) {
+	return node->leaf ? node->bytes < ROPE_CHUNK / 4 : node->n < ROPE_FANOUT / 4;
+}
+
+/* Removes [at, at + len) from a node that keeps some of its text. */
+static void ropeDeleteNode(struct ropeNode *node, size_t at, size_t len) {
+	if (node->leaf) {
+		size_t lines = 0;
+		size_t tabs = 0;
+		ropeCount(node->u.text + at, len, &lines, &tabs);
+		memmove(node->u.text + at, node->u.text + at + len, node->bytes - at - len);
+		node->bytes -= len;
+		node->lines -= lines;
+		node->tabs -= tabs;
+		return;
+	}
+
+	size_t end = at + len;
+	size_t base = 0;
+	int kept = 0;
+	for (int i = 0; i < node->n; i++) {
+		struct ropeNode *c = node->u.child[i];
+		size_t cb = c->bytes;
+		size_t lo = at > base ? at : base;
+		size_t hi = end < base + cb ? end : base + cb;
+		if (hi > lo && lo == base && hi == base + cb) {
+			ropeFree(c);
+		} else {
+			if (hi > lo) ropeDeleteNode(c, lo - base, hi - lo);
+			node->u.child[kept++] = c;
+		}
+		base += cb;
+	}
+	node->n = kept;
+
+	int i = 0;
+	while (i < node->n) {
+		if (node->n > 1 && ropeUnderfull(node->u.child[i])) {
+			int l = i + 1 < node->n ? i : i - 1;
+			if (ropeMerge(node->u.child[l], node->u.child[l + 1])) {
+				memmove(&node->u.child[l + 1], &node->u.child[l + 2], sizeof(struct ropeNode *) * (node->n - l - 2));
+				node->n--;
+				i = l;
+				continue;
+			}
+		}
+		i++;
+	}
+	ropeRecount(node);
+}
+
+static int ropeDelete(void *impl, size_t at, size_t len) {
+	struct ropeText *r = impl;
+	if (at > r->root->bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > r->root->bytes - at) len = r->root->bytes - at;
+	if (len == 0) return 0;
+	if (len == r->root->bytes) {
+		if (ropeReserve(r, 1, 1) == -1) return -1;
+		ropeFree(r->root);
+		r->root = ropeTake(r, 1);
+		return 0;
+	}
+	ropeDeleteNode(r->root, at, len);
+	while (!r->root->leaf && r->root->n == 1) {
+		struct ropeNode *old = r->root;
+		r->root = old->u.child[0];
+		free(old);
+	}
+	return 0;
+}
+
+static void ropeClose(void *impl) {
+	struct ropeText *r = impl;
+	if (r->root != NULL) ropeFree(r->root);
+	for (int leaf = 0; leaf < 2; leaf++) {
+		while (r->spare[leaf] != NULL) {
+			struct ropeNode *next = r->spare[leaf]->u.child[0];
+			free(r->spare[leaf]);
+			r->spare[leaf] = next;
+		}
+	}
+	free(r->scratch[0]);
+	free(r->scratch[1]);
+	free(r);
+}
+
+static void *ropeOpenMemory(const char *data, size_t len) {
+	struct ropeText *r = calloc(1, sizeof(struct ropeText));
+	if (r == NULL) return NULL;
+	if (ropeReserveFor(r, len / ROPE_CHUNK + 1, 0) == -1) {
+		ropeClose(r);
+		return NULL;
+	}
+	struct ropeSpan sp = {data, len};
+	size_t k = ropeLeaves(r, &sp, len, r->scratch[0]);
+	while (k > 1) k = ropeGroup(r, r->scratch[0], k);
+	r->root = r->scratch[0][0];
+	return r;
+}
+
+/* Reads straight into full leaves, so the file is never held twice. */
+static void *ropeOpen(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct ropeText *r = calloc(1, sizeof(struct ropeText));
+	if (r == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t k = 0;
+	int err = 0;
+	for (;;) {
+		if (ropeScratch(r, k + 1) == -1 || ropeReserve(r, 1, 1) == -1) {
+			err = ENOMEM;
+			break;
+		}
+		struct ropeNode *leaf = ropeTake(r, 1);
+		r->scratch[0][k++] = leaf;
+		ssize_t n;
+		while (leaf->bytes < ROPE_CHUNK && (n = read(fd, leaf->u.text + leaf->bytes, ROPE_CHUNK - leaf->bytes)) != 0) {
+			if (n == -1) {
+				if (errno == EINTR) continue;
+				err = errno;
+				break;
+			}
+			leaf->bytes += n;
+		}
+		ropeRecount(leaf);
+		if (err || leaf->bytes < ROPE_CHUNK) break;
+	}
+	close(fd);
+	if (k > 1 && r->scratch[0][k - 1]->bytes == 0) free(r->scratch[0][--k]);
+	if (err == 0 && ropeReserve(r, 0, ropeInnersFor(k, 0)) == -1) err = ENOMEM;
+	if (err) {
+		while (k > 0) free(r->scratch[0][--k]);
+		ropeClose(r);
+		errno = err;
+		return NULL;
+	}
+	while (k > 1) k = ropeGroup(r, r->scratch[0], k);
+	r->root = r->scratch[0][0];
+	return r;
+}
+
+static size_t ropeLength(const void *impl) {
+	return ((const struct ropeText *)impl)->root->bytes;
+}
+
+static int ropeIterateNode(const struct ropeNode *node, size_t at, size_t end, fouSpanFn fn, void *arg) {
+	if (node->leaf) return end > at && fn(arg, node->u.text + at, end - at);
+	size_t base = 0;
+	for (int i = 0; i < node->n && base < end; i++) {
+		size_t cb = node->u.child[i]->bytes;
+		if (base + cb > at) {
+			size_t lo = at > base ? at - base : 0;
+			size_t hi = end - base < cb ? end - base : cb;
+			if (ropeIterateNode(node->u.child[i], lo, hi, fn, arg)) return 1;
+		}
+		base += cb;
+	}
+	return 0;
+}
+
+static int ropeIterate(const void *impl, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	const struct ropeText *r = impl;
+	if (at > r->root->bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > r->root->bytes - at) len = r->root->bytes - at;
+	return ropeIterateNode(r->root, at, at + len, fn, arg);
+}
+
+static size_t ropeLineStart(const void *impl, size_t line) {
+	const struct ropeNode *node = ((const struct ropeText *)impl)->root;
+	if (line == 0) return 0;
+	if (line > node->lines) return node->bytes;
+	size_t base = 0;
+	while (!node->leaf) {
+		int i = 0;
+		while (line > node->u.child[i]->lines) {
+			line -= node->u.child[i]->lines;
+			base += node->u.child[i]->bytes;
+			i++;
+		}
+		node = node->u.child[i];
+	}
+	const char *p = node->u.text;
+	for (;;) {
+		p = memchr(p, '\n', node->bytes - (p - node->u.text));
+		if (--line == 0) return base + (p - node->u.text) + 1;
+		p++;
+	}
+}
+
+static void ropeCountNode(const struct ropeNode *node, size_t at, size_t end, size_t *lines, size_t *tabs) {
+	if (at == 0 && end == node->bytes) {
+		*lines += node->lines;
+		*tabs += node->tabs;
+		return;
+	}
+	if (node->leaf) {
+		ropeCount(node->u.text + at, end - at, lines, tabs);
+		return;
+	}
+	size_t base = 0;
+	for (int i = 0; i < node->n && base < end; i++) {
+		size_t cb = node->u.child[i]->bytes;
+		if (base + cb > at) {
+			size_t lo = at > base ? at - base : 0;
+			size_t hi = end - base < cb ? end - base : cb;
+			ropeCountNode(node->u.child[i], lo, hi, lines, tabs);
+		}
+		base += cb;
+	}
+}
+
+static int ropeMetrics(const void *impl, size_t at, size_t len, size_t *lines, size_t *tabs) {
+	const struct ropeText *r = impl;
+	if (at > r->root->bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > r->root->bytes - at) len = r->root->bytes - at;
+	*lines = 0;
+	*tabs = 0;
+	ropeCountNode(r->root, at, at + len, lines, tabs);
+	return 0;
+}
+
+/*** backends ***/
+
+static const struct fouTextOps fouTextBackends[] = {
+	{"pieces", piecesOpen, piecesOpenMemory, piecesClose, piecesLength, piecesInsert, piecesDelete,
+		piecesIterate, NULL, NULL, piecesSearch, piecesReplaceAll},
+	{"gap", NULL, gapOpenMemory, gapClose, gapLength, gapInsert, gapDelete,
+		gapIterate, NULL, NULL, NULL, NULL},
+	{"rows", NULL, rowsOpenMemory, rowsClose, rowsLength, rowsInsert, rowsDelete,
+		rowsIterate, rowsLineStart, NULL, NULL, NULL},
+	{"rope", ropeOpen, ropeOpenMemory, ropeClose, ropeLength, ropeInsert, ropeDelete,
+		ropeIterate, ropeLineStart, ropeMetrics, NULL, NULL},
+};
+
+#define FOU_TEXT_NBACKENDS (sizeof(fouTextBackends) / sizeof(fouTextBackends[0]))
+
+const char *fouTextBackendName(int i) {
+	if (i < 0 || (size_t)i >= FOU_TEXT_NBACKENDS) return NULL;
+	return fouTextBackends[i].name;
+}
+
+static const struct fouTextOps *fouTextFind(const char *backend) {
+	if (backend == NULL) return &fouTextBackends[0];
+	for (size_t i = 0; i < FOU_TEXT_NBACKENDS; i++) {
+		if (strcmp(fouTextBackends[i].name, backend) == 0) return &fouTextBackends[i];
+	}
+	errno = EINVAL;
+	return NULL;
+}
+
+/*** open and close ***/
+
+static fouText *fouTextWrap(const struct fouTextOps *ops, void *impl) {
+	if (impl == NULL) {
+		errno = errno ? errno : ENOMEM;
+		return NULL;
+	}
+	fouText *t = malloc(sizeof(fouText));
+	if (t == NULL) {
+		ops->close(impl);
+		errno = ENOMEM;
+		return NULL;
+	}
+	t->ops = ops;
+	t->impl = impl;
+	return t;
+}
+
+fouText *fouTextOpenMemory(const char *backend, const char *data, size_t len) {
+	const struct fouTextOps *ops = fouTextFind(backend);
+	if (ops == NULL) return NULL;
+	errno = 0;
+	return fouTextWrap(ops, ops->openMemory(data, len));
+}
+
+fouText *fouTextOpen(const char *backend, const char *path) {
+	const struct fouTextOps *ops = fouTextFind(backend);
+	if (ops == NULL) return NULL;
+	errno = 0;
+	if (ops->open != NULL) return fouTextWrap(ops, ops->open(path));
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	char *data = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	ssize_t n;
+	for (;;) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			char *grown = realloc(data, cap);
+			if (grown == NULL) {
+				n = -1;
+				errno = ENOMEM;
+				break;
+			}
+			data = grown;
+		}
+		n = read(fd, data + len, cap - len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		len += n;
+	}
+	int err = errno;
+	close(fd);
+	if (n == -1) {
+		free(data);
+		errno = err;
+		return NULL;
+	}
+	errno = 0;
+	fouText *t = fouTextWrap(ops, ops->openMemory(data, len));
+	free(data);
+	return t;
+}
+
+void fouTextClose(fouText *t) {
+	if (t == NULL) return;
+	t->ops->close(t->impl);
+	free(t);
+}
+
+const char *fouTextBackend(const fouText *t) {
+	return t->ops->name;
+}
+
+/*** editing ***/
+
+size_t fouTextLength(const fouText *t) {
+	return t->ops->length(t->impl);
+}
+
+int fouTextInsert(fouText *t, size_t at, const char *s, size_t len) {
+	if (at > fouTextLength(t)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len == 0) return 0;
+	return t->ops->insert(t->impl, at, s, len);
+}
+
+int fouTextDelete(fouText *t, size_t at, size_t len) {
+	return t->ops->del(t->impl, at, len);
+}
+
+long fouTextReplaceAll(fouText *t, const char *needle, size_t nlen, const char *with, size_t wlen) {
+	if (t->ops->replaceAll != NULL) return t->ops->replaceAll(t->impl, needle, nlen, with, wlen);
+	if (nlen == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	long count = 0;
+	size_t from = 0;
+	size_t pos;
+	int r;
+	while ((r = fouTextSearch(t, from, needle, nlen, &pos)) == 1) {
+		if (fouTextDelete(t, pos, nlen) == -1 || fouTextInsert(t, pos, with, wlen) == -1) return -1;
+		from = pos + wlen;
+		count++;
+	}
+	return r == -1 ? -1 : count;
+}
+
+/*** reading ***/
+
+int fouTextIterate(const fouText *t, size_t at, size_t len, fouSpanFn fn, void *arg) {
+	return t->ops->iterate(t->impl, at, len, fn, arg);
+}
+
+struct fouTextLines {
+	size_t line;
+	size_t seen;
+	size_t base;
+	size_t found;
+};
+
+static int fouTextLineSpan(void *arg, const char *data, size_t len) {
+	struct fouTextLines *tl = arg;
+	const char *nl = data;
+	while ((nl = memchr(nl, '\n', len - (nl - data))) != NULL) {
+		nl++;
+		if (++tl->seen == tl->line) {
+			tl->found = tl->base + (nl - data);
+			return 1;
+		}
+	}
+	tl->base += len;
+	return 0;
+}
+
+/* Offset of the first byte of a line, or the end of the text. */
+size_t fouTextLineStart(const fouText *t, size_t line) {
+	if (t->ops->lineStart != NULL) return t->ops->lineStart(t->impl, line);
+	if (line == 0) return 0;
+	size_t length = fouTextLength(t);
+	struct fouTextLines tl = {line, 0, 0, length};
+	fouTextIterate(t, 0, length, fouTextLineSpan, &tl);
+	return tl.found;
+}
+
+struct fouTextTally {
+	size_t lines;
+	size_t tabs;
+};
+
+static int fouTextTallySpan(void *arg, const char *data, size_t len) {
+	struct fouTextTally *tt = arg;
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] == '\n') tt->lines++;
+		else if (data[i] == '\t') tt->tabs++;
+	}
+	return 0;
+}
+
+/* Newlines and tabs in [at, at + len). */
+int fouTextCount(const fouText *t, size_t at, size_t len, size_t *lines, size_t *tabs) {
+	if (t->ops->count != NULL) return t->ops->count(t->impl, at, len, lines, tabs);
+	struct fouTextTally tt = {0, 0};
+	if (fouTextIterate(t, at, len, fouTextTallySpan, &tt) == -1) return -1;
+	*lines = tt.lines;
+	*tabs = tt.tabs;
+	return 0;
+}
+
+struct fouTextMatch {
+	const fouText *t;
+	const char *needle;
+	size_t nlen;
+	char *window;
+	size_t base;
+	size_t found;
+};
+
+/* Candidates come from memchr on each span; the rest of the needle is read
+ * back through the backend, so a match may cross spans. */
+static int fouTextFindSpan(void *arg, const char *data, size_t len) {
+	struct fouTextMatch *tf = arg;
+	const char *p = data;
+	while ((p = memchr(p, tf->needle[0], len - (p - data))) != NULL) {
+		size_t at = tf->base + (p - data);
+		if (fouTextRead(tf->t, at, tf->window, tf->nlen) == tf->nlen && memcmp(tf->window, tf->needle, tf->nlen) == 0) {
+			tf->found = at;
+			return 1;
+		}
+		p++;
+	}
+	tf->base += len;
+	return 0;
+}
+
+int fouTextSearch(const fouText *t, size_t from, const char *needle, size_t nlen, size_t *pos) {
+	if (nlen == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (t->ops->search != NULL) return t->ops->search(t->impl, from, needle, nlen, pos);
+	size_t length = fouTextLength(t);
+	if (from >= length) return 0;
+	struct fouTextMatch tf = {t, needle, nlen, malloc(nlen), from, 0};
+	if (tf.window == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int hit = fouTextIterate(t, from, length - from, fouTextFindSpan, &tf) == 1;
+	free(tf.window);
+	if (hit) *pos = tf.found;
+	return hit;
+}
+
+struct fouTextReadBuf {
+	char *buf;
+	size_t len;
+};
+
+static int fouTextReadSpan(void *arg, const char *data, size_t len) {
+	struct fouTextReadBuf *rb = arg;
+	memcpy(rb->buf + rb->len, data, len);
+	rb->len += len;
+	return 0;
+}
+
+size_t fouTextRead(const fouText *t, size_t at, char *buf, size_t len) {
+	struct fouTextReadBuf rb = {buf, 0};
+	if (fouTextIterate(t, at, len, fouTextReadSpan, &rb) == -1) return 0;
+	return rb.len;
+}
+
+static int fouTextWriteSpan(void *arg, const char *data, size_t len) {
+	return fwrite(data, 1, len, arg) != len;
+}
+
+int fouTextWrite(const fouText *t, FILE *fp) {
+	errno = 0;
+	if (fouTextIterate(t, 0, fouTextLength(t), fouTextWriteSpan, fp) != 0) {
+		if (errno == 0) errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+int fouTextSave(const fouText *t, const char *path) {
+	char *tmp = malloc(strlen(path) + 5);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	FILE *fp = fopen(tmp, "w");
+	int ok = fp != NULL && fouTextWrite(t, fp) == 0 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	int err = errno;
+	if (fp != NULL && fclose(fp) != 0 && ok) {
+		ok = 0;
+		err = errno;
+	}
+	if (ok && rename(tmp, path) == -1) {
+		ok = 0;
+		err = errno;
+	}
+	if (!ok) unlink(tmp);
+	free(tmp);
+	errno = err;
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+#ifndef FOU_TEXT_H
+#define FOU_TEXT_H
+
+/*
+ * One text-storage interface over several backends, so that the same edits
+ * can be run against each layout and compared.
+ *
+ *   pieces  the piece table of fou_engine.h
+ *   gap     one gap buffer holding the whole text
+ *   rows    an array of lines, as fou keeps them
+ *   rope    a B-tree of text chunks with cached counts, so line lookup and
+ *           counting are O(log n) as well as edits
+ *
+ * Backends are chosen by name when a text is opened; NULL picks the first.
+ * Offsets and lengths are in bytes and lines count from 0. Calls that can
+ * fail return -1 (or NULL) and set errno.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "fou_engine.h"
+
+typedef struct fouText fouText;
+
+const char *fouTextBackendName(int i);
+
+fouText *fouTextOpen(const char *backend, const char *path);
+fouText *fouTextOpenMemory(const char *backend, const char *data, size_t len);
+void fouTextClose(fouText *t);
+const char *fouTextBackend(const fouText *t);
+
+size_t fouTextLength(const fouText *t);
+int fouTextInsert(fouText *t, size_t at, const char *s, size_t len);
+int fouTextDelete(fouText *t, size_t at, size_t len);
+long fouTextReplaceAll(fouText *t, const char *needle, size_t nlen, const char *with, size_t wlen);
+
+size_t fouTextLineStart(const fouText *t, size_t line);
+int fouTextCount(const fouText *t, size_t at, size_t len, size_t *lines, size_t *tabs);
+int fouTextIterate(const fouText *t, size_t at, size_t len, fouSpanFn fn, void *arg);
+int fouTextSearch(const fouText *t, size_t from, const char *needle, size_t nlen, size_t *pos);
+size_t fouTextRead(const fouText *t, size_t at, char *buf, size_t len);
+int fouTextWrite(const fouText *t, FILE *fp);
+int fouTextSave(const fouText *t, const char *path);
+
+#endif
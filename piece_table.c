@@ -1,273 +1,330 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-struct Piece {
-	int start;
-	int length;
-	char **target;
-};
-
-struct PieceTable {
-	char* content;
-	char* add;
-	size_t add_size;
-	size_t size;
-	struct Piece* p;
-} pt;
-
-void destroyer() {
-	free(pt.content);
-	free(pt.add);
-	free(pt.p);
-}
-
-void printPieces() {
-	for(int i = 0; i < pt.size; i++) {
-		for(int j = 0; j < pt.p[i].length; j++) {
-			printf("%c", (*pt.p[i].target)[pt.p[i].start + j]);
-		}
-	}
-	printf("\n");
-	for (int i = 0; i < pt.size; i++) {
-		printf("%d,%d %.7s\n", pt.p[i].start, pt.p[i].length, *pt.p[i].target == pt.content ? "Content" : "Add");
-	}
-}
-
-void createPieceTable(char* file_name) {
-	FILE* file = fopen(file_name, "r");
-	if (file == NULL) {
-		perror("Error Opening file");
-		exit(0);
-	}
-
-	fseek(file, 0, SEEK_END);
-	long file_size = ftell(file);
-	rewind(file);
-
-	pt.content = malloc(file_size + 1);
-	if (pt.content == NULL){		
-		perror("Memory Allocation for PieceTable Failed");
-		fclose(file);
-		exit(0);
-	}
-
-	size_t read_size = fread(pt.content, 1, file_size, file);
-	fclose(file);
-
-	if (read_size != file_size) {
-		perror("Error loading file into memory");
-		free(pt.content);
-		exit(0);
-	}
-
-	pt.content[file_size] = '\0';
-	pt.add = malloc(0);
-	pt.add_size = 0;
-	pt.size = 1;
-	pt.p = malloc(sizeof(struct Piece));
-	pt.p[0].start = 0;
-	pt.p[0].length = file_size;
-	pt.p[0].target = &pt.content;
-	if (atexit(destroyer) != 0) {
-		perror("Failed to register atexit handler");
-		free(pt.content);
-		free(pt.p);
-		exit(0);
-	}
-}
-
-void insertInBetween(int x, char c, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 2));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-
-	for (int i = pt.size + 1; i > insert_index + 1; i--) {
-		pt.p[i] = pt.p[i - 2];
-	}
-
-	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-	if (new_add == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	new_add[pt.add_size] = c;
-	pt.add = new_add;
-
-	pt.p[insert_index + 1].start = pt.add_size;
-	pt.p[insert_index + 1].length = 1;
-	pt.p[insert_index + 1].target = &pt.add;
-
-	pt.p[insert_index + 2].start = pt.p[insert_index].start + x;
-	pt.p[insert_index + 2].length = pt.p[insert_index].length - x;
-	pt.p[insert_index + 2].target = pt.p[insert_index].target;
-	pt.p[insert_index].length = x;
-
-	pt.size += 2;
-	pt.add_size += 1;
-}
-
-void insertAtEnd(char c, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-
-	for (int i = pt.size; i > insert_index + 1; i--) {
-		pt.p[i] = pt.p[i - 1];
-	}
-
-	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-	if (new_add == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	new_add[pt.add_size] = c;
-	pt.add = new_add;
-
-	pt.p[insert_index + 1].start = pt.add_size;
-	pt.p[insert_index + 1].length = 1;
-	pt.p[insert_index + 1].target = &pt.add;
-
-	pt.size += 1;
-	pt.add_size += 1;
-}
-
-void insertCharacter(int x, char c) {
-	int insert_index = -1;
-	int curr_length = 0;
-	for (int i = 0; i < pt.size; i++) {
-		curr_length += pt.p[i].length;
-		if (x < curr_length) {
-			x -= (curr_length - pt.p[i].length);
-			insert_index = i;
-			insertInBetween(x, c, insert_index);
-			break;
-		} else if (x == curr_length) {
-			if (*pt.p[i].target == pt.add && (pt.add_size == pt.p[i].start + pt.p[i].length)){
-				char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-				if (new_add == NULL) {
-					perror("Memory Allocation Failed!");
-					exit(0);
-				}
-				new_add[pt.add_size] = c;
-				pt.add = new_add;
-				pt.p[i].length += 1;
-				pt.add_size += 1;
-				return;
-			} else {
-			 	insert_index = i;
-			 	insertAtEnd(c, insert_index);
-			 	break;
-			 }
-		}
-	}
-
-	if (insert_index == -1) {
-		printf("Out of bounds index %d", x);
-		return;
-	}
-}
-
-void deleteInBetwen(int x, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	for(int i = pt.size; (i - 1) > insert_index; i--) {
-		pt.p[i] = pt.p[i - 1];
-	}
-	pt.p[insert_index + 1].length = pt.p[insert_index].length;
-	pt.p[insert_index].length = x;
-	pt.p[insert_index + 1].start = pt.p[insert_index].start + x + 1;
-	pt.p[insert_index + 1].length -= (x + 1);
-	pt.p[insert_index + 1].target = pt.p[insert_index].target;
-	pt.size += 1;
-}
-
-void deleteAtEnd(int insert_index) {
-	if (pt.p[insert_index].length == 1) {
-		for (int i = insert_index; i < pt.size - 1; i++){
-			pt.p[i] = pt.p[i + 1];
-		}
-		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
-		pt.size -= 1;
-	} else {
-		pt.p[insert_index].length -= 1;
-	}
-}
-
-void deleteAtBeginning(int insert_index) {
-	if (pt.p[insert_index].length == 1) {
-		for (int i = insert_index; i < pt.size - 1; i++){
-			pt.p[i] = pt.p[i + 1];
-		}
-		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
-		pt.size -= 1;
-	} else {
-		pt.p[insert_index].start += 1;
-		pt.p[insert_index].length -= 1;
-	}
-}
-
-void deleteCharacter(int x) {
-	int curr_length = 0;
-	for (int i = 0; i < pt.size; i++) {
-		curr_length += pt.p[i].length;
-		if (x < (curr_length - 1)) {
-			x -= (curr_length - pt.p[i].length);
-			if (x == 0) {
-				deleteAtBeginning(i);
-				break;
-			}
-			deleteInBetwen(x, i);
-			break;
-		} else if (x == (curr_length - 1)) {
-			deleteAtEnd(i);
-			break;
-		} else if (x == (curr_length)) {
-			deleteAtBeginning(i + 1);
-			break;
-		}
-	}
-}
-
-void printMenu() {
-	printf("\n========= Menu =========\n");
-	printf("1) Add Characters\n");
-	printf("2) Del Characters\n");
-	printf("3) Exit\n\n");
-	printf("Enter your choice: ");
-}
-
-int main(int argc, char **argv) {
-	if (argc < 2) {
-		perror("No file argument given");
-		exit(0);
-	}
-	createPieceTable(argv[1]);
-	int choice = -1;
-	while(choice != 3) {
-		printPieces();
-		printMenu();
-		scanf("%d", &choice);
-		if (choice == 1){
-			int pos;
-			char c;
-			printf("\nEnter the position: ");
-			scanf(" %d", &pos);
-			printf("Enter the character: ");
-			scanf(" %c", &c);
-			insertCharacter(pos, c);
-		} else if (choice == 2) {
-			int pos;
-			printf("\nEnter the position: ");
-			scanf(" %d", &pos);
-			deleteCharacter(pos);
-		}
-	}
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "fou_engine.h"
+#include "fou_text.h"
+
+fouDocument *doc;
+
+void destroyer() {
+	fouClose(doc);
+	doc = NULL;
+}
+
+void printPieces() {
+	fouWrite(doc, stdout);
+	printf("\n");
+	for (size_t i = 0; i < fouPieceCount(doc); i++) {
+		size_t start, length;
+		enum fouBuffer buffer;
+		fouPieceInfo(doc, i, &start, &length, &buffer);
+		printf("%zu,%zu %.7s\n", start, length, buffer == FOU_ORIGINAL ? "Content" : "Add");
+	}
+}
+
+void createPieceTable(char* file_name) {
+	doc = fouOpen(file_name);
+	if (doc == NULL) {
+		perror("Error Opening file");
+		exit(0);
+	}
+	static int registered = 0;
+	if (!registered && atexit(destroyer) != 0) {
+		perror("Failed to register atexit handler");
+		fouClose(doc);
+		exit(0);
+	}
+	registered = 1;
+}
+
+void insertCharacter(int x, char c) {
+	if (x < 0 || fouInsert(doc, x, &c, 1) == -1) {
+		printf("Out of bounds index %d", x);
+	}
+}
+
+void deleteCharacter(int x) {
+	if (x >= 0) fouDelete(doc, x, 1);
+}
+
+int saveText(fouText *t, const char *path) {
+	if (strcmp(path, "-") == 0) {
+		return fouTextWrite(t, stdout) == 0 && fflush(stdout) == 0 ? 0 : -1;
+	}
+	return fouTextSave(t, path);
+}
+
+/*
+ * Batch mode: piece_table -s script [-t] [-b backend] file...
+ *
+ * The script is applied to every file in turn, one command per line:
+ *
+ *   goto LINE      move to the start of a 1-based line
+ *   insert TEXT    insert TEXT at the position and move past it
+ *   delete N       delete N bytes at the position
+ *   replace /A/B/  replace every A with B; any delimiter may be used
+ *   save [PATH]    write the document to PATH, - for stdout, or over the file
+ *
+ * TEXT, A and B understand \n, \t, \r and \\. Blank lines and lines starting
+ * with # are ignored. A script that never saves writes the result to stdout.
+ *
+ * -b runs the script on another storage backend of fou_text.h, so the same
+ * script can time each of them; -t prints the time taken per file and the
+ * peak memory of the process so far.
+ */
+struct scriptOp {
+	char cmd;
+	size_t n;
+	char *a;
+	int alen;
+	char *b;
+	int blen;
+	int line;
+};
+
+struct script {
+	const char *path;
+	struct scriptOp *ops;
+	int count;
+	int saves;
+};
+
+/* Unescapes s[0..len) in place and returns the new length. */
+int unescape(char *s, int len) {
+	int j = 0;
+	for (int i = 0; i < len; i++) {
+		if (s[i] == '\\' && i + 1 < len) {
+			i++;
+			if (s[i] == 'n') s[j++] = '\n';
+			else if (s[i] == 't') s[j++] = '\t';
+			else if (s[i] == 'r') s[j++] = '\r';
+			else s[j++] = s[i];
+		} else {
+			s[j++] = s[i];
+		}
+	}
+	return j;
+}
+
+void scriptError(const char *path, int line, const char *msg) {
+	fprintf(stderr, "%s:%d: %s\n", path, line, msg);
+	exit(1);
+}
+
+/* Counts are byte counts and line numbers, so they are read as size_t. */
+size_t scriptCount(const char *path, int line, const char *arg) {
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(arg, &end, 10);
+	if (end == arg || *end != '\0' || arg[0] == '-' || errno == ERANGE) {
+		scriptError(path, line, "expected a number");
+	}
+	return n;
+}
+
+void loadScript(const char *path, struct script *sc) {
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (fp == NULL) {
+		perror("Error Opening script");
+		exit(1);
+	}
+	sc->path = path;
+	sc->ops = NULL;
+	sc->count = 0;
+	sc->saves = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	int lineno = 0;
+	while ((linelen = getline(&line, &linecap, fp)) != -1) {
+		lineno++;
+		while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
+		line[linelen] = '\0';
+		if (linelen == 0 || line[0] == '#') continue;
+
+		char *arg = strchr(line, ' ');
+		int cmdlen = arg ? arg - line : linelen;
+		arg = arg ? arg + 1 : line + linelen;
+		int arglen = linelen - (arg - line);
+
+		struct scriptOp op = {0, 0, NULL, 0, NULL, 0, lineno};
+		if (cmdlen == 4 && strncmp(line, "goto", 4) == 0) {
+			op.cmd = 'g';
+			op.n = scriptCount(path, lineno, arg);
+		} else if (cmdlen == 6 && strncmp(line, "insert", 6) == 0) {
+			op.cmd = 'i';
+			op.a = strndup(arg, arglen);
+			op.alen = unescape(op.a, arglen);
+		} else if (cmdlen == 6 && strncmp(line, "delete", 6) == 0) {
+			op.cmd = 'd';
+			op.n = scriptCount(path, lineno, arg);
+		} else if (cmdlen == 7 && strncmp(line, "replace", 7) == 0) {
+			op.cmd = 'r';
+			if (arglen < 3) scriptError(path, lineno, "replace needs /old/new/");
+			char delim = arg[0];
+			char *mid = memchr(arg + 1, delim, arglen - 1);
+			if (mid == NULL) scriptError(path, lineno, "replace needs /old/new/");
+			char *end = memchr(mid + 1, delim, arglen - (mid + 1 - arg));
+			if (end == NULL) end = arg + arglen;
+			op.a = strndup(arg + 1, mid - arg - 1);
+			op.alen = unescape(op.a, mid - arg - 1);
+			op.b = strndup(mid + 1, end - mid - 1);
+			op.blen = unescape(op.b, end - mid - 1);
+			if (op.alen == 0) scriptError(path, lineno, "replace with an empty pattern");
+		} else if (cmdlen == 4 && strncmp(line, "save", 4) == 0) {
+			op.cmd = 's';
+			op.a = arglen > 0 ? strndup(arg, arglen) : NULL;
+			sc->saves++;
+		} else {
+			scriptError(path, lineno, "unknown command");
+		}
+
+		sc->ops = realloc(sc->ops, sizeof(struct scriptOp) * (sc->count + 1));
+		if (sc->ops == NULL) {
+			perror("Memory Allocation Failed!");
+			exit(1);
+		}
+		sc->ops[sc->count++] = op;
+	}
+	free(line);
+	if (fp != stdin) fclose(fp);
+}
+
+void freeScript(struct script *sc) {
+	for (int i = 0; i < sc->count; i++) {
+		free(sc->ops[i].a);
+		free(sc->ops[i].b);
+	}
+	free(sc->ops);
+}
+
+double elapsed(struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int runScript(struct script *sc, char *file, const char *backend, int timing) {
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fouText *t = fouTextOpen(backend, file);
+	if (t == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return 1;
+	}
+	long long bytes = fouTextLength(t);
+	size_t pos = 0;
+	int failed = 0;
+	for (int i = 0; i < sc->count && !failed; i++) {
+		struct scriptOp *op = &sc->ops[i];
+		size_t len = fouTextLength(t);
+		if (pos > len) pos = len;
+		switch (op->cmd) {
+			case 'g':
+				pos = fouTextLineStart(t, op->n > 1 ? op->n - 1 : 0);
+				break;
+			case 'i':
+				failed = fouTextInsert(t, pos, op->a, op->alen) == -1;
+				pos += op->alen;
+				break;
+			case 'd':
+				failed = fouTextDelete(t, pos, op->n) == -1;
+				break;
+			case 'r':
+				failed = fouTextReplaceAll(t, op->a, op->alen, op->b, op->blen) == -1;
+				break;
+			case 's':
+				if (saveText(t, op->a ? op->a : file) == -1) {
+					fprintf(stderr, "%s: save failed: %s\n", op->a ? op->a : file, strerror(errno));
+					failed = 1;
+				}
+				break;
+		}
+		if (failed && op->cmd != 's') {
+			fprintf(stderr, "%s:%d: %s: %s\n", sc->path, op->line, file, strerror(errno));
+		}
+	}
+	if (!failed && sc->saves == 0 && fouTextWrite(t, stdout) == -1) failed = 1;
+	if (timing) {
+		double secs = elapsed(&t0);
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		fprintf(stderr, "%s: %s, %d ops, %lld bytes in %.3fs (%.1f MB/s), peak %ld KB\n",
+				file, fouTextBackend(t), sc->count, bytes, secs, secs > 0 ? bytes / secs / (1024 * 1024) : 0.0, ru.ru_maxrss);
+	}
+	fouTextClose(t);
+	return failed;
+}
+
+void printMenu() {
+	printf("\n========= Menu =========\n");
+	printf("1) Add Characters\n");
+	printf("2) Del Characters\n");
+	printf("3) Exit\n\n");
+	printf("Enter your choice: ");
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
+		struct script sc;
+		loadScript(argv[2], &sc);
+		int timing = 0;
+		const char *backend = NULL;
+		int first = 3;
+		while (first < argc) {
+			if (strcmp(argv[first], "-t") == 0) {
+				timing = 1;
+				first++;
+			} else if (strcmp(argv[first], "-b") == 0 && first + 1 < argc) {
+				backend = argv[first + 1];
+				first += 2;
+			} else {
+				break;
+			}
+		}
+		if (first >= argc) {
+			fprintf(stderr, "usage: %s -s script [-t] [-b backend] file...\nbackends:", argv[0]);
+			for (int i = 0; fouTextBackendName(i) != NULL; i++) fprintf(stderr, " %s", fouTextBackendName(i));
+			fprintf(stderr, "\n");
+			exit(1);
+		}
+		int failed = 0;
+		for (int i = first; i < argc; i++) {
+			failed |= runScript(&sc, argv[i], backend, timing);
+		}
+		freeScript(&sc);
+		return failed;
+	}
+	if (argc < 2) {
+		perror("No file argument given");
+		exit(0);
+	}
+	createPieceTable(argv[1]);
+	int choice = -1;
+	while(choice != 3) {
+		printPieces();
+		printMenu();
+		scanf("%d", &choice);
+		if (choice == 1){
+			int pos;
+			char c;
+			printf("\nEnter the position: ");
+			scanf(" %d", &pos);
+			printf("Enter the character: ");
+			scanf(" %c", &c);
+			insertCharacter(pos, c);
+		} else if (choice == 2) {
+			int pos;
+			printf("\nEnter the position: ");
+			scanf(" %d", &pos);
+			deleteCharacter(pos);
+		}
+	}
 }
\ No newline at end of file
@@ -1,971 +1,5729 @@
-/*** includes ***/
-
-#define _DEFAULT_SOURCE
-#define _BSD_SOURCE
-#define _GNU_SOURCE
-
-#include <time.h>
-#include <ctype.h>
-#include <errno.h>
-#include <stdio.h>
-#include <fcntl.h>
-#include <limits.h>
-#include <string.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <stdarg.h>
-#include <termios.h>
-#include <stdbool.h>
-#include <sys/ioctl.h>
-#include <sys/types.h>
-
-/*** defines ***/
-
-#define CTRL_KEY(k) ((k) & 0x1f)
-#define FOU_VERSION "0.0.1"
-#define FOU_TAB_STOP 8
-#define FOU_QUIT_TIMES 3
-enum editorKey {
-	BACKSPACE = 127,
-	ARROW_LEFT = 1000,
-	ARROW_RIGHT,
-	ARROW_UP,
-	ARROW_DOWN,
-	DEL_KEY,
-	HOME_KEY,
-	END_KEY,
-	PAGE_UP,
-	PAGE_DOWN
-};
-
-/*** data ***/
-
-typedef struct erow {
-	int size;
-	int indentation;
-} erow;
-
-struct editorConfig {
-	int cx, cy, rx;
-	int rowoff;
-	int coloff;
-	int screenrows;
-	int screencols;
-	int actual_x;
-	int actual_indentation;
-	int numrows;
-	erow *rows;
-	int dirty;
-	int state;
-	char * filename;
-	char statusmsg[80];
-	time_t statusmsg_time;
-	struct termios orig_termios;
-};
-
-struct editorConfig E;
-
-struct Piece {
-	int start;
-	int length;
-	char **target;
-};
-
-struct PieceTable {
-	char* content;
-	char* add;
-	size_t add_size;
-	size_t size;
-	struct Piece* p;
-} pt;
-
-struct details {
-	size_t add_size;
-	size_t size;
-};
-
-int undotop = -1;
-int redotop = -1;
-
-struct Piece **undostack;
-struct details *undodetails;
-struct Piece **redostack;
-struct details *redodetails;
-
-void die(const char *s) {
-	perror(s);
-	exit(1);
-}
-
-void undopush() {
-	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * (undotop + 2));
-	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * (undotop + 2));
-
-	if ((new_undostack == NULL || new_undodetails == NULL) && undotop < 0) {
-		die("Malloc Error!");
-	}
-
-	undostack = new_undostack;
-	undodetails = new_undodetails;
-	undotop += 1;
-	undodetails[undotop].add_size = pt.add_size;
-	undodetails[undotop].size = pt.size;
-	undostack[undotop] = malloc(sizeof(struct Piece) * (pt.size));
-	for(int i = 0; i < pt.size; i++){
-		undostack[undotop][i].start = pt.p[i].start;
-		undostack[undotop][i].length = pt.p[i].length;
-		undostack[undotop][i].target = pt.p[i].target;
-	}
-	if (redotop >= 0) {
-		for (int i = 0; i <= redotop; i++){
-			free(redostack[i]);
-		}
-		free(redostack);
-		free(redodetails);
-		redotop = -1;
-		redostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
-		redodetails = (struct details*)malloc(0 * sizeof(struct details));
-	}
-}
-
-void redo() {
-	if (redotop < 0){
-		return;
-	}
-	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * (undotop + 2));
-	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * (undotop + 2));
-
-	if ((new_undostack == NULL || new_undodetails == NULL) && undotop < 0) {
-		die("Malloc Error!");
-	}
-
-	undostack = new_undostack;
-	undodetails = new_undodetails;
-	undotop += 1;
-	undodetails[undotop].add_size = pt.add_size;
-	undodetails[undotop].size = pt.size;
-	undostack[undotop] = malloc(sizeof(struct Piece) * (pt.size));
-	for(int i = 0; i < pt.size; i++){
-		undostack[undotop][i].start = pt.p[i].start;
-		undostack[undotop][i].length = pt.p[i].length;
-		undostack[undotop][i].target = pt.p[i].target;
-	}
-
-	pt.add_size = redodetails[redotop].add_size;
-	pt.size = redodetails[redotop].size;
-	free(pt.p);
-	pt.p = malloc(sizeof(struct Piece) * pt.size);
-	for (int i = 0; i < pt.size; i++) {
-		pt.p[i].start = redostack[redotop][i].start;
-		pt.p[i].length = redostack[redotop][i].length;
-		pt.p[i].target = redostack[redotop][i].target;
-	}
-
-	free(redostack[redotop]);
-	struct Piece **new_redostack = realloc(redostack, sizeof(struct Piece*) * redotop);
-	struct details *new_redodetails = realloc(redodetails, sizeof(struct details) * redotop);
-	if ((new_redostack == NULL || new_redodetails == NULL) && redotop < 0) {
-		die("Malloc problem");
-	}
-	redostack = new_redostack;
-	redodetails = new_redodetails;
-	redotop -= 1;
-}
-
-void undo() {
-	if (undotop < 0) {
-		return;
-	}
-	struct Piece **new_redostack = realloc(redostack, sizeof(struct Piece*) * (redotop + 2));
-	struct details *new_redodetails = realloc(redodetails, sizeof(struct details) * (redotop + 2));
-	if ((new_redostack == NULL || new_redodetails == NULL)) {
-		die("Malloc problem");
-	}
-
-	redostack = new_redostack;
-	redodetails = new_redodetails;
-	redotop += 1;
-	redodetails[redotop].add_size = pt.add_size;
-	redodetails[redotop].size = pt.size;
-	redostack[redotop] = malloc(sizeof(struct Piece) * (pt.size));
-	for (int i = 0; i < pt.size; i++) {
-		redostack[redotop][i].start = pt.p[i].start;
-		redostack[redotop][i].length = pt.p[i].length;
-		redostack[redotop][i].target = pt.p[i].target;
-	}
-
-	pt.add_size = undodetails[undotop].add_size;
-	pt.size = undodetails[undotop].size;
-	free(pt.p);
-	pt.p = malloc(sizeof(struct Piece) * pt.size);
-	for (int i = 0; i < pt.size; i++) {
-		pt.p[i].start = undostack[undotop][i].start;
-		pt.p[i].length = undostack[undotop][i].length;
-		pt.p[i].target = undostack[undotop][i].target;
-	}
-
-	free(undostack[undotop]);
-	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * undotop);
-	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * undotop);
-
-	if ((new_undostack == NULL || new_undodetails == NULL) & undotop < 0) {
-		die("Malloc Error!");
-	}
-
-	undostack = new_undostack;
-	undodetails = new_undodetails;
-	undotop -= 1;
-}
-
-void editorMoveCursor(int key);
-
-/*** terminal ***/
-
-void disableRawMode() {
-	write(STDOUT_FILENO, "\x1b[2J", 4);
-	write(STDOUT_FILENO, "\x1b[H", 3);
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
-		die("tcsetattr");
-	}
-}
-
-void enableRawMode() {
-	if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcsetattr");
-	atexit(disableRawMode);
-
-	struct termios raw = E.orig_termios;
-	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-	raw.c_oflag &= ~(OPOST);
-	raw.c_cflag |= (CS8);
-	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
-	raw.c_cc[VMIN] = 0;
- 	raw.c_cc[VTIME] = 1;
-
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
-}
-
-int editorReadKey() {
-	int nread;
-	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-		if (nread == -1 && errno != EAGAIN) die("read");
-	}
-
-	if (c == '\x1b') {
-		char seq[3];
-
-		if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-		if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-
-		if (seq[0] == '[') {
-			if (seq[1] >= '0' && seq[1] <= '9') {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-				if (seq[2] == '~'){
-					switch (seq[1]) {
-						case '1': return HOME_KEY;
-						case '3': return DEL_KEY;
-						case '4': return END_KEY;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME_KEY;
-						case '8': return END_KEY;
-					}
-				}
-			} else {
-				switch (seq[1]) {
-					case 'A': return ARROW_UP;
-					case 'B': return ARROW_DOWN;
-					case 'C': return ARROW_RIGHT;
-					case 'D': return ARROW_LEFT;
-					case 'H': return HOME_KEY;
-					case 'F': return END_KEY;
-				}
-			}
-		} else if (seq[0] == 'O') {
-			switch (seq[1]) {
-				case 'H': return HOME_KEY;
-				case 'F': return END_KEY;
-			}
-		}
-
-		return '\x1b';
-	} else {
-		if (E.state == 0){
-			switch (c) {
-				case 'w': return ARROW_UP;
-				case 'a': return ARROW_LEFT;
-				case 's': return ARROW_DOWN;
-				case 'd': return ARROW_RIGHT;
-			}
-		}
-		return c;
-	}
-}
-
-int getCursorPosition(int *rows, int *cols){
-	char buff[32];
-	unsigned int i = 0;
-	if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
-
-	while (i < sizeof(buff) - 1) {
-		if (read(STDIN_FILENO, &buff[i], 1) != 1) break;
-		if (buff[i] == 'R') break;
-		i++;
-	}
-	buff[i] = '\0';
-
-	if (buff[0] != '\xb' || buff[1] != '[') return -1;
-	if (sscanf(&buff[2], "%d;%d", rows, cols) != 2) return -1;
-
-	return 0;
-}
-
-int getWindowSize(int *rows, int *cols) {
-	struct winsize ws;
-
-	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-		if (write(STDOUT_FILENO, "\x1b[10000000C\x1b[1000000B", 12) != 12) return -1;
-		return getCursorPosition(rows, cols);
-	} else {
-		*cols = ws.ws_col;
-		*rows = ws.ws_row;
-		return 0;
-	}
-}
-
-/*** piece table operations***/
-
-void destroyer() {
-	for (int i = 0; i <= undotop; i++) {
-		free(undostack[i]);
-	}
-	for (int i = 0; i <= redotop; i++) {
-		free(redostack[i]);
-	}
-	free(undostack);
-	free(redostack);
-	free(undodetails);
-	free(redodetails);
-	undotop = -1;
-	redotop = -1;
-	free(pt.p);
-	free(pt.content);
-	free(pt.add);
-	free(E.rows);
-	free(E.filename);
-}
-
-void printPieces() {
-	for (int i = 0; i < pt.size; i++) {
-		printf("\n%d,%d %.7s\n", pt.p[i].start, pt.p[i].length, *pt.p[i].target == pt.content ? "Content" : "Add");
-	}
-	printf("\n%d, %d\n", E.cx, E.cy);
-	for(int i = 0; i < E.numrows; i++) {
-		printf("%d,%d,%d\n", E.numrows, E.rows[i].size, E.rows[i].indentation);
-	}
-}
-
-void insertInBetween(int x, char c, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 2));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-
-	for (int i = pt.size + 1; i > insert_index + 1; i--) {
-		pt.p[i] = pt.p[i - 2];
-	}
-
-	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-	if (new_add == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	new_add[pt.add_size] = c;
-	pt.add = new_add;
-
-	pt.p[insert_index + 1].start = pt.add_size;
-	pt.p[insert_index + 1].length = 1;
-	pt.p[insert_index + 1].target = &pt.add;
-
-	pt.p[insert_index + 2].start = pt.p[insert_index].start + x;
-	pt.p[insert_index + 2].length = pt.p[insert_index].length - x;
-	pt.p[insert_index + 2].target = pt.p[insert_index].target;
-	pt.p[insert_index].length = x;
-
-	pt.size += 2;
-	pt.add_size += 1;
-}
-
-void insertAtEnd(char c, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-
-	for (int i = pt.size; i > insert_index + 1; i--) {
-		pt.p[i] = pt.p[i - 1];
-	}
-
-	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-	if (new_add == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	new_add[pt.add_size] = c;
-	pt.add = new_add;
-
-	pt.p[insert_index + 1].start = pt.add_size;
-	pt.p[insert_index + 1].length = 1;
-	pt.p[insert_index + 1].target = &pt.add;
-
-	pt.size += 1;
-	pt.add_size += 1;
-}
-
-void insertCharacter(char c) {
-	int x = 0;
-	for(int i = 0; i < E.cy; i++) {
-		x += (E.rows[i].size + E.rows[i].indentation + 1);
-	}
-	x += E.cx;
-	E.cx += 1;
-	int insert_index = -1;
-	int curr_length = 0;
-	for (int i = 0; i < pt.size; i++) {
-		curr_length += pt.p[i].length;
-		if (x < curr_length) {
-			x -= (curr_length - pt.p[i].length);
-			insert_index = i;
-			insertInBetween(x, c, insert_index);
-			break;
-		} else if (x == curr_length) {
-			if (*pt.p[i].target == pt.add && (pt.add_size == pt.p[i].start + pt.p[i].length)){
-				char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
-				if (new_add == NULL) {
-					perror("Memory Allocation Failed!");
-					exit(0);
-				}
-				new_add[pt.add_size] = c;
-				pt.add = new_add;
-				pt.p[i].length += 1;
-				pt.add_size += 1;
-				return;
-			} else {
-			 	insert_index = i;
-			 	insertAtEnd(c, insert_index);
-			 	break;
-			 }
-		}
-	}
-	if (insert_index == -1) {
-		printf("Out of bounds index %d", x);
-		return;
-	}
-}
-
-void deleteInBetween(int x, int insert_index) {
-	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
-	if (pt.p == NULL) {
-		perror("Memory Allocation Failed!");
-		exit(0);
-	}
-	for(int i = pt.size; (i - 1) > insert_index; i--) {
-		pt.p[i] = pt.p[i - 1];
-	}
-	pt.p[insert_index + 1].length = pt.p[insert_index].length;
-	pt.p[insert_index].length = x;
-	pt.p[insert_index + 1].start = pt.p[insert_index].start + x + 1;
-	pt.p[insert_index + 1].length -= (x + 1);
-	pt.p[insert_index + 1].target = pt.p[insert_index].target;
-	pt.size += 1;
-}
-
-void deleteAtEnd(int insert_index) {
-	if (pt.p[insert_index].length == 1) {
-		for (int i = insert_index; i < pt.size - 1; i++){
-			pt.p[i] = pt.p[i + 1];
-		}
-		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
-		pt.size -= 1;
-	} else {
-		pt.p[insert_index].length -= 1;
-	}
-}
-
-void deleteAtBeginning(int insert_index) {
-	if (pt.p[insert_index].length == 1) {
-		for (int i = insert_index; i < pt.size - 1; i++){
-			pt.p[i] = pt.p[i + 1];
-		}
-		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
-		pt.size -= 1;
-	} else {
-		pt.p[insert_index].start += 1;
-		pt.p[insert_index].length -= 1;
-	}
-}
-
-void deleteCharacter() {
-	int x = 0;
-	for(int i = 0; i < E.cy; i++) {
-		x += (E.rows[i].size + E.rows[i].indentation + 1);
-	}
-	x += E.cx;
-	E.cx -= 1;
-	int curr_length = 0;
-	for (int i = 0; i < pt.size; i++) {
-		curr_length += pt.p[i].length;
-		if (x < (curr_length - 1)) {
-			x -= (curr_length - pt.p[i].length);
-			if (x == 0) {
-				deleteAtBeginning(i);
-				break;
-			}
-			deleteInBetween(x, i);
-			break;
-		} else if (x == (curr_length - 1)) {
-			deleteAtEnd(i);
-			break;
-		} else if (x == (curr_length)) {
-			deleteAtBeginning(i + 1);
-			break;
-		}
-	}
-}
-
-/*** file i/o ***/
-
-void createPieceTable(char* file_name) {
-	FILE* file = fopen(file_name, "r");
-	if (file == NULL) {
-		perror("Error Opening file");
-		exit(0);
-	}
-
-	fseek(file, 0, SEEK_END);
-	long file_size = ftell(file);
-	rewind(file);
-
-	pt.content = malloc(file_size + 1);
-	if (pt.content == NULL){		
-		perror("Memory Allocation for PieceTable Failed");
-		fclose(file);
-		exit(0);
-	}
-
-	size_t read_size = fread(pt.content, 1, file_size, file);
-	fclose(file);
-
-	if (read_size != file_size) {
-		perror("Error loading file into memory");
-		free(pt.content);
-		exit(0);
-	}
-
-	pt.content[file_size] = '\0';
-	pt.add = malloc(0);
-	pt.add_size = 0;
-	pt.size = 1;
-	pt.p = malloc(sizeof(struct Piece));
-	pt.p[0].start = 0;
-	pt.p[0].length = file_size;
-	pt.p[0].target = &pt.content;
-	if (atexit(destroyer) != 0) {
-		perror("Failed to register atexit handler");
-		free(pt.content);
-		free(pt.p);
-		exit(0);
-	}
-}
-
-void initialiseconfig() {
-	int j = 0;
-	int size = 0;
-	int indentation = 0;
-	E.rows = malloc(1 * sizeof(erow));
-	for(int i = 0; i < pt.p[0].length; i++) {
-		if ((*pt.p[0].target)[i] == '\n') {
-			if (j != 0){
-				E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
-			}
-			E.rows[j].size = size;
-			E.rows[j].indentation = indentation;
-			size = 0;
-			indentation = 0;
-			j += 1;
-		} else if ((*pt.p[0].target)[i] == '\t') {
-			indentation += 1;
-		} else {
-			size += 1;
-		}
-	}
-
-	if (size != 0 || indentation != 0) {
-		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
-		E.rows[j].size = size + 1;
-		E.rows[j].indentation = indentation;
-	} else {
-		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
-		E.rows[j].size = 1;
-	}
-	j += 1;
-
-	E.numrows = j;
-}
-
-void remakeconfig() {
-	int j = 0;
-	int size = 0;
-	int indentation = 0;
-	if (E.rows != NULL){
-		free(E.rows);
-		E.rows = NULL;	
-	}
-	E.rows = malloc(sizeof(erow));
-	for(int k = 0; k < pt.size; k++){
-		for(int i = 0; i < pt.p[k].length; i++) {
-			if ((*pt.p[k].target)[pt.p[k].start + i] == '\n') {
-				if (j != 0) {
-					E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
-				}
-				E.rows[j].size = size;
-				E.rows[j].indentation = indentation;
-				size = 0;
-				indentation = 0;
-				j += 1;
-			} else if ((*pt.p[k].target)[pt.p[k].start + i] == '\t') {
-				indentation += 1;
-			} else {
-				size += 1;
-			}
-		}
-	}
-
-	if (size != 0 || indentation != 0) {
-		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
-		E.rows[j].size = size;
-		E.rows[j].indentation = indentation;
-		j += 1;
-	}
-	E.numrows = j;
-}
-
-/*** append buffer ***/
-
-struct abuf {
-	char *b;
-	int len;
-};
-
-#define ABUF_INIT {NULL, 0}
-
-void abAppend(struct abuf *ab, const char *s, int len) {
-	if (len > 0 && s != NULL) {
-		if (ab->len > INT_MAX - len) return;
-
-		char *new_buffer = realloc(ab->b, ab->len + len);
-		
-		if (new_buffer == NULL) return;
-
-		memcpy(&new_buffer[ab->len], s, len);
-		ab->b = new_buffer;
-		ab->len += len;
-	}
-}
-
-void abFree(struct abuf *ab){
-	free(ab->b);
-	ab->len = 0;
-}
-
-/*** input ***/
-
-void editorMoveCursor(int key) {
-	switch (key) {
-		case ARROW_LEFT:
-			if(E.cx != 0) E.cx--;
-			else if((E.cy > 0) & (E.cx == 0)){
-				E.cy--;
-				E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation - 1;
-			}
-			E.actual_indentation = E.rows[E.cy].indentation;
-			E.actual_x = E.cx - E.rows[E.cy].indentation;
-			break;
-		case ARROW_RIGHT:
-			if(E.cx < E.rows[E.cy].size - 1) E.cx++;
-			else if(E.cy < (E.numrows - 1)){
-				E.cx = 0;
-				E.cy++;
-			}
-			E.actual_indentation = E.rows[E.cy].indentation;
-			E.actual_x = E.cx - E.rows[E.cy].indentation;
-			break;
-		case ARROW_UP:
-			if(E.cy > 0) {
-				E.cy--;
-				if(E.actual_x + E.actual_indentation > E.rows[E.cy].size + E.rows[E.cy].indentation){
-					E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation -1;
-				} else {
-					E.cx = E.actual_x + E.actual_indentation;
-				}
-			}
-			break;
-		case ARROW_DOWN:
-			if(E.cy < E.numrows - 1) {
-				E.cy++;
-				if(E.actual_x + E.actual_indentation > E.rows[E.cy].size + E.rows[E.cy].indentation){
-					E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation - 1;
-				} else {
-					E.cx = E.actual_x + E.actual_indentation;
-				}
-			}
-			break;
-	}
-}
-
-void convertCxToRx() {
-	E.rx = 0;
-	for(int i = 0; i < E.cx; i++) {
-		if (i < E.rows[E.cy].indentation) {
-			E.rx += FOU_TAB_STOP;
-			E.rx += 1;
-		} else {
-			E.rx += 1;
-		}
-	}
-}
-
-void editorProcessKeypress() {
-	static int quit_times = FOU_QUIT_TIMES;
-
-	int c = editorReadKey();
-
-	switch (c) {
-
-		case CTRL_KEY('c'):
-			write(STDOUT_FILENO, "\x1b[2J", 4);
-	 		write(STDOUT_FILENO, "\x1b[H", 3);
-	 		disableRawMode();
-	 		write(STDOUT_FILENO, "\x1b[2J\x1b[H", 7);
-			exit(0);
-			break;
-
-		case CTRL_KEY('y'):
-			redo();
-			break;
-
-		case CTRL_KEY('z'):
-			undo();
-			break;
-
-		case CTRL_KEY('s'):
-			break;
-
-		case '\r':
-			undopush();
-			insertCharacter('\r');
-			insertCharacter('\n');
-			E.cy += 1;
-			E.cx = 0;
-			E.actual_x = 0;
-			break;
-
-		case PAGE_UP:
-		case PAGE_DOWN:
-			{
-				if (c == PAGE_UP) {
-					E.cy = E.rowoff;
-				} else if (c == PAGE_DOWN) {
-					E.cy = E.rowoff + E.screenrows - 1;
-					if (E.cy > E.numrows) {
-						E.cy = E.numrows;
-					}
-				}
-				int times = E.screenrows;
-				while (times--)
-					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-			}
-			break;
-
-		case HOME_KEY:
-			E.cx = 0;
-			break;
-		case END_KEY:
-			break;
-
-		case BACKSPACE:
-		case CTRL_KEY('h'):
-		case DEL_KEY:
-			undopush();
-			deleteCharacter();
-			remakeconfig();
-			break;
-
-		case ARROW_UP:
-		case ARROW_DOWN:
-		case ARROW_LEFT:
-		case ARROW_RIGHT:
-   			editorMoveCursor(c);
-			break;
-
-		case CTRL_KEY('l'):
-		case '\x1b':
-			E.state ^= 1;
-			break;
-
-		default:
-			undopush();
-			insertCharacter(c);
-			break;
-	}
-
-	quit_times = FOU_QUIT_TIMES;
-}
-
-/*** ouput ***/
-
-void pieceTabletoBuffer(struct abuf *ab) {
-	int final_size = 0;
-	for (int i = 0; i < E.numrows; i++) {
-		final_size += E.rows[i].size;
-		final_size += E.rows[i].indentation * (FOU_TAB_STOP);
-	}
-	char* final = malloc(final_size + E.numrows + 3*E.numrows);
-	int pos = 0;
-	for (int i = 0; i < pt.size; i++) {
-		for (int j = 0; j < pt.p[i].length; j++) {
-			if ((*pt.p[i].target)[pt.p[i].start + j] == '\t') {
-				for (int k = 0; k < FOU_TAB_STOP; k++) {
-					final[pos] = ' ';
-					pos += 1;
-				}
-			} else if ((*pt.p[i].target)[pt.p[i].start + j] == '\n') {
-				final[pos] = '\n';
-				final[pos + 1] = '\x1b';
-				final[pos + 2] = '[';
-				final[pos + 3] = 'K';
-				pos += 4;
-			} else {
-				final[pos] = (*pt.p[i].target)[pt.p[i].start + j];
-				pos += 1;
-			}
-		}
-	}
-	abAppend(ab, final, pos);
-	free(final);
-}
-
-void scrollTabletoBuffer(struct abuf *ab) {
-
-}
-
-void editorDrawRows(struct abuf *ab) {
-	int y;
-	for (y = 0; y < E.screenrows; y++) {
-		int filerow = y + E.rowoff;
-		if (filerow >= E.numrows){
-			if (E.numrows == 0 && y == E.screenrows/3){
-				char welcome[80];
-				int welcomelen = snprintf(welcome, sizeof(welcome), "Fou Editor -- version %s", FOU_VERSION);
-				if (welcomelen > E.screencols) welcomelen = E.screencols;
-				int padding = (E.screencols - welcomelen) / 2;
-				if (padding) {
-					abAppend(ab, "~", 1);
-					padding--;
-				}
-				while (padding--) abAppend(ab, " ", 1);
-				abAppend(ab, welcome, welcomelen);
-			} else {
-				abAppend(ab, "~", 1);
-			}
-		} else {
-			abAppend(ab, "\x1b[K", 4);
-			pieceTabletoBuffer(ab);
-			break;
-		}
-		abAppend(ab, "\x1b[K", 3);
-		if (y < E.screenrows - 1) {
-			abAppend(ab, "\r\n", 2);
-		}
-	}
-}
-
-void editorRefreshScreen() {
-	remakeconfig();
-	struct abuf ab = ABUF_INIT;
-
-	abAppend(&ab, "\x1b[?25l", 6);
-	abAppend(&ab, "\x1b[H", 3);
-
-	editorDrawRows(&ab);
-
-	convertCxToRx(&E.rx);
-	char buff[32];
-	snprintf(buff, sizeof(buff), "\x1b[%d;%dH", E.cy + 1, E.rx + 1);
-	abAppend(&ab, buff, strlen(buff));
-
-	abAppend(&ab, "\x1b[?25h", 6);
-	write(STDOUT_FILENO, ab.b, ab.len);
-	abFree(&ab);
-}
-
-/*** init ***/
-
-void initEditor() {
-	E.cy = 0;
-	E.cx = 0;
-	E.rx = 0;
-	E.numrows = 0;
-	E.actual_x = 0;
-	E.actual_indentation = 0;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.rows = NULL;
-	E.dirty = 0;
-	E.state = 0;
-	E.filename = NULL;
-	E.statusmsg[0] = '\0';
-	E.statusmsg_time = 0;
-
-	if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-	E.screenrows -= 2;
-}
-
-void initData(char* file_name) {
-	if (E.filename != NULL){
-		free(E.filename);
-		E.filename = NULL;
-	}
-	E.filename = malloc(strlen(file_name) + 1);
-	if (E.filename == NULL) {
-		perror("malloc E.filename");
-		exit(0);
-	}
-
-	strcpy(E.filename, file_name);
-	createPieceTable(file_name);
-	initialiseconfig();
-	E.dirty = 0;
-	undostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
-	undodetails = (struct details*)malloc(0 * sizeof(struct details));
-	redostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
-	redodetails = (struct details*)malloc(0 * sizeof(struct details));
-}
-
-int main(int argc, char *argv[]) {
-	enableRawMode();
-	initEditor();
-	if (argc >= 2) {
-		write(STDOUT_FILENO, "\x1b[2J", 4);
-		initData(argv[1]);
-	}
-
-	while (1) {
-		editorRefreshScreen();
-		editorProcessKeypress();
-	}
-
-	return 0;
+/*** includes ***/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <termios.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+/*** defines ***/
+
+#define CTRL_KEY(k) ((k) & 0x1f)
+#define FOU_VERSION "0.0.1"
+#define FOU_TAB_STOP 8
+#define FOU_QUIT_TIMES 3
+#define FOU_UNDO_BYTES (128 * 1024 * 1024)
+enum editorKey {
+	BACKSPACE = 127,
+	ARROW_LEFT = 1000,
+	ARROW_RIGHT,
+	ARROW_UP,
+	ARROW_DOWN,
+	DEL_KEY,
+	HOME_KEY,
+	END_KEY,
+	PAGE_UP,
+	PAGE_DOWN
+};
+
+/*** data ***/
+
+typedef struct erow {
+	int size;
+	int indentation;
+} erow;
+
+struct editorConfig {
+	int cx, cy, rx;
+	int rowoff;
+	int coloff;
+	int screenrows;
+	int screencols;
+	int actual_x;
+	int actual_indentation;
+	int numrows;
+	erow *rows;
+	int dirty;
+	int state;
+	int prompting;
+	int mark;
+	char * filename;
+	char statusmsg[80];
+	time_t statusmsg_time;
+	struct termios orig_termios;
+};
+
+struct editorConfig E;
+
+/* A piece names its buffer with a bit instead of pointing at the buffer's
+ * pointer: eight bytes a piece, eight pieces to a cache line, and one load
+ * from the piece to its text. The price is a 31-bit start, so neither the
+ * file nor the add buffer may pass INT_MAX bytes; see pieceAddRoom. */
+struct Piece {
+	unsigned int start : 31;
+	unsigned int add : 1;
+	int length;
+};
+
+struct PieceTable {
+	char* content;
+	size_t content_size;
+	char* add;
+	size_t add_size;
+	size_t size;
+	struct Piece* p;
+} pt;
+
+/* Copied text is kept as pieces over pt.content and pt.add, so its bytes
+ * are never duplicated. add_end is the highest add offset it reads, which
+ * add_size must not fall below or new typing would overwrite it. A block
+ * copy also keeps how many of the pieces make up each of its nrows rows. */
+struct clipboard {
+	struct Piece *p;
+	int size;
+	int length;
+	int add_end;
+	int journaled;
+	int *rows;
+	int nrows;
+} CB;
+
+/* Extra cursors, as sorted text offsets; E's cursor is always the primary.
+ * With any present, typing, Enter and Backspace apply at every cursor in a
+ * single splice, with one undo entry and one journal record. */
+struct cursors {
+	int *pos;
+	int n;
+	int cap;
+} MC;
+
+/* Block selection: the rectangle between the anchor's row and column and
+ * the cursor's. Columns count as drawn, a tab FOU_TAB_STOP wide. */
+struct block {
+	int active;
+	int row;
+	int col;
+} BK;
+
+enum blockOp {
+	BLOCK_INSERT,
+	BLOCK_BACK,
+	BLOCK_COPY,
+	BLOCK_CUT,
+	BLOCK_PASTE
+};
+
+/* Keys recorded through editorProcessKeypress. While one plays, undopush
+ * does nothing: the run keeps the single snapshot taken before it. */
+struct macro {
+	int *keys;
+	int n;
+	int cap;
+	int recording;
+	int playing;
+} MR;
+
+/* While a macro plays a count of times, every edit widens the span, in
+ * current offsets, that changed since the rows were last laid out, and
+ * delta is how much longer the text got. remakeconfig then lays out only
+ * the rows over that span. */
+struct relayout {
+	int on;
+	int from;
+	int to;
+	int delta;
+} RL;
+
+char *pieceBuffer(const struct Piece *p) {
+	return p->add ? pt.add : pt.content;
+}
+
+/* A snapshot taken before the last add buffer collection is stale: its
+ * pieces from done on still hold offsets into the old buffer. */
+struct details {
+	size_t add_size;
+	size_t size;
+	int stale;
+	int done;
+};
+
+void addGcFix(struct details *d, struct Piece *p);
+
+int undotop = -1;
+int redotop = -1;
+size_t undobytes;
+
+struct Piece **undostack;
+struct details *undodetails;
+struct Piece **redostack;
+struct details *redodetails;
+
+void die(const char *s) {
+	perror(s);
+	exit(1);
+}
+
+/* History is bounded by what its snapshots take, not by how many there are:
+ * undopush drops the oldest once the undo stack passes FOU_UNDO_BYTES. */
+size_t undoCost(int i) {
+	return undodetails[i].size * sizeof(struct Piece) + sizeof(struct Piece *) + sizeof(struct details);
+}
+
+void undoRecount() {
+	undobytes = 0;
+	for (int i = 0; i <= undotop; i++) undobytes += undoCost(i);
+}
+
+void undopush() {
+	if (MR.playing) return;
+	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * (undotop + 2));
+	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * (undotop + 2));
+
+	if ((new_undostack == NULL || new_undodetails == NULL) && undotop < 0) {
+		die("Malloc Error!");
+	}
+
+	undostack = new_undostack;
+	undodetails = new_undodetails;
+	undotop += 1;
+	undodetails[undotop].add_size = pt.add_size;
+	undodetails[undotop].size = pt.size;
+	undodetails[undotop].stale = 0;
+	undostack[undotop] = malloc(sizeof(struct Piece) * (pt.size));
+	for(int i = 0; i < pt.size; i++){
+		undostack[undotop][i].start = pt.p[i].start;
+		undostack[undotop][i].length = pt.p[i].length;
+		undostack[undotop][i].add = pt.p[i].add;
+	}
+	if (redotop >= 0) {
+		for (int i = 0; i <= redotop; i++){
+			free(redostack[i]);
+		}
+		free(redostack);
+		free(redodetails);
+		redotop = -1;
+		redostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
+		redodetails = (struct details*)malloc(0 * sizeof(struct details));
+	}
+	undobytes += undoCost(undotop);
+	if (undobytes > FOU_UNDO_BYTES) {
+		int drop = 0;
+		while (undobytes > FOU_UNDO_BYTES && drop < undotop) {
+			undobytes -= undoCost(drop);
+			free(undostack[drop++]);
+		}
+		memmove(undostack, undostack + drop, sizeof(struct Piece*) * (undotop + 1 - drop));
+		memmove(undodetails, undodetails + drop, sizeof(struct details) * (undotop + 1 - drop));
+		undotop -= drop;
+	}
+}
+
+void redo() {
+	if (redotop < 0){
+		return;
+	}
+	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * (undotop + 2));
+	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * (undotop + 2));
+
+	if ((new_undostack == NULL || new_undodetails == NULL) && undotop < 0) {
+		die("Malloc Error!");
+	}
+
+	undostack = new_undostack;
+	undodetails = new_undodetails;
+	undotop += 1;
+	undodetails[undotop].add_size = pt.add_size;
+	undodetails[undotop].size = pt.size;
+	undodetails[undotop].stale = 0;
+	undostack[undotop] = malloc(sizeof(struct Piece) * (pt.size));
+	for(int i = 0; i < pt.size; i++){
+		undostack[undotop][i].start = pt.p[i].start;
+		undostack[undotop][i].length = pt.p[i].length;
+		undostack[undotop][i].add = pt.p[i].add;
+	}
+
+	undobytes += undoCost(undotop);
+
+	addGcFix(&redodetails[redotop], redostack[redotop]);
+	E.mark = -1;
+	pt.add_size = redodetails[redotop].add_size;
+	if (pt.add_size < (size_t)CB.add_end) pt.add_size = CB.add_end;
+	pt.size = redodetails[redotop].size;
+	free(pt.p);
+	pt.p = malloc(sizeof(struct Piece) * pt.size);
+	for (int i = 0; i < pt.size; i++) {
+		pt.p[i].start = redostack[redotop][i].start;
+		pt.p[i].length = redostack[redotop][i].length;
+		pt.p[i].add = redostack[redotop][i].add;
+	}
+
+	free(redostack[redotop]);
+	struct Piece **new_redostack = realloc(redostack, sizeof(struct Piece*) * redotop);
+	struct details *new_redodetails = realloc(redodetails, sizeof(struct details) * redotop);
+	if ((new_redostack == NULL || new_redodetails == NULL) && redotop < 0) {
+		die("Malloc problem");
+	}
+	redostack = new_redostack;
+	redodetails = new_redodetails;
+	redotop -= 1;
+}
+
+void undo() {
+	if (undotop < 0) {
+		return;
+	}
+	struct Piece **new_redostack = realloc(redostack, sizeof(struct Piece*) * (redotop + 2));
+	struct details *new_redodetails = realloc(redodetails, sizeof(struct details) * (redotop + 2));
+	if ((new_redostack == NULL || new_redodetails == NULL)) {
+		die("Malloc problem");
+	}
+
+	redostack = new_redostack;
+	redodetails = new_redodetails;
+	redotop += 1;
+	redodetails[redotop].add_size = pt.add_size;
+	redodetails[redotop].size = pt.size;
+	redodetails[redotop].stale = 0;
+	redostack[redotop] = malloc(sizeof(struct Piece) * (pt.size));
+	for (int i = 0; i < pt.size; i++) {
+		redostack[redotop][i].start = pt.p[i].start;
+		redostack[redotop][i].length = pt.p[i].length;
+		redostack[redotop][i].add = pt.p[i].add;
+	}
+
+	addGcFix(&undodetails[undotop], undostack[undotop]);
+	E.mark = -1;
+	pt.add_size = undodetails[undotop].add_size;
+	if (pt.add_size < (size_t)CB.add_end) pt.add_size = CB.add_end;
+	pt.size = undodetails[undotop].size;
+	free(pt.p);
+	pt.p = malloc(sizeof(struct Piece) * pt.size);
+	for (int i = 0; i < pt.size; i++) {
+		pt.p[i].start = undostack[undotop][i].start;
+		pt.p[i].length = undostack[undotop][i].length;
+		pt.p[i].add = undostack[undotop][i].add;
+	}
+
+	undobytes -= undoCost(undotop);
+	free(undostack[undotop]);
+	struct Piece **new_undostack = realloc(undostack, sizeof(struct Piece*) * undotop);
+	struct details *new_undodetails = realloc(undodetails, sizeof(struct details) * undotop);
+
+	if ((new_undostack == NULL || new_undodetails == NULL) & undotop < 0) {
+		die("Malloc Error!");
+	}
+
+	undostack = new_undostack;
+	undodetails = new_undodetails;
+	undotop -= 1;
+}
+
+void editorMoveCursor(int key);
+void editorSetStatusMessage(const char *fmt, ...);
+void editorRefreshScreen();
+char *editorPrompt(char *prompt, void (*callback)(char *, int), int empty);
+void trigramFree();
+void addGcStart();
+void addGcRemapStep();
+void journalFlush();
+void journalStop(int drop);
+int64_t sessionSave();
+void reloadFree();
+void journalDiscard();
+void journalReplace(const char *needle, int nlen, const char *with, int wlen);
+void journalCopy(int from, int len);
+void journalCut(int from, int len);
+void journalPaste(int at);
+void journalSplice(const int *pos, int count, int dlen, const char *s, int slen);
+void journalBlock(int op, int r0, int r1, int lo, int hi, const char *s, int slen);
+void blockEdit(int op, const char *s, int slen);
+void editorProcessKey(int c);
+int getWindowSize(int *rows, int *cols);
+
+/*** terminal ***/
+
+void disableRawMode() {
+	write(STDOUT_FILENO, "\x1b[2J", 4);
+	write(STDOUT_FILENO, "\x1b[H", 3);
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
+		die("tcsetattr");
+	}
+}
+
+void enableRawMode() {
+	if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcsetattr");
+	atexit(disableRawMode);
+
+	struct termios raw = E.orig_termios;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_oflag &= ~(OPOST);
+	raw.c_cflag |= (CS8);
+	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 0;
+ 	raw.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+}
+
+/*** events ***/
+
+#define FOU_MAX_WATCHES 8
+#define FOU_MAX_TIMERS 8
+#define FOU_ESC_TIMEOUT 100
+
+struct editorWatch {
+	int fd;
+	void (*handler)(int fd);
+};
+
+struct editorTimer {
+	long long deadline;
+	void (*handler)(void);
+};
+
+struct editorEvents {
+	int winch[2];
+	struct editorWatch watches[FOU_MAX_WATCHES];
+	int nwatches;
+	struct editorTimer timers[FOU_MAX_TIMERS];
+	int ntimers;
+} EV;
+
+long long editorNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void editorHandleWinch(int sig) {
+	(void)sig;
+	int saved_errno = errno;
+	if (write(EV.winch[1], "w", 1) == -1) {
+		/* pipe already holds a pending resize */
+	}
+	errno = saved_errno;
+}
+
+void editorInitEvents() {
+	if (pipe(EV.winch) == -1) die("pipe");
+	for (int i = 0; i < 2; i++) {
+		fcntl(EV.winch[i], F_SETFL, O_NONBLOCK);
+		fcntl(EV.winch[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorHandleWinch;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+
+	/* a hung up terminal shows up as end of input instead */
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGHUP, &sa, NULL) == -1) die("sigaction");
+}
+
+int editorAddWatch(int fd, void (*handler)(int fd)) {
+	if (EV.nwatches == FOU_MAX_WATCHES) return -1;
+	EV.watches[EV.nwatches].fd = fd;
+	EV.watches[EV.nwatches].handler = handler;
+	EV.nwatches++;
+	return 0;
+}
+
+void editorRemoveWatch(int fd) {
+	for (int i = 0; i < EV.nwatches; i++) {
+		if (EV.watches[i].fd == fd) {
+			EV.watches[i] = EV.watches[--EV.nwatches];
+			return;
+		}
+	}
+}
+
+/* One-shot timer; scheduling a handler that is already pending moves its
+ * deadline. A NULL handler only wakes the loop up for a redraw. */
+void editorAddTimer(int ms, void (*handler)(void)) {
+	int i;
+	for (i = 0; i < EV.ntimers; i++) {
+		if (EV.timers[i].handler == handler) break;
+	}
+	if (i == FOU_MAX_TIMERS) return;
+	if (i == EV.ntimers) EV.ntimers++;
+	EV.timers[i].deadline = editorNow() + ms;
+	EV.timers[i].handler = handler;
+}
+
+int editorTimerTimeout() {
+	if (EV.ntimers == 0) return -1;
+	long long next = EV.timers[0].deadline;
+	for (int i = 1; i < EV.ntimers; i++) {
+		if (EV.timers[i].deadline < next) next = EV.timers[i].deadline;
+	}
+	long long wait = next - editorNow();
+	return wait > 0 ? (int)wait : 0;
+}
+
+int editorRunTimers() {
+	long long now = editorNow();
+	int ran = 0;
+	int i = 0;
+	while (i < EV.ntimers) {
+		if (EV.timers[i].deadline <= now) {
+			void (*handler)(void) = EV.timers[i].handler;
+			EV.timers[i] = EV.timers[--EV.ntimers];
+			if (handler) handler();
+			ran = 1;
+		} else {
+			i++;
+		}
+	}
+	return ran;
+}
+
+/* The terminal is gone: keep the work as Ctrl-C does and leave without
+ * touching the terminal again. */
+void editorHangup() {
+	if (sessionSave() != 0) {
+		journalDiscard();
+	} else {
+		journalFlush();
+		journalStop(0);
+	}
+	_exit(0);
+}
+
+/* Sleeps in poll until stdin is readable, servicing resizes, watched fds and
+ * timers in the meantime, so an idle editor never wakes up. */
+void editorWaitKey() {
+	while (1) {
+		struct pollfd fds[2 + FOU_MAX_WATCHES];
+		int nfds = 0;
+		fds[nfds].fd = STDIN_FILENO;
+		fds[nfds++].events = POLLIN;
+		fds[nfds].fd = EV.winch[0];
+		fds[nfds++].events = POLLIN;
+		for (int i = 0; i < EV.nwatches; i++) {
+			fds[nfds].fd = EV.watches[i].fd;
+			fds[nfds++].events = POLLIN;
+		}
+
+		if (poll(fds, nfds, editorTimerTimeout()) == -1) {
+			if (errno == EINTR) continue;
+			die("poll");
+		}
+
+		int redraw = 0;
+		if (fds[1].revents & POLLIN) {
+			char buf[32];
+			while (read(EV.winch[0], buf, sizeof(buf)) > 0);
+			if (getWindowSize(&E.screenrows, &E.screencols) == -1) editorHangup();
+			E.screenrows -= 2;
+			redraw = 1;
+		}
+		for (int i = 2; i < nfds; i++) {
+			if (!fds[i].revents) continue;
+			for (int j = 0; j < EV.nwatches; j++) {
+				if (EV.watches[j].fd == fds[i].fd) {
+					EV.watches[j].handler(fds[i].fd);
+					break;
+				}
+			}
+			redraw = 1;
+		}
+		if (editorRunTimers()) redraw = 1;
+
+		if (fds[0].revents) return;
+		if (redraw) editorRefreshScreen();
+	}
+}
+
+int editorPollByte(char *c, int timeout_ms) {
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	int n = poll(&pfd, 1, timeout_ms);
+	if (n == -1 && errno != EINTR) die("poll");
+	if (n <= 0) return 0;
+	if (pfd.revents & POLLNVAL) editorHangup();
+	int nread = read(STDIN_FILENO, c, 1);
+	if (nread == 0 || (nread == -1 && errno != EAGAIN && errno != EINTR)) editorHangup();
+	return nread == 1;
+}
+
+int editorReadKey() {
+	char c;
+	do {
+		editorWaitKey();
+	} while (!editorPollByte(&c, 0));
+
+	if (c == '\x1b') {
+		char seq[3];
+
+		if (!editorPollByte(&seq[0], FOU_ESC_TIMEOUT)) return '\x1b';
+		if (!editorPollByte(&seq[1], FOU_ESC_TIMEOUT)) return '\x1b';
+
+		if (seq[0] == '[') {
+			if (seq[1] >= '0' && seq[1] <= '9') {
+				if (!editorPollByte(&seq[2], FOU_ESC_TIMEOUT)) return '\x1b';
+				if (seq[2] == '~'){
+					switch (seq[1]) {
+						case '1': return HOME_KEY;
+						case '3': return DEL_KEY;
+						case '4': return END_KEY;
+						case '5': return PAGE_UP;
+						case '6': return PAGE_DOWN;
+						case '7': return HOME_KEY;
+						case '8': return END_KEY;
+					}
+				}
+			} else {
+				switch (seq[1]) {
+					case 'A': return ARROW_UP;
+					case 'B': return ARROW_DOWN;
+					case 'C': return ARROW_RIGHT;
+					case 'D': return ARROW_LEFT;
+					case 'H': return HOME_KEY;
+					case 'F': return END_KEY;
+				}
+			}
+		} else if (seq[0] == 'O') {
+			switch (seq[1]) {
+				case 'H': return HOME_KEY;
+				case 'F': return END_KEY;
+			}
+		}
+
+		return '\x1b';
+	} else {
+		if (E.state == 0){
+			switch (c) {
+				case 'w': return ARROW_UP;
+				case 'a': return ARROW_LEFT;
+				case 's': return ARROW_DOWN;
+				case 'd': return ARROW_RIGHT;
+			}
+		}
+		return c;
+	}
+}
+
+int getCursorPosition(int *rows, int *cols){
+	char buff[32];
+	unsigned int i = 0;
+	if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
+
+	while (i < sizeof(buff) - 1) {
+		if (!editorPollByte(&buff[i], FOU_ESC_TIMEOUT)) break;
+		if (buff[i] == 'R') break;
+		i++;
+	}
+	buff[i] = '\0';
+
+	if (buff[0] != '\xb' || buff[1] != '[') return -1;
+	if (sscanf(&buff[2], "%d;%d", rows, cols) != 2) return -1;
+
+	return 0;
+}
+
+int getWindowSize(int *rows, int *cols) {
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+		if (write(STDOUT_FILENO, "\x1b[10000000C\x1b[1000000B", 12) != 12) return -1;
+		return getCursorPosition(rows, cols);
+	} else {
+		*cols = ws.ws_col;
+		*rows = ws.ws_row;
+		return 0;
+	}
+}
+
+/*** piece table operations***/
+
+#define PIECE_COMPACT_MS 1000
+#define PIECE_TINY 16
+#define PIECE_TINY_RUN 4
+
+void destroyer() {
+	journalFlush();
+	journalStop(0);
+	trigramFree();
+	reloadFree();
+	for (int i = 0; i <= undotop; i++) {
+		free(undostack[i]);
+	}
+	for (int i = 0; i <= redotop; i++) {
+		free(redostack[i]);
+	}
+	free(undostack);
+	free(redostack);
+	free(undodetails);
+	free(redodetails);
+	undotop = -1;
+	redotop = -1;
+	undobytes = 0;
+	free(pt.p);
+	if (pt.content_size > 0) {
+		munmap(pt.content, pt.content_size);
+	} else {
+		free(pt.content);
+	}
+	free(pt.add);
+	free(CB.p);
+	free(CB.rows);
+	free(MC.pos);
+	free(MR.keys);
+	free(E.rows);
+	free(E.filename);
+}
+
+void printPieces() {
+	for (int i = 0; i < pt.size; i++) {
+		printf("\n%d,%d %.7s\n", pt.p[i].start, pt.p[i].length, !pt.p[i].add ? "Content" : "Add");
+	}
+	printf("\n%d, %d\n", E.cx, E.cy);
+	for(int i = 0; i < E.numrows; i++) {
+		printf("%d,%d,%d\n", E.numrows, E.rows[i].size, E.rows[i].indentation);
+	}
+}
+
+void insertInBetween(int x, char c, int insert_index) {
+	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 2));
+	if (pt.p == NULL) {
+		perror("Memory Allocation Failed!");
+		exit(0);
+	}
+
+	for (int i = pt.size + 1; i > insert_index + 1; i--) {
+		pt.p[i] = pt.p[i - 2];
+	}
+
+	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
+	if (new_add == NULL) {
+		perror("Memory Allocation Failed!");
+		exit(0);
+	}
+	new_add[pt.add_size] = c;
+	pt.add = new_add;
+
+	pt.p[insert_index + 1].start = pt.add_size;
+	pt.p[insert_index + 1].length = 1;
+	pt.p[insert_index + 1].add = 1;
+
+	pt.p[insert_index + 2].start = pt.p[insert_index].start + x;
+	pt.p[insert_index + 2].length = pt.p[insert_index].length - x;
+	pt.p[insert_index + 2].add = pt.p[insert_index].add;
+	pt.p[insert_index].length = x;
+
+	pt.size += 2;
+	pt.add_size += 1;
+}
+
+void insertAtEnd(char c, int insert_index) {
+	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
+	if (pt.p == NULL) {
+		perror("Memory Allocation Failed!");
+		exit(0);
+	}
+
+	for (int i = pt.size; i > insert_index + 1; i--) {
+		pt.p[i] = pt.p[i - 1];
+	}
+
+	char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
+	if (new_add == NULL) {
+		perror("Memory Allocation Failed!");
+		exit(0);
+	}
+	new_add[pt.add_size] = c;
+	pt.add = new_add;
+
+	pt.p[insert_index + 1].start = pt.add_size;
+	pt.p[insert_index + 1].length = 1;
+	pt.p[insert_index + 1].add = 1;
+
+	pt.size += 1;
+	pt.add_size += 1;
+}
+
+int pieceLength() {
+	int len = 0;
+	for (int k = 0; k < (int)pt.size; k++) {
+		len += pt.p[k].length;
+	}
+	return len;
+}
+
+char pieceByteAt(int x) {
+	for (int k = 0; k < (int)pt.size; k++) {
+		if (x < pt.p[k].length) return pieceBuffer(&pt.p[k])[pt.p[k].start + x];
+		x -= pt.p[k].length;
+	}
+	return '\0';
+}
+
+int editorCursorOffset() {
+	int x = 0;
+	for(int i = 0; i < E.cy; i++) {
+		x += (E.rows[i].size + E.rows[i].indentation + 1);
+	}
+	return x + E.cx;
+}
+
+void editorOffsetToCursor(int x) {
+	int y = 0;
+	while (y < E.numrows - 1 && x >= E.rows[y].size + E.rows[y].indentation + 1) {
+		x -= (E.rows[y].size + E.rows[y].indentation + 1);
+		y++;
+	}
+	E.cy = y;
+	E.cx = x;
+	E.actual_x = E.cx - E.rows[E.cy].indentation;
+	E.actual_indentation = E.rows[E.cy].indentation;
+}
+
+/* Every edit reports here that dlen bytes at at gave way to ilen new ones.
+ * The mark stays on the same text; one inside the removed bytes moves to
+ * where they were. */
+void pieceEdited(int at, int dlen, int ilen) {
+	if (E.mark > at) {
+		if (E.mark < at + dlen) E.mark = at;
+		else E.mark += ilen - dlen;
+	}
+	if (!RL.on) return;
+	if (RL.from < 0) {
+		RL.from = at;
+		RL.to = at + ilen;
+		RL.delta = ilen - dlen;
+		return;
+	}
+	int to = RL.to >= at + dlen ? RL.to + ilen - dlen : at + ilen;
+	if (RL.from > at) RL.from = at;
+	RL.to = to > at + ilen ? to : at + ilen;
+	RL.delta += ilen - dlen;
+}
+
+void pieceInsert(int x, char c) {
+	if ((long long)pt.add_size + 1 > INT_MAX) {
+		errno = EOVERFLOW;
+		die("pieceInsert");
+	}
+	if (x >= 0 && x <= pieceLength()) pieceEdited(x, 0, 1);
+	int insert_index = -1;
+	int curr_length = 0;
+	for (int i = 0; i < pt.size; i++) {
+		curr_length += pt.p[i].length;
+		if (x < curr_length) {
+			x -= (curr_length - pt.p[i].length);
+			insert_index = i;
+			insertInBetween(x, c, insert_index);
+			break;
+		} else if (x == curr_length) {
+			if (pt.p[i].add && (pt.add_size == pt.p[i].start + pt.p[i].length)){
+				char *new_add = realloc(pt.add, pt.add_size + sizeof(char));
+				if (new_add == NULL) {
+					perror("Memory Allocation Failed!");
+					exit(0);
+				}
+				new_add[pt.add_size] = c;
+				pt.add = new_add;
+				pt.p[i].length += 1;
+				pt.add_size += 1;
+				return;
+			} else {
+			 	insert_index = i;
+			 	insertAtEnd(c, insert_index);
+			 	break;
+			 }
+		}
+	}
+	if (insert_index == -1) {
+		printf("Out of bounds index %d", x);
+		return;
+	}
+}
+
+void insertCharacter(char c) {
+	int x = editorCursorOffset();
+	E.cx += 1;
+	pieceInsert(x, c);
+}
+
+void deleteInBetween(int x, int insert_index) {
+	pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
+	if (pt.p == NULL) {
+		perror("Memory Allocation Failed!");
+		exit(0);
+	}
+	for(int i = pt.size; (i - 1) > insert_index; i--) {
+		pt.p[i] = pt.p[i - 1];
+	}
+	pt.p[insert_index + 1].length = pt.p[insert_index].length;
+	pt.p[insert_index].length = x;
+	pt.p[insert_index + 1].start = pt.p[insert_index].start + x + 1;
+	pt.p[insert_index + 1].length -= (x + 1);
+	pt.p[insert_index + 1].add = pt.p[insert_index].add;
+	pt.size += 1;
+}
+
+void deleteAtEnd(int insert_index) {
+	if (pt.p[insert_index].length == 1) {
+		for (int i = insert_index; i < pt.size - 1; i++){
+			pt.p[i] = pt.p[i + 1];
+		}
+		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
+		pt.size -= 1;
+	} else {
+		pt.p[insert_index].length -= 1;
+	}
+}
+
+void deleteAtBeginning(int insert_index) {
+	if (pt.p[insert_index].length == 1) {
+		for (int i = insert_index; i < pt.size - 1; i++){
+			pt.p[i] = pt.p[i + 1];
+		}
+		pt.p = realloc(pt.p, sizeof(struct Piece) * (pt.size - 1));
+		pt.size -= 1;
+	} else {
+		pt.p[insert_index].start += 1;
+		pt.p[insert_index].length -= 1;
+	}
+}
+
+void pieceDelete(int x) {
+	if (x >= 0 && x < pieceLength()) pieceEdited(x, 1, 0);
+	int curr_length = 0;
+	for (int i = 0; i < pt.size; i++) {
+		curr_length += pt.p[i].length;
+		if (x < (curr_length - 1)) {
+			x -= (curr_length - pt.p[i].length);
+			if (x == 0) {
+				deleteAtBeginning(i);
+				break;
+			}
+			deleteInBetween(x, i);
+			break;
+		} else if (x == (curr_length - 1)) {
+			deleteAtEnd(i);
+			break;
+		} else if (x == (curr_length)) {
+			deleteAtBeginning(i + 1);
+			break;
+		}
+	}
+}
+
+void deleteCharacter() {
+	int x = editorCursorOffset();
+	E.cx -= 1;
+	pieceDelete(x);
+}
+
+/* Copies a run of short add-buffer pieces to the end of the add buffer so
+ * they can become one piece. */
+int pieceGatherRun(struct Piece *run, int count) {
+	int bytes = 0;
+	for (int k = 0; k < count; k++) bytes += run[k].length;
+	if ((long long)pt.add_size + bytes > INT_MAX) return -1;
+	char *new_add = realloc(pt.add, pt.add_size + bytes);
+	if (new_add == NULL) return -1;
+	pt.add = new_add;
+	int start = pt.add_size;
+	for (int k = 0; k < count; k++) {
+		memcpy(pt.add + pt.add_size, pt.add + run[k].start, run[k].length);
+		pt.add_size += run[k].length;
+	}
+	run[0].start = start;
+	run[0].length = bytes;
+	return 0;
+}
+
+/* Runs once typing pauses: drops empty pieces, merges pieces that continue
+ * each other in the same buffer, then gathers runs of short add-buffer
+ * pieces into one span. Gathering waits for the redo stack to empty, since
+ * the add bytes past add_size belong to it. Negative lengths, which a delete
+ * at the start of an empty piece leaves behind, are kept as they are. */
+void pieceCompact() {
+	if (E.prompting) {
+		editorAddTimer(PIECE_COMPACT_MS, pieceCompact);
+		return;
+	}
+	int n = 0;
+	for (int i = 0; i < (int)pt.size; i++) {
+		struct Piece *q = &pt.p[i];
+		if (q->length == 0) continue;
+		struct Piece *last = n > 0 ? &pt.p[n - 1] : NULL;
+		if (last && last->length > 0 && q->length > 0 && last->add == q->add &&
+				last->start + last->length == q->start) {
+			last->length += q->length;
+			continue;
+		}
+		pt.p[n++] = *q;
+	}
+
+	int m = 0;
+	for (int i = 0; i < n; ) {
+		int j = i;
+		while (j < n && pt.p[j].add && pt.p[j].length > 0 && pt.p[j].length < PIECE_TINY) j++;
+		if (j - i >= PIECE_TINY_RUN && redotop < 0 && pieceGatherRun(&pt.p[i], j - i) == 0) {
+			pt.p[m++] = pt.p[i];
+			i = j;
+		} else {
+			pt.p[m++] = pt.p[i++];
+		}
+	}
+
+	if (m == 0) {
+		struct Piece *p = realloc(pt.p, sizeof(struct Piece));
+		if (p == NULL) die("Malloc Error!");
+		pt.p = p;
+		pt.p[0].start = 0;
+		pt.p[0].length = 0;
+		pt.p[0].add = 0;
+		m = 1;
+	}
+	if ((size_t)m < pt.size) {
+		struct Piece *p = realloc(pt.p, sizeof(struct Piece) * m);
+		if (p != NULL) pt.p = p;
+	}
+	pt.size = m;
+	addGcStart();
+}
+
+/*** add buffer ***/
+
+#define ADD_GC_MIN (1024 * 1024)
+#define ADD_GC_SLICE (64 * 1024)
+
+/*
+ * Bytes stay in the add buffer for as long as any piece table refers to them:
+ * the live one, or a snapshot on the undo or redo stack. Once the buffer has
+ * doubled since the last collection, idle time is spent marking the spans
+ * those tables use, ADD_GC_SLICE pieces at a time. A keypress or a reload
+ * throws the marks away. When marking finishes, the live spans are copied in
+ * order into a new buffer, so every add offset, add_size included, moves down
+ * by the dead bytes below it. The live table and the clipboard move at once;
+ * the snapshots are left stale and moved ADD_GC_SLICE pieces per tick after,
+ * or all at once when undo or redo brings one back. No collection starts
+ * until the last of them has moved.
+ */
+
+struct addSpan {
+	int start;
+	int end;
+	int to;
+};
+
+struct addCollector {
+	int active;
+	int remap;
+	int table;
+	int index;
+	size_t used;
+	size_t last;
+	struct addSpan *spans;
+	int nspans;
+	int cap;
+} AG;
+
+/* Table 0 is pt.p, then come the undo snapshots, the redo snapshots and the
+ * clipboard. */
+struct Piece *addGcTable(int t, int *n) {
+	if (t == 0) {
+		*n = pt.size;
+		return pt.p;
+	}
+	t -= 1;
+	if (t <= undotop) {
+		*n = undodetails[t].size;
+		return undostack[t];
+	}
+	t -= undotop + 1;
+	if (t <= redotop) {
+		*n = redodetails[t].size;
+		return redostack[t];
+	}
+	if (t == redotop + 1 && CB.size > 0) {
+		*n = CB.size;
+		return CB.p;
+	}
+	return NULL;
+}
+
+size_t addGcUsed() {
+	size_t used = pt.add_size;
+	for (int i = 0; i <= undotop; i++) {
+		if (undodetails[i].add_size > used) used = undodetails[i].add_size;
+	}
+	for (int i = 0; i <= redotop; i++) {
+		if (redodetails[i].add_size > used) used = redodetails[i].add_size;
+	}
+	return used;
+}
+
+/* A keypress only throws away marks: the spans of a finished sweep are
+ * still needed to move the stale snapshots. */
+void addGcCancel() {
+	AG.active = 0;
+	if (!AG.remap) AG.nspans = 0;
+}
+
+void addGcMark(int start, int end) {
+	if (AG.nspans > 0 && AG.spans[AG.nspans - 1].end == start) {
+		AG.spans[AG.nspans - 1].end = end;
+		return;
+	}
+	if (AG.nspans == AG.cap) {
+		int cap = AG.cap ? AG.cap * 2 : 256;
+		struct addSpan *spans = realloc(AG.spans, sizeof(struct addSpan) * cap);
+		if (spans == NULL) {
+			addGcCancel();
+			return;
+		}
+		AG.spans = spans;
+		AG.cap = cap;
+	}
+	AG.spans[AG.nspans].start = start;
+	AG.spans[AG.nspans].end = end;
+	AG.nspans++;
+}
+
+int addGcCompareSpan(const void *a, const void *b) {
+	const struct addSpan *x = a;
+	const struct addSpan *y = b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Offsets inside a live span keep their place in it; offsets in a dead gap
+ * move to the end of the live span before the gap. */
+int addGcMap(int off) {
+	int lo = 0;
+	int hi = AG.nspans;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (AG.spans[mid].start <= off) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return 0;
+	struct addSpan *sp = &AG.spans[lo - 1];
+	if (off > sp->end) off = sp->end;
+	return sp->to + off - sp->start;
+}
+
+void addGcSweep() {
+	qsort(AG.spans, AG.nspans, sizeof(struct addSpan), addGcCompareSpan);
+	int n = 0;
+	size_t live = 0;
+	for (int i = 0; i < AG.nspans; i++) {
+		if (n > 0 && AG.spans[i].start <= AG.spans[n - 1].end) {
+			if (AG.spans[i].end > AG.spans[n - 1].end) {
+				live += AG.spans[i].end - AG.spans[n - 1].end;
+				AG.spans[n - 1].end = AG.spans[i].end;
+			}
+			continue;
+		}
+		AG.spans[n] = AG.spans[i];
+		AG.spans[n].to = live;
+		live += AG.spans[n].end - AG.spans[n].start;
+		n++;
+	}
+	AG.nspans = n;
+	AG.last = AG.used;
+	if (live * 4 > AG.used * 3) {
+		addGcCancel();
+		return;
+	}
+
+	char *add = malloc(live ? live : 1);
+	if (add == NULL) {
+		addGcCancel();
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		memcpy(add + AG.spans[i].to, pt.add + AG.spans[i].start, AG.spans[i].end - AG.spans[i].start);
+	}
+	for (size_t i = 0; i < pt.size; i++) {
+		if (pt.p[i].add) pt.p[i].start = addGcMap(pt.p[i].start);
+	}
+	for (int i = 0; i < CB.size; i++) {
+		if (CB.p[i].add) CB.p[i].start = addGcMap(CB.p[i].start);
+	}
+	for (int i = 0; i <= undotop; i++) {
+		undodetails[i].add_size = addGcMap(undodetails[i].add_size);
+		undodetails[i].stale = 1;
+		undodetails[i].done = 0;
+	}
+	for (int i = 0; i <= redotop; i++) {
+		redodetails[i].add_size = addGcMap(redodetails[i].add_size);
+		redodetails[i].stale = 1;
+		redodetails[i].done = 0;
+	}
+	pt.add_size = addGcMap(pt.add_size);
+	CB.add_end = addGcMap(CB.add_end);
+	free(pt.add);
+	pt.add = add;
+	AG.last = live;
+	AG.active = 0;
+	AG.remap = 1;
+	editorAddTimer(0, addGcRemapStep);
+}
+
+/* Moves up to budget more of a stale snapshot's pieces into the new buffer
+ * and returns what is left of the budget. */
+int addGcRemap(struct details *d, struct Piece *p, int budget) {
+	if (!d->stale) return budget;
+	for (; d->done < (int)d->size && budget > 0; d->done++, budget--) {
+		if (p[d->done].add) p[d->done].start = addGcMap(p[d->done].start);
+	}
+	if (d->done == (int)d->size) d->stale = 0;
+	return budget;
+}
+
+void addGcFix(struct details *d, struct Piece *p) {
+	if (AG.remap) addGcRemap(d, p, INT_MAX);
+}
+
+void addGcRemapStep() {
+	if (!AG.remap) return;
+	int budget = ADD_GC_SLICE;
+	for (int i = 0; i <= undotop && budget > 0; i++) budget = addGcRemap(&undodetails[i], undostack[i], budget);
+	for (int i = 0; i <= redotop && budget > 0; i++) budget = addGcRemap(&redodetails[i], redostack[i], budget);
+	if (budget == 0) {
+		editorAddTimer(0, addGcRemapStep);
+		return;
+	}
+	AG.remap = 0;
+	AG.nspans = 0;
+}
+
+/* Moves every stale snapshot now, for code that reads them all. */
+void addGcSettle() {
+	if (!AG.remap) return;
+	for (int i = 0; i <= undotop; i++) addGcRemap(&undodetails[i], undostack[i], INT_MAX);
+	for (int i = 0; i <= redotop; i++) addGcRemap(&redodetails[i], redostack[i], INT_MAX);
+	AG.remap = 0;
+	AG.nspans = 0;
+}
+
+void addGcStep() {
+	if (!AG.active) return;
+	if (E.prompting) {
+		editorAddTimer(PIECE_COMPACT_MS, addGcStep);
+		return;
+	}
+	int budget = ADD_GC_SLICE;
+	int n;
+	struct Piece *p;
+	while ((p = addGcTable(AG.table, &n)) != NULL) {
+		for (; AG.index < n && budget > 0; AG.index++, budget--) {
+			if (p[AG.index].add && p[AG.index].length > 0) {
+				addGcMark(p[AG.index].start, p[AG.index].start + p[AG.index].length);
+			}
+		}
+		if (!AG.active) return;
+		if (AG.index < n) break;
+		AG.table++;
+		AG.index = 0;
+	}
+	if (p != NULL) {
+		editorAddTimer(0, addGcStep);
+		return;
+	}
+	addGcSweep();
+}
+
+void addGcStart() {
+	if (AG.active || AG.remap) return;
+	size_t used = addGcUsed();
+	if (used < ADD_GC_MIN || used < AG.last * 2) return;
+	AG.active = 1;
+	AG.table = 0;
+	AG.index = 0;
+	AG.used = used;
+	AG.nspans = 0;
+	editorAddTimer(0, addGcStep);
+}
+
+/*** file i/o ***/
+
+long content_page;
+
+/* The original file is mapped rather than read, so opening costs nothing
+ * until pages are touched. Another program can still truncate it in place,
+ * and until the watch reloads it a read past the new end raises SIGBUS, in a
+ * redraw or in a background index alike. Those pages are swapped for zeros,
+ * so the stale text reads as blanks instead of killing the editor. */
+void contentFault(int sig, siginfo_t *si, void *ctx) {
+	(void)ctx;
+	char *addr = si->si_addr;
+	if (pt.content_size > 0 && addr >= pt.content && addr < pt.content + pt.content_size) {
+		char *page = (char *)((uintptr_t)addr & ~(uintptr_t)(content_page - 1));
+		size_t len = pt.content + pt.content_size - page;
+		if (mmap(page, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) return;
+	}
+	signal(sig, SIG_DFL);
+}
+
+/* Maps size bytes of fd; an empty file gets a one-byte buffer instead. */
+char *fileMap(int fd, size_t size) {
+	if (size == 0) return malloc(1);
+	char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+void createPieceTable(char* file_name) {
+	int fd = open(file_name, O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror("Error Opening file");
+		exit(0);
+	}
+	/* piece offsets and lengths are ints */
+	if (st.st_size > INT_MAX) {
+		fprintf(stderr, "%s: too large to open, the limit is %d bytes\n", file_name, INT_MAX);
+		close(fd);
+		exit(0);
+	}
+
+	size_t file_size = st.st_size;
+	pt.content = fileMap(fd, file_size);
+	if (pt.content == NULL) {
+		perror("Error loading file into memory");
+		close(fd);
+		exit(0);
+	}
+	close(fd);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = contentFault;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_SIGINFO;
+	content_page = sysconf(_SC_PAGESIZE);
+	if (sigaction(SIGBUS, &sa, NULL) == -1) die("sigaction");
+
+	pt.content_size = file_size;
+	pt.add = malloc(0);
+	pt.add_size = 0;
+	pt.size = 1;
+	pt.p = malloc(sizeof(struct Piece));
+	pt.p[0].start = 0;
+	pt.p[0].length = file_size;
+	pt.p[0].add = 0;
+	if (atexit(destroyer) != 0) {
+		perror("Failed to register atexit handler");
+		exit(0);
+	}
+}
+
+void initialiseconfig() {
+	int j = 0;
+	int size = 0;
+	int indentation = 0;
+	E.rows = malloc(1 * sizeof(erow));
+	for(int i = 0; i < pt.p[0].length; i++) {
+		if (pieceBuffer(&pt.p[0])[i] == '\n') {
+			if (j != 0){
+				E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
+			}
+			E.rows[j].size = size;
+			E.rows[j].indentation = indentation;
+			size = 0;
+			indentation = 0;
+			j += 1;
+		} else if (pieceBuffer(&pt.p[0])[i] == '\t') {
+			indentation += 1;
+		} else {
+			size += 1;
+		}
+	}
+
+	if (size != 0 || indentation != 0) {
+		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
+		E.rows[j].size = size + 1;
+		E.rows[j].indentation = indentation;
+	} else {
+		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
+		E.rows[j].size = 1;
+	}
+	j += 1;
+
+	E.numrows = j;
+}
+
+/* Lays out again the rows from the one holding from to the one holding
+ * to, for text where [from, to) took the place of [from, oldto). */
+void remakeRows(int from, int oldto, int to) {
+	int y0 = 0;
+	int start = 0;
+	while (y0 < E.numrows && from >= start + E.rows[y0].size + E.rows[y0].indentation + 1) {
+		start += E.rows[y0].size + E.rows[y0].indentation + 1;
+		y0++;
+	}
+	int y1 = y0;
+	int end = start;
+	while (y1 < E.numrows && oldto >= end + E.rows[y1].size + E.rows[y1].indentation + 1) {
+		end += E.rows[y1].size + E.rows[y1].indentation + 1;
+		y1++;
+	}
+	int drop = (y1 < E.numrows ? y1 + 1 : E.numrows) - y0;
+
+	erow *rows = NULL;
+	int n = 0;
+	int cap = 0;
+	int size = 0;
+	int indentation = 0;
+	int base = 0;
+	int done = 0;
+	for (int k = 0; k < (int)pt.size && !done; k++) {
+		if (pt.p[k].length <= 0) continue;
+		if (base + pt.p[k].length <= start) {
+			base += pt.p[k].length;
+			continue;
+		}
+		const char *b = pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		for (int i = start > base ? start - base : 0; i < pt.p[k].length; i++) {
+			if (b[i] == '\n') {
+				if (n == cap) {
+					cap = cap ? cap * 2 : 16;
+					rows = realloc(rows, sizeof(erow) * cap);
+					if (rows == NULL) die("Malloc Error!");
+				}
+				rows[n].size = size;
+				rows[n].indentation = indentation;
+				n++;
+				size = 0;
+				indentation = 0;
+				if (base + i >= to) {
+					done = 1;
+					break;
+				}
+			} else if (b[i] == '\t') {
+				indentation += 1;
+			} else {
+				size += 1;
+			}
+		}
+		base += pt.p[k].length;
+	}
+	if (!done && (size != 0 || indentation != 0)) {
+		if (n == cap) {
+			rows = realloc(rows, sizeof(erow) * (cap + 1));
+			if (rows == NULL) die("Malloc Error!");
+		}
+		rows[n].size = size;
+		rows[n].indentation = indentation;
+		n++;
+	}
+
+	int numrows = E.numrows - drop + n;
+	if (n > drop) {
+		erow *grown = realloc(E.rows, sizeof(erow) * numrows);
+		if (grown == NULL) die("Malloc Error!");
+		E.rows = grown;
+	}
+	memmove(E.rows + y0 + n, E.rows + y0 + drop, sizeof(erow) * (E.numrows - y0 - drop));
+	if (n > 0) memcpy(E.rows + y0, rows, sizeof(erow) * n);
+	E.numrows = numrows;
+	free(rows);
+}
+
+void remakeconfig() {
+	if (RL.on) {
+		if (RL.from >= 0) remakeRows(RL.from, RL.to - RL.delta, RL.to);
+		RL.from = -1;
+		return;
+	}
+	int j = 0;
+	int size = 0;
+	int indentation = 0;
+	if (E.rows != NULL){
+		free(E.rows);
+		E.rows = NULL;	
+	}
+	E.rows = malloc(sizeof(erow));
+	for(int k = 0; k < pt.size; k++){
+		for(int i = 0; i < pt.p[k].length; i++) {
+			if (pieceBuffer(&pt.p[k])[pt.p[k].start + i] == '\n') {
+				if (j != 0) {
+					E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
+				}
+				E.rows[j].size = size;
+				E.rows[j].indentation = indentation;
+				size = 0;
+				indentation = 0;
+				j += 1;
+			} else if (pieceBuffer(&pt.p[k])[pt.p[k].start + i] == '\t') {
+				indentation += 1;
+			} else {
+				size += 1;
+			}
+		}
+	}
+
+	if (size != 0 || indentation != 0) {
+		E.rows = realloc(E.rows, sizeof(erow) * (j + 1));
+		E.rows[j].size = size;
+		E.rows[j].indentation = indentation;
+		j += 1;
+	}
+	E.numrows = j;
+}
+
+/*** trigram index ***/
+
+#define TRIGRAM_BUCKETS (1 << 16)
+#define TRIGRAM_MIN_BLOCK (64 * 1024)
+#define TRIGRAM_MAX_BLOCKS 8192
+#define TRIGRAM_MIN_SIZE (8 * 1024 * 1024)
+
+/* Posting bitmaps over blocks of pt.content, which is never modified after
+ * open. Pieces in the add buffer are the dirty ranges and are always scanned. */
+struct trigramIndex {
+	uint64_t *post;
+	int words;
+	int block;
+	int nblocks;
+	int len;
+	int started;
+	int ready;
+	int cancel;
+	pthread_t thread;
+	pthread_mutex_t lock;
+} tri;
+
+struct trigramRange {
+	int lo, hi;
+};
+
+unsigned int trigramBucket(const char *s) {
+	unsigned int t = ((unsigned char)s[0] << 16) | ((unsigned char)s[1] << 8) | (unsigned char)s[2];
+	return (t * 2654435761u) >> 16 & (TRIGRAM_BUCKETS - 1);
+}
+
+void *trigramBuild(void *arg) {
+	(void)arg;
+	uint64_t *seen = malloc(TRIGRAM_BUCKETS / 8);
+	if (seen == NULL) return NULL;
+
+	for (int b = 0; b < tri.nblocks; b++) {
+		pthread_mutex_lock(&tri.lock);
+		int cancel = tri.cancel;
+		pthread_mutex_unlock(&tri.lock);
+		if (cancel) break;
+
+		/* dedupe in a block-local bitmap first so each posting bit is touched once */
+		memset(seen, 0, TRIGRAM_BUCKETS / 8);
+		int lo = b * tri.block;
+		int hi = lo + tri.block < tri.len - 2 ? lo + tri.block : tri.len - 2;
+		for (int p = lo; p < hi; p++) {
+			unsigned int h = trigramBucket(pt.content + p);
+			seen[h / 64] |= (uint64_t)1 << (h % 64);
+		}
+		for (int w = 0; w < TRIGRAM_BUCKETS / 64; w++) {
+			for (uint64_t bits = seen[w]; bits; bits &= bits - 1) {
+				int h = w * 64 + __builtin_ctzll(bits);
+				tri.post[(size_t)h * tri.words + b / 64] |= (uint64_t)1 << (b % 64);
+			}
+		}
+	}
+	free(seen);
+
+	pthread_mutex_lock(&tri.lock);
+	tri.ready = !tri.cancel;
+	pthread_mutex_unlock(&tri.lock);
+	return NULL;
+}
+
+void trigramStart(int len) {
+	if (len < TRIGRAM_MIN_SIZE) return;
+	tri.len = len;
+	tri.block = (len + TRIGRAM_MAX_BLOCKS - 1) / TRIGRAM_MAX_BLOCKS;
+	if (tri.block < TRIGRAM_MIN_BLOCK) tri.block = TRIGRAM_MIN_BLOCK;
+	tri.nblocks = (len + tri.block - 1) / tri.block;
+	/* one spare word so a row can be read shifted by one block */
+	tri.words = tri.nblocks / 64 + 2;
+	tri.post = calloc((size_t)TRIGRAM_BUCKETS * tri.words, sizeof(uint64_t));
+	if (tri.post == NULL) return;
+	tri.ready = 0;
+	tri.cancel = 0;
+	pthread_mutex_init(&tri.lock, NULL);
+	if (pthread_create(&tri.thread, NULL, trigramBuild, NULL) != 0) {
+		free(tri.post);
+		tri.post = NULL;
+		return;
+	}
+	tri.started = 1;
+}
+
+void trigramFree() {
+	if (!tri.started) return;
+	pthread_mutex_lock(&tri.lock);
+	tri.cancel = 1;
+	pthread_mutex_unlock(&tri.lock);
+	pthread_join(tri.thread, NULL);
+	pthread_mutex_destroy(&tri.lock);
+	free(tri.post);
+	tri.post = NULL;
+	tri.started = 0;
+	tri.ready = 0;
+}
+
+int trigramReady() {
+	if (!tri.started) return 0;
+	pthread_mutex_lock(&tri.lock);
+	int ready = tri.ready;
+	pthread_mutex_unlock(&tri.lock);
+	return ready;
+}
+
+int trigramCompareRange(const void *a, const void *b) {
+	const struct trigramRange *x = a;
+	const struct trigramRange *y = b;
+	return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+void trigramPushRange(struct trigramRange **r, int *n, int *cap, int lo, int hi) {
+	if (lo >= hi) return;
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		*r = realloc(*r, sizeof(struct trigramRange) * *cap);
+		if (*r == NULL) die("Malloc Error!");
+	}
+	(*r)[*n].lo = lo;
+	(*r)[*n].hi = hi;
+	*n += 1;
+}
+
+/* Sorted, merged document ranges that can hold the start of a match of needle,
+ * or NULL when the index cannot narrow the search. */
+struct trigramRange *trigramRanges(const char *needle, int nlen, int *count) {
+	if (nlen < 3 || !trigramReady()) return NULL;
+
+	uint64_t *cand = malloc(sizeof(uint64_t) * tri.words);
+	if (cand == NULL) die("Malloc Error!");
+	memset(cand, 0xff, sizeof(uint64_t) * tri.words);
+	/* a match starting in block b keeps its leading trigrams within b and b + 1 */
+	int limit = nlen < tri.block ? nlen : tri.block;
+	for (int i = 0; i + 3 <= limit; i++) {
+		const uint64_t *row = tri.post + (size_t)trigramBucket(needle + i) * tri.words;
+		for (int w = 0; w < tri.words - 1; w++) {
+			cand[w] &= row[w] | (row[w] >> 1) | (row[w + 1] << 63);
+		}
+	}
+
+	struct trigramRange *r = NULL;
+	int n = 0;
+	int cap = 0;
+	int base = 0;
+	for (int k = 0; k < (int)pt.size; base += pt.p[k].length, k++) {
+		int plen = pt.p[k].length;
+		int s = pt.p[k].start;
+		if (plen == 0) continue;
+		if (pt.p[k].add || s + plen > tri.len) {
+			trigramPushRange(&r, &n, &cap, base, base + plen);
+			continue;
+		}
+		for (int b = s / tri.block; b <= (s + plen - 1) / tri.block; b++) {
+			if (!(cand[b / 64] & ((uint64_t)1 << (b % 64)))) continue;
+			int lo = b * tri.block > s ? b * tri.block : s;
+			int hi = (b + 1) * tri.block < s + plen ? (b + 1) * tri.block : s + plen;
+			trigramPushRange(&r, &n, &cap, base + lo - s, base + hi - s);
+		}
+		/* windows that run into the next piece are not covered by this piece's blocks */
+		int tail = plen - (nlen - 1) > 0 ? plen - (nlen - 1) : 0;
+		trigramPushRange(&r, &n, &cap, base + tail, base + plen);
+	}
+	free(cand);
+
+	qsort(r, n, sizeof(struct trigramRange), trigramCompareRange);
+	int m = 0;
+	for (int i = 0; i < n; i++) {
+		if (m > 0 && r[i].lo <= r[m - 1].hi) {
+			if (r[i].hi > r[m - 1].hi) r[m - 1].hi = r[i].hi;
+		} else {
+			r[m++] = r[i];
+		}
+	}
+	*count = m;
+	if (r == NULL) {
+		r = malloc(sizeof(struct trigramRange));
+		if (r == NULL) die("Malloc Error!");
+	}
+	return r;
+}
+
+/*** find ***/
+
+#define SEARCH_CHUNK (16 * 1024 * 1024)
+#define SEARCH_PARALLEL_MIN (64 * 1024 * 1024)
+#define SEARCH_CHUNK_MATCHES 4096
+#define SEARCH_MAX_THREADS 64
+
+int search_origin = 0;
+
+struct searchSpan {
+	const char *data;
+	int length;
+};
+
+struct searchChunk {
+	int matches[SEARCH_CHUNK_MATCHES];
+	int count;
+	int truncated;
+	int done;
+};
+
+struct searchJob {
+	struct searchSpan *spans;
+	int nspans;
+	char *needle;
+	int nlen;
+	int skip[256];
+	int len;
+	struct searchChunk *chunks;
+	int nchunks;
+	int first_chunk;
+	int claimed;
+	int cancel;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t threads[SEARCH_MAX_THREADS];
+	int nthreads;
+};
+
+struct searchSpan *searchSnapshot(int *count) {
+	struct searchSpan *spans = malloc(sizeof(struct searchSpan) * (pt.size + 1));
+	if (spans == NULL) die("Malloc Error!");
+	for (int k = 0; k < (int)pt.size; k++) {
+		spans[k].data = pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		spans[k].length = pt.p[k].length;
+	}
+	*count = pt.size;
+	return spans;
+}
+
+void searchBuildSkip(const char *needle, int nlen, int *skip) {
+	for (int c = 0; c < 256; c++) {
+		skip[c] = nlen;
+	}
+	for (int j = 0; j < nlen - 1; j++) {
+		skip[(unsigned char)needle[j]] = nlen - 1 - j;
+	}
+}
+
+int searchMatchAcross(const struct searchSpan *sp, int nspans, int k, int off, const char *needle, int nlen) {
+	while (nlen > 0 && k < nspans) {
+		int n = sp[k].length - off;
+		if (n > nlen) n = nlen;
+		if (memcmp(sp[k].data + off, needle, n) != 0) return 0;
+		needle += n;
+		nlen -= n;
+		off = 0;
+		k++;
+	}
+	return nlen == 0;
+}
+
+/* Calls emit for every match starting in [from, to) until it returns 0. */
+void searchSpans(const struct searchSpan *sp, int nspans, const char *needle, int nlen, const int *skip,
+		int from, int to, int (*emit)(void *, int), void *arg) {
+	int base = 0;
+	for (int k = 0; k < nspans && base < to; base += sp[k].length, k++) {
+		int plen = sp[k].length;
+		if (base + plen <= from) continue;
+
+		const char *text = sp[k].data;
+		const char *hit;
+		int i = from > base ? from - base : 0;
+		int end = to - base < plen ? to - base : plen;
+		int fit = plen - nlen + 1 < end ? plen - nlen + 1 : end;
+
+		/* windows that fit in this piece: memchr on the first byte, then a Horspool shift */
+		while (i < fit) {
+			hit = memchr(text + i, needle[0], fit - i);
+			if (hit == NULL) {
+				i = fit;
+				break;
+			}
+			i = hit - text;
+			if (memcmp(text + i, needle, nlen) == 0) {
+				if (!emit(arg, base + i)) return;
+				i++;
+			} else {
+				i += skip[(unsigned char)text[i + nlen - 1]];
+			}
+		}
+
+		/* windows that start here and run into the following pieces */
+		while (i < end && (hit = memchr(text + i, needle[0], end - i)) != NULL) {
+			i = hit - text;
+			if (searchMatchAcross(sp, nspans, k, i, needle, nlen) && !emit(arg, base + i)) return;
+			i++;
+		}
+	}
+}
+
+int searchEmitFirst(void *arg, int pos) {
+	*(int *)arg = pos;
+	return 0;
+}
+
+int searchEmitLast(void *arg, int pos) {
+	*(int *)arg = pos;
+	return 1;
+}
+
+int searchForward(const char *needle, int nlen, const int *skip, int from) {
+	int nspans;
+	int nranges;
+	struct searchSpan *spans = searchSnapshot(&nspans);
+	struct trigramRange *ranges = trigramRanges(needle, nlen, &nranges);
+	int match = -1;
+	if (ranges == NULL) {
+		searchSpans(spans, nspans, needle, nlen, skip, from, INT_MAX, searchEmitFirst, &match);
+	} else {
+		for (int r = 0; r < nranges && match == -1; r++) {
+			if (ranges[r].hi <= from) continue;
+			searchSpans(spans, nspans, needle, nlen, skip, ranges[r].lo > from ? ranges[r].lo : from,
+					ranges[r].hi, searchEmitFirst, &match);
+		}
+		free(ranges);
+	}
+	free(spans);
+	return match;
+}
+
+int searchBackward(const char *needle, int nlen, int before) {
+	int nspans;
+	int nranges;
+	struct searchSpan *spans = searchSnapshot(&nspans);
+	struct trigramRange *ranges = trigramRanges(needle, nlen, &nranges);
+	int match = -1;
+	if (ranges != NULL) {
+		int skip[256];
+		searchBuildSkip(needle, nlen, skip);
+		for (int r = nranges - 1; r >= 0 && match == -1; r--) {
+			if (ranges[r].lo >= before) continue;
+			searchSpans(spans, nspans, needle, nlen, skip, ranges[r].lo,
+					ranges[r].hi < before ? ranges[r].hi : before, searchEmitLast, &match);
+		}
+		free(ranges);
+		free(spans);
+		return match;
+	}
+
+	int base = pieceLength();
+	for (int k = nspans - 1; k >= 0 && match == -1; k--) {
+		int plen = spans[k].length;
+		base -= plen;
+		if (base >= before) continue;
+
+		const char *text = spans[k].data;
+		const char *hit;
+		int limit = before - base < plen ? before - base : plen;
+		while (limit > 0 && (hit = memrchr(text, needle[0], limit)) != NULL) {
+			int i = hit - text;
+			if (searchMatchAcross(spans, nspans, k, i, needle, nlen)) {
+				match = base + i;
+				break;
+			}
+			limit = i;
+		}
+	}
+	free(spans);
+	return match;
+}
+
+/* Chunk bounds in 64 bits: the last chunk of a text near INT_MAX ends past it. */
+int searchChunkEnd(struct searchJob *job, int i) {
+	int64_t hi = (int64_t)(i + 1) * SEARCH_CHUNK;
+	return hi < job->len ? (int)hi : job->len;
+}
+
+int searchEmitChunk(void *arg, int pos) {
+	struct searchChunk *chunk = arg;
+	if (chunk->count == SEARCH_CHUNK_MATCHES) {
+		chunk->truncated = 1;
+		return 0;
+	}
+	chunk->matches[chunk->count++] = pos;
+	return 1;
+}
+
+void *searchWorker(void *arg) {
+	struct searchJob *job = arg;
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+		if (job->cancel || job->claimed == job->nchunks) {
+			pthread_mutex_unlock(&job->lock);
+			return NULL;
+		}
+		int i = (job->first_chunk + job->claimed++) % job->nchunks;
+		pthread_mutex_unlock(&job->lock);
+
+		/* matches may run past hi; they are verified against the following bytes */
+		int lo = (int)((int64_t)i * SEARCH_CHUNK);
+		int hi = searchChunkEnd(job, i);
+		searchSpans(job->spans, job->nspans, job->needle, job->nlen, job->skip, lo, hi, searchEmitChunk, &job->chunks[i]);
+
+		pthread_mutex_lock(&job->lock);
+		job->chunks[i].done = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+struct searchJob *searchJobStart(const char *needle, int nlen, int origin) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int len = pieceLength();
+	if (cpus < 2 || len < SEARCH_PARALLEL_MIN) return NULL;
+
+	struct searchJob *job = calloc(1, sizeof(struct searchJob));
+	if (job == NULL) die("Malloc Error!");
+	job->spans = searchSnapshot(&job->nspans);
+	job->needle = malloc(nlen);
+	if (job->needle == NULL) die("Malloc Error!");
+	memcpy(job->needle, needle, nlen);
+	job->nlen = nlen;
+	searchBuildSkip(needle, nlen, job->skip);
+	job->len = len;
+	job->nchunks = (int)(((int64_t)len + SEARCH_CHUNK - 1) / SEARCH_CHUNK);
+	job->first_chunk = origin / SEARCH_CHUNK < job->nchunks ? origin / SEARCH_CHUNK : 0;
+	job->chunks = calloc(job->nchunks, sizeof(struct searchChunk));
+	if (job->chunks == NULL) die("Malloc Error!");
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+
+	job->nthreads = cpus < SEARCH_MAX_THREADS ? cpus : SEARCH_MAX_THREADS;
+	for (int t = 0; t < job->nthreads; t++) {
+		if (pthread_create(&job->threads[t], NULL, searchWorker, job) != 0) {
+			job->nthreads = t;
+			break;
+		}
+	}
+	if (job->nthreads == 0) {
+		searchWorker(job);
+	}
+	return job;
+}
+
+void searchJobFree(struct searchJob *job) {
+	if (job == NULL) return;
+	pthread_mutex_lock(&job->lock);
+	job->cancel = 1;
+	pthread_mutex_unlock(&job->lock);
+	for (int t = 0; t < job->nthreads; t++) {
+		pthread_join(job->threads[t], NULL);
+	}
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->cond);
+	free(job->chunks);
+	free(job->needle);
+	free(job->spans);
+	free(job);
+}
+
+struct searchChunk *searchJobWait(struct searchJob *job, int i) {
+	pthread_mutex_lock(&job->lock);
+	while (!job->chunks[i].done) {
+		pthread_cond_wait(&job->cond, &job->lock);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return &job->chunks[i];
+}
+
+/* First match at or after from, consuming chunk results in document order. */
+int searchJobNext(struct searchJob *job, int from) {
+	for (int i = from / SEARCH_CHUNK; i < job->nchunks; i++) {
+		struct searchChunk *chunk = searchJobWait(job, i);
+		for (int m = 0; m < chunk->count; m++) {
+			if (chunk->matches[m] >= from) return chunk->matches[m];
+		}
+		if (chunk->truncated) {
+			int lo = chunk->matches[chunk->count - 1] + 1;
+			int hi = searchChunkEnd(job, i);
+			int match = -1;
+			searchSpans(job->spans, job->nspans, job->needle, job->nlen, job->skip,
+					lo > from ? lo : from, hi, searchEmitFirst, &match);
+			if (match != -1) return match;
+		}
+	}
+	return -1;
+}
+
+int searchJobPrev(struct searchJob *job, int before) {
+	if (before > job->len) before = job->len;
+	for (int i = (before - 1) / SEARCH_CHUNK; i >= 0; i--) {
+		struct searchChunk *chunk = searchJobWait(job, i);
+		int match = -1;
+		if (chunk->truncated) {
+			int lo = chunk->matches[chunk->count - 1] + 1;
+			int hi = searchChunkEnd(job, i) < before ? searchChunkEnd(job, i) : before;
+			searchSpans(job->spans, job->nspans, job->needle, job->nlen, job->skip, lo, hi, searchEmitLast, &match);
+		}
+		if (match != -1) return match;
+		for (int m = chunk->count - 1; m >= 0; m--) {
+			if (chunk->matches[m] < before) return chunk->matches[m];
+		}
+	}
+	return -1;
+}
+
+void editorFindCallback(char *query, int key) {
+	static int last_match = -1;
+	static int skip[256];
+	static struct searchJob *job = NULL;
+
+	if (key == '\r' || key == '\x1b') {
+		searchJobFree(job);
+		job = NULL;
+		last_match = -1;
+		return;
+	}
+
+	int direction = 0;
+	if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		direction = 1;
+	} else if (key == ARROW_LEFT || key == ARROW_UP) {
+		direction = -1;
+	} else {
+		searchJobFree(job);
+		job = NULL;
+		last_match = -1;
+	}
+
+	int nlen = strlen(query);
+	if (nlen == 0) return;
+	searchBuildSkip(query, nlen, skip);
+	if (job == NULL && !trigramReady()) job = searchJobStart(query, nlen, search_origin);
+
+	int match;
+	if (direction == -1 && last_match != -1) {
+		if (job) {
+			match = searchJobPrev(job, last_match);
+			if (match == -1) match = searchJobPrev(job, INT_MAX);
+		} else {
+			match = searchBackward(query, nlen, last_match);
+			if (match == -1) match = searchBackward(query, nlen, INT_MAX);
+		}
+	} else {
+		int from = last_match == -1 ? search_origin : last_match + 1;
+		if (job) {
+			match = searchJobNext(job, from);
+			if (match == -1) match = searchJobNext(job, 0);
+		} else {
+			match = searchForward(query, nlen, skip, from);
+			if (match == -1) match = searchForward(query, nlen, skip, 0);
+		}
+	}
+
+	if (match != -1) {
+		last_match = match;
+		editorOffsetToCursor(match);
+	}
+}
+
+void editorFind() {
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	search_origin = editorCursorOffset();
+
+	char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback, 0);
+
+	if (query) {
+		free(query);
+	} else {
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+	}
+}
+
+/*** regex ***/
+
+#define RX_MAX_STATES 1024
+#define RX_TABLE_SIZE 2048
+#define RX_UNKNOWN -1
+#define RX_DEAD -2
+
+enum rxOp { RX_CHAR, RX_SPLIT, RX_JMP, RX_BOL, RX_EOL, RX_MATCH };
+enum rxNodeType { RX_N_EMPTY, RX_N_SET, RX_N_CAT, RX_N_ALT, RX_N_STAR, RX_N_PLUS, RX_N_QUEST, RX_N_BOL, RX_N_EOL };
+
+struct rxInst {
+	int op;
+	int x, y;
+	unsigned char set[32];
+};
+
+struct rxNode {
+	int type;
+	int left, right;
+	unsigned char set[32];
+};
+
+struct rxParser {
+	const char *s;
+	int pos;
+	int error;
+	struct rxNode *nodes;
+	int nnodes;
+};
+
+/* A lazily built DFA state: the NFA pcs reached right after consuming a byte.
+ * Forward states keep the pcs in priority order and remember whether a match
+ * has been seen, after which no new starts are tried. */
+struct rxState {
+	int *pcs;
+	int npcs;
+	int bol;
+	int matched;
+	int accept[2];
+	int next[256];
+};
+
+struct rxProg {
+	struct rxInst *inst;
+	int ninst;
+	int unanchored;
+	struct rxState *states;
+	int nstates;
+	int table[RX_TABLE_SIZE];
+	int *stack;
+	int *list;
+	int *closure;
+	int *mark;
+	int gen;
+};
+
+struct regex {
+	struct rxProg fwd;
+	struct rxProg rev;
+	char literal[64];
+	int literal_len;
+	int single_line;
+};
+
+void rxSetAdd(unsigned char *set, int c) {
+	set[c >> 3] |= 1 << (c & 7);
+}
+
+int rxSetHas(const unsigned char *set, int c) {
+	return set[c >> 3] & (1 << (c & 7));
+}
+
+void rxSetRange(unsigned char *set, int lo, int hi) {
+	for (int c = lo; c <= hi; c++) {
+		rxSetAdd(set, c);
+	}
+}
+
+void rxSetInvert(unsigned char *set) {
+	for (int i = 0; i < 32; i++) {
+		set[i] = ~set[i];
+	}
+}
+
+int rxNewNode(struct rxParser *p, int type, int left, int right) {
+	p->nodes = realloc(p->nodes, sizeof(struct rxNode) * (p->nnodes + 1));
+	if (p->nodes == NULL) die("Malloc Error!");
+	struct rxNode *n = &p->nodes[p->nnodes];
+	n->type = type;
+	n->left = left;
+	n->right = right;
+	memset(n->set, 0, sizeof(n->set));
+	return p->nnodes++;
+}
+
+void rxEscapeSet(unsigned char *set, int c) {
+	unsigned char tmp[32] = {0};
+	switch (tolower(c)) {
+		case 'd':
+			rxSetRange(tmp, '0', '9');
+			break;
+		case 'w':
+			rxSetRange(tmp, '0', '9');
+			rxSetRange(tmp, 'a', 'z');
+			rxSetRange(tmp, 'A', 'Z');
+			rxSetAdd(tmp, '_');
+			break;
+		case 's':
+			rxSetAdd(tmp, ' ');
+			rxSetRange(tmp, '\t', '\r');
+			break;
+		default:
+			if (c == 'n') rxSetAdd(set, '\n');
+			else if (c == 't') rxSetAdd(set, '\t');
+			else rxSetAdd(set, c);
+			return;
+	}
+	if (isupper(c)) rxSetInvert(tmp);
+	for (int i = 0; i < 32; i++) {
+		set[i] |= tmp[i];
+	}
+}
+
+int rxParseAlt(struct rxParser *p);
+
+int rxParseClass(struct rxParser *p) {
+	int n = rxNewNode(p, RX_N_SET, -1, -1);
+	unsigned char set[32] = {0};
+	int negate = 0;
+	if (p->s[p->pos] == '^') {
+		negate = 1;
+		p->pos++;
+	}
+	int first = 1;
+	while (p->s[p->pos] != ']' || first) {
+		int c = (unsigned char)p->s[p->pos++];
+		first = 0;
+		if (c == '\0') {
+			p->error = 1;
+			return n;
+		}
+		if (c == '\\') {
+			c = (unsigned char)p->s[p->pos++];
+			if (c == '\0') {
+				p->error = 1;
+				return n;
+			}
+			rxEscapeSet(set, c);
+		} else if (p->s[p->pos] == '-' && p->s[p->pos + 1] != ']' && p->s[p->pos + 1] != '\0') {
+			int hi = (unsigned char)p->s[p->pos + 1];
+			p->pos += 2;
+			if (hi < c) {
+				p->error = 1;
+				return n;
+			}
+			rxSetRange(set, c, hi);
+		} else {
+			rxSetAdd(set, c);
+		}
+	}
+	p->pos++;
+	if (negate) rxSetInvert(set);
+	memcpy(p->nodes[n].set, set, sizeof(set));
+	return n;
+}
+
+int rxParseAtom(struct rxParser *p) {
+	int c = (unsigned char)p->s[p->pos++];
+	int n;
+	switch (c) {
+		case '(':
+			n = rxParseAlt(p);
+			if (p->s[p->pos] != ')') {
+				p->error = 1;
+				return n;
+			}
+			p->pos++;
+			return n;
+		case '[':
+			return rxParseClass(p);
+		case '^':
+			return rxNewNode(p, RX_N_BOL, -1, -1);
+		case '$':
+			return rxNewNode(p, RX_N_EOL, -1, -1);
+		case '*':
+		case '+':
+		case '?':
+			p->error = 1;
+			return rxNewNode(p, RX_N_EMPTY, -1, -1);
+	}
+
+	n = rxNewNode(p, RX_N_SET, -1, -1);
+	if (c == '.') {
+		rxSetRange(p->nodes[n].set, 0, 255);
+		p->nodes[n].set['\n' >> 3] &= ~(1 << ('\n' & 7));
+	} else if (c == '\\') {
+		c = (unsigned char)p->s[p->pos++];
+		if (c == '\0') {
+			p->error = 1;
+			return n;
+		}
+		rxEscapeSet(p->nodes[n].set, c);
+	} else {
+		rxSetAdd(p->nodes[n].set, c);
+	}
+	return n;
+}
+
+int rxParseRepeat(struct rxParser *p) {
+	int n = rxParseAtom(p);
+	while (!p->error) {
+		char c = p->s[p->pos];
+		if (c == '*') n = rxNewNode(p, RX_N_STAR, n, -1);
+		else if (c == '+') n = rxNewNode(p, RX_N_PLUS, n, -1);
+		else if (c == '?') n = rxNewNode(p, RX_N_QUEST, n, -1);
+		else break;
+		p->pos++;
+	}
+	return n;
+}
+
+int rxParseCat(struct rxParser *p) {
+	int n = -1;
+	while (!p->error && p->s[p->pos] != '\0' && p->s[p->pos] != '|' && p->s[p->pos] != ')') {
+		int r = rxParseRepeat(p);
+		n = n == -1 ? r : rxNewNode(p, RX_N_CAT, n, r);
+	}
+	return n == -1 ? rxNewNode(p, RX_N_EMPTY, -1, -1) : n;
+}
+
+int rxParseAlt(struct rxParser *p) {
+	int n = rxParseCat(p);
+	while (!p->error && p->s[p->pos] == '|') {
+		p->pos++;
+		int r = rxParseCat(p);
+		n = rxNewNode(p, RX_N_ALT, n, r);
+	}
+	return n;
+}
+
+int rxEmit(struct rxProg *rp, int op) {
+	rp->inst = realloc(rp->inst, sizeof(struct rxInst) * (rp->ninst + 1));
+	if (rp->inst == NULL) die("Malloc Error!");
+	rp->inst[rp->ninst].op = op;
+	rp->inst[rp->ninst].x = rp->ninst + 1;
+	rp->inst[rp->ninst].y = -1;
+	return rp->ninst++;
+}
+
+void rxCompileNode(struct rxProg *rp, struct rxNode *nodes, int idx, int reverse) {
+	struct rxNode *n = &nodes[idx];
+	int pc, jmp;
+	switch (n->type) {
+		case RX_N_SET:
+			pc = rxEmit(rp, RX_CHAR);
+			memcpy(rp->inst[pc].set, n->set, sizeof(n->set));
+			break;
+		case RX_N_CAT:
+			rxCompileNode(rp, nodes, reverse ? n->right : n->left, reverse);
+			rxCompileNode(rp, nodes, reverse ? n->left : n->right, reverse);
+			break;
+		case RX_N_ALT:
+			pc = rxEmit(rp, RX_SPLIT);
+			rxCompileNode(rp, nodes, n->left, reverse);
+			jmp = rxEmit(rp, RX_JMP);
+			rp->inst[pc].y = rp->ninst;
+			rxCompileNode(rp, nodes, n->right, reverse);
+			rp->inst[jmp].x = rp->ninst;
+			break;
+		case RX_N_STAR:
+			pc = rxEmit(rp, RX_SPLIT);
+			rxCompileNode(rp, nodes, n->left, reverse);
+			jmp = rxEmit(rp, RX_JMP);
+			rp->inst[jmp].x = pc;
+			rp->inst[pc].y = rp->ninst;
+			break;
+		case RX_N_PLUS:
+			jmp = rp->ninst;
+			rxCompileNode(rp, nodes, n->left, reverse);
+			pc = rxEmit(rp, RX_SPLIT);
+			rp->inst[pc].x = jmp;
+			rp->inst[pc].y = rp->ninst;
+			break;
+		case RX_N_QUEST:
+			pc = rxEmit(rp, RX_SPLIT);
+			rxCompileNode(rp, nodes, n->left, reverse);
+			rp->inst[pc].y = rp->ninst;
+			break;
+		case RX_N_BOL:
+			rxEmit(rp, reverse ? RX_EOL : RX_BOL);
+			break;
+		case RX_N_EOL:
+			rxEmit(rp, reverse ? RX_BOL : RX_EOL);
+			break;
+	}
+}
+
+void rxCompileProg(struct rxProg *rp, struct rxNode *nodes, int root, int reverse) {
+	memset(rp, 0, sizeof(*rp));
+	/* pc 0 is never a jump target, so a state holding it has consumed nothing yet */
+	rxEmit(rp, RX_JMP);
+	rxCompileNode(rp, nodes, root, reverse);
+	rxEmit(rp, RX_MATCH);
+	rp->unanchored = !reverse;
+	rp->stack = malloc(sizeof(int) * (3 * rp->ninst + 1));
+	rp->list = malloc(sizeof(int) * rp->ninst);
+	rp->closure = malloc(sizeof(int) * rp->ninst);
+	rp->mark = calloc(rp->ninst, sizeof(int));
+	if (!rp->stack || !rp->list || !rp->closure || !rp->mark) die("Malloc Error!");
+}
+
+void rxFlush(struct rxProg *rp) {
+	for (int i = 0; i < rp->nstates; i++) {
+		free(rp->states[i].pcs);
+	}
+	rp->nstates = 0;
+	memset(rp->table, 0, sizeof(rp->table));
+}
+
+void rxFreeProg(struct rxProg *rp) {
+	rxFlush(rp);
+	free(rp->states);
+	free(rp->inst);
+	free(rp->stack);
+	free(rp->list);
+	free(rp->closure);
+	free(rp->mark);
+}
+
+/* Visits pcs in priority order. A match reached from pc 0 is empty and does not
+ * count; with cut set, a counted match drops every lower priority pc. */
+int rxClosure(struct rxProg *rp, const int *pcs, int npcs, int skip_start, int bol, int eol, int cut, int *matched) {
+	int top = 0;
+	int n = 0;
+	int empty = 0;
+	rp->gen++;
+	*matched = 0;
+	for (int i = npcs - 1; i >= 0; i--) {
+		if (!(skip_start && pcs[i] == 0)) rp->stack[top++] = pcs[i];
+	}
+	while (top > 0) {
+		int pc = rp->stack[--top];
+		if (rp->mark[pc] == rp->gen) continue;
+		rp->mark[pc] = rp->gen;
+		if (pc == 0) empty = 1;
+		struct rxInst *in = &rp->inst[pc];
+		switch (in->op) {
+			case RX_CHAR:
+				rp->closure[n++] = pc;
+				break;
+			case RX_MATCH:
+				if (empty) break;
+				*matched = 1;
+				if (cut) return n;
+				break;
+			case RX_SPLIT:
+				rp->stack[top++] = in->y;
+				rp->stack[top++] = in->x;
+				break;
+			case RX_JMP:
+				rp->stack[top++] = in->x;
+				break;
+			case RX_BOL:
+				if (bol) rp->stack[top++] = in->x;
+				break;
+			case RX_EOL:
+				if (eol) rp->stack[top++] = in->x;
+				break;
+		}
+	}
+	return n;
+}
+
+int rxCompareInt(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+int rxIntern(struct rxProg *rp, const int *pcs, int npcs, int bol, int matched) {
+	unsigned int h = 2166136261u ^ bol ^ (matched << 1);
+	for (int i = 0; i < npcs; i++) {
+		h = (h ^ pcs[i]) * 16777619u;
+	}
+	unsigned int slot = h & (RX_TABLE_SIZE - 1);
+	while (rp->table[slot] != 0) {
+		struct rxState *st = &rp->states[rp->table[slot] - 1];
+		if (st->bol == bol && st->matched == matched && st->npcs == npcs && memcmp(st->pcs, pcs, sizeof(int) * npcs) == 0) {
+			return rp->table[slot] - 1;
+		}
+		slot = (slot + 1) & (RX_TABLE_SIZE - 1);
+	}
+	if (rp->nstates == RX_MAX_STATES) return -1;
+
+	rp->states = realloc(rp->states, sizeof(struct rxState) * (rp->nstates + 1));
+	if (rp->states == NULL) die("Malloc Error!");
+	struct rxState *st = &rp->states[rp->nstates];
+	st->pcs = malloc(sizeof(int) * (npcs + 1));
+	if (st->pcs == NULL) die("Malloc Error!");
+	memcpy(st->pcs, pcs, sizeof(int) * npcs);
+	st->npcs = npcs;
+	st->bol = bol;
+	st->matched = matched;
+	for (int c = 0; c < 256; c++) {
+		st->next[c] = RX_UNKNOWN;
+	}
+	/* only pcs reached by consuming a byte count, so matches are never empty */
+	rxClosure(rp, pcs, npcs, 1, bol, 0, 0, &st->accept[0]);
+	rxClosure(rp, pcs, npcs, 1, bol, 1, 0, &st->accept[1]);
+	rp->table[slot] = rp->nstates + 1;
+	return rp->nstates++;
+}
+
+int rxInternOrFlush(struct rxProg *rp, int *pcs, int npcs, int bol, int matched) {
+	int s = rxIntern(rp, pcs, npcs, bol, matched);
+	if (s == -1) {
+		rxFlush(rp);
+		s = rxIntern(rp, pcs, npcs, bol, matched);
+	}
+	return s;
+}
+
+int rxStart(struct rxProg *rp, int bol) {
+	int start = 0;
+	return rxInternOrFlush(rp, &start, 1, bol, 0);
+}
+
+int rxStep(struct rxProg *rp, int s, unsigned char c) {
+	struct rxState *st = &rp->states[s];
+	int matched;
+	int n = rxClosure(rp, st->pcs, st->npcs, 0, st->bol, c == '\n', rp->unanchored, &matched);
+	matched |= st->matched;
+	int count = 0;
+	rp->gen++;
+	for (int i = 0; i < n; i++) {
+		struct rxInst *in = &rp->inst[rp->closure[i]];
+		if (rxSetHas(in->set, c) && rp->mark[in->x] != rp->gen) {
+			rp->mark[in->x] = rp->gen;
+			rp->list[count++] = in->x;
+		}
+	}
+	if (rp->unanchored && !matched && rp->mark[0] != rp->gen) {
+		rp->list[count++] = 0;
+	}
+	if (count == 0) {
+		rp->states[s].next[c] = RX_DEAD;
+		return RX_DEAD;
+	}
+	if (!rp->unanchored) qsort(rp->list, count, sizeof(int), rxCompareInt);
+
+	int next = rxIntern(rp, rp->list, count, c == '\n', matched);
+	if (next == -1) {
+		rxFlush(rp);
+		return rxIntern(rp, rp->list, count, c == '\n', matched);
+	}
+	rp->states[s].next[c] = next;
+	return next;
+}
+
+int rxSingleChar(const unsigned char *set) {
+	int c = -1;
+	for (int i = 0; i < 256; i++) {
+		if (rxSetHas(set, i)) {
+			if (c != -1) return -1;
+			c = i;
+		}
+	}
+	return c;
+}
+
+int rxFlattenCat(struct rxNode *nodes, int idx, int *seq, int n) {
+	if (nodes[idx].type == RX_N_CAT) {
+		n = rxFlattenCat(nodes, nodes[idx].left, seq, n);
+		return rxFlattenCat(nodes, nodes[idx].right, seq, n);
+	}
+	seq[n] = idx;
+	return n + 1;
+}
+
+/* Longest run of plain bytes that every match must contain, for the trigram index. */
+void rxRequiredLiteral(struct regex *re, struct rxNode *nodes, int nnodes, int root) {
+	re->single_line = 1;
+	for (int i = 0; i < nnodes; i++) {
+		if (nodes[i].type == RX_N_SET && rxSetHas(nodes[i].set, '\n')) re->single_line = 0;
+	}
+
+	int *seq = malloc(sizeof(int) * nnodes);
+	if (seq == NULL) die("Malloc Error!");
+	int n = rxFlattenCat(nodes, root, seq, 0);
+	int run = 0;
+	re->literal_len = 0;
+	for (int i = 0; i <= n; i++) {
+		int c = i < n && nodes[seq[i]].type == RX_N_SET ? rxSingleChar(nodes[seq[i]].set) : -1;
+		if (c != -1 && run < (int)sizeof(re->literal)) {
+			run++;
+			continue;
+		}
+		if (run > re->literal_len) {
+			for (int j = 0; j < run; j++) {
+				re->literal[j] = rxSingleChar(nodes[seq[i - run + j]].set);
+			}
+			re->literal_len = run;
+		}
+		run = c != -1 ? 1 : 0;
+	}
+	free(seq);
+}
+
+struct regex *regexCompile(const char *pattern) {
+	struct rxParser p = {pattern, 0, 0, NULL, 0};
+	int root = rxParseAlt(&p);
+	if (p.error || p.s[p.pos] != '\0') {
+		free(p.nodes);
+		return NULL;
+	}
+
+	struct regex *re = malloc(sizeof(struct regex));
+	if (re == NULL) die("Malloc Error!");
+	rxCompileProg(&re->fwd, p.nodes, root, 0);
+	rxCompileProg(&re->rev, p.nodes, root, 1);
+	rxRequiredLiteral(re, p.nodes, p.nnodes, root);
+	free(p.nodes);
+	return re;
+}
+
+void regexFree(struct regex *re) {
+	if (re == NULL) return;
+	rxFreeProg(&re->fwd);
+	rxFreeProg(&re->rev);
+	free(re);
+}
+
+/* Leftmost start of a non-empty match that ends at end and starts at or after lo. */
+int regexMatchStart(struct regex *re, int end, int lo, int len) {
+	struct rxProg *rp = &re->rev;
+	int s = rxStart(rp, end == len || pieceByteAt(end) == '\n');
+	int start = end;
+
+	int base = len;
+	for (int k = pt.size - 1; k >= 0 && s != RX_DEAD; k--) {
+		int plen = pt.p[k].length;
+		base -= plen;
+		if (base >= end) continue;
+		const unsigned char *text = (const unsigned char *)pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		int i = end - base < plen ? end - base : plen;
+		int stop = lo > base ? lo - base : 0;
+		while (i > stop) {
+			unsigned char c = text[--i];
+			if (rp->states[s].accept[c == '\n']) start = base + i + 1;
+			int n = rp->states[s].next[c];
+			s = n == RX_UNKNOWN ? rxStep(rp, s, c) : n;
+			if (s == RX_DEAD) break;
+		}
+		if (base <= lo) break;
+	}
+	if (s != RX_DEAD && rp->states[s].accept[lo == 0 || pieceByteAt(lo - 1) == '\n']) start = lo;
+	return start;
+}
+
+/* Streams the forward DFA over the pieces and returns the start of the leftmost
+ * match in [from, to], or -1, with *match_end set to its end. Alternatives are
+ * preferred left to right and repeats are greedy. Matches are never empty. */
+int regexSearchRange(struct regex *re, int from, int to, int *match_end) {
+	struct rxProg *rp = &re->fwd;
+	int len = pieceLength();
+	if (to > len) to = len;
+	if (from >= to) return -1;
+	int s = rxStart(rp, from == 0 || pieceByteAt(from - 1) == '\n');
+	int found = -1;
+
+	int base = 0;
+	for (int k = 0; k < (int)pt.size && base < to && s != RX_DEAD; base += pt.p[k].length, k++) {
+		int plen = pt.p[k].length;
+		if (base + plen <= from) continue;
+		const unsigned char *text = (const unsigned char *)pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		int end = to - base < plen ? to - base : plen;
+		for (int i = from > base ? from - base : 0; i < end; i++) {
+			unsigned char c = text[i];
+			if (rp->states[s].accept[c == '\n']) found = base + i;
+			int n = rp->states[s].next[c];
+			s = n == RX_UNKNOWN ? rxStep(rp, s, c) : n;
+			if (s == RX_DEAD) break;
+		}
+	}
+	if (s != RX_DEAD && rp->states[s].accept[to == len || pieceByteAt(to) == '\n']) found = to;
+	if (found == -1) return -1;
+	*match_end = found;
+	return regexMatchStart(re, found, from, len);
+}
+
+int regexLineStart(const struct searchSpan *sp, int nspans, int pos) {
+	int base = 0;
+	int k = 0;
+	while (k < nspans - 1 && base + sp[k].length < pos) {
+		base += sp[k].length;
+		k++;
+	}
+	for (; k >= 0; k--) {
+		int lim = pos - base < sp[k].length ? pos - base : sp[k].length;
+		const char *hit = lim > 0 ? memrchr(sp[k].data, '\n', lim) : NULL;
+		if (hit != NULL) return base + (hit - sp[k].data) + 1;
+		if (k > 0) base -= sp[k - 1].length;
+	}
+	return 0;
+}
+
+int regexLineEnd(const struct searchSpan *sp, int nspans, int pos) {
+	int base = 0;
+	for (int k = 0; k < nspans; base += sp[k].length, k++) {
+		if (base + sp[k].length <= pos) continue;
+		int off = pos > base ? pos - base : 0;
+		const char *hit = memchr(sp[k].data + off, '\n', sp[k].length - off);
+		if (hit != NULL) return base + (hit - sp[k].data);
+	}
+	return base;
+}
+
+/* Whole lines around the trigram candidates of the required literal, or NULL
+ * when a match could span lines or the index cannot narrow the search. */
+struct trigramRange *regexRanges(struct regex *re, int *count) {
+	int nranges;
+	struct trigramRange *ranges = NULL;
+	if (re->single_line) ranges = trigramRanges(re->literal, re->literal_len, &nranges);
+	if (ranges == NULL) return NULL;
+
+	int nspans;
+	struct searchSpan *spans = searchSnapshot(&nspans);
+	int m = 0;
+	for (int r = 0; r < nranges; r++) {
+		int lo = regexLineStart(spans, nspans, ranges[r].lo);
+		int hi = regexLineEnd(spans, nspans, ranges[r].hi - 1);
+		if (m > 0 && lo <= ranges[m - 1].hi) {
+			ranges[m - 1].hi = hi;
+		} else {
+			ranges[m].lo = lo;
+			ranges[m].hi = hi;
+			m++;
+		}
+	}
+	free(spans);
+	*count = m;
+	return ranges;
+}
+
+int regexSearch(struct regex *re, int from, int *match_end) {
+	int nranges;
+	struct trigramRange *ranges = regexRanges(re, &nranges);
+	if (ranges == NULL) return regexSearchRange(re, from, INT_MAX, match_end);
+
+	int match = -1;
+	for (int r = 0; r < nranges && match == -1; r++) {
+		if (ranges[r].hi <= from) continue;
+		match = regexSearchRange(re, ranges[r].lo > from ? ranges[r].lo : from, ranges[r].hi, match_end);
+	}
+	free(ranges);
+	return match;
+}
+
+int regexCount(struct regex *re) {
+	int nranges;
+	struct trigramRange *ranges = regexRanges(re, &nranges);
+	struct trigramRange all = {0, INT_MAX};
+	if (ranges == NULL) nranges = 1;
+
+	int count = 0;
+	for (int r = 0; r < nranges; r++) {
+		struct trigramRange *range = ranges ? &ranges[r] : &all;
+		int from = range->lo;
+		int end;
+		while (regexSearchRange(re, from, range->hi, &end) != -1) {
+			count++;
+			from = end;
+		}
+	}
+	free(ranges);
+	return count;
+}
+
+void editorRegexCallback(char *query, int key) {
+	static int last_match = -1;
+	static int last_end = -1;
+	static struct regex *re = NULL;
+
+	if (key == '\x1b') {
+		regexFree(re);
+		re = NULL;
+		last_match = -1;
+		return;
+	}
+	if (key == '\r') {
+		if (re != NULL) {
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			int count = regexCount(re);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+			if (secs <= 0) secs = 1e-9;
+			editorSetStatusMessage("%d matches in %.3fs (%.0f matches/s, %.1f MB/s)", count, secs,
+					count / secs, pieceLength() / secs / 1e6);
+		}
+		regexFree(re);
+		re = NULL;
+		last_match = -1;
+		return;
+	}
+
+	int direction = 0;
+	if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		direction = 1;
+	} else if (key == ARROW_LEFT || key == ARROW_UP) {
+		direction = -1;
+	} else {
+		regexFree(re);
+		re = regexCompile(query);
+		last_match = -1;
+	}
+	if (re == NULL || query[0] == '\0') return;
+
+	int end;
+	int match = -1;
+	int match_end = -1;
+	if (direction == -1 && last_match != -1) {
+		int from = 0;
+		int m;
+		while ((m = regexSearch(re, from, &end)) != -1 && m < last_match) {
+			match = m;
+			match_end = end;
+			from = end;
+		}
+	} else {
+		int from = last_match == -1 ? search_origin : last_end;
+		match = regexSearch(re, from, &match_end);
+		if (match == -1) match = regexSearch(re, 0, &match_end);
+	}
+
+	if (match != -1) {
+		last_match = match;
+		last_end = match_end;
+		editorOffsetToCursor(match);
+	}
+}
+
+void editorRegexFind() {
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	search_origin = editorCursorOffset();
+
+	char *query = editorPrompt("Regex: %s (Use ESC/Arrows/Enter)", editorRegexCallback, 0);
+
+	if (query) {
+		free(query);
+	} else {
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+	}
+}
+
+/*** replace ***/
+
+struct replaceMatches {
+	int *pos;
+	int count;
+	int cap;
+	int nlen;
+	int next;
+};
+
+int replaceEmit(void *arg, int pos) {
+	struct replaceMatches *rm = arg;
+	if (pos < rm->next) return 1;
+	if (rm->count == rm->cap) {
+		rm->cap = rm->cap ? rm->cap * 2 : 64;
+		rm->pos = realloc(rm->pos, sizeof(int) * rm->cap);
+		if (rm->pos == NULL) die("Malloc Error!");
+	}
+	rm->pos[rm->count++] = pos;
+	rm->next = pos + rm->nlen;
+	return 1;
+}
+
+void replacePushPiece(struct Piece **p, int *n, int *cap, int start, int length, int add) {
+	if (length == 0) return;
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 16;
+		*p = realloc(*p, sizeof(struct Piece) * *cap);
+		if (*p == NULL) die("Malloc Error!");
+	}
+	(*p)[*n].start = start;
+	(*p)[*n].length = length;
+	(*p)[*n].add = add;
+	*n += 1;
+}
+
+/* Collects every non-overlapping match, narrowed by the trigram index when it is ready. */
+void replaceFind(const char *needle, int nlen, struct replaceMatches *rm) {
+	int skip[256];
+	int nspans;
+	struct searchSpan *spans = searchSnapshot(&nspans);
+	int nranges;
+	struct trigramRange *ranges = trigramRanges(needle, nlen, &nranges);
+	searchBuildSkip(needle, nlen, skip);
+	if (ranges == NULL) {
+		searchSpans(spans, nspans, needle, nlen, skip, 0, INT_MAX, replaceEmit, rm);
+	} else {
+		for (int r = 0; r < nranges; r++) {
+			searchSpans(spans, nspans, needle, nlen, skip, ranges[r].lo, ranges[r].hi, replaceEmit, rm);
+		}
+		free(ranges);
+	}
+	free(spans);
+}
+
+/* Piece starts are 31 bits, so the add buffer ends at INT_MAX bytes. Edits
+ * that would take it past that are refused here, before they are journaled,
+ * instead of wrapping an offset. */
+int pieceAddRoom(long long n) {
+	if ((long long)pt.add_size + n <= INT_MAX) return 1;
+	editorSetStatusMessage("Add buffer full: new text is limited to %d bytes per session", INT_MAX);
+	return 0;
+}
+
+/* Appends s to the add buffer and returns where it starts. */
+int pieceAddText(const char *s, int slen) {
+	int start = pt.add_size;
+	if (slen > 0) {
+		if ((long long)pt.add_size + slen > INT_MAX) {
+			errno = EOVERFLOW;
+			die("pieceAddText");
+		}
+		char *new_add = realloc(pt.add, pt.add_size + slen);
+		if (new_add == NULL) die("Malloc Error!");
+		pt.add = new_add;
+		memcpy(pt.add + pt.add_size, s, slen);
+		pt.add_size += slen;
+	}
+	return start;
+}
+
+/* One edit of a batch: dlen bytes at at give way to the pieces in ins. */
+struct spliceEdit {
+	int at;
+	int dlen;
+	struct Piece *ins;
+	int nins;
+};
+
+/* Applies count edits, sorted by offset, in one pass over pt.p. On return
+ * each at holds the offset just past that edit's inserted pieces. */
+void pieceApply(struct spliceEdit *e, int count) {
+	int len = pieceLength();
+	for (int m = count - 1; m >= 0; m--) {
+		int at = e[m].at < len ? e[m].at : len;
+		int dlen = at + e[m].dlen < len ? e[m].dlen : len - at;
+		int ilen = 0;
+		for (int i = 0; i < e[m].nins; i++) ilen += e[m].ins[i].length;
+		pieceEdited(at, dlen, ilen);
+	}
+	struct Piece *p = NULL;
+	int n = 0;
+	int cap = 0;
+	int k = 0;
+	int base = 0;
+	int keep = 0;
+	int shift = 0;
+	for (int m = 0; m <= count; m++) {
+		int until = m < count ? e[m].at : INT_MAX;
+		while (k < (int)pt.size && keep < until) {
+			int plen = pt.p[k].length;
+			if (base + plen <= keep) {
+				base += plen;
+				k++;
+				continue;
+			}
+			int lo = keep - base;
+			int hi = until - base < plen ? until - base : plen;
+			replacePushPiece(&p, &n, &cap, pt.p[k].start + lo, hi - lo, pt.p[k].add);
+			keep = base + hi;
+		}
+		if (m < count) {
+			for (int i = 0; i < e[m].nins; i++) {
+				replacePushPiece(&p, &n, &cap, e[m].ins[i].start, e[m].ins[i].length, e[m].ins[i].add);
+				shift += e[m].ins[i].length;
+			}
+			int from = e[m].at > keep ? e[m].at : keep;
+			int to = e[m].at + e[m].dlen < len ? e[m].at + e[m].dlen : len;
+			e[m].at = from + shift;
+			if (to > from) shift -= to - from;
+			if (to > keep) keep = to;
+		}
+	}
+	if (n == 0) {
+		p = malloc(sizeof(struct Piece));
+		if (p == NULL) die("Malloc Error!");
+		p[0].start = 0;
+		p[0].length = 0;
+		p[0].add = 0;
+		n = 1;
+	}
+
+	free(pt.p);
+	pt.p = p;
+	pt.size = n;
+}
+
+/* At each of count sorted offsets, removes dlen bytes and puts s in their
+ * place. s is added once and every copy points at it. On return pos holds
+ * the offset just past each copy. */
+void pieceSplice(int *pos, int count, int dlen, const char *s, int slen) {
+	struct Piece piece;
+	piece.start = pieceAddText(s, slen);
+	piece.length = slen;
+	piece.add = 1;
+	struct spliceEdit *e = malloc(sizeof(struct spliceEdit) * (count + 1));
+	if (e == NULL) die("Malloc Error!");
+	for (int m = 0; m < count; m++) {
+		e[m].at = pos[m];
+		e[m].dlen = dlen;
+		e[m].ins = &piece;
+		e[m].nins = 1;
+	}
+	pieceApply(e, count);
+	for (int m = 0; m < count; m++) pos[m] = e[m].at;
+	free(e);
+}
+
+/* Replaces every non-overlapping match in one pass over pt.p, as a single undo entry. */
+int replaceAll(const char *needle, int nlen, const char *with, int wlen) {
+	struct replaceMatches rm = {NULL, 0, 0, nlen, 0};
+	replaceFind(needle, nlen, &rm);
+	if (rm.count == 0) return 0;
+
+	undopush();
+	pieceSplice(rm.pos, rm.count, nlen, with, wlen);
+	E.dirty++;
+	free(rm.pos);
+	return rm.count;
+}
+
+void editorReplaceAll() {
+	char *needle = editorPrompt("Replace: %s (ESC to cancel)", NULL, 0);
+	if (needle == NULL) return;
+	char *with = editorPrompt("Replace with: %s (ESC to cancel)", NULL, 1);
+	if (with == NULL) {
+		free(needle);
+		return;
+	}
+
+	if (!pieceAddRoom(strlen(with))) {
+		free(needle);
+		free(with);
+		return;
+	}
+	int at = editorCursorOffset();
+	int count = replaceAll(needle, strlen(needle), with, strlen(with));
+	if (count > 0) journalReplace(needle, strlen(needle), with, strlen(with));
+	int len = pieceLength();
+	remakeconfig();
+	editorOffsetToCursor(at < len ? at : len);
+	editorSetStatusMessage("Replaced %d occurrences", count);
+	free(needle);
+	free(with);
+}
+
+/*** clipboard ***/
+
+/* Makes a piece start at offset x, splitting the one under it if needed, and
+ * returns its index; pt.size if x is at the end of the text. */
+int pieceSplit(int x) {
+	int k = 0;
+	while (k < (int)pt.size && x > 0 && x >= pt.p[k].length) {
+		x -= pt.p[k].length;
+		k++;
+	}
+	if (x <= 0 || k == (int)pt.size) return k;
+
+	struct Piece *p = realloc(pt.p, sizeof(struct Piece) * (pt.size + 1));
+	if (p == NULL) die("Malloc Error!");
+	pt.p = p;
+	memmove(&pt.p[k + 1], &pt.p[k], sizeof(struct Piece) * (pt.size - k));
+	pt.p[k + 1].start = pt.p[k].start + x;
+	pt.p[k + 1].length = pt.p[k].length - x;
+	pt.p[k].length = x;
+	pt.size += 1;
+	return k + 1;
+}
+
+void pieceDeleteRange(int from, int to) {
+	pieceEdited(from, to - from, 0);
+	int i = pieceSplit(from);
+	int j = pieceSplit(to);
+	memmove(&pt.p[i], &pt.p[j], sizeof(struct Piece) * (pt.size - j));
+	pt.size -= j - i;
+	if (pt.size == 0) {
+		struct Piece *p = realloc(pt.p, sizeof(struct Piece));
+		if (p == NULL) die("Malloc Error!");
+		pt.p = p;
+		pt.p[0].start = 0;
+		pt.p[0].length = 0;
+		pt.p[0].add = 0;
+		pt.size = 1;
+	}
+}
+
+void piecePaste(int at) {
+	pieceEdited(at, 0, CB.length);
+	int i = pieceSplit(at);
+	struct Piece *p = realloc(pt.p, sizeof(struct Piece) * (pt.size + CB.size));
+	if (p == NULL) die("Malloc Error!");
+	pt.p = p;
+	memmove(&pt.p[i + CB.size], &pt.p[i], sizeof(struct Piece) * (pt.size - i));
+	memcpy(&pt.p[i], CB.p, sizeof(struct Piece) * CB.size);
+	pt.size += CB.size;
+}
+
+/* Pushes the pieces covering [from, to), resuming the walk at piece *k,
+ * which starts at offset *base, and leaves it on the piece holding to. */
+void clipboardCollect(int from, int to, int *k, int *base, struct Piece **p, int *n, int *cap, int *add_end) {
+	while (*k < (int)pt.size && *base < to) {
+		int plen = pt.p[*k].length;
+		int lo = from > *base ? from : *base;
+		int hi = to < *base + plen ? to : *base + plen;
+		if (lo < hi) {
+			replacePushPiece(p, n, cap, pt.p[*k].start + lo - *base, hi - lo, pt.p[*k].add);
+			if (pt.p[*k].add && pt.p[*k].start + hi - *base > *add_end) *add_end = pt.p[*k].start + hi - *base;
+		}
+		if (*base + plen > to) break;
+		*base += plen;
+		*k += 1;
+	}
+}
+
+/* Takes the pieces covering [from, to) without touching the text. */
+void clipboardSet(int from, int to) {
+	struct Piece *p = NULL;
+	int n = 0;
+	int cap = 0;
+	int add_end = 0;
+	int k = 0;
+	int base = 0;
+	clipboardCollect(from, to, &k, &base, &p, &n, &cap, &add_end);
+	free(CB.p);
+	CB.p = p;
+	CB.size = n;
+	CB.length = to - from;
+	CB.add_end = add_end;
+	CB.nrows = 0;
+}
+
+int editorSelection(int *from, int *to) {
+	if (E.mark < 0) return 0;
+	int at = editorCursorOffset();
+	int len = pieceLength();
+	int mark = E.mark < len ? E.mark : len;
+	*from = mark < at ? mark : at;
+	*to = mark < at ? at : mark;
+	return *from < *to;
+}
+
+void editorCopy() {
+	int from, to;
+	if (!editorSelection(&from, &to)) {
+		editorSetStatusMessage("Nothing selected; Ctrl-K sets the mark");
+		return;
+	}
+	journalCopy(from, to - from);
+	clipboardSet(from, to);
+	E.mark = -1;
+	editorSetStatusMessage("Copied %d bytes", to - from);
+}
+
+void editorCut() {
+	int from, to;
+	if (!editorSelection(&from, &to)) {
+		editorSetStatusMessage("Nothing selected; Ctrl-K sets the mark");
+		return;
+	}
+	journalCut(from, to - from);
+	undopush();
+	clipboardSet(from, to);
+	pieceDeleteRange(from, to);
+	E.mark = -1;
+	E.dirty++;
+	remakeconfig();
+	editorOffsetToCursor(from);
+}
+
+void editorPaste() {
+	if (CB.nrows > 0) {
+		blockEdit(BLOCK_PASTE, NULL, 0);
+		return;
+	}
+	if (CB.size == 0) return;
+	int at = editorCursorOffset();
+	journalPaste(at);
+	undopush();
+	piecePaste(at);
+	E.mark = -1;
+	E.dirty++;
+	remakeconfig();
+	editorOffsetToCursor(at + CB.length);
+}
+
+/*** cursors ***/
+
+void cursorClear() {
+	MC.n = 0;
+}
+
+void cursorAdd(int off) {
+	if (MC.n == MC.cap) {
+		MC.cap = MC.cap ? MC.cap * 2 : 64;
+		MC.pos = realloc(MC.pos, sizeof(int) * MC.cap);
+		if (MC.pos == NULL) die("Malloc Error!");
+	}
+	MC.pos[MC.n++] = off;
+}
+
+int cursorCompare(const void *a, const void *b) {
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+/* Sorts the extra cursors and drops duplicates and any on the primary. */
+void cursorSort() {
+	qsort(MC.pos, MC.n, sizeof(int), cursorCompare);
+	int at = editorCursorOffset();
+	int n = 0;
+	for (int i = 0; i < MC.n; i++) {
+		if (MC.pos[i] == at || (n > 0 && MC.pos[n - 1] == MC.pos[i])) continue;
+		MC.pos[n++] = MC.pos[i];
+	}
+	MC.n = n;
+}
+
+/* With the mark set, puts a cursor on every line between it and the cursor,
+ * at the cursor's column; otherwise leaves a cursor behind and moves down. */
+void editorCursorsPerLine() {
+	int at = editorCursorOffset();
+	if (E.mark < 0) {
+		int cy = E.cy;
+		editorMoveCursor(ARROW_DOWN);
+		if (E.cy != cy) cursorAdd(at);
+		cursorSort();
+		return;
+	}
+
+	int mark = E.mark;
+	E.mark = -1;
+	int start = 0;
+	int first = -1, last = -1;
+	for (int y = 0; y < E.numrows; y++) {
+		int rowlen = E.rows[y].size + E.rows[y].indentation + 1;
+		if (first == -1 && (mark < start + rowlen || y == E.numrows - 1)) first = y;
+		if (y == E.cy) last = y;
+		if (first != -1 && last != -1) break;
+		start += rowlen;
+	}
+	if (first > last) {
+		int t = first;
+		first = last;
+		last = t;
+	}
+	start = 0;
+	for (int y = 0; y <= last; y++) {
+		int rowlen = E.rows[y].size + E.rows[y].indentation;
+		if (y >= first && y != E.cy) cursorAdd(start + (E.cx < rowlen ? E.cx : rowlen));
+		start += rowlen + 1;
+	}
+	cursorSort();
+	editorSetStatusMessage("%d cursors", MC.n + 1);
+}
+
+void editorCursorsOnMatches() {
+	char *needle = editorPrompt("Cursors at: %s (ESC to cancel)", NULL, 0);
+	if (needle == NULL) return;
+	struct replaceMatches rm = {NULL, 0, 0, strlen(needle), 0};
+	replaceFind(needle, strlen(needle), &rm);
+	free(needle);
+	if (rm.count == 0) {
+		editorSetStatusMessage("No matches");
+		return;
+	}
+	cursorClear();
+	editorOffsetToCursor(rm.pos[0]);
+	for (int i = 1; i < rm.count; i++) cursorAdd(rm.pos[i]);
+	free(rm.pos);
+	cursorSort();
+	editorSetStatusMessage("%d cursors", MC.n + 1);
+}
+
+/* Inserts s at every cursor, or with back set, removes the byte before each. */
+void editorCursorsEdit(const char *s, int slen, int back) {
+	if (!pieceAddRoom(slen)) return;
+	int len = pieceLength();
+	int at = editorCursorOffset();
+	if (at > len) at = len;
+	int *pos = malloc(sizeof(int) * (MC.n + 1));
+	if (pos == NULL) die("Malloc Error!");
+	int count = 0;
+	for (int i = 0; i < MC.n; i++) pos[count++] = MC.pos[i] < len ? MC.pos[i] : len;
+	pos[count++] = at;
+	qsort(pos, count, sizeof(int), cursorCompare);
+
+	int n = 0;
+	int primary = -1;
+	for (int i = 0; i < count; i++) {
+		if (n > 0 && pos[n - 1] + back == pos[i]) continue;
+		if (back && pos[i] == 0) continue;
+		if (pos[i] == at) primary = n;
+		pos[n++] = pos[i] - back;
+	}
+	count = n;
+
+	if (count > 0) {
+		journalSplice(pos, count, back, s, slen);
+		undopush();
+		pieceSplice(pos, count, back, s, slen);
+		E.dirty++;
+	}
+	remakeconfig();
+	MC.n = 0;
+	for (int i = 0; i < count; i++) {
+		if (i != primary) cursorAdd(pos[i]);
+	}
+	editorOffsetToCursor(primary >= 0 ? pos[primary] : 0);
+	cursorSort();
+	free(pos);
+}
+
+/*** blocks ***/
+
+/* One row of a block: where the row starts, the offsets its columns lo and
+ * hi fall on, and the spaces a short row needs to reach lo. */
+struct blockRow {
+	int start;
+	int a;
+	int b;
+	int pad;
+};
+
+int blockWidth(char c) {
+	return c == '\t' ? FOU_TAB_STOP : c != '\r';
+}
+
+/* Columns taken by [from, to) as drawn. */
+int blockColumn(int from, int to) {
+	int col = 0;
+	int base = 0;
+	for (int k = 0; k < (int)pt.size && base < to; base += pt.p[k].length, k++) {
+		const char *text = pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		for (int j = from > base ? from - base : 0; j < pt.p[k].length && base + j < to; j++) {
+			col += blockWidth(text[j]);
+		}
+	}
+	return col;
+}
+
+void blockEndRow(struct blockRow *r, int start, int a, int b, int end, int pad) {
+	r->start = start;
+	r->a = a == -1 ? end : a;
+	r->b = b == -1 ? end : b;
+	r->pad = a == -1 && pad > 0 ? pad : 0;
+}
+
+/* Cuts rows r0..r1 at columns lo and hi in one pass over the text and
+ * returns how many of those rows exist. A CR before the newline belongs to
+ * the line end, so short CRLF rows are padded before it. */
+int blockScan(int r0, int r1, int lo, int hi, struct blockRow *out) {
+	int row = 0;
+	int col = 0;
+	int off = 0;
+	int n = 0;
+	int start = 0;
+	int a = -1, b = -1, cr = -1;
+	for (int k = 0; k < (int)pt.size && row <= r1; k++) {
+		const char *text = pieceBuffer(&pt.p[k]) + pt.p[k].start;
+		for (int j = 0; j < pt.p[k].length && row <= r1; j++, off++) {
+			char c = text[j];
+			if (c == '\n') {
+				if (row >= r0) blockEndRow(&out[n++], start, a, b, cr == off - 1 ? cr : off, lo - col);
+				row++;
+				start = off + 1;
+				col = 0;
+				a = b = cr = -1;
+				continue;
+			}
+			if (row < r0) continue;
+			if (a == -1 && col >= lo) a = off;
+			if (b == -1 && col >= hi) b = off;
+			if (c == '\r') cr = off;
+			col += blockWidth(c);
+		}
+	}
+	if (row >= r0 && row <= r1 && off > start) blockEndRow(&out[n++], start, a, b, off, lo - col);
+	return n;
+}
+
+/* Rows and columns between the anchor and the cursor; with no block, the
+ * cursor's own row and column. */
+void blockRange(int *r0, int *r1, int *lo, int *hi) {
+	int at = editorCursorOffset();
+	int col = blockColumn(at - E.cx, at);
+	int row = BK.active ? BK.row : E.cy;
+	int acol = BK.active ? BK.col : col;
+	*r0 = row < E.cy ? row : E.cy;
+	*r1 = row < E.cy ? E.cy : row;
+	*lo = acol < col ? acol : col;
+	*hi = acol < col ? col : acol;
+}
+
+/* Takes each row's [a, b) as one row of a block clipboard. */
+void clipboardSetRows(const struct blockRow *rows, int n) {
+	struct Piece *p = NULL;
+	int size = 0;
+	int cap = 0;
+	int add_end = 0;
+	int k = 0;
+	int base = 0;
+	int length = 0;
+	int *counts = malloc(sizeof(int) * (n + 1));
+	if (counts == NULL) die("Malloc Error!");
+	for (int i = 0; i < n; i++) {
+		int before = size;
+		clipboardCollect(rows[i].a, rows[i].b, &k, &base, &p, &size, &cap, &add_end);
+		counts[i] = size - before;
+		length += rows[i].b - rows[i].a;
+	}
+	free(CB.p);
+	free(CB.rows);
+	CB.p = p;
+	CB.size = size;
+	CB.length = length;
+	CB.add_end = add_end;
+	CB.rows = counts;
+	CB.nrows = n;
+}
+
+/* Applies op to rows r0..r1 between columns lo and hi as one splice, each
+ * row's new text built from shared add spans. A paste fills one row per
+ * clipboard row from r0, adding rows past the end of the text. Returns the
+ * column the cursor belongs at on row cy. */
+int blockApply(int op, int r0, int r1, int lo, int hi, const char *s, int slen, int cy) {
+	if (op == BLOCK_PASTE) r1 = r0 + CB.nrows - 1;
+	if (r1 < r0) return lo;
+	struct blockRow *rows = malloc(sizeof(struct blockRow) * (r1 - r0 + 1));
+	if (rows == NULL) die("Malloc Error!");
+	int n = blockScan(r0, r1, lo, hi, rows);
+	if (op == BLOCK_COPY || op == BLOCK_CUT) clipboardSetRows(rows, n);
+	if (op == BLOCK_COPY) {
+		free(rows);
+		return lo;
+	}
+
+	int len = pieceLength();
+	int extra = op == BLOCK_PASTE ? CB.nrows - n : 0;
+	int pad = extra > 0 ? lo : 0;
+	for (int i = 0; i < n; i++) {
+		if (rows[i].pad > pad) pad = rows[i].pad;
+	}
+	char *spaces = malloc(pad + 1);
+	if (spaces == NULL) die("Malloc Error!");
+	memset(spaces, ' ', pad);
+	struct Piece blank, text, nl;
+	blank.start = pieceAddText(spaces, pad);
+	blank.length = pad;
+	blank.add = 1;
+	free(spaces);
+	text.start = pieceAddText(s, slen);
+	text.length = slen;
+	text.add = 1;
+	if (extra > 0) {
+		nl.start = pieceAddText("\n", 1);
+		nl.length = 1;
+		nl.add = 1;
+	}
+
+	struct Piece *ins = malloc(sizeof(struct Piece) * (2 * n + 3 * extra + CB.size + 1));
+	struct spliceEdit *e = malloc(sizeof(struct spliceEdit) * (n + 1));
+	if (ins == NULL || e == NULL) die("Malloc Error!");
+	int ni = 0;
+	int ne = 0;
+	int clip = 0;
+	int col = lo;
+	for (int i = 0; i < n; i++) {
+		struct blockRow *r = &rows[i];
+		struct spliceEdit *ed = &e[ne];
+		ed->at = r->a;
+		ed->dlen = op == BLOCK_PASTE ? 0 : r->b - r->a;
+		ed->ins = ins + ni;
+		if (op == BLOCK_BACK && lo == hi) {
+			if (r->pad > 0 || r->a == r->start) continue;
+			ed->at = r->a - 1;
+			ed->dlen = 1;
+		}
+		if ((op == BLOCK_INSERT || op == BLOCK_PASTE) && r->pad > 0) {
+			ins[ni] = blank;
+			ins[ni++].length = r->pad;
+		}
+		if (op == BLOCK_INSERT && slen > 0) ins[ni++] = text;
+		if (op == BLOCK_PASTE) {
+			for (int j = 0; j < CB.rows[i]; j++) ins[ni++] = CB.p[clip++];
+		}
+		if (r0 + i == cy && op != BLOCK_PASTE) {
+			col = blockColumn(r->start, ed->at) + r->pad;
+			for (int j = 0; op == BLOCK_INSERT && j < slen; j++) col += blockWidth(s[j]);
+		}
+		ed->nins = ins + ni - ed->ins;
+		ne++;
+	}
+	if (extra > 0) {
+		int ends = len == 0 || pieceByteAt(len - 1) == '\n';
+		e[ne].at = len;
+		e[ne].dlen = 0;
+		e[ne].ins = ins + ni;
+		for (int i = n; i < CB.nrows; i++) {
+			if (i > n || !ends) ins[ni++] = nl;
+			if (lo > 0) {
+				ins[ni] = blank;
+				ins[ni++].length = lo;
+			}
+			for (int j = 0; j < CB.rows[i]; j++) ins[ni++] = CB.p[clip++];
+		}
+		e[ne].nins = ins + ni - e[ne].ins;
+		ne++;
+	}
+	pieceApply(e, ne);
+	free(e);
+	free(ins);
+	free(rows);
+	return col;
+}
+
+/* Rebuilds a clipboard from a journal record: the rows' bytes, in order,
+ * become one add span each, or all of them one span with no rows. */
+void clipboardLoadRows(const int32_t *lens, int nrows, const char *bytes, int length) {
+	int start = pieceAddText(bytes, length);
+	struct Piece *p = NULL;
+	int size = 0;
+	int cap = 0;
+	int at = 0;
+	int *counts = malloc(sizeof(int) * (nrows + 1));
+	if (counts == NULL) die("Malloc Error!");
+	for (int i = 0; i < nrows; i++) {
+		int l = lens[i] < length - at ? lens[i] : length - at;
+		if (l < 0) l = 0;
+		replacePushPiece(&p, &size, &cap, start + at, l, 1);
+		counts[i] = l > 0;
+		at += l;
+	}
+	if (nrows == 0 && length > 0) {
+		replacePushPiece(&p, &size, &cap, start, length, 1);
+		at = length;
+	}
+	free(CB.p);
+	free(CB.rows);
+	CB.p = p;
+	CB.size = size;
+	CB.length = at;
+	CB.add_end = start + at;
+	CB.rows = counts;
+	CB.nrows = nrows;
+}
+
+void blockMoveTo(int row, int col) {
+	struct blockRow r;
+	if (blockScan(row, row, col, col, &r) == 1) editorOffsetToCursor(r.a);
+}
+
+/* One undo entry, one journal record and one relayout per block edit,
+ * however many rows it spans. */
+void blockEdit(int op, const char *s, int slen) {
+	if (op == BLOCK_PASTE && CB.nrows == 0) return;
+	int r0, r1, lo, hi;
+	blockRange(&r0, &r1, &lo, &hi);
+	/* padding never reaches past the right edge of the block */
+	if (op != BLOCK_COPY && !pieceAddRoom((long long)slen + hi + 1)) return;
+	journalBlock(op, r0, r1, lo, hi, s, slen);
+	if (op != BLOCK_COPY) undopush();
+	int col = blockApply(op, r0, r1, lo, hi, s, slen, E.cy);
+	if (op == BLOCK_COPY || op == BLOCK_PASTE) BK.active = 0;
+	if (op == BLOCK_COPY) {
+		editorSetStatusMessage("Copied %d rows", CB.nrows);
+		return;
+	}
+	E.dirty++;
+	remakeconfig();
+	blockMoveTo(E.cy, col);
+	BK.col = col;
+}
+
+void editorBlockToggle() {
+	if (BK.active) {
+		BK.active = 0;
+		return;
+	}
+	int at = editorCursorOffset();
+	BK.active = 1;
+	BK.row = E.cy;
+	BK.col = blockColumn(at - E.cx, at);
+	E.mark = -1;
+	cursorClear();
+}
+
+/* Keys that act on the whole block. The rest fall through, so the arrows
+ * move the cursor's corner of it. */
+int editorBlockKeypress(int c) {
+	char ch = c;
+	switch (c) {
+		case CTRL_KEY('b'):
+			BK.active = 0;
+			return 1;
+
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL_KEY:
+			blockEdit(BLOCK_BACK, NULL, 0);
+			return 1;
+
+		case CTRL_KEY('w'):
+			blockEdit(BLOCK_COPY, NULL, 0);
+			return 1;
+
+		case CTRL_KEY('x'):
+			blockEdit(BLOCK_CUT, NULL, 0);
+			return 1;
+
+		case CTRL_KEY('v'):
+			if (CB.nrows == 0) break;
+			blockEdit(BLOCK_PASTE, NULL, 0);
+			return 1;
+
+		case '\r':
+		case CTRL_KEY('k'):
+		case CTRL_KEY('n'):
+		case CTRL_KEY('t'):
+		case CTRL_KEY('y'):
+		case CTRL_KEY('z'):
+		case CTRL_KEY('g'):
+			break;
+
+		default:
+			if (c == '\t' || (c >= ' ' && c < 127)) {
+				blockEdit(BLOCK_INSERT, &ch, 1);
+				return 1;
+			}
+			return 0;
+	}
+	BK.active = 0;
+	return 0;
+}
+
+/*** journal ***/
+
+#define JOURNAL_MAGIC "FOUJ0002"
+#define JOURNAL_FLUSH_MS 500
+#define JOURNAL_BATCH (64 * 1024)
+
+enum journalOp {
+	JOURNAL_INSERT = 'I',
+	JOURNAL_DELETE = 'D',
+	JOURNAL_UNDO = 'U',
+	JOURNAL_REDO = 'R',
+	JOURNAL_REPLACE = 'G',
+	JOURNAL_COPY = 'W',
+	JOURNAL_CUT = 'X',
+	JOURNAL_PASTE = 'V',
+	JOURNAL_SPLICE = 'M',
+	JOURNAL_BLOCK = 'B',
+	JOURNAL_CLIP = 'K',
+	JOURNAL_EDITS = 'E'
+};
+
+/* Ties a journal to the exact file, and session snapshot, it was recorded against. */
+struct journalHeader {
+	char magic[8];
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t base;
+};
+
+/* A full batch waiting for the writer thread. */
+struct journalBatch {
+	char *buf;
+	int len;
+	struct journalBatch *next;
+};
+
+/* The UI thread fills buf and hands it over whole; the writer thread owns
+ * wfd and does the writes and the fdatasync. fd is -1 while not recording. */
+struct editorJournal {
+	int fd;
+	char *path;
+	char *buf;
+	int len;
+	int cap;
+	int wfd;
+	int threaded;
+	int stop;
+	int drop;
+	int error;
+	struct journalBatch *queue;
+	struct journalBatch **tail;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} J = {.fd = -1, .wfd = -1};
+
+/* Hidden files kept next to the document, e.g. dir/.name.fouj */
+char *sidecarPath(const char *filename, const char *ext) {
+	const char *base = strrchr(filename, '/');
+	int dirlen = base ? base - filename + 1 : 0;
+	base = base ? base + 1 : filename;
+	char *path = malloc(dirlen + strlen(base) + strlen(ext) + 3);
+	if (path == NULL) die("Malloc Error!");
+	sprintf(path, "%.*s.%s.%s", dirlen, filename, base, ext);
+	return path;
+}
+
+/* Returns 0 or the errno that stopped the write. */
+int journalWrite(int fd, const char *buf, int len) {
+	int done = 0;
+	while (done < len) {
+		ssize_t n = write(fd, buf + done, len - done);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return n == 0 ? EIO : errno;
+		done += n;
+	}
+	return 0;
+}
+
+/* Takes every queued batch at once, so a backlog costs one fdatasync. */
+void *journalWriter(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&J.lock);
+	while (1) {
+		while (J.queue == NULL && !J.stop) {
+			pthread_cond_wait(&J.cond, &J.lock);
+		}
+		struct journalBatch *b = J.queue;
+		if (b == NULL) break;
+		J.queue = NULL;
+		J.tail = &J.queue;
+		int drop = J.drop || J.error;
+		pthread_mutex_unlock(&J.lock);
+
+		int err = 0;
+		while (b != NULL) {
+			struct journalBatch *next = b->next;
+			if (!drop && err == 0) err = journalWrite(J.wfd, b->buf, b->len);
+			free(b->buf);
+			free(b);
+			b = next;
+		}
+		if (!drop && err == 0 && fdatasync(J.wfd) == -1) err = errno;
+
+		pthread_mutex_lock(&J.lock);
+		if (err != 0 && J.error == 0) J.error = err;
+	}
+	pthread_mutex_unlock(&J.lock);
+	return NULL;
+}
+
+void journalStart(int fd) {
+	J.fd = fd;
+	J.wfd = fd;
+	J.stop = 0;
+	J.drop = 0;
+	J.error = 0;
+	J.queue = NULL;
+	J.tail = &J.queue;
+	pthread_mutex_init(&J.lock, NULL);
+	pthread_cond_init(&J.cond, NULL);
+	J.threaded = pthread_create(&J.thread, NULL, journalWriter, NULL) == 0;
+}
+
+/* Waits for the writer to finish; with drop set, queued batches are thrown away. */
+void journalStop(int drop) {
+	if (!J.threaded) return;
+	pthread_mutex_lock(&J.lock);
+	J.stop = 1;
+	J.drop = drop;
+	pthread_cond_signal(&J.cond);
+	pthread_mutex_unlock(&J.lock);
+	pthread_join(J.thread, NULL);
+	pthread_mutex_destroy(&J.lock);
+	pthread_cond_destroy(&J.cond);
+	J.threaded = 0;
+}
+
+/* Hands the batch to the writer thread and starts a fresh one; the UI
+ * thread never waits on the disk. Without the thread the batch is written
+ * here. */
+void journalFlush() {
+	if (J.fd == -1 || J.len == 0) return;
+	int err = 0;
+	if (J.threaded) {
+		struct journalBatch *b = malloc(sizeof(struct journalBatch));
+		if (b == NULL) die("Malloc Error!");
+		b->buf = J.buf;
+		b->len = J.len;
+		b->next = NULL;
+		pthread_mutex_lock(&J.lock);
+		*J.tail = b;
+		J.tail = &b->next;
+		err = J.error;
+		pthread_cond_signal(&J.cond);
+		pthread_mutex_unlock(&J.lock);
+		J.buf = NULL;
+		J.cap = 0;
+	} else {
+		err = journalWrite(J.fd, J.buf, J.len);
+		if (err == 0 && fdatasync(J.fd) == -1) err = errno;
+	}
+	J.len = 0;
+	if (err != 0) {
+		editorSetStatusMessage("Journal disabled: %s", strerror(err));
+		J.fd = -1;
+	}
+}
+
+void journalAppend(const void *data, int len) {
+	if (J.len + len > J.cap) {
+		J.cap = J.len + len > J.cap * 2 ? J.len + len : J.cap * 2;
+		J.buf = realloc(J.buf, J.cap);
+		if (J.buf == NULL) die("Malloc Error!");
+	}
+	memcpy(J.buf + J.len, data, len);
+	J.len += len;
+}
+
+/* Records are batched in memory and reach the disk on a timer or once a batch fills. */
+void journalRecord(char op, int a, int b, const char *data, int len) {
+	if (J.fd == -1) return;
+	if (J.len == 0) editorAddTimer(JOURNAL_FLUSH_MS, journalFlush);
+	int32_t fields[2] = {a, b};
+	journalAppend(&op, 1);
+	if (op != JOURNAL_UNDO && op != JOURNAL_REDO) journalAppend(fields, sizeof(fields));
+	if (len > 0) journalAppend(data, len);
+	if (J.len >= JOURNAL_BATCH) journalFlush();
+}
+
+void journalInsert(int offset, const char *s, int len) {
+	journalRecord(JOURNAL_INSERT, offset, len, s, len);
+}
+
+void journalDelete(int offset, int count) {
+	journalRecord(JOURNAL_DELETE, offset, count, NULL, 0);
+}
+
+void journalUndo() {
+	journalRecord(JOURNAL_UNDO, 0, 0, NULL, 0);
+}
+
+void journalRedo() {
+	journalRecord(JOURNAL_REDO, 0, 0, NULL, 0);
+}
+
+void journalReplace(const char *needle, int nlen, const char *with, int wlen) {
+	if (J.fd == -1) return;
+	journalRecord(JOURNAL_REPLACE, nlen, wlen, needle, nlen);
+	if (wlen > 0) journalAppend(with, wlen);
+}
+
+/* Copies and cuts are journaled by range, so a paste can name the clipboard
+ * instead of its bytes. A clipboard filled before this journal began, or
+ * while a macro played, has no such record until its first paste. */
+void journalCopy(int from, int len) {
+	journalRecord(JOURNAL_COPY, from, len, NULL, 0);
+	CB.journaled = J.fd != -1;
+}
+
+void journalCut(int from, int len) {
+	journalRecord(JOURNAL_CUT, from, len, NULL, 0);
+	CB.journaled = J.fd != -1;
+}
+
+/* One record for an edit at every cursor: dlen, the offsets, then s. */
+void journalSplice(const int *pos, int count, int dlen, const char *s, int slen) {
+	if (J.fd == -1) return;
+	int32_t d = dlen;
+	journalRecord(JOURNAL_SPLICE, count, slen, NULL, 0);
+	journalAppend(&d, sizeof(d));
+	for (int i = 0; i < count; i++) {
+		int32_t x = pos[i];
+		journalAppend(&x, sizeof(x));
+	}
+	if (slen > 0) journalAppend(s, slen);
+	if (J.len >= JOURNAL_BATCH) journalFlush();
+}
+
+/* A clipboard with no record of its own is written out once, row lengths
+ * then bytes, so the pastes after it can replay. A linear one has no rows. */
+void journalClip() {
+	journalRecord(JOURNAL_CLIP, CB.nrows, CB.length, NULL, 0);
+	int k = 0;
+	for (int i = 0; i < CB.nrows; i++) {
+		int32_t l = 0;
+		for (int j = 0; j < CB.rows[i]; j++) l += CB.p[k + j].length;
+		k += CB.rows[i];
+		journalAppend(&l, sizeof(l));
+	}
+	for (k = 0; k < CB.size; k++) {
+		journalAppend(pieceBuffer(&CB.p[k]) + CB.p[k].start, CB.p[k].length);
+		if (J.len >= JOURNAL_BATCH) journalFlush();
+	}
+	CB.journaled = 1;
+}
+
+/* A block edit is its op and rectangle, rows then columns, and any text. */
+void journalBlock(int op, int r0, int r1, int lo, int hi, const char *s, int slen) {
+	if (op == BLOCK_COPY || op == BLOCK_CUT) CB.journaled = J.fd != -1;
+	if (J.fd == -1) return;
+	if (op == BLOCK_PASTE && !CB.journaled) journalClip();
+	int32_t box[4] = {r0, r1, lo, hi};
+	journalRecord(JOURNAL_BLOCK, op, slen, NULL, 0);
+	journalAppend(box, sizeof(box));
+	if (slen > 0) journalAppend(s, slen);
+	if (J.len >= JOURNAL_BATCH) journalFlush();
+}
+
+/* Edits whose text was built without the journal, such as a macro run:
+ * each edit's offset, removed length and new length, then the new bytes. */
+void journalEdits(const struct spliceEdit *e, int count) {
+	if (J.fd == -1 || count == 0) return;
+	int total = 0;
+	for (int m = 0; m < count; m++) {
+		for (int i = 0; i < e[m].nins; i++) total += e[m].ins[i].length > 0 ? e[m].ins[i].length : 0;
+	}
+	journalRecord(JOURNAL_EDITS, count, total, NULL, 0);
+	for (int m = 0; m < count; m++) {
+		int32_t h[3] = {e[m].at, e[m].dlen, 0};
+		for (int i = 0; i < e[m].nins; i++) h[2] += e[m].ins[i].length > 0 ? e[m].ins[i].length : 0;
+		journalAppend(h, sizeof(h));
+	}
+	for (int m = 0; m < count; m++) {
+		for (int i = 0; i < e[m].nins; i++) {
+			if (e[m].ins[i].length <= 0) continue;
+			journalAppend(pieceBuffer(&e[m].ins[i]) + e[m].ins[i].start, e[m].ins[i].length);
+			if (J.len >= JOURNAL_BATCH) journalFlush();
+		}
+	}
+}
+
+/* Checks an edits record: offsets in order, lengths that add up to its bytes. */
+int journalEditsValid(const char *data, int count, int total) {
+	int32_t last = 0;
+	int64_t sum = 0;
+	for (int m = 0; m < count; m++) {
+		int32_t h[3];
+		memcpy(h, data + sizeof(h) * m, sizeof(h));
+		if (h[0] < last || h[1] < 0 || h[2] < 0) return 0;
+		last = h[0] + h[1];
+		sum += h[2];
+	}
+	return sum == total;
+}
+
+void journalPaste(int at) {
+	if (J.fd == -1) return;
+	if (!CB.journaled) journalClip();
+	journalRecord(JOURNAL_PASTE, at, 0, NULL, 0);
+}
+
+/* Applies every complete record in one pass and returns the length of the valid prefix. */
+off_t journalReplay(int fd, const struct journalHeader *h, int *count) {
+	struct stat st;
+	*count = 0;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*h)) return 0;
+	char *data = malloc(st.st_size);
+	if (data == NULL) die("Malloc Error!");
+	off_t got = 0;
+	while (got < st.st_size) {
+		ssize_t n = pread(fd, data + got, st.st_size - got, got);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		got += n;
+	}
+	if (got < (off_t)sizeof(*h) || memcmp(data, h, sizeof(*h)) != 0) {
+		free(data);
+		return 0;
+	}
+
+	char *p = data + sizeof(*h);
+	char *end = data + got;
+	while (p < end) {
+		char op = p[0];
+		int32_t fields[2] = {0, 0};
+		off_t need = 1;
+		if (op == JOURNAL_INSERT || op == JOURNAL_DELETE || op == JOURNAL_REPLACE ||
+				op == JOURNAL_COPY || op == JOURNAL_CUT || op == JOURNAL_PASTE || op == JOURNAL_SPLICE ||
+				op == JOURNAL_BLOCK || op == JOURNAL_CLIP || op == JOURNAL_EDITS) {
+			need += sizeof(fields);
+			if (end - p < need) break;
+			memcpy(fields, p + 1, sizeof(fields));
+			if (fields[0] < 0 || fields[1] < 0) break;
+			if (op == JOURNAL_INSERT) need += fields[1];
+			if (op == JOURNAL_REPLACE) need += (off_t)fields[0] + fields[1];
+			if (op == JOURNAL_SPLICE) need += sizeof(int32_t) * ((off_t)fields[0] + 1) + fields[1];
+			if (op == JOURNAL_BLOCK) need += sizeof(int32_t) * 4 + fields[1];
+			if (op == JOURNAL_CLIP) need += sizeof(int32_t) * (off_t)fields[0] + fields[1];
+			if (op == JOURNAL_EDITS) need += sizeof(int32_t) * 3 * (off_t)fields[0] + fields[1];
+			if (end - p < need) break;
+			if (op == JOURNAL_EDITS && !journalEditsValid(p + 1 + sizeof(fields), fields[0], fields[1])) break;
+			long long grow = op == JOURNAL_COPY || op == JOURNAL_CUT || op == JOURNAL_PASTE || op == JOURNAL_DELETE ? 0 : fields[1];
+			if (op == JOURNAL_BLOCK) {
+				int32_t box[4];
+				memcpy(box, p + 1 + sizeof(fields), sizeof(box));
+				if (fields[0] > BLOCK_PASTE || box[0] < 0 || box[1] < box[0] || box[2] < 0 || box[3] < box[2]) break;
+				grow += (long long)box[3] + 1;
+			}
+			/* replay never collects the add buffer, so a session that did
+			 * can leave more new text behind than one replay can hold */
+			if (!pieceAddRoom(grow)) break;
+		} else if (op != JOURNAL_UNDO && op != JOURNAL_REDO) {
+			break;
+		}
+
+		const char *bytes = p + 1 + sizeof(fields);
+		switch (op) {
+			case JOURNAL_INSERT:
+				undopush();
+				for (int i = 0; i < fields[1]; i++) pieceInsert(fields[0] + i, bytes[i]);
+				break;
+			case JOURNAL_DELETE:
+				undopush();
+				for (int i = 0; i < fields[1]; i++) pieceDelete(fields[0]);
+				break;
+			case JOURNAL_UNDO:
+				undo();
+				break;
+			case JOURNAL_REDO:
+				redo();
+				break;
+			case JOURNAL_REPLACE:
+				replaceAll(bytes, fields[0], bytes + fields[0], fields[1]);
+				break;
+			case JOURNAL_COPY:
+				clipboardSet(fields[0], fields[0] + fields[1]);
+				CB.journaled = 1;
+				break;
+			case JOURNAL_CUT:
+				undopush();
+				clipboardSet(fields[0], fields[0] + fields[1]);
+				pieceDeleteRange(fields[0], fields[0] + fields[1]);
+				CB.journaled = 1;
+				break;
+			case JOURNAL_PASTE:
+				undopush();
+				piecePaste(fields[0]);
+				break;
+			case JOURNAL_SPLICE:
+				{
+					int32_t dlen;
+					int *pos = malloc(sizeof(int) * (fields[0] + 1));
+					if (pos == NULL) die("Malloc Error!");
+					memcpy(&dlen, bytes, sizeof(dlen));
+					if (dlen < 0) dlen = 0;
+					memcpy(pos, bytes + sizeof(dlen), sizeof(int32_t) * fields[0]);
+					undopush();
+					pieceSplice(pos, fields[0], dlen, bytes + sizeof(int32_t) * (fields[0] + 1), fields[1]);
+					free(pos);
+				}
+				break;
+			case JOURNAL_BLOCK:
+				{
+					int32_t box[4];
+					memcpy(box, bytes, sizeof(box));
+					if (fields[0] != BLOCK_COPY) undopush();
+					blockApply(fields[0], box[0], box[1], box[2], box[3], bytes + sizeof(box), fields[1], -1);
+					if (fields[0] == BLOCK_COPY || fields[0] == BLOCK_CUT) CB.journaled = 1;
+				}
+				break;
+			case JOURNAL_CLIP:
+				{
+					int32_t *lens = malloc(sizeof(int32_t) * (fields[0] + 1));
+					if (lens == NULL) die("Malloc Error!");
+					memcpy(lens, bytes, sizeof(int32_t) * fields[0]);
+					clipboardLoadRows(lens, fields[0], bytes + sizeof(int32_t) * fields[0], fields[1]);
+					CB.journaled = 1;
+					free(lens);
+				}
+				break;
+			case JOURNAL_EDITS:
+				{
+					const char *text = bytes + sizeof(int32_t) * 3 * fields[0];
+					int start = pieceAddText(text, fields[1]);
+					struct spliceEdit *e = malloc(sizeof(struct spliceEdit) * (fields[0] + 1));
+					struct Piece *ins = malloc(sizeof(struct Piece) * (fields[0] + 1));
+					if (e == NULL || ins == NULL) die("Malloc Error!");
+					for (int m = 0; m < fields[0]; m++) {
+						int32_t h[3];
+						memcpy(h, bytes + sizeof(h) * m, sizeof(h));
+						ins[m].start = start;
+						ins[m].length = h[2];
+						ins[m].add = 1;
+						e[m].at = h[0];
+						e[m].dlen = h[1];
+						e[m].ins = &ins[m];
+						e[m].nins = 1;
+						start += h[2];
+					}
+					undopush();
+					pieceApply(e, fields[0]);
+					free(e);
+					free(ins);
+				}
+				break;
+		}
+		p += need;
+		*count += 1;
+	}
+	off_t keep = p - data;
+	free(data);
+	return keep;
+}
+
+void journalOpen(const char *filename, int64_t base) {
+	struct stat st;
+	if (stat(filename, &st) == -1) return;
+	struct journalHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+	h.size = st.st_size;
+	h.mtime_sec = st.st_mtim.tv_sec;
+	h.mtime_nsec = st.st_mtim.tv_nsec;
+	h.base = base;
+
+	J.path = sidecarPath(filename, "fouj");
+	int fd = open(J.path, O_RDWR | O_CREAT, 0600);
+	if (fd == -1) {
+		editorSetStatusMessage("Journal disabled: %s", strerror(errno));
+		free(J.path);
+		J.path = NULL;
+		return;
+	}
+
+	int count;
+	CB.journaled = 0;
+	off_t keep = journalReplay(fd, &h, &count);
+	if (keep == 0) {
+		if (ftruncate(fd, 0) == -1 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+			editorSetStatusMessage("Journal disabled: %s", strerror(errno));
+			close(fd);
+			return;
+		}
+		keep = sizeof(h);
+	} else if (ftruncate(fd, keep) == -1) {
+		close(fd);
+		return;
+	}
+	lseek(fd, keep, SEEK_SET);
+	journalStart(fd);
+
+	if (count > 0) {
+		E.dirty = count;
+		remakeconfig();
+		editorSetStatusMessage("Recovered %d edits from %s", count, J.path);
+	}
+}
+
+/* A clean quit drops the journal; anything else leaves it behind for the next open. */
+void journalDiscard() {
+	journalStop(1);
+	if (J.wfd != -1) {
+		close(J.wfd);
+		J.wfd = -1;
+	}
+	J.fd = -1;
+	if (J.path != NULL) {
+		unlink(J.path);
+		free(J.path);
+		J.path = NULL;
+	}
+	free(J.buf);
+	J.buf = NULL;
+	J.len = 0;
+	J.cap = 0;
+}
+
+/*** session ***/
+
+#define SESSION_MAGIC "FOUS0001"
+
+/* On-disk layout: header, live pieces, each undo then redo entry as a
+ * sessionStack followed by its pieces, and finally the add buffer. */
+struct sessionHeader {
+	char magic[8];
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t id;
+	int64_t add_size;
+	int64_t add_len;
+	int64_t npieces;
+	int64_t nundo;
+	int64_t nredo;
+	int32_t cx, cy, rowoff, actual_x;
+	int32_t dirty;
+	int32_t pad;
+};
+
+struct sessionPiece {
+	int32_t start;
+	int32_t length;
+	int32_t add;
+};
+
+struct sessionStack {
+	int64_t add_size;
+	int64_t size;
+};
+
+void sessionWritePieces(FILE *fp, struct Piece *p, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		struct sessionPiece sp = {p[i].start, p[i].length, p[i].add};
+		fwrite(&sp, sizeof(sp), 1, fp);
+	}
+}
+
+/* Returns the snapshot's id once it is safely renamed into place, 0 on failure. */
+int64_t sessionSave() {
+	struct stat st;
+	if (E.filename == NULL || stat(E.filename, &st) == -1) return 0;
+
+	struct sessionHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SESSION_MAGIC, sizeof(h.magic));
+	h.size = st.st_size;
+	h.mtime_sec = st.st_mtim.tv_sec;
+	h.mtime_nsec = st.st_mtim.tv_nsec;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	h.id = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	addGcSettle();
+	h.add_size = pt.add_size;
+	h.add_len = pt.add_size;
+	for (int i = 0; i <= undotop; i++) {
+		if ((int64_t)undodetails[i].add_size > h.add_len) h.add_len = undodetails[i].add_size;
+	}
+	for (int i = 0; i <= redotop; i++) {
+		if ((int64_t)redodetails[i].add_size > h.add_len) h.add_len = redodetails[i].add_size;
+	}
+	h.npieces = pt.size;
+	h.nundo = undotop + 1;
+	h.nredo = redotop + 1;
+	h.cx = E.cx;
+	h.cy = E.cy;
+	h.rowoff = E.rowoff;
+	h.actual_x = E.actual_x;
+	h.dirty = E.dirty;
+
+	char *path = sidecarPath(E.filename, "fous");
+	char *tmp = sidecarPath(E.filename, "fous.tmp");
+	FILE *fp = fopen(tmp, "w");
+	int ok = fp != NULL;
+	if (ok) {
+		fwrite(&h, sizeof(h), 1, fp);
+		sessionWritePieces(fp, pt.p, pt.size);
+		for (int i = 0; i <= undotop; i++) {
+			struct sessionStack ss = {undodetails[i].add_size, undodetails[i].size};
+			fwrite(&ss, sizeof(ss), 1, fp);
+			sessionWritePieces(fp, undostack[i], undodetails[i].size);
+		}
+		for (int i = 0; i <= redotop; i++) {
+			struct sessionStack ss = {redodetails[i].add_size, redodetails[i].size};
+			fwrite(&ss, sizeof(ss), 1, fp);
+			sessionWritePieces(fp, redostack[i], redodetails[i].size);
+		}
+		fwrite(pt.add, 1, h.add_len, fp);
+		ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+		ok = fclose(fp) == 0 && ok;
+	}
+	if (ok) ok = rename(tmp, path) == 0;
+	if (!ok) unlink(tmp);
+	free(path);
+	free(tmp);
+	return ok ? h.id : 0;
+}
+
+/* Checks one piece list inside the mapping and returns the offset just past it, or -1. */
+int64_t sessionCheckPieces(int64_t off, int64_t len, int64_t n) {
+	if (n < 0 || n > (len - off) / (int64_t)sizeof(struct sessionPiece)) return -1;
+	return off + n * sizeof(struct sessionPiece);
+}
+
+struct Piece *sessionReadPieces(const char *map, int64_t *off, int64_t n, const struct sessionHeader *h) {
+	struct Piece *p = malloc(sizeof(struct Piece) * (n > 0 ? n : 1));
+	if (p == NULL) die("Malloc Error!");
+	for (int64_t i = 0; i < n; i++) {
+		struct sessionPiece sp;
+		memcpy(&sp, map + *off, sizeof(sp));
+		*off += sizeof(sp);
+		int64_t limit = sp.add ? h->add_len : (int64_t)pt.content_size;
+		if (sp.start < 0 || sp.length < 0 || (int64_t)sp.start + sp.length > limit) {
+			free(p);
+			return NULL;
+		}
+		p[i].start = sp.start;
+		p[i].length = sp.length;
+		p[i].add = sp.add != 0;
+	}
+	return p;
+}
+
+/* Restores a snapshot that matches the file on disk. The add buffer is copied
+ * out of the mapping since it keeps growing; the original file stays mapped
+ * and is not read here. */
+int64_t sessionLoad(const char *filename) {
+	struct stat st;
+	struct stat ss;
+	if (stat(filename, &st) == -1) return 0;
+	char *path = sidecarPath(filename, "fous");
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd == -1) return 0;
+	if (fstat(fd, &ss) == -1 || ss.st_size < (off_t)sizeof(struct sessionHeader)) {
+		close(fd);
+		return 0;
+	}
+	char *map = mmap(NULL, ss.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	struct sessionHeader h;
+	memcpy(&h, map, sizeof(h));
+	int64_t len = ss.st_size;
+	if (memcmp(h.magic, SESSION_MAGIC, sizeof(h.magic)) != 0 || h.size != st.st_size ||
+			h.mtime_sec != st.st_mtim.tv_sec || h.mtime_nsec != st.st_mtim.tv_nsec ||
+			h.nundo < 0 || h.nredo < 0 || h.add_size < 0 || h.add_size > h.add_len ||
+			h.npieces < 1 || h.add_len > INT_MAX) {
+		munmap(map, len);
+		return 0;
+	}
+
+	int64_t off = sessionCheckPieces(sizeof(h), len, h.npieces);
+	for (int64_t i = 0; off != -1 && i < h.nundo + h.nredo; i++) {
+		struct sessionStack sk;
+		if (len - off < (int64_t)sizeof(sk)) {
+			off = -1;
+			break;
+		}
+		memcpy(&sk, map + off, sizeof(sk));
+		off = sessionCheckPieces(off + sizeof(sk), len, sk.size);
+		if (off != -1 && (sk.add_size < 0 || sk.add_size > h.add_len)) off = -1;
+	}
+	if (off == -1 || len - off != h.add_len) {
+		munmap(map, len);
+		return 0;
+	}
+
+	off = sizeof(h);
+	struct Piece *p = sessionReadPieces(map, &off, h.npieces, &h);
+	struct Piece **undos = malloc(sizeof(struct Piece*) * (h.nundo + 1));
+	struct details *undod = malloc(sizeof(struct details) * (h.nundo + 1));
+	struct Piece **redos = malloc(sizeof(struct Piece*) * (h.nredo + 1));
+	struct details *redod = malloc(sizeof(struct details) * (h.nredo + 1));
+	if (undos == NULL || undod == NULL || redos == NULL || redod == NULL) die("Malloc Error!");
+	int64_t nundo = 0;
+	int64_t nredo = 0;
+	for (int64_t i = 0; p != NULL && i < h.nundo + h.nredo; i++) {
+		struct sessionStack sk;
+		memcpy(&sk, map + off, sizeof(sk));
+		off += sizeof(sk);
+		struct Piece *sp = sessionReadPieces(map, &off, sk.size, &h);
+		if (sp == NULL) {
+			free(p);
+			p = NULL;
+			break;
+		}
+		if (i < h.nundo) {
+			undos[nundo] = sp;
+			undod[nundo].add_size = sk.add_size;
+			undod[nundo].size = sk.size;
+			undod[nundo].stale = 0;
+			nundo++;
+		} else {
+			redos[nredo] = sp;
+			redod[nredo].add_size = sk.add_size;
+			redod[nredo].size = sk.size;
+			redod[nredo].stale = 0;
+			nredo++;
+		}
+	}
+	if (p == NULL) {
+		for (int64_t i = 0; i < nundo; i++) free(undos[i]);
+		for (int64_t i = 0; i < nredo; i++) free(redos[i]);
+		free(undos);
+		free(undod);
+		free(redos);
+		free(redod);
+		munmap(map, len);
+		return 0;
+	}
+
+	char *add = malloc(h.add_len > 0 ? h.add_len : 1);
+	if (add == NULL) die("Malloc Error!");
+	memcpy(add, map + off, h.add_len);
+	munmap(map, len);
+
+	for (int i = 0; i <= undotop; i++) free(undostack[i]);
+	for (int i = 0; i <= redotop; i++) free(redostack[i]);
+	free(undostack);
+	free(undodetails);
+	free(redostack);
+	free(redodetails);
+	undostack = undos;
+	undodetails = undod;
+	redostack = redos;
+	redodetails = redod;
+	undotop = nundo - 1;
+	redotop = nredo - 1;
+	undoRecount();
+
+	free(pt.p);
+	free(pt.add);
+	pt.p = p;
+	pt.size = h.npieces;
+	pt.add = add;
+	pt.add_size = h.add_size;
+
+	remakeconfig();
+	E.cy = h.cy < E.numrows ? h.cy : 0;
+	E.cx = h.cx;
+	E.actual_x = h.actual_x;
+	E.rowoff = h.rowoff <= E.cy ? h.rowoff : E.cy;
+	E.dirty = h.dirty;
+	editorSetStatusMessage("Resumed session: %d pieces, %d undo steps", (int)h.npieces, (int)h.nundo);
+	return h.id;
+}
+
+/*** reload ***/
+
+#define RELOAD_DELAY 100
+#define RELOAD_SAVE_MS 1000
+#define BLOCK_MIN 2048
+#define BLOCK_MAX (64 * 1024)
+#define BLOCK_MASK ((1 << 13) - 1)
+
+/* Content-defined blocks of pt.content: boundaries fall after newlines or
+ * where a rolling gear hash says so, so an insertion only disturbs the blocks
+ * around it and the rest of the file still lines up by hash after it shifts.
+ * Small files get a small minimum so their blocks are single lines. */
+struct blockHash {
+	int off;
+	int len;
+	uint64_t hash;
+};
+
+struct blockIndex {
+	struct blockHash *blocks;
+	int count;
+	int min;
+	int started;
+	int threaded;
+	int ready;
+	int cancel;
+	pthread_t thread;
+	pthread_mutex_t lock;
+} blk;
+
+struct fileWatch {
+	int fd;
+	char *name;
+	struct stat st;
+} FW = {-1, NULL, {0}};
+
+/* A stretch of the old file found again in the new one. */
+struct reloadRun {
+	int old;
+	int new;
+	int len;
+	int gap;
+};
+
+uint64_t gear[256];
+
+void blockGearInit() {
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	for (int i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+uint64_t blockDigest(const char *s, int len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Splits data into blocks; returns -1 if cancelled part way. */
+int blockChunk(const char *data, int len, int min, struct blockHash **out, int *count, int *cancel) {
+	struct blockHash *b = NULL;
+	int n = 0;
+	int cap = 0;
+	uint64_t h = 0;
+	int start = 0;
+	for (int i = 0; i < len; i++) {
+		h = (h << 1) + gear[(unsigned char)data[i]];
+		int size = i - start + 1;
+		if ((size >= min && (data[i] == '\n' || (h & BLOCK_MASK) == 0)) || size == BLOCK_MAX || i == len - 1) {
+			if (n == cap) {
+				cap = cap ? cap * 2 : 1024;
+				b = realloc(b, sizeof(struct blockHash) * cap);
+				if (b == NULL) die("Malloc Error!");
+			}
+			b[n].off = start;
+			b[n].len = size;
+			b[n].hash = blockDigest(data + start, size);
+			n++;
+			start = i + 1;
+			h = 0;
+		}
+		if (cancel != NULL && (i & 0xfffff) == 0) {
+			pthread_mutex_lock(&blk.lock);
+			int stop = *cancel;
+			pthread_mutex_unlock(&blk.lock);
+			if (stop) {
+				free(b);
+				return -1;
+			}
+		}
+	}
+	*out = b;
+	*count = n;
+	return 0;
+}
+
+void *blockBuild(void *arg) {
+	(void)arg;
+	struct blockHash *b = NULL;
+	int n = 0;
+	int ok = blockChunk(pt.content, pt.content_size, blk.min, &b, &n, &blk.cancel) == 0;
+	pthread_mutex_lock(&blk.lock);
+	blk.blocks = b;
+	blk.count = n;
+	blk.ready = ok;
+	pthread_mutex_unlock(&blk.lock);
+	return NULL;
+}
+
+void blockStart() {
+	blk.min = pt.content_size >> 16;
+	if (blk.min < 1) blk.min = 1;
+	if (blk.min > BLOCK_MIN) blk.min = BLOCK_MIN;
+	blk.blocks = NULL;
+	blk.count = 0;
+	blk.ready = 0;
+	blk.cancel = 0;
+	pthread_mutex_init(&blk.lock, NULL);
+	blk.started = 1;
+	blk.threaded = pthread_create(&blk.thread, NULL, blockBuild, NULL) == 0;
+}
+
+void blockFree() {
+	if (!blk.started) return;
+	pthread_mutex_lock(&blk.lock);
+	blk.cancel = 1;
+	pthread_mutex_unlock(&blk.lock);
+	if (blk.threaded) pthread_join(blk.thread, NULL);
+	pthread_mutex_destroy(&blk.lock);
+	free(blk.blocks);
+	blk.blocks = NULL;
+	blk.started = 0;
+	blk.ready = 0;
+}
+
+int blockReady() {
+	if (!blk.started) return 0;
+	pthread_mutex_lock(&blk.lock);
+	int ready = blk.ready;
+	pthread_mutex_unlock(&blk.lock);
+	return ready;
+}
+
+/* Matches the new file's blocks against the old index. Runs come out in new
+ * file order; run[i].gap is the length of unmatched new text just before it,
+ * and the final entry is a zero-length run holding the trailing gap. */
+struct reloadRun *reloadMatch(struct blockHash *nb, int ncount, int new_len, int *nruns) {
+	struct blockHash *ob = blk.blocks;
+	int ocount = blk.count;
+	int size = 1;
+	while (size < ocount * 2) size *= 2;
+	int *table = malloc(sizeof(int) * size);
+	unsigned char *used = calloc(ocount + 1, 1);
+	struct reloadRun *runs = malloc(sizeof(struct reloadRun) * (ncount + 1));
+	if (table == NULL || used == NULL || runs == NULL) die("Malloc Error!");
+	for (int i = 0; i < size; i++) table[i] = -1;
+	for (int j = 0; j < ocount; j++) {
+		int slot = ob[j].hash & (size - 1);
+		while (table[slot] != -1) slot = (slot + 1) & (size - 1);
+		table[slot] = j;
+	}
+
+	int n = 0;
+	int prev = -2;
+	int covered = 0;
+	for (int i = 0; i < ncount; i++) {
+		int j = prev + 1;
+		if (prev < 0 || j >= ocount || used[j] || ob[j].hash != nb[i].hash || ob[j].len != nb[i].len) {
+			j = -1;
+			for (int slot = nb[i].hash & (size - 1); table[slot] != -1; slot = (slot + 1) & (size - 1)) {
+				int k = table[slot];
+				if (!used[k] && ob[k].hash == nb[i].hash && ob[k].len == nb[i].len) {
+					j = k;
+					break;
+				}
+			}
+		}
+		if (j == -1) {
+			prev = -2;
+			continue;
+		}
+		used[j] = 1;
+		if (j == prev + 1 && n > 0 && runs[n - 1].new + runs[n - 1].len == nb[i].off) {
+			runs[n - 1].len += nb[i].len;
+		} else {
+			runs[n].old = ob[j].off;
+			runs[n].new = nb[i].off;
+			runs[n].len = nb[i].len;
+			runs[n].gap = nb[i].off - covered;
+			n++;
+		}
+		covered = nb[i].off + nb[i].len;
+		prev = j;
+	}
+	runs[n].old = -1;
+	runs[n].new = new_len;
+	runs[n].len = 0;
+	runs[n].gap = new_len - covered;
+	free(table);
+	free(used);
+	*nruns = n;
+	return runs;
+}
+
+void reloadPush(struct Piece **p, int *n, int *cap, int start, int length) {
+	if (length == 0) return;
+	if (*n > 0 && !(*p)[*n - 1].add && (*p)[*n - 1].start + (*p)[*n - 1].length == start) {
+		(*p)[*n - 1].length += length;
+		return;
+	}
+	replacePushPiece(p, n, cap, start, length, 0);
+}
+
+struct reloadMap {
+	struct reloadRun *runs;
+	int nruns;
+	int *order;
+	int old_len;
+	unsigned char *placed;
+	int conflict;
+};
+
+/* First run, in old file order, that ends after pos. */
+int reloadFindRun(struct reloadMap *m, int pos) {
+	int lo = 0;
+	int hi = m->nruns;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		struct reloadRun *r = &m->runs[m->order[mid]];
+		if (r->old + r->len <= pos) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* A piece that starts or ends inside text changed on disk means the user
+ * edited that text too, and the two versions cannot both be kept. */
+void reloadCheckEdges(struct reloadMap *m, int s, int e) {
+	int o = reloadFindRun(m, s);
+	if (o == m->nruns || m->runs[m->order[o]].old > s) {
+		int u0 = o > 0 ? m->runs[m->order[o - 1]].old + m->runs[m->order[o - 1]].len : 0;
+		if (s != u0) m->conflict = 1;
+	}
+	o = reloadFindRun(m, e - 1);
+	if (o == m->nruns || m->runs[m->order[o]].old > e - 1) {
+		int u1 = o < m->nruns ? m->runs[m->order[o]].old : m->old_len;
+		if (e != u1) m->conflict = 1;
+	}
+}
+
+/* Rewrites a piece list against the new file: matched text moves to its new
+ * offset, text changed on disk is dropped, and new text on disk is spliced in
+ * where its neighbouring old text still survives. */
+struct Piece *reloadMapPieces(struct reloadMap *m, struct Piece *src, int nsrc, int *outn) {
+	struct reloadRun *runs = m->runs;
+	int nruns = m->nruns;
+	struct Piece *p = NULL;
+	int n = 0;
+	int cap = 0;
+	for (int k = 0; k < nsrc; k++) {
+		if (src[k].add) {
+			replacePushPiece(&p, &n, &cap, src[k].start, src[k].length, 1);
+			continue;
+		}
+		int s = src[k].start;
+		int e = s + src[k].length;
+		if (s == e) continue;
+		if (m->placed) reloadCheckEdges(m, s, e);
+		/* nothing survived, so the new file goes where the old one began */
+		if (nruns == 0 && s == 0 && runs[0].gap > 0) {
+			reloadPush(&p, &n, &cap, 0, runs[0].gap);
+			if (m->placed) m->placed[0] = 1;
+		}
+		for (int o = reloadFindRun(m, s); o < nruns && runs[m->order[o]].old < e; o++) {
+			int i = m->order[o];
+			struct reloadRun *r = &runs[i];
+			int a = s > r->old ? s : r->old;
+			int b = e < r->old + r->len ? e : r->old + r->len;
+			if (a == r->old && r->gap > 0) {
+				reloadPush(&p, &n, &cap, r->new - r->gap, r->gap);
+				if (m->placed) m->placed[i] = 1;
+			}
+			reloadPush(&p, &n, &cap, r->new + (a - r->old), b - a);
+			if (b == r->old + r->len && i == nruns - 1 && runs[nruns].gap > 0) {
+				reloadPush(&p, &n, &cap, runs[nruns].new - runs[nruns].gap, runs[nruns].gap);
+				if (m->placed) m->placed[nruns] = 1;
+			}
+		}
+	}
+	if (n == 0) {
+		p = malloc(sizeof(struct Piece));
+		if (p == NULL) die("Malloc Error!");
+		p[0].start = 0;
+		p[0].length = 0;
+		p[0].add = 0;
+		n = 1;
+	}
+	*outn = n;
+	return p;
+}
+
+struct reloadRun *reload_sort_runs;
+
+int reloadCompareOld(const void *a, const void *b) {
+	int x = reload_sort_runs[*(const int *)a].old;
+	int y = reload_sort_runs[*(const int *)b].old;
+	return (x > y) - (x < y);
+}
+
+/* The journal restarts from a session snapshot of the reloaded text, which
+ * writes out every piece and the whole add buffer; that waits until no key is
+ * pending, and the snapshot then takes in whatever was typed meanwhile. */
+void reloadSave() {
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	if (poll(&pfd, 1, 0) > 0) {
+		editorAddTimer(RELOAD_SAVE_MS, reloadSave);
+		return;
+	}
+	journalOpen(E.filename, sessionSave());
+}
+
+void reloadCheck() {
+	struct stat st;
+	if (E.filename == NULL || stat(E.filename, &st) == -1) return;
+	if (st.st_ino == FW.st.st_ino && st.st_size == FW.st.st_size &&
+			st.st_mtim.tv_sec == FW.st.st_mtim.tv_sec && st.st_mtim.tv_nsec == FW.st.st_mtim.tv_nsec) {
+		return;
+	}
+	/* a search prompt may still be reading the old text */
+	if (E.prompting) {
+		editorAddTimer(RELOAD_DELAY, reloadCheck);
+		return;
+	}
+	if (st.st_size > INT_MAX) {
+		editorSetStatusMessage("File changed on disk and is too large to reload");
+		FW.st = st;
+		return;
+	}
+
+	int fd = open(E.filename, O_RDONLY);
+	if (fd == -1) return;
+	int new_len = st.st_size;
+	char *content = fileMap(fd, new_len);
+	close(fd);
+	if (content == NULL) {
+		editorSetStatusMessage("File changed on disk; reload failed: %s", strerror(errno));
+		return;
+	}
+	FW.st = st;
+
+	struct blockHash *nb = NULL;
+	int ncount = 0;
+	blockChunk(content, new_len, blk.min, &nb, &ncount, NULL);
+
+	int nruns = 0;
+	struct reloadRun *runs;
+	if (blockReady()) {
+		runs = reloadMatch(nb, ncount, new_len, &nruns);
+	} else {
+		runs = malloc(sizeof(struct reloadRun));
+		if (runs == NULL) die("Malloc Error!");
+		runs[0].old = -1;
+		runs[0].new = new_len;
+		runs[0].len = 0;
+		runs[0].gap = new_len;
+	}
+	struct reloadMap m = {runs, nruns, NULL, pt.content_size, NULL, 0};
+	m.order = malloc(sizeof(int) * (nruns + 1));
+	if (m.order == NULL) die("Malloc Error!");
+	for (int i = 0; i < nruns; i++) m.order[i] = i;
+	reload_sort_runs = runs;
+	qsort(m.order, nruns, sizeof(int), reloadCompareOld);
+
+	int at = editorCursorOffset();
+	int n;
+	addGcSettle();
+	for (int i = 0; i <= undotop; i++) {
+		struct Piece *u = reloadMapPieces(&m, undostack[i], undodetails[i].size, &n);
+		free(undostack[i]);
+		undostack[i] = u;
+		undodetails[i].size = n;
+	}
+	undoRecount();
+	for (int i = 0; i <= redotop; i++) {
+		struct Piece *r = reloadMapPieces(&m, redostack[i], redodetails[i].size, &n);
+		free(redostack[i]);
+		redostack[i] = r;
+		redodetails[i].size = n;
+	}
+	if (CB.size > 0) {
+		/* a block clipboard is mapped row by row to keep its row counts */
+		struct Piece *all = NULL;
+		int size = 0;
+		int cap = 0;
+		int from = 0;
+		CB.length = 0;
+		for (int r = 0; r < (CB.nrows > 0 ? CB.nrows : 1); r++) {
+			int count = CB.nrows > 0 ? CB.rows[r] : CB.size;
+			struct Piece *c = reloadMapPieces(&m, CB.p + from, count, &n);
+			int before = size;
+			for (int i = 0; i < n; i++) {
+				replacePushPiece(&all, &size, &cap, c[i].start, c[i].length, c[i].add);
+				CB.length += c[i].length;
+			}
+			if (CB.nrows > 0) CB.rows[r] = size - before;
+			from += count;
+			free(c);
+		}
+		free(CB.p);
+		CB.p = all;
+		CB.size = size;
+	}
+	m.placed = calloc(nruns + 1, 1);
+	if (m.placed == NULL) die("Malloc Error!");
+	struct Piece *p = reloadMapPieces(&m, pt.p, pt.size, &n);
+	int changed = 0;
+	for (int i = 0; i <= nruns; i++) {
+		if (runs[i].gap > 0 || (i < nruns && runs[i].old != (i > 0 ? runs[i - 1].old + runs[i - 1].len : 0))) changed++;
+		if (runs[i].gap > 0 && !m.placed[i]) m.conflict = 1;
+	}
+
+	/* every piece now reads the new mapping, and the old one is dropped */
+	addGcCancel();
+	cursorClear();
+	E.mark = -1;
+	trigramFree();
+	blockFree();
+	if (pt.content_size > 0) {
+		munmap(pt.content, pt.content_size);
+	} else {
+		free(pt.content);
+	}
+	pt.content = content;
+	pt.content_size = new_len;
+	free(pt.p);
+	pt.p = p;
+	pt.size = n;
+
+	if (m.conflict) {
+		undopush();
+		free(pt.p);
+		pt.p = malloc(sizeof(struct Piece));
+		if (pt.p == NULL) die("Malloc Error!");
+		pt.p[0].start = 0;
+		pt.p[0].length = new_len;
+		pt.p[0].add = 0;
+		pt.size = 1;
+	}
+
+	/* the new file's blocks were just hashed, so they become the index as is */
+	blk.blocks = nb;
+	blk.count = ncount;
+	blk.ready = 1;
+	blk.cancel = 0;
+	blk.started = 1;
+	blk.threaded = 0;
+	pthread_mutex_init(&blk.lock, NULL);
+	trigramStart(new_len);
+
+	remakeconfig();
+	int len = pieceLength();
+	editorOffsetToCursor(at < len ? at : len);
+	journalDiscard();
+	editorAddTimer(RELOAD_SAVE_MS, reloadSave);
+	if (m.conflict) {
+		editorSetStatusMessage("File changed on disk; edits conflicted, Ctrl-Z restores them");
+	} else {
+		editorSetStatusMessage("File changed on disk; reloaded %d changed regions", changed);
+	}
+	free(runs);
+	free(m.order);
+	free(m.placed);
+}
+
+void reloadEvent(int fd) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int hit = 0;
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)ptr;
+			if (ev->len && strcmp(ev->name, FW.name) == 0) hit = 1;
+			ptr += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (hit) editorAddTimer(RELOAD_DELAY, reloadCheck);
+}
+
+/* Watches the directory rather than the file so that saves which replace
+ * the file by rename are seen too. */
+void reloadStart(const char *filename) {
+	if (stat(filename, &FW.st) == -1) return;
+	blockGearInit();
+	blockStart();
+
+	const char *base = strrchr(filename, '/');
+	char *dir = base ? strndup(filename, base - filename + 1) : strdup(".");
+	FW.name = strdup(base ? base + 1 : filename);
+	if (dir == NULL || FW.name == NULL) die("Malloc Error!");
+	FW.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (FW.fd == -1 || inotify_add_watch(FW.fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) == -1 ||
+			editorAddWatch(FW.fd, reloadEvent) == -1) {
+		if (FW.fd != -1) close(FW.fd);
+		FW.fd = -1;
+	}
+	free(dir);
+}
+
+void reloadFree() {
+	blockFree();
+	if (FW.fd != -1) {
+		editorRemoveWatch(FW.fd);
+		close(FW.fd);
+		FW.fd = -1;
+	}
+	free(FW.name);
+	FW.name = NULL;
+}
+
+/*** macros ***/
+
+/* Keys that prompt, quit, undo or drive recording would need the screen or
+ * break the run's single undo entry, so they are kept out of macros. */
+int macroAllowed(int c) {
+	switch (c) {
+		case CTRL_KEY('c'):
+		case CTRL_KEY('z'):
+		case CTRL_KEY('y'):
+		case CTRL_KEY('f'):
+		case CTRL_KEY('r'):
+		case CTRL_KEY('g'):
+		case CTRL_KEY('t'):
+		case CTRL_KEY('p'):
+			return 0;
+	}
+	return 1;
+}
+
+void macroRecord(int c) {
+	if (MR.n == MR.cap) {
+		MR.cap = MR.cap ? MR.cap * 2 : 64;
+		MR.keys = realloc(MR.keys, sizeof(int) * MR.cap);
+		if (MR.keys == NULL) die("Malloc Error!");
+	}
+	MR.keys[MR.n++] = c;
+}
+
+/* Edits made while a macro plays are journaled once, for the whole run. */
+void macroKey(int c) {
+	int fd = J.fd;
+	J.fd = -1;
+	editorProcessKey(c);
+	J.fd = fd;
+}
+
+int piecesEqual(const struct Piece *a, int na, const struct Piece *b, int nb) {
+	if (na != nb) return 0;
+	for (int i = 0; i < na; i++) {
+		if (a[i].start != b[i].start || a[i].length != b[i].length || a[i].add != b[i].add) return 0;
+	}
+	return 1;
+}
+
+/* Runs the macro once on each of rows r0..r1, each time with that row as
+ * the whole text and the cursor at its start, so every key costs only as
+ * much as the row. Changed rows go back in one splice. Returns how many
+ * rows changed. */
+int macroPlayLines(int r0, int r1) {
+	int *lens = malloc(sizeof(int) * (r1 - r0 + 1));
+	struct spliceEdit *e = malloc(sizeof(struct spliceEdit) * (r1 - r0 + 1));
+	if (lens == NULL || e == NULL) die("Malloc Error!");
+	int from = 0;
+	for (int y = 0; y < r0; y++) from += E.rows[y].size + E.rows[y].indentation + 1;
+	for (int y = r0; y <= r1; y++) lens[y - r0] = E.rows[y].size + E.rows[y].indentation;
+	int home = from;
+	int rowoff = E.rowoff;
+
+	struct Piece *doc = pt.p;
+	size_t docsize = pt.size;
+	int m = 0;
+	int k = 0;
+	int base = 0;
+	for (int y = r0; y <= r1; y++) {
+		int to = from + lens[y - r0];
+		struct Piece *p = NULL;
+		int n = 0;
+		int cap = 0;
+		int add_end = 0;
+		pt.p = doc;
+		pt.size = docsize;
+		clipboardCollect(from, to, &k, &base, &p, &n, &cap, &add_end);
+		if (n == 0) {
+			p = malloc(sizeof(struct Piece));
+			if (p == NULL) die("Malloc Error!");
+			p[0].start = 0;
+			p[0].length = 0;
+			p[0].add = 0;
+			n = 1;
+		}
+		struct Piece *line = malloc(sizeof(struct Piece) * n);
+		if (line == NULL) die("Malloc Error!");
+		memcpy(line, p, sizeof(struct Piece) * n);
+
+		pt.p = p;
+		pt.size = n;
+		remakeconfig();
+		E.cx = 0;
+		E.cy = 0;
+		E.actual_x = 0;
+		E.actual_indentation = E.numrows > 0 ? E.rows[0].indentation : 0;
+		E.mark = -1;
+		BK.active = 0;
+		cursorClear();
+		for (int i = 0; i < MR.n; i++) {
+			macroKey(MR.keys[i]);
+			remakeconfig();
+		}
+
+		if (piecesEqual(pt.p, pt.size, line, n)) {
+			free(pt.p);
+		} else {
+			e[m].at = from;
+			e[m].dlen = to - from;
+			e[m].ins = pt.p;
+			e[m].nins = pt.size;
+			m++;
+		}
+		free(line);
+		from = to + 1;
+	}
+
+	pt.p = doc;
+	pt.size = docsize;
+	E.mark = -1;
+	BK.active = 0;
+	cursorClear();
+	journalEdits(e, m);
+	pieceApply(e, m);
+	for (int i = 0; i < m; i++) free(e[i].ins);
+	free(e);
+	free(lens);
+	remakeconfig();
+	E.rowoff = rowoff;
+	editorOffsetToCursor(home);
+	return m;
+}
+
+/* Length of the text the two piece lists share from the start, and from the
+ * end without reaching back past that. */
+void pieceDiff(const struct Piece *a, int na, const struct Piece *b, int nb, int *prefix, int *suffix) {
+	int ka = 0, ja = 0, kb = 0, jb = 0;
+	int same = 0;
+	while (1) {
+		while (ka < na && ja >= a[ka].length) ka++, ja = 0;
+		while (kb < nb && jb >= b[kb].length) kb++, jb = 0;
+		if (ka == na || kb == nb) break;
+		if (pieceBuffer(&a[ka])[a[ka].start + ja] != pieceBuffer(&b[kb])[b[kb].start + jb]) break;
+		ja++;
+		jb++;
+		same++;
+	}
+	*prefix = same;
+
+	int lena = 0, lenb = 0;
+	for (int i = 0; i < na; i++) lena += a[i].length > 0 ? a[i].length : 0;
+	for (int i = 0; i < nb; i++) lenb += b[i].length > 0 ? b[i].length : 0;
+	ka = na - 1;
+	kb = nb - 1;
+	ja = ka >= 0 ? a[ka].length : 0;
+	jb = kb >= 0 ? b[kb].length : 0;
+	same = 0;
+	while (lena - same > *prefix && lenb - same > *prefix) {
+		while (ka >= 0 && ja <= 0) ka--, ja = ka >= 0 ? a[ka].length : 0;
+		while (kb >= 0 && jb <= 0) kb--, jb = kb >= 0 ? b[kb].length : 0;
+		if (ka < 0 || kb < 0) break;
+		if (pieceBuffer(&a[ka])[a[ka].start + ja - 1] != pieceBuffer(&b[kb])[b[kb].start + jb - 1]) break;
+		ja--;
+		jb--;
+		same++;
+	}
+	*suffix = same;
+}
+
+/* Runs the macro count times over the whole text, stopping early once a run
+ * leaves the text and the cursor as they were. After each key only the rows
+ * it changed are laid out again. Returns the runs made. */
+int macroPlayCount(int count) {
+	int runs = 0;
+	RL.on = 1;
+	RL.from = -1;
+	while (runs < count) {
+		struct Piece *p = pt.p;
+		size_t size = pt.size;
+		size_t add_size = pt.add_size;
+		int len = pieceLength();
+		int at = editorCursorOffset();
+		for (int i = 0; i < MR.n; i++) {
+			macroKey(MR.keys[i]);
+			remakeconfig();
+		}
+		runs++;
+		if (pt.p == p && pt.size == size && pt.add_size == add_size && pieceLength() == len &&
+				editorCursorOffset() == at) {
+			break;
+		}
+	}
+	RL.on = 0;
+
+	/* the whole run is journaled as the one span it changed */
+	int prefix, suffix;
+	struct Piece *old = undostack[undotop];
+	int oldn = undodetails[undotop].size;
+	pieceDiff(old, oldn, pt.p, pt.size, &prefix, &suffix);
+	int oldlen = 0;
+	for (int i = 0; i < oldn; i++) oldlen += old[i].length;
+	int newlen = pieceLength();
+	if (prefix + suffix < oldlen || prefix + suffix < newlen) {
+		struct spliceEdit e;
+		struct Piece *ins = NULL;
+		int n = 0, cap = 0, add_end = 0, k = 0, base = 0;
+		clipboardCollect(prefix, newlen - suffix, &k, &base, &ins, &n, &cap, &add_end);
+		e.at = prefix;
+		e.dlen = oldlen - suffix - prefix;
+		e.ins = ins;
+		e.nins = n;
+		journalEdits(&e, 1);
+		free(ins);
+	}
+	return runs;
+}
+
+void editorMacroRecord() {
+	if (MR.recording) {
+		MR.recording = 0;
+		editorSetStatusMessage("Recorded a macro of %d keys; Ctrl-P plays it", MR.n);
+		return;
+	}
+	MR.n = 0;
+	MR.recording = 1;
+	editorSetStatusMessage("Recording a macro; Ctrl-E to stop");
+}
+
+/* Plays the macro as one transaction: one undo entry, one journal record,
+ * and a single relayout and redraw once it is done. */
+void editorMacroPlay() {
+	if (MR.recording || MR.n == 0) {
+		editorSetStatusMessage("No macro recorded; Ctrl-E starts one");
+		return;
+	}
+	char *arg = editorPrompt("Play macro: %s (times, or l for each line; ESC to cancel)", NULL, 0);
+	if (arg == NULL) return;
+	int lines = arg[0] == 'l';
+	int count = arg[0] == '\0' ? 1 : atoi(arg);
+	free(arg);
+	if (!lines && count <= 0) return;
+
+	int r0 = E.cy;
+	int r1 = E.numrows - 1;
+	if (lines && E.mark >= 0) {
+		int start = 0;
+		r1 = E.numrows - 1;
+		for (int y = 0; y < E.numrows; y++) {
+			start += E.rows[y].size + E.rows[y].indentation + 1;
+			if (E.mark < start) {
+				r1 = y;
+				break;
+			}
+		}
+		if (r1 < r0) {
+			int t = r0;
+			r0 = r1;
+			r1 = t;
+		}
+	}
+	if (lines && r1 < r0) return;
+
+	cursorClear();
+	BK.active = 0;
+	undopush();
+	MR.playing = 1;
+	int done = lines ? macroPlayLines(r0, r1) : macroPlayCount(count);
+	MR.playing = 0;
+	remakeconfig();
+
+	int changed = lines ? done > 0 : !piecesEqual(pt.p, pt.size, undostack[undotop], undodetails[undotop].size);
+	if (changed) {
+		E.dirty++;
+	} else {
+		undobytes -= undoCost(undotop);
+		free(undostack[undotop]);
+		undotop--;
+	}
+	if (lines) {
+		editorSetStatusMessage("Macro changed %d of %d lines", done, r1 - r0 + 1);
+	} else {
+		editorSetStatusMessage("Macro played %d times", done);
+	}
+}
+
+/*** append buffer ***/
+
+struct abuf {
+	char *b;
+	int len;
+};
+
+#define ABUF_INIT {NULL, 0}
+
+void abAppend(struct abuf *ab, const char *s, int len) {
+	if (len > 0 && s != NULL) {
+		if (ab->len > INT_MAX - len) return;
+
+		char *new_buffer = realloc(ab->b, ab->len + len);
+		
+		if (new_buffer == NULL) return;
+
+		memcpy(&new_buffer[ab->len], s, len);
+		ab->b = new_buffer;
+		ab->len += len;
+	}
+}
+
+void abFree(struct abuf *ab){
+	free(ab->b);
+	ab->len = 0;
+}
+
+/*** input ***/
+
+/* Enter accepts the input; an empty one only when empty is set. */
+char *editorPrompt(char *prompt, void (*callback)(char *, int), int empty) {
+	size_t bufsize = 128;
+	char *buf = malloc(bufsize);
+
+	size_t buflen = 0;
+	buf[0] = '\0';
+
+	int state = E.state;
+	E.state = 1;
+	E.prompting = 1;
+
+	while(1) {
+		editorSetStatusMessage(prompt, buf);
+		editorRefreshScreen();
+
+		int c = editorReadKey();
+		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+			if (buflen != 0) buf[--buflen] = '\0';
+		} else if (c == '\x1b'){
+			editorSetStatusMessage("");
+			if (callback) callback(buf, c);
+			free(buf);
+			E.state = state;
+			E.prompting = 0;
+			return NULL;
+		} else if (c == '\r') {
+			if (buflen != 0 || empty) {
+				editorSetStatusMessage("");
+				if (callback) callback(buf, c);
+				E.state = state;
+				E.prompting = 0;
+				return buf;
+			}
+		} else if (!iscntrl(c) && c < 128) {
+			if (buflen == bufsize - 1) {
+				bufsize *= 2;
+				buf = realloc(buf, bufsize);
+			}
+			buf[buflen++] = c;
+			buf[buflen] = '\0';
+		}
+
+		if (callback) callback(buf, c);
+	}
+}
+
+void editorMoveCursor(int key) {
+	switch (key) {
+		case ARROW_LEFT:
+			if(E.cx != 0) E.cx--;
+			else if((E.cy > 0) & (E.cx == 0)){
+				E.cy--;
+				E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation - 1;
+			}
+			E.actual_indentation = E.rows[E.cy].indentation;
+			E.actual_x = E.cx - E.rows[E.cy].indentation;
+			break;
+		case ARROW_RIGHT:
+			if(E.cx < E.rows[E.cy].size - 1) E.cx++;
+			else if(E.cy < (E.numrows - 1)){
+				E.cx = 0;
+				E.cy++;
+			}
+			E.actual_indentation = E.rows[E.cy].indentation;
+			E.actual_x = E.cx - E.rows[E.cy].indentation;
+			break;
+		case ARROW_UP:
+			if(E.cy > 0) {
+				E.cy--;
+				if(E.actual_x + E.actual_indentation > E.rows[E.cy].size + E.rows[E.cy].indentation){
+					E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation -1;
+				} else {
+					E.cx = E.actual_x + E.actual_indentation;
+				}
+			}
+			break;
+		case ARROW_DOWN:
+			if(E.cy < E.numrows - 1) {
+				E.cy++;
+				if(E.actual_x + E.actual_indentation > E.rows[E.cy].size + E.rows[E.cy].indentation){
+					E.cx = E.rows[E.cy].size + E.rows[E.cy].indentation - 1;
+				} else {
+					E.cx = E.actual_x + E.actual_indentation;
+				}
+			}
+			break;
+	}
+}
+
+void convertCxToRx() {
+	E.rx = 0;
+	for(int i = 0; i < E.cx; i++) {
+		if (i < E.rows[E.cy].indentation) {
+			E.rx += FOU_TAB_STOP;
+			E.rx += 1;
+		} else {
+			E.rx += 1;
+		}
+	}
+}
+
+void editorProcessKeypress() {
+	int c = editorReadKey();
+	addGcCancel();
+	if (MR.recording && c != CTRL_KEY('e')) {
+		if (!macroAllowed(c)) {
+			editorSetStatusMessage("That key can't be part of a macro");
+			return;
+		}
+		macroRecord(c);
+	}
+	editorProcessKey(c);
+}
+
+void editorProcessKey(int c) {
+	static int quit_times = FOU_QUIT_TIMES;
+
+	if (BK.active && editorBlockKeypress(c)) {
+		editorAddTimer(PIECE_COMPACT_MS, pieceCompact);
+		return;
+	}
+
+	switch (c) {
+
+		case CTRL_KEY('c'):
+			write(STDOUT_FILENO, "\x1b[2J", 4);
+	 		write(STDOUT_FILENO, "\x1b[H", 3);
+	 		disableRawMode();
+	 		write(STDOUT_FILENO, "\x1b[2J\x1b[H", 7);
+			if (sessionSave() != 0) journalDiscard();
+			exit(0);
+			break;
+
+		case CTRL_KEY('y'):
+			cursorClear();
+			redo();
+			journalRedo();
+			break;
+
+		case CTRL_KEY('z'):
+			cursorClear();
+			undo();
+			journalUndo();
+			break;
+
+		case CTRL_KEY('s'):
+			break;
+
+		case CTRL_KEY('f'):
+			editorFind();
+			break;
+
+		case CTRL_KEY('r'):
+			editorRegexFind();
+			break;
+
+		case CTRL_KEY('g'):
+			cursorClear();
+			editorReplaceAll();
+			break;
+
+		case CTRL_KEY('k'):
+			E.mark = E.mark < 0 ? editorCursorOffset() : -1;
+			break;
+
+		case CTRL_KEY('w'):
+			editorCopy();
+			break;
+
+		case CTRL_KEY('x'):
+			cursorClear();
+			editorCut();
+			break;
+
+		case CTRL_KEY('v'):
+			cursorClear();
+			editorPaste();
+			break;
+
+		case CTRL_KEY('n'):
+			editorCursorsPerLine();
+			break;
+
+		case CTRL_KEY('t'):
+			editorCursorsOnMatches();
+			break;
+
+		case CTRL_KEY('u'):
+			cursorClear();
+			break;
+
+		case CTRL_KEY('b'):
+			editorBlockToggle();
+			break;
+
+		case CTRL_KEY('e'):
+			editorMacroRecord();
+			break;
+
+		case CTRL_KEY('p'):
+			editorMacroPlay();
+			break;
+
+		case '\r':
+			if (MC.n > 0) {
+				editorCursorsEdit("\r\n", 2, 0);
+				break;
+			}
+			if (!pieceAddRoom(2)) break;
+			journalInsert(editorCursorOffset(), "\r\n", 2);
+			undopush();
+			insertCharacter('\r');
+			insertCharacter('\n');
+			E.cy += 1;
+			E.cx = 0;
+			E.actual_x = 0;
+			break;
+
+		case PAGE_UP:
+		case PAGE_DOWN:
+			{
+				if (c == PAGE_UP) {
+					E.cy = E.rowoff;
+				} else if (c == PAGE_DOWN) {
+					E.cy = E.rowoff + E.screenrows - 1;
+					if (E.cy > E.numrows) {
+						E.cy = E.numrows;
+					}
+				}
+				int times = E.screenrows;
+				while (times--)
+					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+			}
+			break;
+
+		case HOME_KEY:
+			E.cx = 0;
+			break;
+		case END_KEY:
+			break;
+
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL_KEY:
+			if (MC.n > 0) {
+				editorCursorsEdit(NULL, 0, 1);
+				break;
+			}
+			journalDelete(editorCursorOffset(), 1);
+			undopush();
+			deleteCharacter();
+			remakeconfig();
+			break;
+
+		case ARROW_UP:
+		case ARROW_DOWN:
+		case ARROW_LEFT:
+		case ARROW_RIGHT:
+   			editorMoveCursor(c);
+			break;
+
+		case CTRL_KEY('l'):
+		case '\x1b':
+			E.state ^= 1;
+			break;
+
+		default:
+			{
+				char ch = c;
+				if (MC.n > 0) {
+					editorCursorsEdit(&ch, 1, 0);
+					break;
+				}
+				if (!pieceAddRoom(1)) break;
+				journalInsert(editorCursorOffset(), &ch, 1);
+			}
+			undopush();
+			insertCharacter(c);
+			break;
+	}
+
+	editorAddTimer(PIECE_COMPACT_MS, pieceCompact);
+	quit_times = FOU_QUIT_TIMES;
+}
+
+/*** ouput ***/
+
+void pieceTabletoBuffer(struct abuf *ab) {
+	int final_size = 0;
+	for (int i = 0; i < E.numrows; i++) {
+		final_size += E.rows[i].size;
+		final_size += E.rows[i].indentation * (FOU_TAB_STOP);
+	}
+	int r0 = 1, r1 = 0, lo = 0, hi = 0;
+	if (BK.active) blockRange(&r0, &r1, &lo, &hi);
+	if (hi == lo) hi = lo + 1;
+	char* final = malloc(final_size + E.numrows + 3*E.numrows + 8 + 9*MC.n + 7*(r1 - r0 + 1));
+	int pos = 0;
+	int from = -1, to = -1;
+	if (!editorSelection(&from, &to)) from = to = -1;
+	int off = 0;
+	int cur = 0;
+	int row = 0, col = 0, inblock = 0;
+	for (int i = 0; i < pt.size; i++) {
+		for (int j = 0; j < pt.p[i].length; j++, off++) {
+			char c = pieceBuffer(&pt.p[i])[pt.p[i].start + j];
+			int in = row >= r0 && row <= r1 && col >= lo && col < hi && c != '\n';
+			if (in != inblock) {
+				memcpy(final + pos, in ? "\x1b[7m" : "\x1b[m", in ? 4 : 3);
+				pos += in ? 4 : 3;
+				inblock = in;
+			}
+			if (c == '\n') {
+				row++;
+				col = 0;
+			} else {
+				col += blockWidth(c);
+			}
+			if (off == from) {
+				memcpy(final + pos, "\x1b[7m", 4);
+				pos += 4;
+			} else if (off == to) {
+				memcpy(final + pos, "\x1b[m", 3);
+				pos += 3;
+			}
+			while (cur < MC.n && MC.pos[cur] < off) cur++;
+			int under = cur < MC.n && MC.pos[cur] == off;
+			if (under) {
+				memcpy(final + pos, "\x1b[4m", 4);
+				pos += 4;
+			}
+			if (pieceBuffer(&pt.p[i])[pt.p[i].start + j] == '\t') {
+				for (int k = 0; k < FOU_TAB_STOP; k++) {
+					final[pos] = ' ';
+					pos += 1;
+				}
+			} else if (pieceBuffer(&pt.p[i])[pt.p[i].start + j] == '\n') {
+				final[pos] = '\n';
+				final[pos + 1] = '\x1b';
+				final[pos + 2] = '[';
+				final[pos + 3] = 'K';
+				pos += 4;
+			} else {
+				final[pos] = pieceBuffer(&pt.p[i])[pt.p[i].start + j];
+				pos += 1;
+			}
+			if (under) {
+				memcpy(final + pos, "\x1b[24m", 5);
+				pos += 5;
+			}
+		}
+	}
+	if ((from >= 0 && to >= off) || inblock) {
+		memcpy(final + pos, "\x1b[m", 3);
+		pos += 3;
+	}
+	abAppend(ab, final, pos);
+	free(final);
+}
+
+void scrollTabletoBuffer(struct abuf *ab) {
+
+}
+
+void editorSetStatusMessage(const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+	va_end(ap);
+	E.statusmsg_time = time(NULL);
+	editorAddTimer(6000, NULL);
+}
+
+void editorDrawMessageBar(struct abuf *ab) {
+	char buff[32];
+	snprintf(buff, sizeof(buff), "\x1b[%d;1H", E.screenrows + 2);
+	abAppend(ab, buff, strlen(buff));
+	abAppend(ab, "\x1b[K", 3);
+	int msglen = strlen(E.statusmsg);
+	if (msglen > E.screencols) {
+		msglen = E.screencols;
+	}
+	if (msglen && time(NULL) - E.statusmsg_time < 5) {
+		abAppend(ab, E.statusmsg, msglen);
+	}
+}
+
+void editorDrawRows(struct abuf *ab) {
+	int y;
+	for (y = 0; y < E.screenrows; y++) {
+		int filerow = y + E.rowoff;
+		if (filerow >= E.numrows){
+			if (E.numrows == 0 && y == E.screenrows/3){
+				char welcome[80];
+				int welcomelen = snprintf(welcome, sizeof(welcome), "Fou Editor -- version %s", FOU_VERSION);
+				if (welcomelen > E.screencols) welcomelen = E.screencols;
+				int padding = (E.screencols - welcomelen) / 2;
+				if (padding) {
+					abAppend(ab, "~", 1);
+					padding--;
+				}
+				while (padding--) abAppend(ab, " ", 1);
+				abAppend(ab, welcome, welcomelen);
+			} else {
+				abAppend(ab, "~", 1);
+			}
+		} else {
+			abAppend(ab, "\x1b[K", 4);
+			pieceTabletoBuffer(ab);
+			break;
+		}
+		abAppend(ab, "\x1b[K", 3);
+		if (y < E.screenrows - 1) {
+			abAppend(ab, "\r\n", 2);
+		}
+	}
+}
+
+void editorRefreshScreen() {
+	remakeconfig();
+	struct abuf ab = ABUF_INIT;
+
+	abAppend(&ab, "\x1b[?25l", 6);
+	abAppend(&ab, "\x1b[H", 3);
+
+	editorDrawRows(&ab);
+	editorDrawMessageBar(&ab);
+
+	convertCxToRx(&E.rx);
+	char buff[32];
+	snprintf(buff, sizeof(buff), "\x1b[%d;%dH", E.cy + 1, E.rx + 1);
+	abAppend(&ab, buff, strlen(buff));
+
+	abAppend(&ab, "\x1b[?25h", 6);
+	write(STDOUT_FILENO, ab.b, ab.len);
+	abFree(&ab);
+}
+
+/*** init ***/
+
+void initEditor() {
+	E.cy = 0;
+	E.cx = 0;
+	E.rx = 0;
+	E.numrows = 0;
+	E.actual_x = 0;
+	E.actual_indentation = 0;
+	E.rowoff = 0;
+	E.coloff = 0;
+	E.rows = NULL;
+	E.dirty = 0;
+	E.state = 0;
+	E.prompting = 0;
+	E.mark = -1;
+	E.filename = NULL;
+	E.statusmsg[0] = '\0';
+	E.statusmsg_time = 0;
+
+	if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+	E.screenrows -= 2;
+}
+
+void initData(char* file_name) {
+	if (E.filename != NULL){
+		free(E.filename);
+		E.filename = NULL;
+	}
+	E.filename = malloc(strlen(file_name) + 1);
+	if (E.filename == NULL) {
+		perror("malloc E.filename");
+		exit(0);
+	}
+
+	strcpy(E.filename, file_name);
+	createPieceTable(file_name);
+	trigramStart(pt.p[0].length);
+	initialiseconfig();
+	E.dirty = 0;
+	undostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
+	undodetails = (struct details*)malloc(0 * sizeof(struct details));
+	redostack = (struct Piece**)malloc(0 * sizeof(struct Piece*));
+	redodetails = (struct details*)malloc(0 * sizeof(struct details));
+	journalOpen(file_name, sessionLoad(file_name));
+	reloadStart(file_name);
+}
+
+int main(int argc, char *argv[]) {
+	enableRawMode();
+	editorInitEvents();
+	initEditor();
+	if (argc >= 2) {
+		write(STDOUT_FILENO, "\x1b[2J", 4);
+		initData(argv[1]);
+	}
+
+	while (1) {
+		editorRefreshScreen();
+		editorProcessKeypress();
+	}
+
+	return 0;
 }
\ No newline at end of file